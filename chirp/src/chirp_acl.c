@@ -30,6 +30,7 @@ See the file COPYING for details.
 #include <unistd.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <time.h>
 
 const char *chirp_super_user = "";
 
@@ -100,6 +101,188 @@ static int ticket_write(const char *ticket_filename, struct chirp_ticket *ct)
 	return cfs->rename(tmp, ticket_filename);
 }
 
+/*
+The parsed ACL of each directory is kept in memory after it is read, along
+with the identity of its ACL file. Each use of a cached ACL only stats the ACL
+file, and reads it again if the file has changed. An ACL file modified in the
+last few seconds is not cached, since another change within the same second
+could not be told apart by its times. Directories without their own ACL file,
+which fall back to an inherited or default ACL, are not cached.
+*/
+
+#define ACL_CACHE_MAX 1024
+#define ACL_CACHE_SETTLE_TIME 2
+
+struct acl_cache_entry {
+	struct chirp_stat info;
+	UINT64_T last_used;
+	int nentries;
+	char **subjects;
+	int *flags;
+};
+
+static struct hash_table *acl_cache = 0;
+static UINT64_T acl_cache_clock = 0;
+static UINT64_T acl_cache_hits = 0;
+static UINT64_T acl_cache_misses = 0;
+
+static void acl_cache_entry_delete(struct acl_cache_entry *e)
+{
+	int i;
+	for(i = 0; i < e->nentries; i++)
+		free(e->subjects[i]);
+	free(e->subjects);
+	free(e->flags);
+	free(e);
+}
+
+static void acl_cache_remove(const char *dirname)
+{
+	struct acl_cache_entry *e;
+
+	if(acl_cache && (e = hash_table_remove(acl_cache, dirname)))
+		acl_cache_entry_delete(e);
+}
+
+static int acl_cache_same_file(struct chirp_stat *a, struct chirp_stat *b)
+{
+	return a->cst_dev == b->cst_dev && a->cst_ino == b->cst_ino && a->cst_size == b->cst_size && a->cst_mtime == b->cst_mtime && a->cst_ctime == b->cst_ctime;
+}
+
+static void acl_cache_insert(const char *dirname, struct acl_cache_entry *e)
+{
+	char *key;
+	struct acl_cache_entry *old;
+
+	if(!acl_cache)
+		acl_cache = hash_table_create(0, 0);
+
+	acl_cache_remove(dirname);
+
+	if(hash_table_size(acl_cache) >= ACL_CACHE_MAX) {
+		char *oldest = 0;
+		struct acl_cache_entry *oldest_e = 0;
+
+		hash_table_firstkey(acl_cache);
+		while(hash_table_nextkey(acl_cache, &key, (void **) &old)) {
+			if(!oldest_e || old->last_used < oldest_e->last_used) {
+				oldest = key;
+				oldest_e = old;
+			}
+		}
+
+		oldest = xxstrdup(oldest);
+		acl_cache_remove(oldest);
+		free(oldest);
+	}
+
+	e->last_used = ++acl_cache_clock;
+	hash_table_insert(acl_cache, dirname, e);
+}
+
+/* Returns the cached ACL of dirname, if its ACL file is unchanged. */
+
+static struct acl_cache_entry *acl_cache_lookup(const char *dirname)
+{
+	char aclpath[CHIRP_PATH_MAX];
+	struct chirp_stat info;
+	struct acl_cache_entry *e;
+
+	if(!acl_cache || !(e = hash_table_lookup(acl_cache, dirname)))
+		return 0;
+
+	string_nformat(aclpath, sizeof(aclpath), "%s/%s", dirname, CHIRP_ACL_BASE_NAME);
+	if(cfs->stat(aclpath, &info) < 0 || !acl_cache_same_file(&e->info, &info)) {
+		acl_cache_remove(dirname);
+		return 0;
+	}
+
+	e->last_used = ++acl_cache_clock;
+	return e;
+}
+
+static int acl_subject_matches(const char *aclsubject, const char *subject)
+{
+	if(string_match(aclsubject, subject)) {
+		return 1;
+	} else if(!strncmp(aclsubject, "group:", 6)) {
+		return chirp_group_lookup(aclsubject, subject);
+	} else {
+		return 0;
+	}
+}
+
+/*
+Adds the rights of subject in the ACL effective for dirname to totalflags.
+Returns zero with errno set if there is no effective ACL.
+*/
+
+static int acl_get_flags(const char *dirname, const char *subject, int *totalflags)
+{
+	char aclpath[CHIRP_PATH_MAX];
+	char aclsubject[CHIRP_LINE_MAX];
+	struct chirp_stat info;
+	struct acl_cache_entry *e;
+	CHIRP_FILE *aclfile;
+	int aclflags;
+	int i;
+
+	e = acl_cache_lookup(dirname);
+	if(e) {
+		acl_cache_hits++;
+		for(i = 0; i < e->nentries; i++) {
+			if(acl_subject_matches(e->subjects[i], subject))
+				*totalflags |= e->flags[i];
+		}
+		return 1;
+	}
+
+	acl_cache_misses++;
+
+	/* stat before reading, so a concurrent change is noticed by the next lookup. */
+	string_nformat(aclpath, sizeof(aclpath), "%s/%s", dirname, CHIRP_ACL_BASE_NAME);
+	time_t settled = time(0) - ACL_CACHE_SETTLE_TIME;
+	int cacheable = cfs->stat(aclpath, &info) == 0 && info.cst_mtime < settled && info.cst_ctime < settled;
+
+	aclfile = chirp_acl_open(dirname);
+	if(!aclfile)
+		return 0;
+
+	e = 0;
+	if(cacheable) {
+		e = xxcalloc(1, sizeof(*e));
+		e->info = info;
+	}
+
+	int nalloc = 0;
+	while(chirp_acl_read(aclfile, aclsubject, &aclflags)) {
+		if(acl_subject_matches(aclsubject, subject))
+			*totalflags |= aclflags;
+		if(e) {
+			if(e->nentries == nalloc) {
+				nalloc = nalloc ? nalloc * 2 : 8;
+				e->subjects = xxrealloc(e->subjects, nalloc * sizeof(*e->subjects));
+				e->flags = xxrealloc(e->flags, nalloc * sizeof(*e->flags));
+			}
+			e->subjects[e->nentries] = xxstrdup(aclsubject);
+			e->flags[e->nentries] = aclflags;
+			e->nentries++;
+		}
+	}
+	chirp_acl_close(aclfile);
+
+	if(e)
+		acl_cache_insert(dirname, e);
+
+	return 1;
+}
+
+void chirp_acl_cache_stats(UINT64_T *hits, UINT64_T *misses)
+{
+	*hits = acl_cache_hits;
+	*misses = acl_cache_misses;
+}
+
 /*
 do_chirp_acl_get returns the acl flags associated with a subject and directory.
 If the subject has rights there, they are returned and errno is undefined.
@@ -109,10 +292,6 @@ If the rights cannot be obtained, returns zero with errno set appropriately.
 
 static int do_chirp_acl_get(const char *dirname, const char *subject, int *totalflags)
 {
-	CHIRP_FILE *aclfile;
-	char aclsubject[CHIRP_LINE_MAX];
-	int aclflags;
-
 	errno = 0;
 	*totalflags = 0;
 
@@ -147,21 +326,8 @@ static int do_chirp_acl_get(const char *dirname, const char *subject, int *total
 		}
 		*totalflags &= mask;
 	} else {
-		aclfile = chirp_acl_open(dirname);
-		if(aclfile) {
-			while(chirp_acl_read(aclfile, aclsubject, &aclflags)) {
-				if(string_match(aclsubject, subject)) {
-					*totalflags |= aclflags;
-				} else if(!strncmp(aclsubject, "group:", 6)) {
-					if(chirp_group_lookup(aclsubject, subject)) {
-						*totalflags |= aclflags;
-					}
-				}
-			}
-			chirp_acl_close(aclfile);
-		} else {
+		if(!acl_get_flags(dirname, subject, totalflags))
 			return 0;
-		}
 	}
 
 	if(read_only_mode) {
@@ -666,6 +832,7 @@ int chirp_acl_set(const char *dirname, const char *subject, int flags, int reset
 		result = -1;
 	} else {
 		result = cfs->rename(newaclname, aclname);
+		acl_cache_remove(dirname);
 		if(result < 0) {
 			cfs->unlink(newaclname);
 			errno = EACCES;
@@ -892,6 +1059,7 @@ int chirp_acl_init_root(const char *path)
 	username_get(username);
 
 	string_nformat(aclpath, sizeof(aclpath), "%s/%s", path, CHIRP_ACL_BASE_NAME);
+	acl_cache_remove(path);
 	file = cfs_fopen(aclpath, "w");
 	if(file) {
 		cfs_fprintf(file, "unix:%s %s\n", username, chirp_acl_flags_to_text(CHIRP_ACL_READ | CHIRP_ACL_WRITE | CHIRP_ACL_DELETE | CHIRP_ACL_LIST | CHIRP_ACL_ADMIN));
@@ -920,6 +1088,7 @@ int chirp_acl_init_copy(const char *path)
 
 	oldfile = chirp_acl_open(oldpath);
 	if(oldfile) {
+		acl_cache_remove(path);
 		newfile = cfs_fopen(newpath, "w");
 		if(newfile) {
 			while(chirp_acl_read(oldfile, subject, &flags)) {
@@ -977,6 +1146,7 @@ int chirp_acl_init_reserve(const char *path, const char *subject)
 		newflags = CHIRP_ACL_READ | CHIRP_ACL_WRITE | CHIRP_ACL_LIST | CHIRP_ACL_DELETE | CHIRP_ACL_ADMIN;
 
 	string_nformat(aclpath, sizeof(aclpath), "%s/%s", path, CHIRP_ACL_BASE_NAME);
+	acl_cache_remove(path);
 	file = cfs_fopen(aclpath, "w");
 	if(file) {
 		cfs_fprintf(file, "%s %s\n", subject, chirp_acl_flags_to_text(newflags));
@@ -37,6 +37,9 @@ int chirp_acl_check_recursive(const char *path, const char *subject, int flags);
 int chirp_acl_check_dir(const char *dirname, const char *subject, int flags);
 int chirp_acl_check_link(const char *linkname, const char *subject, int flags);
 
+/* Count the lookups answered by the in-memory ACL cache of this process, and those that read an ACL file. */
+void chirp_acl_cache_stats(UINT64_T *hits, UINT64_T *misses);
+
 int chirp_acl_set(const char *filename, const char *subject, int flags, int reset_acl);
 
 int chirp_acl_ticket_create(const char *subject, const char *newsubject, const char *ticket, const char *duration);
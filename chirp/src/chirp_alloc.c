@@ -17,13 +17,20 @@ See the file COPYING for details.
 #include "stringtools.h"
 #include "xxmalloc.h"
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#	define MAP_ANONYMOUS MAP_ANON
+#endif
 
 /* On why HDFS can't do quotas (allocations) [1]:
  *
@@ -45,14 +52,69 @@ See the file COPYING for details.
  */
 
 
+/* The shared allocation table:
+ *
+ * When chirp_alloc_shared_init is called by the server before it forks, the
+ * state of each allocation is kept in a table of shared memory instead of
+ * being locked in its .__alloc file for as long as a process uses it. Space is
+ * reserved by atomic updates of the table, so concurrent writers to the same
+ * allocation no longer wait on each other. The table is written back to the
+ * .__alloc files every ALLOC_CHECKPOINT_INTERVAL seconds.
+ *
+ * The table only lives as long as the server: after a crash, the next server
+ * recomputes every allocation with the usual recovery scan, so the
+ * checkpoints never need to be more than a hint. The scan is done once, by the
+ * first process to call chirp_alloc_init, rather than by every process.
+ *
+ * Entries are added, checked against their .__alloc file and released with
+ * the table locked by a record lock on an unlinked temporary file, which the
+ * kernel releases if the holder dies. An entry is released when its .__alloc
+ * file is gone, and its slot may then be reused by another allocation: the
+ * generation tells processes still holding the entry that it changed.
+ *
+ * An allocation that does not fit in the table falls back to the .__alloc
+ * file and its lock.
+ */
+
+#define ALLOC_TABLE_SIZE 1024
+#define ALLOC_CHECKPOINT_INTERVAL 5
+
+#define ALLOC_ENTRY_EMPTY 0
+#define ALLOC_ENTRY_USED 1
+#define ALLOC_ENTRY_REMOVED 2 /* reusable, but lookups must probe past it */
+
+#define ALLOC_LOCK_TABLE 0 /* bytes of the lock file */
+#define ALLOC_LOCK_RECOVERY 1
+
+struct alloc_entry {
+	int state;
+	unsigned generation;
+	volatile INT64_T size;
+	volatile INT64_T inuse;
+	INT64_T checkpoint; /* inuse as of the last checkpoint */
+	char path[CHIRP_PATH_MAX];
+};
+
+struct alloc_table {
+	int recovered;
+	volatile time_t checkpoint;
+	struct alloc_entry entry[ALLOC_TABLE_SIZE];
+};
+
 static int alloc_enabled = 0;
 static struct hash_table *alloc_table = 0;
 static time_t last_flush_time = 0;
 static int recovery_in_progress = 0;
 static struct hash_table *root_table = 0;
+static struct alloc_table *shared_table = 0;
+static int shared_lock = -1;
+static int alloc_locked = 0; /* states locked in their .__alloc file */
 
 struct alloc_state {
 	int fd;
+	struct alloc_entry *entry; /* in the shared table, or 0 if locked in .__alloc */
+	unsigned generation; /* of entry */
+	char path[CHIRP_PATH_MAX];
 	INT64_T size;
 	INT64_T inuse;
 	INT64_T avail;
@@ -76,9 +138,225 @@ static INT64_T space_consumed(INT64_T filesize)
 	return blocks * block_size;
 }
 
+static int alloc_state_read(int fd, INT64_T *size, INT64_T *inuse)
+{
+	char buffer[4096]; /* any .__alloc file is smaller than this */
+
+	memset(buffer, 0, sizeof(buffer));
+	INT64_T result = cfs->pread(fd, buffer, sizeof(buffer), 0);
+	assert(0 < result && result < (INT64_T)sizeof(buffer));
+	result = sscanf(buffer, "%" SCNd64 " %" SCNd64, size, inuse);
+	assert(result == 2);
+
+	return 0;
+}
+
+static int alloc_state_write(int fd, INT64_T size, INT64_T inuse)
+{
+	char buffer[4096];
+
+	cfs->ftruncate(fd, 0);
+	string_nformat(buffer, sizeof(buffer), "%" PRId64 "\n%" PRId64 "\n", size, inuse);
+	int64_t result = cfs->pwrite(fd, buffer, strlen(buffer), 0);
+	assert(result == (int64_t) strlen(buffer));
+
+	return 0;
+}
+
+/* Lock (or unlock) one byte of the shared lock file, waiting for it. */
+static void alloc_shared_lock(int which, int lock)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = lock ? F_WRLCK : F_UNLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = which;
+	fl.l_len = 1;
+	while(fcntl(shared_lock, F_SETLKW, &fl) == -1) {
+		if(errno != EINTR)
+			fatal("couldn't %s shared allocation table: %s", lock ? "lock" : "unlock", strerror(errno));
+	}
+}
+
+/* Fill in an entry from the .__alloc file in path, with the table locked. */
+static struct alloc_entry *alloc_entry_fill(struct alloc_entry *e, const char *path)
+{
+	char statename[CHIRP_PATH_MAX];
+	INT64_T size, inuse;
+	int fd;
+
+	string_nformat(statename, sizeof(statename), "%s/.__alloc", path);
+	fd = cfs->open(statename, O_RDONLY, 0);
+	if(fd == -1)
+		return 0;
+	alloc_state_read(fd, &size, &inuse);
+	cfs->close(fd);
+
+	string_nformat(e->path, sizeof(e->path), "%s", path);
+	e->size = size;
+	e->inuse = recovery_in_progress ? 0 : inuse;
+	e->checkpoint = recovery_in_progress ? -1 : inuse;
+	e->generation++;
+	e->state = ALLOC_ENTRY_USED;
+
+	debug(D_ALLOC, "sharing %s", path);
+
+	return e;
+}
+
+static void alloc_entry_release(struct alloc_entry *e)
+{
+	debug(D_ALLOC, "releasing %s", e->path);
+	e->generation++;
+	e->state = ALLOC_ENTRY_REMOVED;
+}
+
+/* Check an entry against its .__alloc file, with the table locked: the
+ * allocation may have been removed, or removed and created again. */
+static struct alloc_entry *alloc_entry_validate(struct alloc_entry *e)
+{
+	char statename[CHIRP_PATH_MAX];
+	INT64_T size, inuse;
+	int fd;
+
+	string_nformat(statename, sizeof(statename), "%s/.__alloc", e->path);
+	fd = cfs->open(statename, O_RDONLY, 0);
+	if(fd == -1) {
+		alloc_entry_release(e);
+		return 0;
+	}
+	alloc_state_read(fd, &size, &inuse);
+	cfs->close(fd);
+
+	if(size != e->size) {
+		char path[CHIRP_PATH_MAX];
+		strcpy(path, e->path);
+		return alloc_entry_fill(e, path);
+	}
+	return e;
+}
+
+/* Find the shared entry of the allocation in path, adding it if needed. */
+static struct alloc_entry *alloc_entry_lookup(const char *path)
+{
+	struct alloc_entry *found = 0;
+	struct alloc_entry *unused = 0;
+	unsigned h = hash_string(path);
+	unsigned i;
+
+	alloc_shared_lock(ALLOC_LOCK_TABLE, 1);
+	for(i = 0; i < ALLOC_TABLE_SIZE; i++) {
+		struct alloc_entry *e = &shared_table->entry[(h+i) % ALLOC_TABLE_SIZE];
+		if(e->state == ALLOC_ENTRY_USED) {
+			if(strcmp(e->path, path) == 0) {
+				unused = 0;
+				found = alloc_entry_validate(e);
+				break;
+			}
+		} else {
+			if(!unused)
+				unused = e;
+			if(e->state == ALLOC_ENTRY_EMPTY)
+				break;
+		}
+	}
+	if(unused) {
+		found = alloc_entry_fill(unused, path);
+	} else if(i == ALLOC_TABLE_SIZE) {
+		debug(D_ALLOC, "shared allocation table is full, locking %s instead", path);
+	}
+	alloc_shared_lock(ALLOC_LOCK_TABLE, 0);
+
+	return found;
+}
+
+/* Write every allocation changed since the last checkpoint to its .__alloc
+ * file, and release the entries of removed allocations. */
+static void alloc_checkpoint(int force)
+{
+	time_t now = time(0);
+	time_t last = shared_table->checkpoint;
+	int i;
+
+	if(!force && (now < last+ALLOC_CHECKPOINT_INTERVAL || !__sync_bool_compare_and_swap(&shared_table->checkpoint, last, now)))
+		return;
+	shared_table->checkpoint = now;
+
+	alloc_shared_lock(ALLOC_LOCK_TABLE, 1);
+	for(i = 0; i < ALLOC_TABLE_SIZE; i++) {
+		struct alloc_entry *e = &shared_table->entry[i];
+		char statename[CHIRP_PATH_MAX];
+		INT64_T inuse;
+		int fd;
+
+		if(e->state != ALLOC_ENTRY_USED)
+			continue;
+		string_nformat(statename, sizeof(statename), "%s/.__alloc", e->path);
+		inuse = e->inuse;
+		if(inuse == e->checkpoint) {
+			if(cfs_file_size(statename) == -1 && errno == ENOENT)
+				alloc_entry_release(e);
+			continue;
+		}
+
+		fd = cfs->open(statename, O_WRONLY, S_IRUSR|S_IWUSR);
+		if(fd == -1) {
+			if(errno == ENOENT)
+				alloc_entry_release(e);
+			continue;
+		}
+		if(cfs->lockf(fd, F_TLOCK, 0) == 0) {
+			debug(D_ALLOC, "checkpointing %s", e->path);
+			alloc_state_write(fd, e->size, inuse);
+			cfs->fsync(fd);
+			e->checkpoint = inuse;
+		}
+		cfs->close(fd);
+	}
+	alloc_shared_lock(ALLOC_LOCK_TABLE, 0);
+}
+
+/* The shared entry of a state, found again if it was released since. */
+static struct alloc_entry *alloc_state_entry(struct alloc_state *a)
+{
+	if(a->entry && a->entry->generation != a->generation) {
+		a->entry = alloc_entry_lookup(a->path);
+		if(a->entry) {
+			a->generation = a->entry->generation;
+		} else {
+			/* the allocation is gone: nothing is left to take */
+			a->size = a->inuse = a->avail = 0;
+		}
+	}
+	return a->entry;
+}
+
+/* Bring a state up to date with its shared entry. */
+static struct alloc_state *alloc_state_refresh(struct alloc_state *a)
+{
+	struct alloc_entry *e = alloc_state_entry(a);
+	if(e) {
+		a->size = e->size;
+		a->inuse = e->inuse;
+		a->avail = a->size - a->inuse;
+	}
+	return a;
+}
+
 static void alloc_state_update(struct alloc_state *a, INT64_T change)
 {
-	if(change != 0) {
+	struct alloc_entry *e = alloc_state_entry(a);
+	if(change != 0 && e) {
+		INT64_T inuse = e->inuse;
+		while(1) {
+			INT64_T prev = __sync_val_compare_and_swap(&e->inuse, inuse, inuse+change < 0 ? 0 : inuse+change);
+			if(prev == inuse)
+				break;
+			inuse = prev;
+		}
+		alloc_state_refresh(a);
+	} else if(change != 0) {
 		a->inuse += change;
 		if(a->inuse < 0)
 			a->inuse = 0;
@@ -87,11 +365,51 @@ static void alloc_state_update(struct alloc_state *a, INT64_T change)
 	}
 }
 
+/* Take change bytes from the allocation if that leaves at least keep bytes available. */
+static int alloc_state_reserve(struct alloc_state *a, INT64_T change, INT64_T keep)
+{
+	struct alloc_entry *e = alloc_state_entry(a);
+	if(e) {
+		INT64_T inuse = e->inuse;
+		while(1) {
+			INT64_T prev;
+			if(change > 0 && e->size-inuse-keep < change) {
+				alloc_state_refresh(a);
+				errno = ENOSPC;
+				return -1;
+			}
+			prev = __sync_val_compare_and_swap(&e->inuse, inuse, inuse+change < 0 ? 0 : inuse+change);
+			if(prev == inuse)
+				break;
+			inuse = prev;
+		}
+		alloc_state_refresh(a);
+		return 0;
+	} else if(a->avail-keep >= change) {
+		alloc_state_update(a, change);
+		return 0;
+	} else {
+		errno = ENOSPC;
+		return -1;
+	}
+}
+
 static struct alloc_state *alloc_state_load(const char *path)
 {
 	struct alloc_state *s = xxmalloc(sizeof(*s));
 	char statename[CHIRP_PATH_MAX];
-	char buffer[4096]; /* any .__alloc file is smaller than this */
+
+	string_nformat(s->path, sizeof(s->path), "%s", path);
+	if(shared_table) {
+		s->fd = -1;
+		s->entry = alloc_entry_lookup(path);
+		if(s->entry) {
+			s->generation = s->entry->generation;
+			s->dirty = 0;
+			return alloc_state_refresh(s);
+		}
+	}
+	s->entry = 0;
 
 	debug(D_ALLOC, "locking %s", path);
 
@@ -116,11 +434,8 @@ static struct alloc_state *alloc_state_load(const char *path)
 		}
 	}
 
-	memset(buffer, 0, sizeof(buffer));
-	INT64_T result = cfs->pread(s->fd, buffer, sizeof(buffer), 0);
-	assert(0 < result && result < (INT64_T)sizeof(buffer));
-	result = sscanf(buffer, "%" SCNd64 " %" SCNd64, &s->size, &s->inuse);
-	assert(result == 2);
+	alloc_state_read(s->fd, &s->size, &s->inuse);
+	alloc_locked++;
 
 	s->dirty = 0;
 
@@ -136,6 +451,12 @@ static struct alloc_state *alloc_state_load(const char *path)
 
 static void alloc_state_save(const char *path, struct alloc_state *s)
 {
+	if(s->entry || s->fd == -1) {
+		/* written by alloc_checkpoint, or the shared allocation is gone */
+		free(s);
+		return;
+	}
+
 	if(s->dirty) {
 		debug(D_ALLOC, "storing %s", path);
 	} else {
@@ -143,13 +464,10 @@ static void alloc_state_save(const char *path, struct alloc_state *s)
 	}
 
 	if(s->dirty) {
-		char buffer[4096];
-		cfs->ftruncate(s->fd, 0);
-		string_nformat(buffer, sizeof(buffer), "%" PRId64 "\n%" PRId64 "\n", s->size, s->inuse);
-		int64_t result = cfs->pwrite(s->fd, buffer, strlen(buffer), 0);
-		assert(result == (int64_t) strlen(buffer));
+		alloc_state_write(s->fd, s->size, s->inuse);
 	}
 	cfs->close(s->fd);
+	alloc_locked--;
 	free(s);
 }
 
@@ -166,6 +484,15 @@ static int alloc_state_create(const char *path, INT64_T size)
 		int64_t result = cfs->pwrite(fd, buffer, strlen(buffer), 0);
 		assert(result == (int64_t) strlen(buffer));
 		cfs->close(fd);
+		if(shared_table) {
+			/* a new allocation may reuse the path of a removed one */
+			struct alloc_entry *e = alloc_entry_lookup(path);
+			if(e) {
+				e->size = size;
+				e->inuse = 0;
+				e->checkpoint = 0;
+			}
+		}
 		return 1;
 	} else {
 		return 0;
@@ -290,6 +617,26 @@ static void recover(const char *path)
 	debug(D_ALLOC, "%s (%sB)", path, string_metric(a->inuse, -1, 0));
 }
 
+int chirp_alloc_shared_init(void)
+{
+	FILE *lock;
+
+	assert(shared_table == NULL);
+	lock = tmpfile();
+	if(!lock)
+		return -1;
+	shared_table = mmap(NULL, sizeof(*shared_table), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(shared_table == MAP_FAILED) {
+		fclose(lock);
+		shared_table = NULL;
+		return -1;
+	}
+	memset(shared_table, 0, sizeof(*shared_table));
+	shared_lock = fileno(lock); /* kept open for every child */
+	fcntl(shared_lock, F_SETFD, FD_CLOEXEC);
+	return 0;
+}
+
 int chirp_alloc_init(INT64_T size)
 {
 	struct alloc_state *a;
@@ -311,16 +658,30 @@ int chirp_alloc_init(INT64_T size)
 	assert(root_table == NULL);
 	root_table = hash_table_create(0, 0);
 
+	if(shared_table) {
+		/* wait for the process doing the recovery scan, or do it */
+		alloc_shared_lock(ALLOC_LOCK_RECOVERY, 1);
+		if(shared_table->recovered) {
+			alloc_shared_lock(ALLOC_LOCK_RECOVERY, 0);
+			recovery_in_progress = 0;
+			return 0;
+		}
+	}
+
 	debug(D_ALLOC, "### begin allocation recovery scan ###");
 
 	if(!alloc_state_create("/", size)) {
 		debug(D_ALLOC, "couldn't create allocation in `/': %s\n", strerror(errno));
+		if(shared_table)
+			alloc_shared_lock(ALLOC_LOCK_RECOVERY, 0);
 		return -1;
 	}
 
 	a = alloc_state_cache_exact("/");
 	if(!a) {
 		debug(D_ALLOC, "couldn't find allocation in `/': %s\n", strerror(errno));
+		if(shared_table)
+			alloc_shared_lock(ALLOC_LOCK_RECOVERY, 0);
 		return -1;
 	}
 
@@ -330,6 +691,11 @@ int chirp_alloc_init(INT64_T size)
 	inuse = a->inuse;
 	avail = a->avail;
 	chirp_alloc_flush();
+	if(shared_table) {
+		alloc_checkpoint(1);
+		shared_table->recovered = 1;
+		alloc_shared_lock(ALLOC_LOCK_RECOVERY, 0);
+	}
 	stop = time(0);
 
 	debug(D_ALLOC, "### allocation recovery took %d seconds ###", (int) (stop-start) );
@@ -366,6 +732,9 @@ void chirp_alloc_flush()
 		hash_table_remove(root_table, path);
 	}
 
+	if(shared_table && !recovery_in_progress)
+		alloc_checkpoint(0);
+
 	last_flush_time = time(0);
 }
 
@@ -373,6 +742,8 @@ int chirp_alloc_flush_needed()
 {
 	if(!alloc_enabled)
 		return 0;
+	if(shared_table)
+		return alloc_locked > 0 || time(0) >= shared_table->checkpoint+ALLOC_CHECKPOINT_INTERVAL;
 	return hash_table_size(alloc_table);
 }
 
@@ -409,13 +780,9 @@ INT64_T chirp_alloc_realloc (const char *path, INT64_T change, INT64_T *current)
 			} else {
 				INT64_T alloc_change = space_consumed(change) - space_consumed(*current);
 				debug(D_ALLOC, "path `%s' actual change = %" PRId64 " from current = %" PRId64, path, alloc_change, *current);
-				if(a->avail >= alloc_change) {
-					alloc_state_update(a, alloc_change);
-					result = 0;
-				} else {
-					errno = ENOSPC;
-					result = -1;
-				}
+				result = alloc_state_reserve(a, alloc_change, 0);
+				if(result == 0 && shared_table)
+					alloc_checkpoint(0);
 			}
 		} else {
 			result = -1;
@@ -443,6 +810,7 @@ INT64_T chirp_alloc_statfs(const char *path, struct chirp_statfs * info)
 
 	a = alloc_state_cache(path);
 	if(a) {
+		alloc_state_refresh(a);
 		result = cfs->statfs(path, info);
 		if(result == 0) {
 			info->f_blocks = a->size / info->f_bsize;
@@ -480,6 +848,7 @@ INT64_T chirp_alloc_lsalloc(const char *path, char *alloc_path, INT64_T * total,
 	if(name) {
 		struct alloc_state *a = alloc_state_cache_exact(name);
 		if(a) {
+			alloc_state_refresh(a);
 			strcpy(alloc_path, name);
 			*total = a->size;
 			*inuse = a->inuse;
@@ -505,19 +874,23 @@ INT64_T chirp_alloc_mkalloc(const char *path, INT64_T size, INT64_T mode)
 
 	a = alloc_state_cache(path);
 	if(a) {
-		if(a->avail > size) {
+		/* a new allocation may not take all the space left in its parent */
+		if(alloc_state_reserve(a, size, 1) == 0) {
 			result = cfs->mkdir(path, mode);
 			if(result == 0) {
 				if(alloc_state_create(path, size)) {
-					alloc_state_update(a, size);
 					debug(D_ALLOC, "mkalloc %s %"PRId64, path, size);
+					if(shared_table)
+						alloc_checkpoint(1);
 					chirp_alloc_flush();
 				} else {
+					alloc_state_update(a, -size);
 					result = -1;
 				}
+			} else {
+				alloc_state_update(a, -size);
 			}
 		} else {
-			errno = ENOSPC;
 			return -1;
 		}
 	} else {
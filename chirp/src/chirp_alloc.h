@@ -12,6 +12,8 @@ See the file COPYING for details.
 
 #include <sys/types.h>
 
+/* Keep allocations in a table shared by every process forked after this call. */
+int    chirp_alloc_shared_init(void);
 int    chirp_alloc_init(INT64_T size);
 void   chirp_alloc_flush(void);
 int    chirp_alloc_flush_needed(void);
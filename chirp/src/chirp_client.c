@@ -79,6 +79,23 @@ struct chirp_client {
 	char hostport[CHIRP_PATH_MAX];
 	int broken;
 	int serial;
+	struct list *requests;	/* asynchronous requests sent, in order, whose replies have not been read. */
+};
+
+typedef enum {
+	REQUEST_PREAD,
+	REQUEST_PWRITE,
+	REQUEST_STAT,
+} request_type_t;
+
+struct chirp_client_request {
+	request_type_t type;
+	void *buffer;
+	INT64_T length;
+	struct chirp_stat *info;
+	INT64_T result;
+	int errnum;
+	int done;
 };
 
 static INT64_T convert_result(INT64_T result)
@@ -263,11 +280,16 @@ static INT64_T send_command_varargs(struct chirp_client *c, time_t stoptime, cha
 	return result;
 }
 
+static void finish_requests(struct chirp_client *c, time_t stoptime);
+static void request_fail(struct chirp_client_request *r, int errnum);
+
 static INT64_T send_command(struct chirp_client *c, time_t stoptime, char const *fmt, ...)
 {
 	INT64_T result;
 	va_list args;
 
+	finish_requests(c, stoptime);
+
 	va_start(args, fmt);
 	result = send_command_varargs(c, stoptime, fmt, args);
 	va_end(args);
@@ -280,6 +302,8 @@ static INT64_T simple_command(struct chirp_client *c, time_t stoptime, char cons
 	INT64_T result;
 	va_list args;
 
+	finish_requests(c, stoptime);
+
 	va_start(args, fmt);
 	result = send_command_varargs(c, stoptime, fmt, args);
 	va_end(args);
@@ -366,6 +390,7 @@ struct chirp_client *chirp_client_connect(const char *hostport, int negotiate_au
 		c->link = link_connect(addr, port, stoptime);
 		c->broken = 0;
 		c->serial = global_serial++;
+		c->requests = list_create();
 		strcpy(c->hostport, hostport);
 		if(c->link) {
 			link_tune(c->link, LINK_TUNE_INTERACTIVE);
@@ -389,6 +414,7 @@ struct chirp_client *chirp_client_connect(const char *hostport, int negotiate_au
 			}
 		}
 		save_errno = errno;
+		list_delete(c->requests);
 		free(c);
 		errno = save_errno;
 	}
@@ -398,6 +424,13 @@ struct chirp_client *chirp_client_connect(const char *hostport, int negotiate_au
 
 void chirp_client_disconnect(struct chirp_client *c)
 {
+	struct chirp_client_request *r;
+
+	/* requests still outstanding fail, but their handles still belong to the callers. */
+	while((r = list_pop_head(c->requests)))
+		request_fail(r, ECONNRESET);
+	list_delete(c->requests);
+
 	link_close(c->link);
 	free(c);
 }
@@ -1522,6 +1555,66 @@ INT64_T chirp_client_access(struct chirp_client * c, char const *path, INT64_T m
 	return simple_command(c, stoptime, "access %s %lld\n", safepath, mode);
 }
 
+INT64_T chirp_client_bulkstat(struct chirp_client * c, struct chirp_bulkstat *list, int count, time_t stoptime)
+{
+	int start;
+	int i;
+	buffer_t B[1];
+
+	buffer_init(B);
+	buffer_abortonfailure(B, 1);
+
+	for(start = 0; start < count; start += CHIRP_BULKSTAT_MAX) {
+		int n = MIN(count - start, CHIRP_BULKSTAT_MAX);
+		struct chirp_bulkstat *v = &list[start];
+
+		/* the server agrees before the operations are sent, so that a server without bulkstat does not take them as commands. */
+		INT64_T result = simple_command(c, stoptime, "bulkstat %d\n", n);
+		if(result < 0) {
+			if(errno == EINVAL)
+				errno = ENOSYS;
+			buffer_free(B);
+			return -1;
+		}
+
+		buffer_rewind(B, 0);
+		for(i = 0; i < n; i++) {
+			char safepath[CHIRP_LINE_MAX];
+			url_encode(v[i].path, safepath, sizeof(safepath));
+			if(v[i].type == CHIRP_BULKSTAT_STAT) {
+				buffer_putfstring(B, "stat %s\n", safepath);
+			} else if(v[i].type == CHIRP_BULKSTAT_LSTAT) {
+				buffer_putfstring(B, "lstat %s\n", safepath);
+			} else {
+				buffer_putfstring(B, "access %s %" PRId64 "\n", safepath, v[i].mode);
+			}
+		}
+
+		if(link_putlstring(c->link, buffer_tostring(B), buffer_pos(B), stoptime) < 0) {
+			c->broken = 1;
+			errno = ECONNRESET;
+			buffer_free(B);
+			return -1;
+		}
+
+		for(i = 0; i < n; i++) {
+			result = get_result(c, stoptime);
+			if(result >= 0 && v[i].type != CHIRP_BULKSTAT_ACCESS)
+				result = get_stat_result(c, v[i].path, v[i].info, stoptime);
+			if(c->broken) {
+				errno = ECONNRESET;
+				buffer_free(B);
+				return -1;
+			}
+			v[i].result = result;
+			v[i].errnum = result < 0 ? errno : 0;
+		}
+	}
+
+	buffer_free(B);
+	return count;
+}
+
 INT64_T chirp_client_chmod(struct chirp_client * c, char const *path, INT64_T mode, time_t stoptime)
 {
 	char safepath[CHIRP_LINE_MAX];
@@ -2143,4 +2236,166 @@ INT64_T chirp_client_job_reap (struct chirp_client *c, const char *json, time_t
 	return get_result(c, stoptime);
 }
 
+/*
+Asynchronous requests are sent at once, and their replies are read later, in
+the order in which the requests were sent, so that several requests may be in
+flight on one connection.  The reply to a request is read when the request is
+waited for, or when any later request or synchronous call needs the
+connection.
+*/
+
+static struct chirp_client_request *request_create(struct chirp_client *c, request_type_t type, void *buffer, INT64_T length, struct chirp_stat *info)
+{
+	struct chirp_client_request *r = xxmalloc(sizeof(*r));
+	r->type = type;
+	r->buffer = buffer;
+	r->length = length;
+	r->info = info;
+	r->result = -1;
+	r->errnum = 0;
+	r->done = 0;
+	list_push_tail(c->requests, r);
+	return r;
+}
+
+static void request_fail(struct chirp_client_request *r, int errnum)
+{
+	r->result = -1;
+	r->errnum = errnum;
+	r->done = 1;
+}
+
+/* Read the reply to the oldest outstanding request. */
+
+static void finish_one_request(struct chirp_client *c, time_t stoptime)
+{
+	struct chirp_client_request *r = list_pop_head(c->requests);
+	if(!r)
+		return;
+
+	if(c->broken) {
+		request_fail(r, ECONNRESET);
+		return;
+	}
+
+	INT64_T result = get_result(c, stoptime);
+	if(result < 0) {
+		request_fail(r, errno);
+		return;
+	}
+
+	switch(r->type) {
+	case REQUEST_PREAD:
+		if(result > r->length) {
+			c->broken = 1;
+			request_fail(r, ECONNRESET);
+			return;
+		}
+		if(result > 0 && link_read(c->link, r->buffer, result, stoptime) != result) {
+			c->broken = 1;
+			request_fail(r, ECONNRESET);
+			return;
+		}
+		break;
+	case REQUEST_STAT:
+		if(get_stat_result(c, NULL, r->info, stoptime) < 0) {
+			request_fail(r, errno);
+			return;
+		}
+		break;
+	case REQUEST_PWRITE:
+		break;
+	}
+
+	r->result = result;
+	r->done = 1;
+}
+
+static void finish_requests(struct chirp_client *c, time_t stoptime)
+{
+	while(list_size(c->requests) > 0)
+		finish_one_request(c, stoptime);
+}
+
+static struct chirp_client_request *send_request(struct chirp_client *c, request_type_t type, void *buffer, INT64_T length, struct chirp_stat *info, time_t stoptime, char const *fmt, ...)
+{
+	INT64_T result;
+	va_list args;
+
+	va_start(args, fmt);
+	result = send_command_varargs(c, stoptime, fmt, args);
+	va_end(args);
+
+	if(result < 0)
+		return NULL;
+
+	return request_create(c, type, buffer, length, info);
+}
+
+struct chirp_client_request *chirp_client_pread_async(struct chirp_client *c, INT64_T fd, void *buffer, INT64_T length, INT64_T offset, time_t stoptime)
+{
+	return send_request(c, REQUEST_PREAD, buffer, length, NULL, stoptime, "pread %lld %lld %lld\n", fd, length, offset);
+}
+
+struct chirp_client_request *chirp_client_pwrite_async(struct chirp_client *c, INT64_T fd, const void *buffer, INT64_T length, INT64_T offset, time_t stoptime)
+{
+	if(length > MAX_BUFFER_SIZE)
+		length = MAX_BUFFER_SIZE;
+
+	struct chirp_client_request *r = send_request(c, REQUEST_PWRITE, NULL, length, NULL, stoptime, "pwrite %lld %lld %lld\n", fd, length, offset);
+	if(!r)
+		return NULL;
+
+	if(link_putlstring(c->link, buffer, length, stoptime) != length) {
+		c->broken = 1;
+		list_remove(c->requests, r);
+		request_fail(r, ECONNRESET);
+	}
+
+	return r;
+}
+
+struct chirp_client_request *chirp_client_fstat_async(struct chirp_client *c, INT64_T fd, struct chirp_stat *info, time_t stoptime)
+{
+	return send_request(c, REQUEST_STAT, NULL, 0, info, stoptime, "fstat %lld\n", fd);
+}
+
+struct chirp_client_request *chirp_client_stat_async(struct chirp_client *c, const char *path, struct chirp_stat *info, time_t stoptime)
+{
+	char safepath[CHIRP_LINE_MAX];
+	url_encode(path, safepath, sizeof(safepath));
+	return send_request(c, REQUEST_STAT, NULL, 0, info, stoptime, "stat %s\n", safepath);
+}
+
+INT64_T chirp_client_request_wait(struct chirp_client *c, struct chirp_client_request *r, time_t stoptime)
+{
+	while(!r->done) {
+		if(list_size(c->requests) < 1) {
+			/* r is not outstanding on c, so it was sent on another client. */
+			request_fail(r, ECONNRESET);
+			break;
+		}
+		finish_one_request(c, stoptime);
+	}
+
+	INT64_T result = r->result;
+	int errnum = r->errnum;
+	free(r);
+
+	if(result < 0)
+		errno = errnum;
+
+	return result;
+}
+
+int chirp_client_request_done(struct chirp_client_request *r)
+{
+	return r->done;
+}
+
+int chirp_client_requests_outstanding(struct chirp_client *c)
+{
+	return list_size(c->requests);
+}
+
 /* vim: set noexpandtab tabstop=4: */
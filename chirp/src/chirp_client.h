@@ -88,6 +88,7 @@ INT64_T chirp_client_stat(struct chirp_client *c, const char *path, struct chirp
 INT64_T chirp_client_lstat(struct chirp_client *c, const char *path, struct chirp_stat *buf, time_t stoptime);
 INT64_T chirp_client_statfs(struct chirp_client *c, const char *path, struct chirp_statfs *buf, time_t stoptime);
 INT64_T chirp_client_access(struct chirp_client *c, const char *path, INT64_T mode, time_t stoptime);
+INT64_T chirp_client_bulkstat(struct chirp_client *c, struct chirp_bulkstat *list, int count, time_t stoptime);
 INT64_T chirp_client_chmod(struct chirp_client *c, const char *path, INT64_T mode, time_t stoptime);
 INT64_T chirp_client_chown(struct chirp_client *c, const char *path, INT64_T uid, INT64_T gid, time_t stoptime);
 INT64_T chirp_client_lchown(struct chirp_client *c, const char *path, INT64_T uid, INT64_T gid, time_t stoptime);
@@ -130,6 +131,27 @@ INT64_T chirp_client_fsync_finish(struct chirp_client *c, INT64_T fd, time_t sto
 INT64_T chirp_client_fstat_begin(struct chirp_client *c, INT64_T fd, struct chirp_stat *buf, time_t stoptime);
 INT64_T chirp_client_fstat_finish(struct chirp_client *c, INT64_T fd, struct chirp_stat *buf, time_t stoptime);
 
+/*
+Asynchronous requests: each call sends its request and returns at once with a
+handle, or null if the request could not be sent.  Any number of requests may
+be outstanding on one client, and their replies are read in the order the
+requests were sent.  Buffers must stay valid until the request is waited for.
+chirp_client_request_wait returns the result of the request, as the
+synchronous call would, and frees the handle.  Synchronous calls on the same
+client first read the replies of all outstanding requests.  If the client is
+disconnected, its outstanding requests fail with ECONNRESET, but must still be
+waited for to free their handles; waiting for a request that has already
+failed does not touch the client.
+*/
+
+struct chirp_client_request *chirp_client_pread_async(struct chirp_client *c, INT64_T fd, void *buffer, INT64_T length, INT64_T offset, time_t stoptime);
+struct chirp_client_request *chirp_client_pwrite_async(struct chirp_client *c, INT64_T fd, const void *buffer, INT64_T length, INT64_T offset, time_t stoptime);
+struct chirp_client_request *chirp_client_fstat_async(struct chirp_client *c, INT64_T fd, struct chirp_stat *buf, time_t stoptime);
+struct chirp_client_request *chirp_client_stat_async(struct chirp_client *c, const char *path, struct chirp_stat *buf, time_t stoptime);
+INT64_T chirp_client_request_wait(struct chirp_client *c, struct chirp_client_request *r, time_t stoptime);
+int chirp_client_request_done(struct chirp_client_request *r);
+int chirp_client_requests_outstanding(struct chirp_client *c);
+
 INT64_T chirp_client_job_create(struct chirp_client *c, const char *json, chirp_jobid_t *id, time_t stoptime);
 INT64_T chirp_client_job_commit(struct chirp_client *c, const char *json, time_t stoptime);
 INT64_T chirp_client_job_kill(struct chirp_client *c, const char *json, time_t stoptime);
@@ -11,10 +11,13 @@ See the file COPYING for details.
 #include <stdlib.h>
 #include <dirent.h>
 #include <time.h>
+#include <inttypes.h>
+#include <sys/stat.h>
 
 #include "chirp_client.h"
 #include "chirp_reli.h"
 #include "chirp_recursive.h"
+#include "chirp_stripe.h"
 
 #include "cctools.h"
 #include "debug.h"
@@ -25,6 +28,7 @@ See the file COPYING for details.
 #include "full_io.h"
 
 static int timeout = 3600;
+static int parallel = -1;
 
 static void show_help(const char *cmd)
 {
@@ -33,6 +37,7 @@ static void show_help(const char *cmd)
 	fprintf(stdout, " %-30s Require this authentication mode.\n", "-a,--auth=<flag>");
 	fprintf(stdout, " %-30s Enable debugging for this subsystem.\n", "-d,--debug <flag>");
 	fprintf(stdout, " %-30s Comma-delimited list of tickets to use for authentication.\n", "-i,--tickets=<files>");
+	fprintf(stdout, " %-30s Get a large file over this many streams, or auto. (max %d)\n", "-p,--parallel=<n|auto>", CHIRP_STRIPE_STREAMS_MAX);
 	fprintf(stdout, " %-30s Timeout for failure. (default is %ds)\n", "-t,--timeout=<time>", timeout);
 	fprintf(stdout, " %-30s Show program version.\n", "-v,--version");
 	fprintf(stdout, " %-30s This message.\n", "-h,--help");
@@ -46,6 +51,7 @@ int main(int argc, char *argv[])
 	time_t stoptime;
 	FILE *file;
 	INT64_T result;
+	struct chirp_stat info;
 	signed char c;
 	char *tickets = NULL;
 
@@ -55,13 +61,14 @@ int main(int argc, char *argv[])
 		{"auth", required_argument, 0, 'a'},
 		{"debug", required_argument, 0, 'd'},
 		{"tickets", required_argument, 0, 'i'},
+		{"parallel", required_argument, 0, 'p'},
 		{"timeout", required_argument, 0, 't'},
 		{"version", no_argument, 0, 'v'},
 		{"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
 	};
 
-	while((c = getopt_long(argc, argv, "a:d:i:t:vh", long_options, NULL)) > -1) {
+	while((c = getopt_long(argc, argv, "a:d:i:p:t:vh", long_options, NULL)) > -1) {
 		switch (c) {
 		case 'a':
 			if (!auth_register_byname(optarg))
@@ -74,6 +81,11 @@ int main(int argc, char *argv[])
 		case 'i':
 			tickets = strdup(optarg);
 			break;
+		case 'p':
+			parallel = chirp_stripe_streams_parse(optarg);
+			if(parallel < 0)
+				fatal("invalid number of streams: %s", optarg);
+			break;
 		case 't':
 			timeout = string_time_parse(optarg);
 			break;
@@ -119,6 +131,14 @@ int main(int argc, char *argv[])
 
 	if(stdout_mode) {
 		result = chirp_reli_getfile(hostname, source_file, file, stoptime);
+	} else if(parallel >= 0 && chirp_reli_stat(hostname, source_file, &info, stoptime) == 0 && S_ISREG(info.cst_mode)) {
+		struct chirp_stripe_stats stats;
+		result = chirp_stripe_get(hostname, source_file, target_file, parallel, &stats, stoptime);
+		if(result >= 0) {
+			char rate[256];
+			string_metric(stats.seconds > 0 ? stats.bytes / stats.seconds : 0, -1, rate);
+			printf("%" PRId64 " bytes in %.2f s (%sB/s) using %d streams\n", stats.bytes, stats.seconds, rate, stats.streams);
+		}
 	} else {
 		result = chirp_recursive_get(hostname, source_file, target_file, stoptime);
 	}
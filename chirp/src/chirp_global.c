@@ -719,6 +719,36 @@ INT64_T chirp_global_access(const char *host, const char *path, INT64_T mode, ti
 	}
 }
 
+INT64_T chirp_global_bulkstat(const char *host, struct chirp_bulkstat *list, int count, time_t stoptime)
+{
+	int i;
+	INT64_T result;
+
+	if(!is_multi_path(host) && not_empty(host)) {
+		for(i = 0; i < count; i++) {
+			if(!not_empty(list[i].path))
+				break;
+		}
+		if(i == count)
+			return chirp_reli_bulkstat(host, list, count, stoptime);
+	}
+
+	for(i = 0; i < count; i++) {
+		struct chirp_bulkstat *b = &list[i];
+		if(b->type == CHIRP_BULKSTAT_STAT) {
+			result = chirp_global_stat(host, b->path, b->info, stoptime);
+		} else if(b->type == CHIRP_BULKSTAT_LSTAT) {
+			result = chirp_global_lstat(host, b->path, b->info, stoptime);
+		} else {
+			result = chirp_global_access(host, b->path, b->mode, stoptime);
+		}
+		b->result = result;
+		b->errnum = result < 0 ? errno : 0;
+	}
+
+	return count;
+}
+
 INT64_T chirp_global_chmod(const char *host, const char *path, INT64_T mode, time_t stoptime)
 {
 	if(is_multi_path(host)) {
@@ -48,6 +48,7 @@ INT64_T chirp_global_stat(const char *host, const char *path, struct chirp_stat
 INT64_T chirp_global_lstat(const char *host, const char *path, struct chirp_stat *buf, time_t stoptime);
 INT64_T chirp_global_statfs(const char *host, const char *path, struct chirp_statfs *buf, time_t stoptime);
 INT64_T chirp_global_access(const char *host, const char *path, INT64_T mode, time_t stoptime);
+INT64_T chirp_global_bulkstat(const char *host, struct chirp_bulkstat *list, int count, time_t stoptime);
 INT64_T chirp_global_chmod(const char *host, const char *path, INT64_T mode, time_t stoptime);
 INT64_T chirp_global_chown(const char *host, const char *path, INT64_T uid, INT64_T gid, time_t stoptime);
 INT64_T chirp_global_lchown(const char *host, const char *path, INT64_T uid, INT64_T gid, time_t stoptime);
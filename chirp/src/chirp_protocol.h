@@ -19,6 +19,9 @@ used by both the client and server implementations of the protocol.
 /** The maximum length of a full path in any Chirp operation. */
 #define CHIRP_PATH_MAX 1024
 
+/** The maximum number of operations in one bulkstat request. */
+#define CHIRP_BULKSTAT_MAX 1024
+
 /** The current version of the Chirp protocol. */
 #define CHIRP_VERSION 3
 
@@ -12,11 +12,13 @@ See the file COPYING for details.
 #include <dirent.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <inttypes.h>
 
 #include "chirp_client.h"
 #include "chirp_reli.h"
 #include "chirp_recursive.h"
 #include "chirp_stream.h"
+#include "chirp_stripe.h"
 
 #include "cctools.h"
 #include "debug.h"
@@ -38,6 +40,7 @@ See the file COPYING for details.
 
 static int timeout = 3600;
 static size_t buffer_size = 65536;
+static int parallel = -1;
 
 static void show_help(const char *cmd)
 {
@@ -48,6 +51,7 @@ static void show_help(const char *cmd)
 	fprintf(stdout, " %-30s Enable debugging for this subsystem.\n", "-d,--debug <flag>");
 	fprintf(stdout, " %-30s Follow input file like tail -f.\n", "-f,--follow");
 	fprintf(stdout, " %-30s Comma-delimited list of tickets to use for authentication.\n", "-i,--tickets=<files>");
+	fprintf(stdout, " %-30s Put a large file over this many streams, or auto. (max %d)\n", "-p,--parallel=<n|auto>", CHIRP_STRIPE_STREAMS_MAX);
 	fprintf(stdout, " %-30s Timeout for failure. (default is %ds)\n", "-t,--timeout=<time>", timeout);
 	fprintf(stdout, " %-30s Show program version.\n", "-v,--version");
 	fprintf(stdout, " %-30s This message.\n", "-h,--help");
@@ -61,6 +65,7 @@ int main(int argc, char *argv[])
 	const char *hostname, *source_file, *target_file;
 	time_t stoptime;
 	FILE *file;
+	struct stat info;
 	int c;
 	char *tickets = NULL;
 
@@ -72,13 +77,14 @@ int main(int argc, char *argv[])
 		{"debug", required_argument, 0, 'd'},
 		{"follow", no_argument, 0, 'f'},
 		{"tickets", required_argument, 0, 'i'},
+		{"parallel", required_argument, 0, 'p'},
 		{"timeout", required_argument, 0, 't'},
 		{"version", no_argument, 0, 'v'},
 		{"help", no_argument, 0, 'h'},
 		{0, 0, 0, 0}
 	};
 
-	while((c = getopt_long(argc, argv, "a:b:d:fi:t:vh", long_options, NULL)) > -1) {
+	while((c = getopt_long(argc, argv, "a:b:d:fi:p:t:vh", long_options, NULL)) > -1) {
 		switch (c) {
 		case 'a':
 			if (!auth_register_byname(optarg))
@@ -97,6 +103,11 @@ int main(int argc, char *argv[])
 		case 'i':
 			tickets = strdup(optarg);
 			break;
+		case 'p':
+			parallel = chirp_stripe_streams_parse(optarg);
+			if(parallel < 0)
+				fatal("invalid number of streams: %s", optarg);
+			break;
 		case 't':
 			timeout = string_time_parse(optarg);
 			break;
@@ -149,7 +160,19 @@ int main(int argc, char *argv[])
 	if(follow_mode)
 		whole_file_mode = 0;
 
-	if(whole_file_mode) {
+	if(whole_file_mode && parallel >= 0 && stat(source_file, &info) == 0 && S_ISREG(info.st_mode)) {
+		struct chirp_stripe_stats stats;
+		INT64_T result = chirp_stripe_put(source_file, hostname, target_file, parallel, &stats, stoptime);
+		if(result < 0) {
+			fprintf(stderr, "chirp_put: couldn't put %s to host %s: %s\n", source_file, hostname, strerror(errno));
+			return 1;
+		} else {
+			char rate[256];
+			string_metric(stats.seconds > 0 ? stats.bytes / stats.seconds : 0, -1, rate);
+			printf("%" PRId64 " bytes in %.2f s (%sB/s) using %d streams\n", stats.bytes, stats.seconds, rate, stats.streams);
+			return 0;
+		}
+	} else if(whole_file_mode) {
 		INT64_T result = chirp_recursive_put(hostname, source_file, target_file, stoptime);
 		if(result < 0) {
 			fprintf(stderr, "chirp_put: couldn't put %s to host %s: %s\n", source_file, hostname, strerror(errno));
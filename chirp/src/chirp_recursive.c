@@ -9,6 +9,8 @@ See the file COPYING for details.
 
 #include "stringtools.h"
 #include "list.h"
+#include "xxmalloc.h"
+#include "macros.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,19 +30,31 @@ See the file COPYING for details.
 #define fseeko64 fseeko
 #endif
 
+#define FIFO_BUFFER_SIZE (32*1024*1024)
+
 static void add_to_list(const char *name, void *list)
 {
 	list_push_tail(list, strdup(name));
 }
 
+static INT64_T do_get_one(const char *hostport, const char *source_file, const char *target_file, struct chirp_stat *info, time_t stoptime);
+
+/*
+The entries of a directory are examined with one bulkstat request for each
+CHIRP_BULKSTAT_MAX entries, rather than one lstat each.
+*/
+
 static INT64_T do_get_one_dir(const char *hostport, const char *source_file, const char *target_file, int mode, time_t stoptime)
 {
-	char new_source_file[CHIRP_PATH_MAX];
 	char new_target_file[CHIRP_PATH_MAX];
 	struct list *work_list;
-	const char *name;
+	char *name;
 	INT64_T result;
 	INT64_T total = 0;
+	int i, n, nmax;
+	struct chirp_bulkstat *bulk = 0;
+	struct chirp_stat *info = 0;
+	char **names = 0;
 
 	work_list = list_create();
 
@@ -48,18 +62,44 @@ static INT64_T do_get_one_dir(const char *hostport, const char *source_file, con
 	if(result == 0 || errno == EEXIST) {
 		result = chirp_reli_getdir(hostport, source_file, add_to_list, work_list, stoptime);
 		if(result >= 0) {
-			while((name = list_pop_head(work_list))) {
-				if(!strcmp(name, "."))
-					continue;
-				if(!strcmp(name, ".."))
-					continue;
-				sprintf(new_source_file, "%s/%s", source_file, name);
-				sprintf(new_target_file, "%s/%s", target_file, name);
-				result = chirp_recursive_get(hostport, new_source_file, new_target_file, stoptime);
-				free((char *) name);
-				if(result < 0)
-					break;
-				total += result;
+			nmax = MIN(list_size(work_list), CHIRP_BULKSTAT_MAX);
+			if(nmax > 0) {
+				bulk = xxcalloc(nmax, sizeof(*bulk));
+				info = xxcalloc(nmax, sizeof(*info));
+				names = xxcalloc(nmax, sizeof(*names));
+			}
+			while(result >= 0 && list_size(work_list) > 0) {
+				n = 0;
+				while(n < nmax && (name = list_pop_head(work_list))) {
+					if(!strcmp(name, ".") || !strcmp(name, "..")) {
+						free(name);
+						continue;
+					}
+					names[n] = name;
+					bulk[n].type = CHIRP_BULKSTAT_LSTAT;
+					bulk[n].path = string_format("%s/%s", source_file, name);
+					bulk[n].info = &info[n];
+					n++;
+				}
+
+				if(n > 0)
+					result = chirp_reli_bulkstat(hostport, bulk, n, stoptime);
+
+				for(i = 0; i < n; i++) {
+					if(result >= 0) {
+						if(bulk[i].result >= 0) {
+							sprintf(new_target_file, "%s/%s", target_file, names[i]);
+							result = do_get_one(hostport, bulk[i].path, new_target_file, &info[i], stoptime);
+							if(result >= 0)
+								total += result;
+						} else {
+							errno = bulk[i].errnum;
+							result = -1;
+						}
+					}
+					free((char *) bulk[i].path);
+					free(names[i]);
+				}
 			}
 		} else {
 			result = -1;
@@ -69,9 +109,12 @@ static INT64_T do_get_one_dir(const char *hostport, const char *source_file, con
 	}
 
 	while((name = list_pop_head(work_list)))
-		free((char *) name);
+		free(name);
 
 	list_delete(work_list);
+	free(bulk);
+	free(info);
+	free(names);
 
 	if(result >= 0) {
 		return total;
@@ -128,23 +171,27 @@ static INT64_T do_get_one_file(const char *hostport, const char *source_file, co
 	}
 }
 
+static INT64_T do_get_one(const char *hostport, const char *source_file, const char *target_file, struct chirp_stat *info, time_t stoptime)
+{
+	if(S_ISLNK(info->cst_mode)) {
+		return do_get_one_link(hostport, source_file, target_file, stoptime);
+	} else if(S_ISDIR(info->cst_mode)) {
+		return do_get_one_dir(hostport, source_file, target_file, info->cst_mode, stoptime);
+	} else if(S_ISREG(info->cst_mode)) {
+		return do_get_one_file(hostport, source_file, target_file, info->cst_mode, info->cst_size, stoptime);
+	} else {
+		return 0;
+	}
+}
+
 INT64_T chirp_recursive_get(const char *hostport, const char *source_file, const char *target_file, time_t stoptime)
 {
 	INT64_T result;
 	struct chirp_stat info;
 
 	result = chirp_reli_lstat(hostport, source_file, &info, stoptime);
-	if(result >= 0) {
-		if(S_ISLNK(info.cst_mode)) {
-			result = do_get_one_link(hostport, source_file, target_file, stoptime);
-		} else if(S_ISDIR(info.cst_mode)) {
-			result = do_get_one_dir(hostport, source_file, target_file, info.cst_mode, stoptime);
-		} else if(S_ISREG(info.cst_mode)) {
-			result = do_get_one_file(hostport, source_file, target_file, info.cst_mode, info.cst_size, stoptime);
-		} else {
-			result = 0;
-		}
-	}
+	if(result >= 0)
+		result = do_get_one(hostport, source_file, target_file, &info, stoptime);
 
 	return result;
 }
@@ -255,11 +302,13 @@ static INT64_T do_put_one_fifo(const char *hostport, const char *source_file, co
 	if(!file)
 		return -1;
 
+	/* large writes are pipelined by chirp_reli, so read the fifo in large pieces. */
+	char *buffer = xxmalloc(FIFO_BUFFER_SIZE);
+
 	cf = chirp_reli_open(hostport, target_file, O_WRONLY|O_CREAT|O_TRUNC, 0600, stoptime);
 	if(cf) {
 		size_t n;
-		char buffer[65536];
-		while((n = fread(buffer, sizeof(char), 65536, file))) {
+		while((n = fread(buffer, sizeof(char), FIFO_BUFFER_SIZE, file))) {
 			if(chirp_reli_pwrite(cf, buffer, n, offset, stoptime) < 0)
 				goto fail;
 			offset += n;
@@ -275,6 +324,7 @@ fail:
 	goto out;
 out:
 	save_errno = errno;
+	free(buffer);
 	fclose(file);
 	errno = save_errno;
 	return result;
@@ -16,6 +16,7 @@ See the file COPYING for details.
 #include "hash_table.h"
 #include "xxmalloc.h"
 #include "list.h"
+#include "stats.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -26,6 +27,17 @@ See the file COPYING for details.
 #define MIN_DELAY 1
 #define MAX_DELAY 60
 
+/* Counters of the buffering done for one file. */
+
+struct chirp_reli_stats {
+	INT64_T hits;              /* small reads served from a cached block. */
+	INT64_T misses;            /* small reads that had to wait for a block from the server. */
+	INT64_T prefetches;        /* blocks read ahead of a sequential reader. */
+	INT64_T prefetch_hits;     /* blocks read ahead that were then read. */
+	INT64_T writes_behind;     /* write buffers sent without waiting for the result. */
+	INT64_T write_retries;     /* writes behind that had to be sent again after a failure. */
+};
+
 struct chirp_file {
 	char host[CHIRP_LINE_MAX];
 	char path[CHIRP_LINE_MAX];
@@ -39,12 +51,58 @@ struct chirp_file {
 	INT64_T buffer_valid;
 	INT64_T buffer_offset;
 	INT64_T buffer_dirty;
+	INT64_T blocksize;
+	struct chirp_block *blocks;
+	INT64_T clock;
+	INT64_T read_next;
+	int readahead;
+	INT64_T eof;
+	struct list *writes;
+	struct chirp_reli_stats stats;
+};
+
+/*
+Small reads are served from a cache of CHIRP_RELI_BLOCKS aligned blocks per
+file.  When reads are sequential, the following blocks are read ahead with
+asynchronous requests, in a window that doubles with each sequential read up
+to CHIRP_RELI_READAHEAD_MAX blocks, and closes at the first seek.
+
+Small writes are coalesced in the write buffer as before, but a full buffer
+is sent without waiting for the reply, with up to CHIRP_RELI_WRITES_MAX
+buffers in flight.  Their results are collected by chirp_reli_flush, which
+is called by close and by every operation that must see the written data.
+If any write behind fails, it and all of the writes sent after it are sent
+again, in order, with the usual retries.  An error that remains is then
+returned by the flush, rather than by the write that caused it.
+
+The counters of each file are logged when it is closed, and their totals are
+kept as chirp.reli.* in the stats module, as reported by parrot --stats-file.
+*/
+
+#define CHIRP_RELI_BLOCKS 16
+#define CHIRP_RELI_READAHEAD_MAX 8
+#define CHIRP_RELI_WRITES_MAX 8
+
+struct chirp_block {
+	INT64_T offset;
+	INT64_T valid;
+	INT64_T last_used;
+	char *data;
+	struct chirp_client *client;
+	struct chirp_client_request *request;
+};
+
+struct chirp_write {
+	INT64_T offset;
+	INT64_T length;
+	char *data;
+	struct chirp_client *client;
+	struct chirp_client_request *request;
 };
 
 struct hash_table *table = 0;
 static int chirp_reli_blocksize = 65536;
 static int chirp_reli_default_nreps = 0;
-
 INT64_T chirp_reli_blocksize_get()
 {
 	return chirp_reli_blocksize;
@@ -150,6 +208,7 @@ struct chirp_file * chirp_reli_open( const char *host, const char *path, INT64_T
 	INT64_T result;
 	struct chirp_stat buf;
 	time_t current;
+	int i;
 
 	while(1) {
 		struct chirp_client *client = connect_to_host(host,stoptime);
@@ -165,10 +224,19 @@ struct chirp_file * chirp_reli_open( const char *host, const char *path, INT64_T
 				file->mode = mode;
 				file->serial = chirp_client_serial(client);
 				file->stale = 0;
-				file->buffer = malloc(chirp_reli_blocksize);
+				file->buffer = xxmalloc(chirp_reli_blocksize);
 				file->buffer_offset = 0;
 				file->buffer_valid = 0;
 				file->buffer_dirty = 0;
+				file->blocksize = chirp_reli_blocksize;
+				file->blocks = xxcalloc(CHIRP_RELI_BLOCKS,sizeof(struct chirp_block));
+				for(i=0;i<CHIRP_RELI_BLOCKS;i++) file->blocks[i].offset = -1;
+				file->clock = 0;
+				file->read_next = 0;
+				file->readahead = 0;
+				file->eof = -1;
+				file->writes = list_create();
+				memset(&file->stats,0,sizeof(file->stats));
 				return file;
 			} else {
 				if(errno!=ECONNRESET) return 0;
@@ -195,17 +263,34 @@ struct chirp_file * chirp_reli_open( const char *host, const char *path, INT64_T
 	}
 }
 
+static void block_discard( struct chirp_block *b, time_t stoptime );
+
 INT64_T chirp_reli_close( struct chirp_file *file, time_t stoptime )
 {
 	struct chirp_client *client;
+	int i;
 	if(chirp_reli_flush(file,stoptime) < 0)
 		return -1;
+	for(i=0;i<CHIRP_RELI_BLOCKS;i++) {
+		block_discard(&file->blocks[i],stoptime);
+		free(file->blocks[i].data);
+	}
 	client = connect_to_host(file->host,stoptime);
 	if(client) {
 		if(chirp_client_serial(client)==file->serial) {
 			chirp_client_close(client,file->fd,stoptime);
 		}
 	}
+	debug(D_CHIRP,"%s: %lld hits %lld misses %lld prefetches (%lld used) %lld writes behind (%lld retried)",
+		file->path,
+		(long long)file->stats.hits,
+		(long long)file->stats.misses,
+		(long long)file->stats.prefetches,
+		(long long)file->stats.prefetch_hits,
+		(long long)file->stats.writes_behind,
+		(long long)file->stats.write_retries);
+	list_delete(file->writes);
+	free(file->blocks);
 	free(file->buffer);
 	free(file);
 	return 0;
@@ -248,42 +333,257 @@ INT64_T chirp_reli_close( struct chirp_file *file, time_t stoptime )
 	}
 
 
+/*
+Large unbuffered reads and writes are split into chunks of PIPELINE_CHUNK
+bytes, with up to PIPELINE_DEPTH chunks in flight on the connection at once,
+so that the connection is not idle for a round trip between chunks.  The
+result is the number of bytes transferred before the first short or failed
+chunk.  All chunks sent are waited for before returning, so that a failure
+leaves no requests outstanding on the client.
+*/
+
+#define PIPELINE_CHUNK (4*1024*1024)
+#define PIPELINE_DEPTH 8
+
+typedef struct chirp_client_request * (*pipeline_send_t)( struct chirp_client *c, INT64_T fd, char *data, INT64_T length, INT64_T offset, time_t stoptime );
+
+static INT64_T pipeline_io( struct chirp_client *client, pipeline_send_t send, INT64_T fd, char *data, INT64_T length, INT64_T offset, time_t stoptime )
+{
+	struct chirp_client_request *requests[PIPELINE_DEPTH];
+	INT64_T lengths[PIPELINE_DEPTH];
+	int head = 0;
+	int count = 0;
+
+	INT64_T sent = 0;
+	INT64_T total = 0;
+	int stopped = 0;
+	int failed = 0;
+	int save_errno = 0;
+
+	while(count > 0 || (!stopped && sent < length)) {
+		while(!stopped && sent < length && count < PIPELINE_DEPTH) {
+			INT64_T chunk = MIN(PIPELINE_CHUNK, length - sent);
+			struct chirp_client_request *r = send(client, fd, data + sent, chunk, offset + sent, stoptime);
+			if(!r) {
+				if(total == 0 && count == 0) {
+					failed = 1;
+					save_errno = errno;
+				}
+				stopped = 1;
+				break;
+			}
+			int slot = (head + count) % PIPELINE_DEPTH;
+			requests[slot] = r;
+			lengths[slot] = chunk;
+			count++;
+			sent += chunk;
+		}
+
+		if(count == 0)
+			break;
+
+		INT64_T result = chirp_client_request_wait(client, requests[head], stoptime);
+		if(!stopped) {
+			if(result < 0) {
+				if(total == 0) {
+					failed = 1;
+					save_errno = errno;
+				}
+				stopped = 1;
+			} else {
+				total += result;
+				if(result < lengths[head])
+					stopped = 1;
+			}
+		}
+
+		head = (head + 1) % PIPELINE_DEPTH;
+		count--;
+	}
+
+	if(failed) {
+		errno = save_errno;
+		return -1;
+	}
+
+	return total;
+}
+
+static struct chirp_client_request * pipeline_pread( struct chirp_client *c, INT64_T fd, char *data, INT64_T length, INT64_T offset, time_t stoptime )
+{
+	return chirp_client_pread_async(c, fd, data, length, offset, stoptime);
+}
+
+static struct chirp_client_request * pipeline_pwrite( struct chirp_client *c, INT64_T fd, char *data, INT64_T length, INT64_T offset, time_t stoptime )
+{
+	return chirp_client_pwrite_async(c, fd, data, length, offset, stoptime);
+}
+
 INT64_T chirp_reli_pread_unbuffered( struct chirp_file *file, void *data, INT64_T length, INT64_T offset, time_t stoptime )
 {
-	RETRY_FILE( result = chirp_client_pread(client,file->fd,data,length,offset,stoptime); )
+	if(length > PIPELINE_CHUNK) {
+		RETRY_FILE( result = pipeline_io(client,pipeline_pread,file->fd,data,length,offset,stoptime); )
+	} else {
+		RETRY_FILE( result = chirp_client_pread(client,file->fd,data,length,offset,stoptime); )
+	}
 }
 
-static INT64_T chirp_reli_pread_buffered( struct chirp_file *file, void *data, INT64_T length, INT64_T offset, time_t stoptime )
+#define COUNT_STAT( file, name ) do { file->stats.name++; stats_inc("chirp.reli." #name,1); } while(0)
+
+/* Complete the read ahead into a block, if any.  A failed read leaves the block unused. */
+
+static void block_complete( struct chirp_block *b, time_t stoptime )
 {
-	if(file->buffer_valid) {
-		if(offset >= file->buffer_offset && offset < (file->buffer_offset+file->buffer_valid) ) {
-			INT64_T blength;
-			blength = MIN(length,file->buffer_offset+file->buffer_valid-offset);
-			memcpy(data,&file->buffer[offset-file->buffer_offset],blength);
-			return blength;
+	if(!b->request) return;
+
+	INT64_T result = chirp_client_request_wait(b->client,b->request,stoptime);
+	b->request = 0;
+	b->client = 0;
+
+	if(result<0) {
+		b->offset = -1;
+		b->valid = 0;
+	} else {
+		b->valid = result;
+	}
+}
+
+static void block_discard( struct chirp_block *b, time_t stoptime )
+{
+	block_complete(b,stoptime);
+	b->offset = -1;
+	b->valid = 0;
+}
+
+static struct chirp_block * block_lookup( struct chirp_file *file, INT64_T offset )
+{
+	int i;
+	for(i=0;i<CHIRP_RELI_BLOCKS;i++) {
+		if(file->blocks[i].offset==offset) return &file->blocks[i];
+	}
+	return 0;
+}
+
+/*
+Choose the least recently used block to replace.  A block with a read ahead
+still in flight is only chosen if pending is set, and is then completed first.
+*/
+
+static struct chirp_block * block_victim( struct chirp_file *file, int pending, time_t stoptime )
+{
+	struct chirp_block *victim = 0;
+	int i;
+
+	for(i=0;i<CHIRP_RELI_BLOCKS;i++) {
+		struct chirp_block *b = &file->blocks[i];
+		if(b->request && !pending) continue;
+		if(b->offset<0 && !b->request) {
+			victim = b;
+			break;
 		}
+		if(!victim || b->last_used<victim->last_used) victim = b;
 	}
 
-	chirp_reli_flush(file,stoptime);
+	if(victim) {
+		block_discard(victim,stoptime);
+		if(!victim->data) victim->data = xxmalloc(file->blocksize);
+	}
+
+	return victim;
+}
 
-	if(length<=chirp_reli_blocksize) {
-		INT64_T result = chirp_reli_pread_unbuffered(file,file->buffer,chirp_reli_blocksize,offset,stoptime);
+/* Drop the cached blocks that overlap a range written by this client. */
+
+static void blocks_invalidate( struct chirp_file *file, INT64_T offset, INT64_T length, time_t stoptime )
+{
+	int i;
+	for(i=0;i<CHIRP_RELI_BLOCKS;i++) {
+		struct chirp_block *b = &file->blocks[i];
+		if(b->offset<0) continue;
+		if(length>=0 && (b->offset+file->blocksize<=offset || b->offset>=offset+length)) continue;
+		block_discard(b,stoptime);
+	}
+	file->eof = -1;
+}
+
+/*
+Send asynchronous reads for the blocks following offset, as far as the
+readahead window allows.  Read ahead is only done on a connection on which
+the file is already open, and never waits for anything but an idle block.
+*/
+
+static void read_ahead( struct chirp_file *file, INT64_T offset, time_t stoptime )
+{
+	if(file->readahead<1 || file->stale || !table) return;
+
+	struct chirp_client *client = hash_table_lookup(table,file->host);
+	if(!client || chirp_client_serial(client)!=file->serial) return;
+
+	INT64_T start = offset - offset%file->blocksize;
+	int i;
+
+	for(i=0;i<file->readahead;i++) {
+		INT64_T boffset = start + i*file->blocksize;
+		if(file->eof>=0 && boffset>=file->eof) break;
+		if(block_lookup(file,boffset)) continue;
+
+		struct chirp_block *b = block_victim(file,0,stoptime);
+		if(!b) break;
+
+		b->request = chirp_client_pread_async(client,file->fd,b->data,file->blocksize,boffset,stoptime);
+		if(!b->request) break;
+
+		b->client = client;
+		b->offset = boffset;
+		b->valid = 0;
+		b->last_used = ++file->clock;
+		COUNT_STAT(file,prefetches);
+	}
+}
+
+static INT64_T chirp_reli_pread_buffered( struct chirp_file *file, void *data, INT64_T length, INT64_T offset, time_t stoptime )
+{
+	/* reads must see the data written so far. */
+	if(file->buffer_valid || list_size(file->writes)>0) {
+		if(chirp_reli_flush(file,stoptime)<0) return -1;
+	}
+
+	if(length>file->blocksize) {
+		return chirp_reli_pread_unbuffered(file,data,length,offset,stoptime);
+	}
+
+	INT64_T boffset = offset - offset%file->blocksize;
+	INT64_T skip = offset - boffset;
+
+	struct chirp_block *b = block_lookup(file,boffset);
+	if(b && b->request) {
+		block_complete(b,stoptime);
+		if(b->offset>=0) COUNT_STAT(file,prefetch_hits);
+	}
+
+	if(b && b->offset>=0 && skip<b->valid) {
+		COUNT_STAT(file,hits);
+	} else {
+		COUNT_STAT(file,misses);
+		if(!b) b = block_victim(file,1,stoptime);
+		INT64_T result = chirp_reli_pread_unbuffered(file,b->data,file->blocksize,boffset,stoptime);
 		if(result<0) {
-			file->buffer_offset = 0;
-			file->buffer_valid = 0;
-			file->buffer_dirty = 0;
-			return result;
-		} else {
-			file->buffer_offset = offset;
-			file->buffer_valid = result;
-			file->buffer_dirty = 0;
-			result = MIN(result,length);
-			memcpy(data,file->buffer,result);
+			b->offset = -1;
+			b->valid = 0;
 			return result;
 		}
-	} else {
-		return chirp_reli_pread_unbuffered(file,data,length,offset,stoptime);
+		b->offset = boffset;
+		b->valid = result;
 	}
+
+	if(b->valid<file->blocksize) file->eof = boffset + b->valid;
+	b->last_used = ++file->clock;
+
+	if(skip>=b->valid) return 0;
+
+	INT64_T result = MIN(length,b->valid-skip);
+	memcpy(data,&b->data[skip],result);
+	return result;
 }
 
 INT64_T chirp_reli_pread( struct chirp_file *file, void *data, INT64_T length, INT64_T offset, time_t stoptime )
@@ -292,6 +592,12 @@ INT64_T chirp_reli_pread( struct chirp_file *file, void *data, INT64_T length, I
 	INT64_T result = 0;
 	INT64_T actual = 0;
 
+	if(length<=file->blocksize && offset==file->read_next) {
+		file->readahead = MIN(MAX(file->readahead*2,1),CHIRP_RELI_READAHEAD_MAX);
+	} else {
+		file->readahead = 0;
+	}
+
 	while(length>0) {
 		actual = chirp_reli_pread_buffered(file,cdata,length,offset,stoptime);
 		if(actual<=0) break;
@@ -303,6 +609,8 @@ INT64_T chirp_reli_pread( struct chirp_file *file, void *data, INT64_T length, I
 	}
 
 	if(result>0) {
+		file->read_next = offset;
+		read_ahead(file,offset,stoptime);
 		return result;
 	} else {
 		return actual;
@@ -311,12 +619,94 @@ INT64_T chirp_reli_pread( struct chirp_file *file, void *data, INT64_T length, I
 
 INT64_T chirp_reli_pwrite_unbuffered( struct chirp_file *file, const void *data, INT64_T length, INT64_T offset, time_t stoptime )
 {
-	RETRY_FILE( result = chirp_client_pwrite(client,file->fd,data,length,offset,stoptime); )
+	if(length > PIPELINE_CHUNK) {
+		RETRY_FILE( result = pipeline_io(client,pipeline_pwrite,file->fd,(char *) data,length,offset,stoptime); )
+	} else {
+		RETRY_FILE( result = chirp_client_pwrite(client,file->fd,data,length,offset,stoptime); )
+	}
+}
+
+/*
+Collect the results of the writes behind.  If all is not set, only collect
+enough of the oldest to make room for one more.  After a failure, every later
+write is sent again, so that overlapping writes are still applied in order.
+*/
+
+static INT64_T complete_writes( struct chirp_file *file, int all, time_t stoptime )
+{
+	struct chirp_write *w;
+	INT64_T result = 0;
+	int rewrite = 0;
+	int save_errno = 0;
+
+	while((w = list_peek_head(file->writes))) {
+		if(!all && !rewrite && list_size(file->writes)<CHIRP_RELI_WRITES_MAX) break;
+		list_pop_head(file->writes);
+
+		INT64_T actual = chirp_client_request_wait(w->client,w->request,stoptime);
+		if(rewrite || actual!=w->length) {
+			if(!rewrite) debug(D_CHIRP,"write behind to %s failed: %s",file->path,actual<0 ? strerror(errno) : "short write");
+			rewrite = 1;
+			COUNT_STAT(file,write_retries);
+			actual = chirp_reli_pwrite_unbuffered(file,w->data,w->length,w->offset,stoptime);
+			if(actual!=w->length && result==0) {
+				result = -1;
+				save_errno = actual<0 ? errno : EIO;
+			}
+		}
+
+		free(w->data);
+		free(w);
+	}
+
+	if(result<0) errno = save_errno;
+	return result;
+}
+
+/*
+Send the write buffer without waiting for the reply, and give the file a new
+buffer.  If the file is not open on the current connection, it is written
+synchronously instead.
+*/
+
+static INT64_T write_behind( struct chirp_file *file, time_t stoptime )
+{
+	if(!file->buffer_valid) return 0;
+
+	if(complete_writes(file,0,stoptime)<0) return -1;
+
+	struct chirp_client *client = table ? hash_table_lookup(table,file->host) : 0;
+	if(!client || file->stale || chirp_client_serial(client)!=file->serial) {
+		return chirp_reli_flush(file,stoptime);
+	}
+
+	struct chirp_client_request *r = chirp_client_pwrite_async(client,file->fd,file->buffer,file->buffer_valid,file->buffer_offset,stoptime);
+	if(!r) {
+		return chirp_reli_flush(file,stoptime);
+	}
+
+	struct chirp_write *w = xxmalloc(sizeof(*w));
+	w->offset = file->buffer_offset;
+	w->length = file->buffer_valid;
+	w->data = file->buffer;
+	w->client = client;
+	w->request = r;
+	list_push_tail(file->writes,w);
+	COUNT_STAT(file,writes_behind);
+
+	file->buffer = xxmalloc(file->blocksize);
+	file->buffer_valid = 0;
+	file->buffer_dirty = 0;
+	file->buffer_offset = 0;
+
+	return 0;
 }
 
 static INT64_T chirp_reli_pwrite_buffered( struct chirp_file *file, const void *data, INT64_T length, INT64_T offset, time_t stoptime )
 {
-	if(length>=chirp_reli_blocksize) {
+	blocks_invalidate(file,offset,length,stoptime);
+
+	if(length>=file->blocksize) {
 		if(chirp_reli_flush(file,stoptime)<0) {
 			return -1;
 		} else {
@@ -326,18 +716,18 @@ static INT64_T chirp_reli_pwrite_buffered( struct chirp_file *file, const void *
 
 	if(file->buffer_valid>0) {
 		if( (file->buffer_offset + file->buffer_valid) == offset ) {
-			INT64_T blength = MIN(chirp_reli_blocksize-file->buffer_valid,length);
+			INT64_T blength = MIN(file->blocksize-file->buffer_valid,length);
 			memcpy(&file->buffer[file->buffer_valid],data,blength);
 			file->buffer_valid += blength;
 			file->buffer_dirty = 1;
-			if(file->buffer_valid==chirp_reli_blocksize) {
-				if(chirp_reli_flush(file,stoptime)<0) {
+			if(file->buffer_valid==file->blocksize) {
+				if(write_behind(file,stoptime)<0) {
 					return -1;
 				}
 			}
 			return blength;
 		} else {
-			if(chirp_reli_flush(file,stoptime)<0) {
+			if(write_behind(file,stoptime)<0) {
 				return -1;
 			} else {
 				/* fall through */
@@ -386,6 +776,7 @@ INT64_T chirp_reli_sread( struct chirp_file *file, void *data, INT64_T length, I
 INT64_T chirp_reli_swrite( struct chirp_file *file, const void *data, INT64_T length, INT64_T stride_length, INT64_T stride_offset, INT64_T offset, time_t stoptime )
 {
 	chirp_reli_flush(file,stoptime);
+	blocks_invalidate(file,0,-1,stoptime);
 	RETRY_FILE( result = chirp_client_swrite(client,file->fd,data,length,stride_length,stride_offset,offset,stoptime); )
 }
 
@@ -416,6 +807,7 @@ INT64_T chirp_reli_fchmod( struct chirp_file *file, INT64_T mode, time_t stoptim
 INT64_T chirp_reli_ftruncate( struct chirp_file *file, INT64_T length, time_t stoptime )
 {
 	chirp_reli_flush(file,stoptime);
+	blocks_invalidate(file,0,-1,stoptime);
 	RETRY_FILE( result = chirp_client_ftruncate(client,file->fd,length,stoptime); )
 }
 
@@ -423,10 +815,10 @@ INT64_T chirp_reli_flush( struct chirp_file *file, time_t stoptime )
 {
 	INT64_T result;
 
-	if(file->buffer_valid && file->buffer_dirty) {
+	result = complete_writes(file,1,stoptime);
+
+	if(result>=0 && file->buffer_valid && file->buffer_dirty) {
 		result = chirp_reli_pwrite_unbuffered(file,file->buffer,file->buffer_valid,file->buffer_offset,stoptime);
-	} else {
-		result = 0;
 	}
 
 	file->buffer_valid = 0;
@@ -666,6 +1058,39 @@ INT64_T chirp_reli_access( const char *host, const char *path, INT64_T mode, tim
 	RETRY_ATOMIC( result = chirp_client_access(client,path,mode,stoptime); )
 }
 
+static INT64_T chirp_reli_bulkstat_all( const char *host, struct chirp_bulkstat *v, int count, time_t stoptime )
+{
+	RETRY_ATOMIC( result = chirp_client_bulkstat(client,v,count,stoptime); )
+}
+
+INT64_T chirp_reli_bulkstat( const char *host, struct chirp_bulkstat *v, int count, time_t stoptime )
+{
+	int i;
+	INT64_T result;
+
+	result = chirp_reli_bulkstat_all(host,v,count,stoptime);
+	if(result>=0 || errno!=ENOSYS) return result;
+
+	/* older servers do not know bulkstat, so perform each operation alone. */
+	debug(D_CHIRP,"%s does not support bulkstat, performing %d operations one by one",host,count);
+
+	for(i=0;i<count;i++) {
+		struct chirp_bulkstat *b = &v[i];
+		if(b->type==CHIRP_BULKSTAT_STAT) {
+			result = chirp_reli_stat(host,b->path,b->info,stoptime);
+		} else if(b->type==CHIRP_BULKSTAT_LSTAT) {
+			result = chirp_reli_lstat(host,b->path,b->info,stoptime);
+		} else {
+			result = chirp_reli_access(host,b->path,b->mode,stoptime);
+		}
+		if(result<0 && errno==ECONNRESET) return -1;
+		b->result = result;
+		b->errnum = result<0 ? errno : 0;
+	}
+
+	return count;
+}
+
 INT64_T chirp_reli_chmod( const char *host, const char *path, INT64_T mode, time_t stoptime )
 {
 	RETRY_ATOMIC( result = chirp_client_chmod(client,path,mode,stoptime); )
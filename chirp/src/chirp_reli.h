@@ -204,6 +204,8 @@ INT64_T chirp_reli_ftruncate(struct chirp_file *file, INT64_T length, time_t sto
 To improve performance, Chirp buffers small writes to files.
 These writes might not be forced to disk until a later write or a call to @ref chirp_reli_close.
 To force any buffered writes to disk, call this function.
+Buffered writes may be sent to the server before they are flushed, without waiting
+for the result, so an error in any of them is returned here or by @ref chirp_reli_close.
 @param file A chirp_file handle returned by chirp_reli_open.
 @param stoptime The absolute time at which to abort.
 @see chirp_reli_close
@@ -761,6 +763,21 @@ and writes simultaneously, whether against one or many files.
 
 INT64_T chirp_reli_bulkio(struct chirp_bulkio *list, int count, time_t stoptime);
 
+/** Perform multiple metadata operations in bulk.
+This operation sends a list of stat, lstat, and access operations on one server
+in a single request, and receives all of their results in a single reply.
+It is the most efficient way to examine many files at once, such as all of the
+entries of a directory.  If the server does not support bulk operations, they
+are performed one at a time.
+@param host The name and port of the Chirp server to access.
+@param list An array of @ref chirp_bulkstat structures, each describing one operation.
+@param count The number of entries in the list.
+@param stoptime The absolute time at which to abort.
+@return If the operations could be performed, returns greater than or equal to zero, and the result of each individual operation may be determined by examining the result and errnum fields set in each @ref chirp_bulkstat structure.  On failure, returns less than zero and sets errno.
+*/
+
+INT64_T chirp_reli_bulkstat(const char *host, struct chirp_bulkstat *list, int count, time_t stoptime);
+
 /** Return the current buffer block size.
 This module performs input and output buffering to improve the performance of small I/O operations.
 Operations larger than the buffer size are sent directly over the network, while those smaller are
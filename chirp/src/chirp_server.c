@@ -41,6 +41,7 @@
 #include "pattern.h"
 #include "random.h"
 #include "stringtools.h"
+#include "timestamp.h"
 #include "url_encode.h"
 #include "username.h"
 #include "uuid.h"
@@ -51,8 +52,12 @@
 #include <pwd.h>
 #include <unistd.h>
 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
 #include <sys/resource.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/utsname.h>
@@ -292,7 +297,7 @@ static void config_pipe_handler(int fd)
 	char flag[PIPE_BUF];
 	char subject[PIPE_BUF];
 	char address[PIPE_BUF];
-	UINT64_T ops, bytes_read, bytes_written;
+	UINT64_T ops, bytes_read, bytes_written, acl_hits, acl_misses;
 
 	while(1) {
 		fcntl(fd, F_SETFL, O_NONBLOCK);
@@ -309,8 +314,9 @@ static void config_pipe_handler(int fd)
 
 			if(sscanf(msg, "debug %s", flag) == 1) {
 				debug_flags_set(flag);
-			} else if(sscanf(msg, "stats %s %s %" SCNu64 " %" SCNu64 " %" SCNu64, address, subject, &ops, &bytes_read, &bytes_written) == 5) {
+			} else if(sscanf(msg, "stats %s %s %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64, address, subject, &ops, &bytes_read, &bytes_written, &acl_hits, &acl_misses) == 7) {
 				chirp_stats_collect(address, subject, ops, bytes_read, bytes_written);
+				chirp_stats_collect_acl_cache(acl_hits, acl_misses);
 			} else {
 				debug(D_NOTICE, "bad config message: %s\n", msg);
 			}
@@ -538,6 +544,98 @@ static INT64_T getvarstring (struct link *l, time_t stalltime, void *buffer, INT
  * in the server handling loop, we treat all integers as INT64_T. What the
  * operating system does from there is out of our hands.
  */
+static INT64_T do_stat(const char *path, const char *subject, struct chirp_stat *info)
+{
+	if(!chirp_acl_check(path, subject, CHIRP_ACL_LIST))
+		return -1;
+	return cfs->stat(path, info);
+}
+
+static INT64_T do_lstat(const char *path, const char *subject, struct chirp_stat *info)
+{
+	if(!chirp_acl_check_link(path, subject, CHIRP_ACL_LIST))
+		return -1;
+	return cfs->lstat(path, info);
+}
+
+static INT64_T do_access(const char *path, const char *subject, INT64_T flags)
+{
+	int chirp_flags = chirp_acl_from_access_flags(flags);
+	/* If filename is a directory, then we change execute flags to list flags. */
+	if(cfs_isdir(path) && (chirp_flags & CHIRP_ACL_EXECUTE)) {
+		chirp_flags ^= CHIRP_ACL_EXECUTE;	/* remove execute flag */
+		chirp_flags |= CHIRP_ACL_LIST;	/* change to list */
+	}
+	if(!chirp_acl_check(path, subject, chirp_flags))
+		return -1;
+	return cfs->access(path, flags);
+}
+
+/*
+Perform count stat, lstat, and access operations sent by the client after the
+bulkstat request. All of them are read before any result is sent, so that a
+client sending many does not block on a server sending results.
+*/
+
+static INT64_T bulkstat(struct link *l, const char *subject, INT64_T count, buffer_t *B, time_t stalltime)
+{
+	INT64_T i;
+	char **lines = xxcalloc(count, sizeof(*lines));
+
+	for(i = 0; i < count; i++) {
+		char line[CHIRP_LINE_MAX];
+		if(!link_readline(l, line, sizeof(line), stalltime))
+			break;
+		lines[i] = xxstrdup(line);
+	}
+
+	if(i < count) {
+		while(i > 0)
+			free(lines[--i]);
+		free(lines);
+		return -1;
+	}
+
+	for(i = 0; i < count; i++) {
+		char path[CHIRP_PATH_MAX];
+		struct chirp_stat info;
+		INT64_T flags;
+		INT64_T result;
+		int is_stat = 0;
+
+		if(sscanf(lines[i], "stat %s", path) == 1) {
+			path_fix(path);
+			result = do_stat(path, subject, &info);
+			is_stat = 1;
+		} else if(sscanf(lines[i], "lstat %s", path) == 1) {
+			path_fix(path);
+			result = do_lstat(path, subject, &info);
+			is_stat = 1;
+		} else if(sscanf(lines[i], "access %s %" SCNd64, path, &flags) == 2) {
+			path_fix(path);
+			result = do_access(path, subject, flags);
+		} else {
+			errno = EINVAL;
+			result = -1;
+		}
+
+		if(result < 0) {
+			buffer_putfstring(B, "%" PRId64 "\n", (INT64_T) errno_to_chirp(errno));
+		} else {
+			buffer_putfstring(B, "%" PRId64 "\n", result);
+			if(is_stat) {
+				chirp_stat_encode(B, &info);
+				buffer_putliteral(B, "\n");
+			}
+		}
+
+		free(lines[i]);
+	}
+	free(lines);
+
+	return link_putlstring(l, buffer_tostring(B), buffer_pos(B), stalltime);
+}
+
 static void chirp_handler(struct link *l, const char *addr, const char *subject)
 {
 	char *esubject;
@@ -1106,15 +1204,17 @@ static void chirp_handler(struct link *l, const char *addr, const char *subject)
 			}
 		} else if(sscanf(line, "access %s %" SCNd64, path, &flags) == 2) {
 			path_fix(path);
-			int chirp_flags = chirp_acl_from_access_flags(flags);
-			/* If filename is a directory, then we change execute flags to list flags. */
-			if(cfs_isdir(path) && (chirp_flags & CHIRP_ACL_EXECUTE)) {
-				chirp_flags ^= CHIRP_ACL_EXECUTE;	/* remove execute flag */
-				chirp_flags |= CHIRP_ACL_LIST;	/* change to list */
-			}
-			if(!chirp_acl_check(path, subject, chirp_flags))
+			result = do_access(path, subject, flags);
+		} else if(sscanf(line, "bulkstat %" SCNd64, &length) == 1) {
+			if(length < 0 || length > CHIRP_BULKSTAT_MAX) {
+				errno = EINVAL;
 				goto failure;
-			result = cfs->access(path, flags);
+			}
+			link_putliteral(l, "0\n", stalltime);
+			if(bulkstat(l, subject, length, B, stalltime) < 0)
+				goto die;
+			result = 0;
+			goto done;
 		} else if(sscanf(line, "chmod %s %" SCNd64, path, &mode) == 2) {
 			path_fix(path);
 			if(chirp_acl_check_dir(path, subject, CHIRP_ACL_WRITE) || chirp_acl_check(path, subject, CHIRP_ACL_WRITE)) {
@@ -1397,9 +1497,7 @@ static void chirp_handler(struct link *l, const char *addr, const char *subject)
 		} else if(sscanf(line, "stat %s", path) == 1) {
 			struct chirp_stat info;
 			path_fix(path);
-			if(!chirp_acl_check(path, subject, CHIRP_ACL_LIST))
-				goto failure;
-			result = cfs->stat(path, &info);
+			result = do_stat(path, subject, &info);
 			if (result >= 0) {
 				chirp_stat_encode(B, &info);
 				buffer_putliteral(B, "\n");
@@ -1407,9 +1505,7 @@ static void chirp_handler(struct link *l, const char *addr, const char *subject)
 		} else if(sscanf(line, "lstat %s", path) == 1) {
 			struct chirp_stat info;
 			path_fix(path);
-			if(!chirp_acl_check_link(path, subject, CHIRP_ACL_LIST))
-				goto failure;
-			result = cfs->lstat(path, &info);
+			result = do_lstat(path, subject, &info);
 			if (result >= 0) {
 				chirp_stat_encode(B, &info);
 				buffer_putliteral(B, "\n");
@@ -1688,7 +1784,10 @@ die:
 	free(buffer);
 }
 
-static void chirp_receive(struct link *link, char url[CHIRP_PATH_MAX])
+/* Authenticate the client on link with the current (server) authentication
+ * state and serve its requests. The backend authentication state is consumed.
+ */
+static void chirp_serve(struct link *link, struct auth_state *backend_state)
 {
 	char *atype, *asubject;
 	char typesubject[AUTH_TYPE_MAX + AUTH_SUBJECT_MAX];
@@ -1697,7 +1796,56 @@ static void chirp_receive(struct link *link, char url[CHIRP_PATH_MAX])
 
 	link_address_remote(link, addr, &port);
 
-	change_process_title("chirp_server [%s:%d] [backend starting]", addr, port, typesubject);
+	change_process_title("chirp_server [%s:%d] [authenticating]", addr, port);
+
+	auth_ticket_server_callback(chirp_acl_ticket_callback);
+
+	if(auth_accept(link, &atype, &asubject, time(0) + idle_timeout)) {
+		auth_replace(backend_state);
+
+		sprintf(typesubject, "%s:%s", atype, asubject);
+		free(atype);
+		free(asubject);
+
+		debug(D_LOGIN, "%s from %s:%d", typesubject, addr, port);
+
+		downgrade(); /* downgrade privileges after authentication */
+
+		/* See comment in chirp_receive concerning authentication. */
+		if (cfs != &chirp_fs_confuga) {
+			/* Enable only globus, hostname, and address authentication for third-party transfers. */
+			auth_clear();
+			if(auth_globus_has_delegated_credential()) {
+				auth_globus_use_delegated_credential(1);
+				auth_globus_register();
+			}
+			auth_hostname_register();
+			auth_address_register();
+		}
+
+		change_process_title("chirp_server [%s:%d] [%s]", addr, port, typesubject);
+
+		chirp_handler(link, addr, typesubject);
+		chirp_alloc_flush();
+		chirp_stats_report(config_pipe[1], addr, typesubject, 0);
+
+		debug(D_LOGIN, "disconnected");
+	} else {
+		auth_free(backend_state);
+		debug(D_LOGIN, "authentication failed from %s:%d", addr, port);
+	}
+
+	link_close(link);
+}
+
+static void chirp_receive(struct link *link, char url[CHIRP_PATH_MAX])
+{
+	char addr[LINK_ADDRESS_MAX];
+	int port;
+
+	link_address_remote(link, addr, &port);
+
+	change_process_title("chirp_server [%s:%d] [backend starting]", addr, port);
 
 	/* Authentication problems:
 	 *
@@ -1734,51 +1882,244 @@ static void chirp_receive(struct link *link, char url[CHIRP_PATH_MAX])
 	 */
 	backend_setup(url);
 
-	change_process_title("chirp_server [%s:%d] [authenticating]", addr, port, typesubject);
-
 	struct auth_state *backend_state = auth_clone();
 	auth_replace(server_state);
 
-	auth_ticket_server_callback(chirp_acl_ticket_callback);
+	chirp_serve(link, backend_state);
 
-	if(auth_accept(link, &atype, &asubject, time(0) + idle_timeout)) {
-		auth_replace(backend_state);
+	cfs->destroy();
+}
 
-		sprintf(typesubject, "%s:%s", atype, asubject);
-		free(atype);
-		free(asubject);
+/* Handler pool: instead of forking a process for each client, the server may
+ * keep a pool of handler processes, forked and with their backend set up
+ * before any client arrives. The parent accepts each connection, queues it
+ * until a handler is idle, and passes the socket to the handler over a unix
+ * socket pair. The handler writes one byte back when it is idle again. A
+ * handler that dropped its privileges to serve a client cannot authenticate
+ * the next one, so when running as root each handler serves one client and
+ * is then replaced.
+ */
+struct pool_handler {
+	pid_t pid;
+	int fd; /* parent end of the socket pair, -1 if the slot is empty. */
+	int busy;
+};
 
-		debug(D_LOGIN, "%s from %s:%d", typesubject, addr, port);
+struct pending_client {
+	struct link *link;
+	timestamp_t accepted;
+};
 
-		downgrade(); /* downgrade privileges after authentication */
+static struct pool_handler *pool = 0;
+static int pool_size = 0;
+static struct list *pending_clients = 0;
 
-		/* See above comment concerning authentication. */
-		if (cfs != &chirp_fs_confuga) {
-			/* Enable only globus, hostname, and address authentication for third-party transfers. */
-			auth_clear();
-			if(auth_globus_has_delegated_credential()) {
-				auth_globus_use_delegated_credential(1);
-				auth_globus_register();
+static int send_fd(int sock, int fd)
+{
+	char byte = 0;
+	struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+	union {
+		struct cmsghdr header;
+		char buffer[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buffer;
+	msg.msg_controllen = sizeof(control.buffer);
+
+	struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(c), &fd, sizeof(int));
+
+	ssize_t result;
+	do {
+		result = sendmsg(sock, &msg, 0);
+	} while(result < 0 && errno == EINTR);
+
+	return result == 1;
+}
+
+/* Returns the descriptor received, or -1 if the parent went away. */
+static int recv_fd(int sock)
+{
+	char byte;
+	struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+	union {
+		struct cmsghdr header;
+		char buffer[CMSG_SPACE(sizeof(int))];
+	} control;
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buffer;
+	msg.msg_controllen = sizeof(control.buffer);
+
+	ssize_t result;
+	do {
+		result = recvmsg(sock, &msg, 0);
+	} while(result < 0 && errno == EINTR);
+
+	if(result != 1)
+		return -1;
+
+	struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+	if(!c || c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+		return -1;
+
+	int fd;
+	memcpy(&fd, CMSG_DATA(c), sizeof(int));
+	return fd;
+}
+
+/* Make a saved authentication state current, and return a fresh copy of it. */
+static struct auth_state *auth_restore(struct auth_state *saved)
+{
+	auth_replace(saved);
+	free(saved);
+	return auth_clone();
+}
+
+static void pool_handler_run(int sock, char url[CHIRP_PATH_MAX])
+{
+	change_process_title("chirp_server [backend starting]");
+
+	/* See chirp_receive concerning the two authentication states. */
+	struct auth_state *server_state = auth_clone();
+	backend_setup(url);
+	struct auth_state *backend_state = auth_clone();
+	server_state = auth_restore(server_state);
+
+	while(1) {
+		change_process_title("chirp_server [idle]");
+
+		int fd = recv_fd(sock);
+		if(fd < 0)
+			break;
+
+		struct link *l = link_attach(fd);
+		if(!l) {
+			close(fd);
+		} else {
+			backend_state = auth_restore(backend_state);
+			struct auth_state *client_backend_state = auth_clone();
+			server_state = auth_restore(server_state);
+
+			chirp_serve(l, client_backend_state);
+
+			/* The next client must not inherit the files this one left open. */
+			int i;
+			char path[CHIRP_PATH_MAX];
+			for(i = 0; i < CHIRP_FILESYSTEM_MAXFD; i++) {
+				if(cfs->fname(i, path) == 0)
+					cfs->close(i);
 			}
-			auth_hostname_register();
-			auth_address_register();
 		}
 
-		change_process_title("chirp_server [%s:%d] [%s]", addr, port, typesubject);
+		if(safe_username)
+			break;
 
-		chirp_handler(link, addr, typesubject);
-		chirp_alloc_flush();
-		chirp_stats_report(config_pipe[1], addr, typesubject, 0);
+		char byte = 0;
+		if(write(sock, &byte, 1) != 1)
+			break;
+	}
 
-		debug(D_LOGIN, "disconnected");
+	cfs->destroy();
+}
+
+static void pool_start_handler(int slot, struct link *listen_link)
+{
+	int fds[2];
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		debug(D_PROCESS, "couldn't create socket pair: %s", strerror(errno));
+		return;
+	}
+
+	pid_t pid = fork();
+	if(pid == 0) {
+		int i;
+		for(i = 0; i < pool_size; i++) {
+			if(pool[i].fd >= 0)
+				close(pool[i].fd);
+		}
+		close(fds[0]);
+		link_close(listen_link);
+		close(config_pipe[0]);
+		config_pipe[0] = -1;
+		pool_handler_run(fds[1], chirp_url);
+		_exit(0);
+	} else if(pid > 0) {
+		close(fds[1]);
+		pool[slot].pid = pid;
+		pool[slot].fd = fds[0];
+		pool[slot].busy = 0;
+		debug(D_PROCESS, "created handler pid %d", pid);
 	} else {
-		auth_free(backend_state);
-		debug(D_LOGIN, "authentication failed from %s:%d", addr, port);
+		debug(D_PROCESS, "couldn't fork: %s", strerror(errno));
+		close(fds[0]);
+		close(fds[1]);
 	}
+}
 
-	link_close(link);
+static void pool_handler_exited(pid_t pid)
+{
+	int i;
+	for(i = 0; i < pool_size; i++) {
+		if(pool[i].pid == pid) {
+			if(pool[i].fd >= 0)
+				close(pool[i].fd);
+			pool[i].pid = 0;
+			pool[i].fd = -1;
+			pool[i].busy = 0;
+		}
+	}
+}
 
-	cfs->destroy();
+/* Hand queued clients to idle handlers. */
+static void pool_dispatch(void)
+{
+	int i;
+
+	for(i = 0; i < pool_size && list_size(pending_clients) > 0; i++) {
+		if(pool[i].fd < 0 || pool[i].busy)
+			continue;
+
+		struct pending_client *p = list_pop_head(pending_clients);
+		if(send_fd(pool[i].fd, link_fd(p->link))) {
+			pool[i].busy = 1;
+			chirp_stats_accept(timestamp_get() - p->accepted);
+			link_close(p->link);
+			free(p);
+		} else {
+			debug(D_PROCESS, "couldn't pass connection to handler %d: %s", pool[i].pid, strerror(errno));
+			list_push_head(pending_clients, p);
+			close(pool[i].fd);
+			pool[i].fd = -1;
+		}
+	}
+}
+
+/* The number of connections waiting for a handler, including those the kernel has not yet given to accept. */
+static int accept_queue_depth(struct link *listen_link)
+{
+	int depth = pending_clients ? list_size(pending_clients) : 0;
+#if defined(__linux__) && defined(TCP_INFO)
+	struct tcp_info info;
+	socklen_t length = sizeof(info);
+	if(getsockopt(link_fd(listen_link), IPPROTO_TCP, TCP_INFO, &info, &length) == 0) {
+		/* on a listening socket, tcpi_unacked is the length of the accept queue. */
+		depth += info.tcpi_unacked;
+	}
+#endif
+	return depth;
 }
 
 void killeveryone (int sig)
@@ -1872,6 +2213,7 @@ static void show_help(const char *cmd)
 	fprintf(stdout, " %-30s Rotate debug file once it reaches this size.\n", "-O,--debug-rotate-max=<bytes>");
 	fprintf(stdout, " %-30s Superuser for all directories. (default: none)\n", "-P,--superuser=<user>");
 	fprintf(stdout, " %-30s Listen on this port. (default: %d; arbitrary: 0)\n", "-p,--port=<port>", chirp_port);
+	fprintf(stdout, " %-30s Serve clients from this many pre-forked handlers, queueing the rest. (default: fork per client)\n", "   --pool-size=<count>");
 	fprintf(stdout, " %-30s Project this Chirp server belongs to.\n", "   --project-name=<name>");
 	fprintf(stdout, " %-30s Enforce this root quota in software.\n", "-Q,--root-quota=<size>");
 	fprintf(stdout, " %-30s Read-only mode.\n", "-R,--read-only");
@@ -1898,6 +2240,7 @@ int main(int argc, char *argv[])
 		LONGOPT_JOB_TIME_LIMIT                   = INT_MAX-2,
 		LONGOPT_INHERIT_DEFAULT_ACL              = INT_MAX-3,
 		LONGOPT_PROJECT_NAME                     = INT_MAX-4,
+		LONGOPT_POOL_SIZE                        = INT_MAX-5,
 	};
 
 	static const struct option long_options[] = {
@@ -1927,6 +2270,7 @@ int main(int argc, char *argv[])
 		{"parent-death", no_argument, 0, 'E'},
 		{"passwd", required_argument, 0, 'W'},
 		{"pid-file", required_argument, 0, 'B'},
+		{"pool-size", required_argument, 0, LONGOPT_POOL_SIZE},
 		{"port", required_argument, 0, 'p'},
 		{"port-file", required_argument, 0, 'Z'},
 		{"project-name", required_argument, 0, LONGOPT_PROJECT_NAME},
@@ -2104,6 +2448,9 @@ int main(int argc, char *argv[])
 		case LONGOPT_PROJECT_NAME:
 			strncpy(chirp_project_name, optarg, sizeof(chirp_project_name)-1);
 			break;
+		case LONGOPT_POOL_SIZE:
+			pool_size = atoi(optarg);
+			break;
 		case 'h':
 		default:
 			show_help(argv[0]);
@@ -2190,6 +2537,10 @@ int main(int argc, char *argv[])
 
 	cfs = cfs_lookup(chirp_url);
 
+	if(root_quota > 0 && chirp_alloc_shared_init() == -1) {
+		debug(D_NOTICE, "couldn't share allocations between processes, locking them instead: %s", strerror(errno));
+	}
+
 	if(run_in_child_process(backend_bootstrap, chirp_url, "backend bootstrap") != 0) {
 		fatal("couldn't setup %s", chirp_url);
 	}
@@ -2254,6 +2605,14 @@ int main(int argc, char *argv[])
 		fatal("could not start scheduler");
 	}
 
+	if(pool_size > 0) {
+		int i;
+		pool = xxcalloc(pool_size, sizeof(*pool));
+		for(i = 0; i < pool_size; i++)
+			pool[i].fd = -1;
+		pending_clients = list_create();
+	}
+
 	while(1) {
 		pid_t pid;
 		int status;
@@ -2270,8 +2629,24 @@ int main(int argc, char *argv[])
 				debug(D_PROCESS, "pid %d failed due to signal %d (%s) (%d total child procs)", pid, WTERMSIG(status), string_signal(WTERMSIG(status)), total_child_procs);
 			else assert(0);
 			total_child_procs--;
+			if(pool)
+				pool_handler_exited(pid);
+		}
+
+		if(pool) {
+			int i;
+			for(i = 0; i < pool_size; i++) {
+				if(pool[i].pid == 0) {
+					pool_start_handler(i, link);
+					if(pool[i].pid > 0)
+						total_child_procs++;
+				}
+			}
+			pool_dispatch();
 		}
 
+		chirp_stats_queue(accept_queue_depth(link));
+
 		if(time(0) >= advertise_alarm) {
 			run_in_child_process(update_all_catalogs, chirp_url, "catalog update");
 			advertise_alarm = time(0) + advertise_timeout;
@@ -2286,13 +2661,29 @@ int main(int argc, char *argv[])
 		/* Wait for action on one of two ports: the master TCP port, or the internal pipe. */
 		/* If the limit of child procs has been reached, don't watch the TCP port. */
 
+		/* With a handler pool, also watch the handlers. Clients waiting for a handler count toward the limit. */
+
 		fd_set rfds;
 		FD_ZERO(&rfds);
 		FD_SET(config_pipe[0], &rfds);
-		if(max_child_procs == 0 || total_child_procs < max_child_procs) {
+		int maxfd = MAX(link_fd(link), config_pipe[0]) + 1;
+		if(pool) {
+			int i;
+			int clients = list_size(pending_clients);
+			for(i = 0; i < pool_size; i++) {
+				if(pool[i].fd >= 0) {
+					FD_SET(pool[i].fd, &rfds);
+					maxfd = MAX(maxfd, pool[i].fd + 1);
+				}
+				if(pool[i].busy)
+					clients++;
+			}
+			if(max_child_procs == 0 || clients < max_child_procs) {
+				FD_SET(link_fd(link), &rfds);
+			}
+		} else if(max_child_procs == 0 || total_child_procs < max_child_procs) {
 			FD_SET(link_fd(link), &rfds);
 		}
-		int maxfd = MAX(link_fd(link), config_pipe[0]) + 1;
 
 		/* Wait for activity on the listening port or the config pipe */
 		struct timeval timeout = {.tv_sec = 1};
@@ -2308,8 +2699,19 @@ int main(int argc, char *argv[])
 			if(!l)
 				continue;
 
+			timestamp_t accepted = timestamp_get();
+
 			link_address_remote(l, addr, &port);
 
+			if(pool) {
+				struct pending_client *p = xxmalloc(sizeof(*p));
+				p->link = l;
+				p->accepted = accepted;
+				list_push_tail(pending_clients, p);
+				pool_dispatch();
+				continue;
+			}
+
 			pid = fork();
 			if(pid == 0) {
 				link_close(link);
@@ -2319,6 +2721,7 @@ int main(int argc, char *argv[])
 				_exit(0);
 			} else if(pid > 0) {
 				total_child_procs++;
+				chirp_stats_accept(timestamp_get() - accepted);
 				debug(D_PROCESS, "created pid %d (%d total child procs)", pid, total_child_procs);
 			} else {
 				debug(D_PROCESS, "couldn't fork: %s", strerror(errno));
@@ -2331,6 +2734,24 @@ int main(int argc, char *argv[])
 		if(FD_ISSET(config_pipe[0], &rfds)) {
 			config_pipe_handler(config_pipe[0]);
 		}
+
+		/* A handler writes one byte when it is idle again, or closes its end when it exits. */
+
+		if(pool) {
+			int i;
+			for(i = 0; i < pool_size; i++) {
+				if(pool[i].fd >= 0 && FD_ISSET(pool[i].fd, &rfds)) {
+					char byte;
+					if(read(pool[i].fd, &byte, 1) == 1) {
+						pool[i].busy = 0;
+					} else {
+						close(pool[i].fd);
+						pool[i].fd = -1;
+					}
+				}
+			}
+			pool_dispatch();
+		}
 	}
 }
 
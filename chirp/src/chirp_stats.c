@@ -5,12 +5,14 @@ See the file COPYING for details.
 */
 
 #include "chirp_stats.h"
+#include "chirp_acl.h"
 
 #include "debug.h"
 #include "xxmalloc.h"
 #include "hash_table.h"
 #include "link.h"
 #include "jx.h"
+#include "macros.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -24,6 +26,17 @@ static UINT64_T total_ops = 0;
 static UINT64_T total_bytes_read = 0;
 static UINT64_T total_bytes_written = 0;
 
+/* connections handed to handlers, and how long they waited, since the last cleanup. */
+static UINT64_T accept_count = 0;
+static UINT64_T accept_latency_total = 0;
+static UINT64_T accept_latency_max = 0;
+static int queue_depth = 0;
+static int queue_depth_max = 0;
+
+/* lookups of the acl caches of all handlers, since the server started. */
+static UINT64_T acl_cache_hits = 0;
+static UINT64_T acl_cache_misses = 0;
+
 struct chirp_stats {
 	char addr[LINK_ADDRESS_MAX];
 	UINT64_T ops;
@@ -55,6 +68,12 @@ void chirp_stats_collect(const char *addr, const char *subject, UINT64_T ops, UI
 	total_bytes_written += bytes_written;
 }
 
+void chirp_stats_collect_acl_cache(UINT64_T hits, UINT64_T misses)
+{
+	acl_cache_hits += hits;
+	acl_cache_misses += misses;
+}
+
 void chirp_stats_summary( struct jx *j )
 {
 	char *addr;
@@ -67,6 +86,14 @@ void chirp_stats_summary( struct jx *j )
 	jx_insert_integer(j,"bytes_read",total_bytes_read);
 	jx_insert_integer(j,"total_ops",total_ops);
 
+	jx_insert_integer(j,"accepts",accept_count);
+	jx_insert_integer(j,"accept_latency",accept_count ? accept_latency_total/accept_count : 0);
+	jx_insert_integer(j,"accept_latency_max",accept_latency_max);
+	jx_insert_integer(j,"queue_depth",queue_depth);
+	jx_insert_integer(j,"queue_depth_max",queue_depth_max);
+	jx_insert_integer(j,"acl_cache_hits",acl_cache_hits);
+	jx_insert_integer(j,"acl_cache_misses",acl_cache_misses);
+
 	struct jx *arr = jx_array(0);
 
 	hash_table_firstkey(stats_table);
@@ -96,12 +123,32 @@ void chirp_stats_cleanup()
 		hash_table_remove(stats_table, addr);
 		free(s);
 	}
+
+	accept_count = 0;
+	accept_latency_total = 0;
+	accept_latency_max = 0;
+	queue_depth_max = queue_depth;
+}
+
+void chirp_stats_accept(UINT64_T latency)
+{
+	accept_count++;
+	accept_latency_total += latency;
+	accept_latency_max = MAX(accept_latency_max, latency);
+}
+
+void chirp_stats_queue(int depth)
+{
+	queue_depth = depth;
+	queue_depth_max = MAX(queue_depth_max, depth);
 }
 
 static UINT64_T child_ops = 0;
 static UINT64_T child_bytes_read = 0;
 static UINT64_T child_bytes_written = 0;
 static time_t child_report_time = 0;
+static UINT64_T child_acl_cache_hits = 0;
+static UINT64_T child_acl_cache_misses = 0;
 
 void chirp_stats_update(UINT64_T ops, UINT64_T bytes_read, UINT64_T bytes_written)
 {
@@ -115,10 +162,14 @@ void chirp_stats_report(int pipefd, const char *addr, const char *subject, int i
 	char line[PIPE_BUF];
 
 	if(time(0) - child_report_time > interval) {
-		snprintf(line, PIPE_BUF, "stats %s %s %" PRId64 " %" PRId64 " %" PRId64 "\n", addr, subject, child_ops, child_bytes_read, child_bytes_written);
+		UINT64_T hits, misses;
+		chirp_acl_cache_stats(&hits, &misses);
+		snprintf(line, PIPE_BUF, "stats %s %s %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64 "\n", addr, subject, child_ops, child_bytes_read, child_bytes_written, hits - child_acl_cache_hits, misses - child_acl_cache_misses);
 		write(pipefd, line, strlen(line));
 		debug(D_DEBUG, "sending stats: %s", line);
 		child_ops = child_bytes_read = child_bytes_written = 0;
+		child_acl_cache_hits = hits;
+		child_acl_cache_misses = misses;
 		child_report_time = time(0);
 	}
 }
@@ -11,9 +11,14 @@ See the file COPYING for details.
 #include "int_sizes.h"
 
 void chirp_stats_collect( const char *addr, const char *subject, UINT64_T ops, UINT64_T bytes_read, UINT64_T bytes_written );
+void chirp_stats_collect_acl_cache( UINT64_T hits, UINT64_T misses );
 void chirp_stats_summary( struct jx *j );
 void chirp_stats_cleanup();
 
+/* Record that a connection waited latency microseconds between its accept and its handler, and the number of connections waiting now. */
+void chirp_stats_accept( UINT64_T latency );
+void chirp_stats_queue( int depth );
+
 void chirp_stats_update( UINT64_T ops, UINT64_T bytes_read, UINT64_T bytes_written );
 void chirp_stats_report( int pipefd, const char *addr, const char *subject, int interval );
 
@@ -0,0 +1,613 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "chirp_stripe.h"
+#include "chirp_client.h"
+#include "chirp_protocol.h"
+#include "chirp_reli.h"
+
+#include "debug.h"
+#include "full_io.h"
+#include "link.h"
+#include "list.h"
+#include "macros.h"
+#include "timestamp.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+/*
+The parent hands out chunks to the workers over pipes, one line per chunk
+giving its offset and length, and each worker answers with one line per chunk
+giving its offset, result, and errno.  Each worker has up to STRIPE_DEPTH
+chunks at once, so that its connection is not idle while it reports one chunk
+and waits for the next.  Chunks of a worker that fails are handed to the
+others.
+
+With automatic tuning, the transfer starts with one stream and adds one more
+every STRIPE_WINDOW for as long as doing so raised the throughput by at least
+STRIPE_GAIN.  The chunk size is doubled while chunks complete very quickly,
+to spend less time per request, and halved when they are slow, to keep the
+streams evenly loaded.
+*/
+
+#define STRIPE_CHUNK_MIN (256*1024)
+#define STRIPE_CHUNK_START (1024*1024)
+#define STRIPE_CHUNK_MAX (8*1024*1024)
+#define STRIPE_CHUNK_FAST 200000
+#define STRIPE_CHUNK_SLOW 2000000
+#define STRIPE_DEPTH 2
+#define STRIPE_WINDOW 1000000
+#define STRIPE_GAIN 1.1
+#define STRIPE_RETRIES_MAX 8
+
+typedef enum {
+	STRIPE_GET,
+	STRIPE_PUT
+} stripe_direction_t;
+
+struct chunk {
+	INT64_T offset;
+	INT64_T length;
+};
+
+struct worker {
+	pid_t pid;
+	struct link *to;
+	struct link *from;
+	struct list *chunks;
+	timestamp_t last_done;
+	int failed;
+};
+
+struct stripe {
+	stripe_direction_t direction;
+	const char *host;
+	const char *path;
+	int localfd;
+	INT64_T size;
+	INT64_T next_offset;
+	INT64_T chunk_size;
+	INT64_T bytes_done;
+	struct list *retry;
+	struct worker *workers[CHIRP_STRIPE_STREAMS_MAX];
+	int nworkers;
+	int max_streams;
+	int growing;
+	double best_rate;
+	timestamp_t window_start;
+	INT64_T window_bytes;
+	int failures;
+	int error;
+	struct chirp_stripe_stats stats;
+	time_t stoptime;
+};
+
+static void worker_report(struct link *out, INT64_T offset, INT64_T result, int errnum, time_t stoptime)
+{
+	link_putfstring(out, "%" PRId64 " %" PRId64 " %d\n", stoptime, offset, result, errnum);
+}
+
+/* Complete a chunk that the server transferred only in part. */
+
+static INT64_T worker_finish_chunk(struct stripe *s, struct chirp_client *c, INT64_T fd, char *buffer, struct chunk *k, INT64_T result)
+{
+	while(result >= 0 && result < k->length) {
+		INT64_T n;
+		if(s->direction == STRIPE_GET) {
+			n = chirp_client_pread(c, fd, buffer + result, k->length - result, k->offset + result, s->stoptime);
+		} else {
+			n = chirp_client_pwrite(c, fd, buffer + result, k->length - result, k->offset + result, s->stoptime);
+		}
+		if(n < 0)
+			return -1;
+		if(n == 0) {
+			/* the remote file is shorter than when the transfer started. */
+			errno = EIO;
+			return -1;
+		}
+		result += n;
+	}
+
+	if(result >= 0 && s->direction == STRIPE_GET) {
+		if(full_pwrite(s->localfd, buffer, k->length, k->offset) != k->length)
+			return -1;
+	}
+
+	return result;
+}
+
+static void worker_run(struct stripe *s, struct link *in, struct link *out)
+{
+	struct chirp_client *c;
+	struct chirp_stat info;
+	INT64_T fd = -1;
+
+	struct chunk chunks[STRIPE_DEPTH];
+	char *buffers[STRIPE_DEPTH];
+	struct chirp_client_request *requests[STRIPE_DEPTH];
+	int head = 0;
+	int count = 0;
+	int i;
+
+	for(i = 0; i < STRIPE_DEPTH; i++)
+		buffers[i] = 0;
+
+	c = chirp_client_connect(s->host, 1, s->stoptime);
+	if(c)
+		fd = chirp_client_open(c, s->path, s->direction == STRIPE_GET ? O_RDONLY : O_WRONLY, 0, &info, s->stoptime);
+
+	if(fd < 0) {
+		worker_report(out, -1, -1, errno, s->stoptime);
+		_exit(1);
+	}
+
+	while(1) {
+		/* take another chunk if there is room, but wait for one only if nothing is in flight. */
+		if(count < STRIPE_DEPTH) {
+			struct link_info li;
+			li.link = in;
+			li.events = LINK_READ;
+			li.revents = 0;
+			if(count == 0 || link_poll(&li, 1, 0) > 0) {
+				char line[CHIRP_LINE_MAX];
+				if(!link_readline(in, line, sizeof(line), s->stoptime))
+					break;
+
+				i = (head + count) % STRIPE_DEPTH;
+				struct chunk *k = &chunks[i];
+				if(sscanf(line, "%" SCNd64 " %" SCNd64, &k->offset, &k->length) != 2)
+					break;
+				buffers[i] = xxrealloc(buffers[i], k->length);
+
+				if(s->direction == STRIPE_GET) {
+					requests[i] = chirp_client_pread_async(c, fd, buffers[i], k->length, k->offset, s->stoptime);
+				} else if(full_pread(s->localfd, buffers[i], k->length, k->offset) == k->length) {
+					requests[i] = chirp_client_pwrite_async(c, fd, buffers[i], k->length, k->offset, s->stoptime);
+				} else {
+					if(errno == 0)
+						errno = EIO;
+					requests[i] = 0;
+				}
+
+				if(!requests[i]) {
+					worker_report(out, k->offset, -1, errno, s->stoptime);
+					_exit(1);
+				}
+
+				count++;
+				continue;
+			}
+		}
+
+		i = head;
+		INT64_T result = chirp_client_request_wait(c, requests[i], s->stoptime);
+		result = worker_finish_chunk(s, c, fd, buffers[i], &chunks[i], result);
+		worker_report(out, chunks[i].offset, result, result < 0 ? errno : 0, s->stoptime);
+		if(result < 0)
+			_exit(1);
+
+		head = (head + 1) % STRIPE_DEPTH;
+		count--;
+	}
+
+	chirp_client_close(c, fd, s->stoptime);
+	chirp_client_disconnect(c);
+	_exit(0);
+}
+
+static int worker_start(struct stripe *s)
+{
+	int to[2], from[2];
+	int i;
+
+	if(pipe(to) < 0)
+		return 0;
+	if(pipe(from) < 0) {
+		close(to[0]);
+		close(to[1]);
+		return 0;
+	}
+
+	pid_t pid = fork();
+	if(pid == 0) {
+		/* the other workers must see the end of their pipes when the parent closes them. */
+		for(i = 0; i < s->nworkers; i++) {
+			link_close(s->workers[i]->to);
+			link_close(s->workers[i]->from);
+		}
+		close(to[1]);
+		close(from[0]);
+		worker_run(s, link_attach_to_fd(to[0]), link_attach_to_fd(from[1]));
+	}
+
+	close(to[0]);
+	close(from[1]);
+
+	if(pid < 0) {
+		close(to[1]);
+		close(from[0]);
+		return 0;
+	}
+
+	struct worker *w = xxcalloc(1, sizeof(*w));
+	w->pid = pid;
+	w->to = link_attach_to_fd(to[1]);
+	w->from = link_attach_to_fd(from[0]);
+	w->chunks = list_create();
+	s->workers[s->nworkers++] = w;
+	s->stats.streams = MAX(s->stats.streams, s->nworkers);
+
+	debug(D_CHIRP, "stripe: started stream %d to %s", s->nworkers, s->host);
+
+	return 1;
+}
+
+static void worker_stop(struct stripe *s, struct worker *w)
+{
+	struct chunk *k;
+	int status;
+
+	while((k = list_pop_head(w->chunks)))
+		list_push_tail(s->retry, k);
+	list_delete(w->chunks);
+
+	link_close(w->to);
+	link_close(w->from);
+
+	if(w->failed)
+		kill(w->pid, SIGKILL);
+	waitpid(w->pid, &status, 0);
+
+	free(w);
+}
+
+static int next_chunk(struct stripe *s, struct chunk **k)
+{
+	*k = list_pop_head(s->retry);
+	if(*k)
+		return 1;
+
+	if(s->next_offset >= s->size)
+		return 0;
+
+	*k = xxmalloc(sizeof(**k));
+	(*k)->offset = s->next_offset;
+	(*k)->length = MIN(s->chunk_size, s->size - s->next_offset);
+	s->next_offset += (*k)->length;
+
+	return 1;
+}
+
+static void worker_fill(struct stripe *s, struct worker *w)
+{
+	struct chunk *k;
+
+	while(!w->failed && list_size(w->chunks) < STRIPE_DEPTH && next_chunk(s, &k)) {
+		list_push_tail(w->chunks, k);
+		if(link_putfstring(w->to, "%" PRId64 " %" PRId64 "\n", s->stoptime, k->offset, k->length) < 0)
+			w->failed = 1;
+	}
+}
+
+static int error_is_fatal(int errnum)
+{
+	switch (errnum) {
+	case ENOENT:
+	case EACCES:
+	case EPERM:
+	case EISDIR:
+	case ENOSPC:
+	case EDQUOT:
+	case EFBIG:
+	case EIO:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+static void worker_fail(struct stripe *s, struct worker *w, int errnum)
+{
+	debug(D_CHIRP, "stripe: stream to %s failed: %s", s->host, strerror(errnum));
+
+	w->failed = 1;
+	s->failures++;
+
+	if(error_is_fatal(errnum) || s->failures > STRIPE_RETRIES_MAX)
+		s->error = errnum ? errnum : ECONNRESET;
+}
+
+static void chunk_done(struct stripe *s, struct worker *w, INT64_T offset, INT64_T result, int errnum)
+{
+	struct chunk *k = list_peek_head(w->chunks);
+
+	if(result < 0 || !k || k->offset != offset || k->length != result) {
+		worker_fail(s, w, result < 0 ? errnum : EIO);
+		return;
+	}
+
+	list_pop_head(w->chunks);
+	s->bytes_done += k->length;
+	free(k);
+
+	timestamp_t now = timestamp_get();
+	if(w->last_done) {
+		timestamp_t interval = now - w->last_done;
+		if(interval < STRIPE_CHUNK_FAST && s->chunk_size < STRIPE_CHUNK_MAX) {
+			s->chunk_size *= 2;
+		} else if(interval > STRIPE_CHUNK_SLOW && s->chunk_size > STRIPE_CHUNK_MIN) {
+			s->chunk_size /= 2;
+		}
+	}
+	w->last_done = now;
+
+	worker_fill(s, w);
+}
+
+static void autotune(struct stripe *s)
+{
+	timestamp_t now = timestamp_get();
+	timestamp_t elapsed = now - s->window_start;
+
+	if(elapsed < STRIPE_WINDOW)
+		return;
+
+	double rate = (s->bytes_done - s->window_bytes) / (elapsed / 1000000.0);
+
+	if(s->growing && s->nworkers < s->max_streams && s->next_offset < s->size) {
+		if(rate > s->best_rate * STRIPE_GAIN) {
+			s->best_rate = rate;
+			if(worker_start(s))
+				worker_fill(s, s->workers[s->nworkers - 1]);
+		} else {
+			debug(D_CHIRP, "stripe: settled on %d streams at %.0f bytes/s", s->nworkers, rate);
+			s->growing = 0;
+		}
+	}
+
+	s->window_start = now;
+	s->window_bytes = s->bytes_done;
+}
+
+int chirp_stripe_streams_parse(const char *str)
+{
+	char *end;
+	long n;
+
+	if(!strcmp(str, "auto"))
+		return 0;
+
+	errno = 0;
+	n = strtol(str, &end, 10);
+	if(errno || end == str || *end || n < 1)
+		return -1;
+	if(n > CHIRP_STRIPE_STREAMS_MAX) {
+		warn(D_NOTICE, "%ld streams requested, using the maximum of %d", n, CHIRP_STRIPE_STREAMS_MAX);
+		n = CHIRP_STRIPE_STREAMS_MAX;
+	}
+	return n;
+}
+
+static INT64_T stripe_run(struct stripe *s, int streams, struct chirp_stripe_stats *stats)
+{
+	struct link_info links[CHIRP_STRIPE_STREAMS_MAX];
+	struct chunk *k;
+	timestamp_t start = timestamp_get();
+	int i, n;
+
+	s->next_offset = 0;
+	s->bytes_done = 0;
+	s->chunk_size = STRIPE_CHUNK_START;
+	s->retry = list_create();
+	s->nworkers = 0;
+	s->failures = 0;
+	s->error = 0;
+	s->growing = streams == 0;
+	s->max_streams = streams ? MIN(streams, CHIRP_STRIPE_STREAMS_MAX) : CHIRP_STRIPE_STREAMS_MAX;
+	s->best_rate = 0;
+	s->window_start = start;
+	s->window_bytes = 0;
+	memset(&s->stats, 0, sizeof(s->stats));
+
+	/* a small file needs no more streams than it has chunks. */
+	n = streams ? s->max_streams : 1;
+	n = MIN(n, (s->size + s->chunk_size - 1) / s->chunk_size);
+	for(i = 0; i < n; i++) {
+		if(!worker_start(s))
+			break;
+	}
+
+	if(n > 0 && s->nworkers == 0)
+		s->error = errno;
+
+	for(i = 0; i < s->nworkers; i++)
+		worker_fill(s, s->workers[i]);
+
+	while(!s->error && s->bytes_done < s->size) {
+		if(time(0) >= s->stoptime) {
+			s->error = ETIMEDOUT;
+			break;
+		}
+
+		for(i = 0; i < s->nworkers; i++) {
+			links[i].link = s->workers[i]->from;
+			links[i].events = LINK_READ;
+			links[i].revents = 0;
+		}
+
+		link_poll(links, s->nworkers, 1000);
+
+		for(i = 0; i < s->nworkers; i++) {
+			struct worker *w = s->workers[i];
+			if(!(links[i].revents & LINK_READ))
+				continue;
+
+			/* a worker may have sent several results at once. */
+			do {
+				char line[CHIRP_LINE_MAX];
+				INT64_T offset, result;
+				int errnum;
+
+				if(!link_readline(w->from, line, sizeof(line), s->stoptime)) {
+					worker_fail(s, w, ECONNRESET);
+				} else if(sscanf(line, "%" SCNd64 " %" SCNd64 " %d", &offset, &result, &errnum) != 3) {
+					worker_fail(s, w, ECONNRESET);
+				} else {
+					chunk_done(s, w, offset, result, errnum);
+				}
+			} while(!w->failed && !link_buffer_empty(w->from));
+		}
+
+		/* replace the workers that failed, and give their chunks to the others. */
+		for(i = 0; i < s->nworkers;) {
+			if(s->workers[i]->failed) {
+				worker_stop(s, s->workers[i]);
+				s->workers[i] = s->workers[--s->nworkers];
+				s->stats.retries++;
+				if(!s->error && worker_start(s))
+					worker_fill(s, s->workers[s->nworkers - 1]);
+			} else {
+				i++;
+			}
+		}
+
+		if(!s->error && s->nworkers == 0)
+			s->error = ECONNRESET;
+
+		for(i = 0; i < s->nworkers; i++)
+			worker_fill(s, s->workers[i]);
+
+		autotune(s);
+	}
+
+	while(s->nworkers > 0)
+		worker_stop(s, s->workers[--s->nworkers]);
+
+	while((k = list_pop_head(s->retry)))
+		free(k);
+	list_delete(s->retry);
+
+	s->stats.bytes = s->bytes_done;
+	s->stats.seconds = (timestamp_get() - start) / 1000000.0;
+	s->stats.chunk_size = s->chunk_size;
+	if(stats)
+		*stats = s->stats;
+
+	if(s->error) {
+		errno = s->error;
+		return -1;
+	}
+
+	return s->bytes_done;
+}
+
+INT64_T chirp_stripe_get(const char *host, const char *source_file, const char *target_file, int streams, struct chirp_stripe_stats *stats, time_t stoptime)
+{
+	struct stripe s;
+	struct chirp_stat info;
+	INT64_T result;
+
+	if(chirp_reli_stat(host, source_file, &info, stoptime) < 0)
+		return -1;
+
+	if(S_ISDIR(info.cst_mode)) {
+		errno = EISDIR;
+		return -1;
+	}
+
+	int fd = open(target_file, O_WRONLY | O_CREAT | O_TRUNC, info.cst_mode & 0777);
+	if(fd < 0)
+		return -1;
+
+	if(ftruncate(fd, info.cst_size) < 0) {
+		int save_errno = errno;
+		close(fd);
+		errno = save_errno;
+		return -1;
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.direction = STRIPE_GET;
+	s.host = host;
+	s.path = source_file;
+	s.localfd = fd;
+	s.size = info.cst_size;
+	s.stoptime = stoptime;
+
+	result = stripe_run(&s, streams, stats);
+
+	int save_errno = errno;
+	if(close(fd) < 0 && result >= 0) {
+		result = -1;
+	} else {
+		errno = save_errno;
+	}
+
+	return result;
+}
+
+INT64_T chirp_stripe_put(const char *source_file, const char *host, const char *target_file, int streams, struct chirp_stripe_stats *stats, time_t stoptime)
+{
+	struct stripe s;
+	struct stat info;
+	struct chirp_file *file;
+	INT64_T result;
+
+	int fd = open(source_file, O_RDONLY);
+	if(fd < 0)
+		return -1;
+
+	if(fstat(fd, &info) < 0) {
+		int save_errno = errno;
+		close(fd);
+		errno = save_errno;
+		return -1;
+	}
+
+	if(S_ISDIR(info.st_mode)) {
+		close(fd);
+		errno = EISDIR;
+		return -1;
+	}
+
+	/* create and truncate the file once, before the workers open it. */
+	file = chirp_reli_open(host, target_file, O_WRONLY | O_CREAT | O_TRUNC, info.st_mode & 0777, stoptime);
+	if(!file || chirp_reli_close(file, stoptime) < 0) {
+		int save_errno = errno;
+		close(fd);
+		errno = save_errno;
+		return -1;
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.direction = STRIPE_PUT;
+	s.host = host;
+	s.path = target_file;
+	s.localfd = fd;
+	s.size = info.st_size;
+	s.stoptime = stoptime;
+
+	result = stripe_run(&s, streams, stats);
+
+	int save_errno = errno;
+	close(fd);
+	errno = save_errno;
+
+	return result;
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,69 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef CHIRP_STRIPE_H
+#define CHIRP_STRIPE_H
+
+#include "int_sizes.h"
+#include <time.h>
+
+/** @file chirp_stripe.h
+Transfer a single large file over several connections at once.
+The file is divided into chunks, which are handed out to a set of worker
+processes, each with its own connection to the server, and transferred with
+<tt>pread</tt> and <tt>pwrite</tt> at their offsets.  A single TCP stream is
+often limited well below the capacity of a fast wide area path, while several
+streams together may fill it.
+*/
+
+/** The largest number of streams used for one file. */
+#define CHIRP_STRIPE_STREAMS_MAX 16
+
+/** A summary of a striped transfer. */
+
+struct chirp_stripe_stats {
+	INT64_T bytes;          /**< The number of bytes transferred. */
+	double seconds;         /**< The time taken by the transfer. */
+	int streams;            /**< The largest number of streams used at once. */
+	INT64_T chunk_size;     /**< The chunk size in use at the end of the transfer. */
+	int retries;            /**< The number of streams that failed and were replaced. */
+};
+
+/** Parse a number of streams given by the user.
+Values above @ref CHIRP_STRIPE_STREAMS_MAX are reduced to it with a warning.
+@param str A positive number, or <tt>auto</tt> to find the best number while transferring.
+@return The number of streams, zero for <tt>auto</tt>, or less than zero if the string is not valid.
+*/
+
+int chirp_stripe_streams_parse(const char *str);
+
+/** Get a file from a Chirp server over several streams.
+@param host The host and port of the Chirp server.
+@param source_file The path of the remote file.
+@param target_file The name to give the local file.
+@param streams The number of streams to use, or zero to find the best number while transferring.
+@param stats If not null, filled with a summary of the transfer.
+@param stoptime The absolute time at which to abort.
+@return On success, returns the number of bytes transferred.  On failure, returns less than zero and sets errno.
+*/
+
+INT64_T chirp_stripe_get(const char *host, const char *source_file, const char *target_file, int streams, struct chirp_stripe_stats *stats, time_t stoptime);
+
+/** Put a file to a Chirp server over several streams.
+@param source_file The path of the local file.
+@param host The host and port of the Chirp server.
+@param target_file The name to give the remote file.
+@param streams The number of streams to use, or zero to find the best number while transferring.
+@param stats If not null, filled with a summary of the transfer.
+@param stoptime The absolute time at which to abort.
+@return On success, returns the number of bytes transferred.  On failure, returns less than zero and sets errno.
+*/
+
+INT64_T chirp_stripe_put(const char *source_file, const char *host, const char *target_file, int streams, struct chirp_stripe_stats *stats, time_t stoptime);
+
+#endif
+
+/* vim: set noexpandtab tabstop=4: */
@@ -168,6 +168,27 @@ struct chirp_bulkio {
 	INT64_T errnum;		   /**< On failure, contains the errno for the call. */
 };
 
+/** Describes the type of a bulk metadata operation. Used by @ref chirp_bulkstat */
+
+typedef enum {
+	CHIRP_BULKSTAT_STAT,   /**< Perform a chirp_reli_stat.*/
+	CHIRP_BULKSTAT_LSTAT,  /**< Perform a chirp_reli_lstat.*/
+	CHIRP_BULKSTAT_ACCESS  /**< Perform a chirp_reli_access.*/
+} chirp_bulkstat_t;
+
+/** Describes a bulk metadata operation.
+An array of chirp_bulkstat structures passed to @ref chirp_reli_bulkstat describes a list of operations to be performed on one server in a single round trip.
+*/
+
+struct chirp_bulkstat {
+	chirp_bulkstat_t type;	   /**< The type of operation to perform. */
+	const char *path;	   /**< The path to examine. */
+	struct chirp_stat *info;   /**< Pointer to a buffer filled by STAT and LSTAT. */
+	INT64_T mode;		   /**< The access mode to check for ACCESS. */
+	INT64_T result;		   /**< On completion, contains result of operation. */
+	INT64_T errnum;		   /**< On failure, contains the errno for the call. */
+};
+
 /** Descibes the space consumed by a single user on a Chirp server.
 @see chirp_reli_audit
 */
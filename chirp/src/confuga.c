@@ -7,8 +7,6 @@ See the file COPYING for details.
 /* TODO
  *
  * o Interface to read File/Replica/SN metadata.
- * o Replica GC.
- * o Replica Health.
  * o Dynamically generated tickets for file transfers.
  * o Bind task failures in special .confuga/job/id/files/...
  * o Limit # of operations for each create/commit/wait/etc.
@@ -702,13 +700,39 @@ static int parse_uri (confuga *C, const char *uri, int *explicit_auth)
 			} else if (strcmp(option, "scheduler") == 0) {
 				if (pattern_match(value, "^fifo%-?(%d*)$", &subvalue) >= 0) {
 					CATCH(confuga_scheduler_strategy(C, CONFUGA_SCHEDULER_FIFO, strtoul(subvalue, NULL, 10)));
+				} else if (pattern_match(value, "^locality%-?(%d*)$", &subvalue) >= 0) {
+					CATCH(confuga_scheduler_strategy(C, CONFUGA_SCHEDULER_LOCALITY, strtoul(subvalue, NULL, 10)));
 				} else CATCH(EINVAL);
+			} else if (strcmp(option, "slots") == 0) {
+				if (pattern_match(value, "^(%d+)$", &subvalue) >= 0)
+					CATCH(confuga_scheduler_slots(C, strtoul(subvalue, NULL, 10)));
+				else CATCH(EINVAL);
 			} else if (strcmp(option, "replication") == 0) {
 				if (pattern_match(value, "^push%-sync%-?(%d*)$", &subvalue) >= 0) {
 					CATCH(confuga_replication_strategy(C, CONFUGA_REPLICATION_PUSH_SYNCHRONOUS, strtoul(subvalue, NULL, 10)));
 				} else if (pattern_match(value, "^push%-async%-?(%d*)$", &subvalue) >= 0) {
 					CATCH(confuga_replication_strategy(C, CONFUGA_REPLICATION_PUSH_ASYNCHRONOUS, strtoul(subvalue, NULL, 10)));
 				} else CATCH(EINVAL);
+			} else if (strcmp(option, "replicas") == 0) {
+				if (pattern_match(value, "^(%d+)$", &subvalue) >= 0)
+					CATCH(confuga_replicas(C, strtoul(subvalue, NULL, 10)));
+				else CATCH(EINVAL);
+			} else if (strcmp(option, "rebalance") == 0) {
+				if (pattern_match(value, "^(%d+)$", &subvalue) >= 0)
+					CATCH(confuga_rebalance(C, strtoul(subvalue, NULL, 10), C->health_bandwidth));
+				else CATCH(EINVAL);
+			} else if (strcmp(option, "health-bandwidth") == 0) {
+				if (pattern_match(value, "^(%d+[kKmMgGtTpP]?)[bB]?$", &subvalue) >= 0)
+					CATCH(confuga_rebalance(C, C->rebalance, string_metric_parse(subvalue)));
+				else CATCH(EINVAL);
+			} else if (strcmp(option, "trim-age") == 0) {
+				if (pattern_match(value, "^(%d+)$", &subvalue) >= 0)
+					CATCH(confuga_health_ages(C, strtoul(subvalue, NULL, 10), C->health_orphan_age));
+				else CATCH(EINVAL);
+			} else if (strcmp(option, "orphan-age") == 0) {
+				if (pattern_match(value, "^(%d+)$", &subvalue) >= 0)
+					CATCH(confuga_health_ages(C, C->health_trim_age, strtoul(subvalue, NULL, 10)));
+				else CATCH(EINVAL);
 			} else if (strcmp(option, "nodes") == 0) {
 				CATCH(confuga_nodes(C, value));
 			} else if (strcmp(option, "tickets") == 0) {
@@ -761,6 +785,12 @@ CONFUGA_API int confuga_connect (confuga **Cp, const char *uri, const char *cata
 	C->replication_n = 1; /* max one push async job per node */
 	C->scheduler = CONFUGA_SCHEDULER_FIFO;
 	C->scheduler_n = 0; /* unlimited */
+	C->scheduler_slots = 0; /* depends on the scheduler */
+	C->replicas = 1;
+	C->rebalance = 10; /* percent */
+	C->health_bandwidth = (1<<24); /* 16MB/s */
+	C->health_trim_age = 60*60;
+	C->health_orphan_age = 24*60*60;
 	C->operations = 0;
 	C->rootfd = -1;
 	C->nsrootfd = -1;
@@ -846,6 +876,36 @@ CONFUGA_API int confuga_replication_strategy (confuga *C, int strategy, uint64_t
 	return 0;
 }
 
+CONFUGA_API int confuga_scheduler_slots (confuga *C, uint64_t n)
+{
+	debug(D_CONFUGA, "setting scheduler slots to %" PRIu64, n);
+	C->scheduler_slots = n;
+	return 0;
+}
+
+CONFUGA_API int confuga_replicas (confuga *C, uint64_t n)
+{
+	debug(D_CONFUGA, "setting target replicas to %" PRIu64, n);
+	C->replicas = n;
+	return 0;
+}
+
+CONFUGA_API int confuga_rebalance (confuga *C, uint64_t threshold, uint64_t bandwidth)
+{
+	debug(D_CONFUGA, "setting rebalance threshold to %" PRIu64 "%% at %" PRIu64 " bytes/s", threshold, bandwidth);
+	C->rebalance = threshold;
+	C->health_bandwidth = bandwidth;
+	return 0;
+}
+
+CONFUGA_API int confuga_health_ages (confuga *C, uint64_t trim, uint64_t orphan)
+{
+	debug(D_CONFUGA, "setting replica trim age to %" PRIu64 "s and orphan age to %" PRIu64 "s", trim, orphan);
+	C->health_trim_age = trim;
+	C->health_orphan_age = orphan;
+	return 0;
+}
+
 CONFUGA_API int confuga_disconnect (confuga *C)
 {
 	int rc;
@@ -853,6 +913,7 @@ CONFUGA_API int confuga_disconnect (confuga *C)
 	debug(D_CONFUGA, "disconnecting from confuga://%s", C->root);
 
 	CATCH(confugaI_dbclose(C));
+	confugaJ_free(C);
 	free(C);
 
 	rc = 0;
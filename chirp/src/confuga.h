@@ -115,8 +115,10 @@ CONFUGA_API int confuga_snadd (confuga *C, const char *id, const char *root, con
 CONFUGA_API int confuga_snrm (confuga *C, const char *id, int flag);
 CONFUGA_API int confuga_nodes (confuga *C, const char *nodes); /* deprecated */
 
-#define CONFUGA_SCHEDULER_FIFO 1
+#define CONFUGA_SCHEDULER_FIFO     1
+#define CONFUGA_SCHEDULER_LOCALITY 2
 CONFUGA_API int confuga_scheduler_strategy (confuga *C, int strategy, uint64_t n);
+CONFUGA_API int confuga_scheduler_slots (confuga *C, uint64_t n);
 
 CONFUGA_API int confuga_pull_threshold (confuga *C, uint64_t n);
 
@@ -124,6 +126,12 @@ CONFUGA_API int confuga_pull_threshold (confuga *C, uint64_t n);
 #define CONFUGA_REPLICATION_PUSH_ASYNCHRONOUS 2
 CONFUGA_API int confuga_replication_strategy (confuga *C, int strategy, uint64_t n);
 
+CONFUGA_API int confuga_replicas (confuga *C, uint64_t n);
+CONFUGA_API int confuga_rebalance (confuga *C, uint64_t threshold, uint64_t bandwidth);
+CONFUGA_API int confuga_health_ages (confuga *C, uint64_t trim, uint64_t orphan);
+CONFUGA_API int confuga_health (confuga *C, FILE *stream);
+CONFUGA_API int confuga_job_stats (confuga *C, FILE *stream);
+
 CONFUGA_API int confuga_getid (confuga *C, char **id);
 
 #define CONFUGA_O_EXCL (1L<<0)
@@ -92,6 +92,54 @@ static int process (confuga *C, int argc, char *argv[])
 			flag |= CONFUGA_SN_ADDR;
 		else CATCH(EINVAL);
 		CATCH(confuga_snrm(C, argv[optind+1], flag));
+	} else if (strcmp(argv[0], "health") == 0) {
+		static const struct option long_options[] = {
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		static const char usage[] = "health";
+
+		while((c = getopt_long(argc, argv, "+h", long_options, NULL)) > -1) {
+			switch (c) {
+				case 'h':
+					CATCHUNIX(fprintf(stdout, "%s\n", usage));
+					rc = 0;
+					goto out;
+				default:
+					CATCHUNIX(fprintf(stderr, "%s\n", usage));
+					CATCH(EINVAL);
+					break;
+			}
+		}
+		if (optind != argc) {
+			CATCHUNIX(fprintf(stderr, "invalid command: %s\n", usage));
+			CATCH(EINVAL);
+		}
+		CATCH(confuga_health(C, stdout));
+	} else if (strcmp(argv[0], "job-stats") == 0) {
+		static const struct option long_options[] = {
+			{"help", no_argument, 0, 'h'},
+			{0, 0, 0, 0}
+		};
+		static const char usage[] = "job-stats";
+
+		while((c = getopt_long(argc, argv, "+h", long_options, NULL)) > -1) {
+			switch (c) {
+				case 'h':
+					CATCHUNIX(fprintf(stdout, "%s\n", usage));
+					rc = 0;
+					goto out;
+				default:
+					CATCHUNIX(fprintf(stderr, "%s\n", usage));
+					CATCH(EINVAL);
+					break;
+			}
+		}
+		if (optind != argc) {
+			CATCHUNIX(fprintf(stderr, "invalid command: %s\n", usage));
+			CATCH(EINVAL);
+		}
+		CATCH(confuga_job_stats(C, stdout));
 	} else {
 		CATCHUNIX(fprintf(stderr, "invalid command: %s\n", argv[0]));
 		CATCH(EINVAL);
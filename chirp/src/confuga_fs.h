@@ -28,6 +28,12 @@ struct confuga {
 	uint64_t replication_n;
 	int scheduler;
 	uint64_t scheduler_n;
+	uint64_t scheduler_slots; /* jobs allocated to one SN, 0 for the default of the scheduler */
+	uint64_t replicas; /* target number of replicas for every file */
+	uint64_t rebalance; /* percent difference in free space between SN that triggers rebalancing */
+	uint64_t health_bandwidth; /* bytes per second for rebalancing transfers, 0 is unlimited */
+	uint64_t health_trim_age; /* seconds before an extra Replica may be trimmed */
+	uint64_t health_orphan_age; /* seconds before an unknown file on a SN may be reclaimed */
 
 	const char *catalog_hosts;
 
@@ -35,6 +41,13 @@ struct confuga {
 
 	time_t job_stats;
 	time_t transfer_stats;
+	time_t health;
+	time_t health_orphans;
+	confuga_sid_t health_orphans_sid; /* last SN searched for orphaned replicas */
+	time_t health_budget_time;
+	double health_budget; /* bytes rebalancing may still transfer */
+
+	struct confuga_jobs *jobs; /* in-memory job queues of the scheduler, see confuga_job.c */
 
 	uint64_t operations;
 };
@@ -81,6 +94,7 @@ CONFUGA_IAPI int confugaS_manager (confuga *C);
 CONFUGA_IAPI int confugaS_node_insert (confuga *C, const char *hostport, const char *root);
 
 CONFUGA_IAPI int confugaJ_schedule (confuga *C);
+CONFUGA_IAPI void confugaJ_free (confuga *C);
 
 #define CONFUGA_DB_VERSION  2
 
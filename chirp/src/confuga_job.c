@@ -7,8 +7,12 @@ See the file COPYING for details.
 #include "confuga_fs.h"
 
 #include "debug.h"
+#include "histogram.h"
+#include "itable.h"
 #include "json.h"
 #include "json_aux.h"
+#include "list.h"
+#include "timestamp.h"
 
 #include "catch.h"
 #include "chirp_reli.h"
@@ -20,6 +24,7 @@ See the file COPYING for details.
 #include <assert.h>
 #include <float.h>
 #include <limits.h>
+#include <math.h>
 #include <signal.h>
 #include <stdarg.h>
 
@@ -37,6 +42,82 @@ struct job_stats {
 	uint64_t      repl_count;
 };
 
+/* The scheduler keeps each unfinished job in memory, in a queue for its
+ * state, so that each step of confugaJ_schedule only visits the jobs it can
+ * advance instead of searching the ConfugaJob table. The table remains the
+ * durable record: a job is moved between queues only after its row is read
+ * back, and the queues are rebuilt from the table on startup and reconciled
+ * with it every JOB_SYNC_INTERVAL seconds.
+ */
+
+enum job_state {
+	JOB_NEW,
+	JOB_BOUND_INPUTS,
+	JOB_SCHEDULED,
+	JOB_REPLICATED,
+	JOB_CREATED,
+	JOB_COMMITTED,
+	JOB_WAITED,
+	JOB_REAPED,
+	JOB_BOUND_OUTPUTS,
+	JOB_ERRORED,
+	JOB_KILLED,
+	JOB_STATE_MAX
+};
+
+static const char *job_state_names[JOB_STATE_MAX] = {
+	"NEW",
+	"BOUND_INPUTS",
+	"SCHEDULED",
+	"REPLICATED",
+	"CREATED",
+	"COMMITTED",
+	"WAITED",
+	"REAPED",
+	"BOUND_OUTPUTS",
+	"ERRORED",
+	"KILLED",
+};
+
+#define JOB_ACTIVE_STATES "'NEW', 'BOUND_INPUTS', 'SCHEDULED', 'REPLICATED', 'CREATED', 'COMMITTED', 'WAITED', 'REAPED', 'ERRORED'"
+
+#define JOB_SYNC_INTERVAL 60
+#define JOB_KILL_INTERVAL 5
+#define JOB_LATENCY_MIN (1.0/1024)
+
+/* Allocated jobs per storage node, unless set with the slots URI option. With
+ * the locality scheduler, a storage node already holding inputs of a job may
+ * take it while running another.
+ */
+#define JOB_SLOTS_FIFO 1
+#define JOB_SLOTS_LOCALITY 2
+
+struct confuga_job {
+	chirp_jobid_t id;
+	char *tag;
+	enum job_state state;
+	confuga_sid_t sid;
+	chirp_jobid_t cid;
+	sqlite3_int64 priority;
+	sqlite3_int64 time_commit;
+	timestamp_t entered; /* when the job entered its current state */
+	struct list *queue; /* the queue holding the job */
+	unsigned generation; /* the last reconciliation which found the job */
+};
+
+struct confuga_jobs {
+	struct itable *table; /* chirp_jobid_t -> struct confuga_job */
+	struct list *queue[JOB_STATE_MAX];
+	struct list *killed; /* jobs killed by their owner, waiting to be stopped */
+	struct histogram *latency[JOB_STATE_MAX]; /* log2 of the seconds spent in each state */
+	chirp_jobid_t last; /* the largest job id seen */
+	unsigned generation;
+	time_t synced;
+	time_t kill_checked;
+};
+
+#define job_finished(state) ((state) == JOB_BOUND_OUTPUTS || (state) == JOB_KILLED || (state) == JOB_STATE_MAX)
+
 /* TODO:
  *
  * o Separate db instances for Confuga/Chirp Job. Use synchronization code.
@@ -62,6 +143,254 @@ static void jdebug (uint64_t level, chirp_jobid_t id, const char *tag, const cha
 	va_end(va);
 }
 
+static enum job_state job_state_parse (const char *state)
+{
+	int i;
+	for (i = 0; i < JOB_STATE_MAX; i++) {
+		if (state && streql(state, job_state_names[i]))
+			return i;
+	}
+	return JOB_STATE_MAX;
+}
+
+/* FIFO order: least priority, then earliest commit. */
+static int job_before (struct confuga_job *a, struct confuga_job *b)
+{
+	return a->priority < b->priority || (a->priority == b->priority && a->time_commit < b->time_commit);
+}
+
+/* Add a job to the queue of its state. The BOUND_INPUTS queue is kept in FIFO
+ * order so the scheduler always takes its head. Jobs mostly arrive in commit
+ * order, so the search for their place starts from the tail.
+ */
+static void job_enqueue (struct confuga_jobs *J, struct confuga_job *job)
+{
+	job->queue = J->queue[job->state];
+	if (job->state == JOB_BOUND_INPUTS) {
+		struct list_cursor *cur = list_cursor_create(job->queue);
+		struct confuga_job *other;
+		int found = list_seek(cur, -1);
+		while (found && list_get(cur, (void **)&other) && job_before(job, other))
+			found = list_prev(cur);
+		if (found) {
+			list_next(cur); /* off the tail, list_insert appends */
+			list_insert(cur, job);
+		} else {
+			list_push_head(job->queue, job);
+		}
+		list_cursor_destroy(cur);
+	} else {
+		list_push_tail(job->queue, job);
+	}
+}
+
+static void job_drop (confuga *C, struct confuga_job *job, struct list_cursor *cur)
+{
+	if (cur)
+		list_drop(cur);
+	else
+		list_remove(job->queue, job);
+	itable_remove(C->jobs->table, job->id);
+	free(job->tag);
+	free(job);
+}
+
+/* Move a job to the queue of its new state, recording how long it spent in
+ * the old one. The cursor, if given, must be on the job in its current queue.
+ * Finished jobs are forgotten.
+ */
+static void job_move (confuga *C, struct confuga_job *job, enum job_state state, struct list_cursor *cur)
+{
+	struct confuga_jobs *J = C->jobs;
+	timestamp_t now = timestamp_get();
+	double elapsed = (now - job->entered) / 1000000.0;
+
+	if (state == job->state)
+		return;
+
+	histogram_insert(J->latency[job->state], log2(elapsed > JOB_LATENCY_MIN ? elapsed : JOB_LATENCY_MIN));
+	jdebug(D_DEBUG, job->id, job->tag, "%s -> %s after %.3fs", job_state_names[job->state], state < JOB_STATE_MAX ? job_state_names[state] : "(none)", elapsed);
+
+	if (job_finished(state)) {
+		job_drop(C, job, cur);
+		return;
+	}
+
+	job->state = state;
+	job->entered = now;
+	if (job->queue == J->killed)
+		return; /* stays until it is stopped */
+
+	if (cur)
+		list_drop(cur);
+	else
+		list_remove(job->queue, job);
+	job_enqueue(J, job);
+}
+
+/* Read back the row of a job after trying to advance it. */
+static int job_refresh (confuga *C, struct confuga_job *job, struct list_cursor *cur, enum job_state *statep)
+{
+	static const char SQL[] =
+		"SELECT state, sid, cid FROM ConfugaJob WHERE id = ?;";
+
+	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	const char *current = SQL;
+	enum job_state state = job->state;
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(sqlite3_bind_int64(stmt, 1, job->id));
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW) {
+		state = job_state_parse((const char *)sqlite3_column_text(stmt, 0));
+		job->sid = sqlite3_column_int64(stmt, 1);
+		job->cid = sqlite3_column_int64(stmt, 2);
+	} else if (rc == SQLITE_DONE) {
+		state = JOB_STATE_MAX;
+	} else {
+		sqlcatch(rc);
+	}
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	job_move(C, job, state, cur);
+
+	rc = 0;
+	goto out;
+out:
+	if (statep)
+		*statep = state;
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+/* Track a job from a row of (id, tag, state, sid, cid, priority, time_commit). */
+static int job_track (confuga *C, sqlite3_stmt *stmt)
+{
+	int rc;
+	struct confuga_jobs *J = C->jobs;
+	chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
+	enum job_state state = job_state_parse((const char *)sqlite3_column_text(stmt, 2));
+	struct confuga_job *job = itable_lookup(J->table, id);
+
+	if (id > J->last)
+		J->last = id;
+
+	if (job == NULL) {
+		if (job_finished(state)) {
+			rc = 0;
+			goto out;
+		}
+		job = malloc(sizeof(*job));
+		CATCHUNIX(job == NULL ? -1 : 0);
+		memset(job, 0, sizeof(*job));
+		job->tag = strdup((const char *)sqlite3_column_text(stmt, 1));
+		if (job->tag == NULL) {
+			free(job);
+			CATCH(ENOMEM);
+		}
+		job->id = id;
+		job->state = state;
+		job->entered = timestamp_get();
+		job->priority = sqlite3_column_int64(stmt, 5);
+		job->time_commit = sqlite3_column_int64(stmt, 6);
+		job_enqueue(J, job);
+		itable_insert(J->table, id, job);
+	} else if (job->priority != sqlite3_column_int64(stmt, 5) || job->time_commit != sqlite3_column_int64(stmt, 6)) {
+		job->priority = sqlite3_column_int64(stmt, 5);
+		job->time_commit = sqlite3_column_int64(stmt, 6);
+		if (job->queue == J->queue[JOB_BOUND_INPUTS]) {
+			list_remove(job->queue, job);
+			job_enqueue(J, job);
+		}
+	}
+
+	job->sid = sqlite3_column_int64(stmt, 3);
+	job->cid = sqlite3_column_int64(stmt, 4);
+	job->generation = J->generation;
+	job_move(C, job, state, NULL);
+
+	rc = 0;
+	goto out;
+out:
+	return rc;
+}
+
+static int job_host (confuga *C, confuga_sid_t sid, struct confuga_host *host)
+{
+	static const char SQL[] =
+		"SELECT hostport FROM Confuga.StorageNode WHERE id = ?;";
+
+	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	const char *current = SQL;
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(sqlite3_bind_int64(stmt, 1, sid));
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_DONE) {
+		THROW_QUIET(ENOENT);
+	}
+	sqlcatchcode(rc, SQLITE_ROW);
+	snprintf(host->hostport, sizeof(host->hostport), "%s", (const char *)sqlite3_column_text(stmt, 0));
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	rc = 0;
+	goto out;
+out:
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+static int jobs_init (confuga *C)
+{
+	int rc;
+	int i;
+	struct confuga_jobs *J = malloc(sizeof(*J));
+
+	CATCHUNIX(J == NULL ? -1 : 0);
+	memset(J, 0, sizeof(*J));
+	J->table = itable_create(0);
+	for (i = 0; i < JOB_STATE_MAX; i++) {
+		J->queue[i] = list_create();
+		J->latency[i] = histogram_create(1.0);
+	}
+	J->killed = list_create();
+	C->jobs = J;
+
+	rc = 0;
+	goto out;
+out:
+	return rc;
+}
+
+CONFUGA_IAPI void confugaJ_free (confuga *C)
+{
+	struct confuga_jobs *J = C->jobs;
+	struct confuga_job *job;
+	uint64_t id;
+	int i;
+
+	if (J == NULL)
+		return;
+
+	itable_firstkey(J->table);
+	while (itable_nextkey(J->table, &id, (void **)&job)) {
+		free(job->tag);
+		free(job);
+	}
+	itable_delete(J->table);
+	for (i = 0; i < JOB_STATE_MAX; i++) {
+		list_delete(J->queue[i]);
+		histogram_delete(J->latency[i]);
+	}
+	list_delete(J->killed);
+	free(J);
+	C->jobs = NULL;
+}
+
 CONFUGA_API int confuga_job_dbinit (confuga *C, sqlite3 *db)
 {
 	static const char SQL[] =
@@ -145,6 +474,13 @@ CONFUGA_API int confuga_job_dbinit (confuga *C, sqlite3 *db)
 		sqlite3_exec(db, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
 	}
 	sqlite3_free(errmsg);
+	errmsg = NULL;
+
+	/* The scheduler finds active jobs by state; also added to older databases. */
+	rc = sqlite3_exec(db, "CREATE INDEX IF NOT EXISTS ConfugaJobStateIndex ON ConfugaJob (state);", NULL, NULL, &errmsg);
+	if (rc)
+		debug(D_DEBUG, "[%s:%d] sqlite3 error: %d `%s': %s", __FILE__, __LINE__, rc, sqlite3_errstr(rc), sqlite3_errmsg(db));
+	sqlite3_free(errmsg);
 
 	rc = 0;
 	goto out;
@@ -333,27 +669,123 @@ static void CATCHJOB (confuga *C, chirp_jobid_t id, const char *tag, int rc)
 	}
 }
 
+#define JOB_TRACK_COLUMNS "ConfugaJob.id, ConfugaJob.tag, ConfugaJob.state, ConfugaJob.sid, ConfugaJob.cid, Job.priority, Job.time_commit"
+
+/* Only jobs above the largest id seen are considered, so this is a search of
+ * the primary key rather than of the whole Job table. A job given a lower id
+ * is still found by the next job_sync.
+ */
 static int job_new (confuga *C)
 {
 	static const char SQL[] =
 		"INSERT INTO ConfugaJob (id, state, tag, time_new)"
 		"	SELECT Job.id, 'NEW', Job.tag, (strftime('%s', 'now'))"
 		"		FROM Job LEFT OUTER JOIN ConfugaJob ON Job.id = ConfugaJob.id"
-		"		WHERE ConfugaJob.id IS NULL;";
+		"		WHERE Job.id > ?1 AND ConfugaJob.id IS NULL;"
+		"SELECT " JOB_TRACK_COLUMNS
+		"	FROM ConfugaJob INNER JOIN Job ON ConfugaJob.id = Job.id"
+		"	WHERE ConfugaJob.id > ?1"
+		"	ORDER BY ConfugaJob.id;"
+		;
+
+	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	const char *current = SQL;
+	chirp_jobid_t last = C->jobs->last;
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(sqlite3_bind_int64(stmt, 1, last));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	C->operations += sqlite3_changes(db);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(sqlite3_bind_int64(stmt, 1, last));
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		CATCH(job_track(C, stmt));
+	}
+	sqlcatchcode(rc, SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	rc = 0;
+	goto out;
+out:
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+/* Reconcile the queues with the ConfugaJob table, in case a row was changed
+ * by something other than this scheduler.
+ */
+static int job_sync (confuga *C)
+{
+	static const char SQL[] =
+		"INSERT INTO ConfugaJob (id, state, tag, time_new)"
+		"	SELECT Job.id, 'NEW', Job.tag, (strftime('%s', 'now'))"
+		"		FROM Job LEFT OUTER JOIN ConfugaJob ON Job.id = ConfugaJob.id"
+		"		WHERE ConfugaJob.id IS NULL;"
+		"SELECT " JOB_TRACK_COLUMNS
+		"	FROM ConfugaJob INNER JOIN Job ON ConfugaJob.id = Job.id"
+		"	WHERE ConfugaJob.state IN (" JOB_ACTIVE_STATES ");"
+		"SELECT MAX(id) FROM ConfugaJob;"
+		;
 
 	int rc;
 	sqlite3 *db = C->db;
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
+	struct confuga_jobs *J = C->jobs;
+	struct confuga_job *job;
+	struct list *lost = NULL;
+	uint64_t id;
+	time_t now = time(NULL);
+
+	if (now < J->synced+JOB_SYNC_INTERVAL) {
+		rc = 0;
+		goto out;
+	}
+
+	debug(D_DEBUG, "reconciling job queues");
 
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
 	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
 	C->operations += sqlite3_changes(db);
 	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
 
+	J->generation++;
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		CATCH(job_track(C, stmt));
+	}
+	sqlcatchcode(rc, SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_ROW);
+	if (sqlite3_column_int64(stmt, 0) > J->last)
+		J->last = sqlite3_column_int64(stmt, 0);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	/* forget jobs which are no longer active in the table */
+	lost = list_create();
+	itable_firstkey(J->table);
+	while (itable_nextkey(J->table, &id, (void **)&job)) {
+		if (job->generation != J->generation)
+			list_push_tail(lost, job);
+	}
+	while ((job = list_pop_head(lost))) {
+		jdebug(D_DEBUG, job->id, job->tag, "no longer active");
+		job_drop(C, job, NULL);
+	}
+
+	J->synced = now;
+
 	rc = 0;
 	goto out;
 out:
+	if (lost)
+		list_delete(lost);
 	sqlite3_finalize(stmt);
 	return rc;
 }
@@ -457,33 +889,18 @@ out:
 
 static int job_bind_inputs (confuga *C)
 {
-	static const char SQL[] =
-		"SELECT id, tag"
-		"	FROM ConfugaJob"
-		"	WHERE state = 'NEW'"
-		"	ORDER BY RANDOM();"; /* to ensure no starvation, bindinputs may result in a ROLLBACK that aborts this SELECT */
+	struct list_cursor *cur = list_cursor_create(C->jobs->queue[JOB_NEW]);
+	struct confuga_job *job;
 
-	int rc;
-	sqlite3 *db = C->db;
-	sqlite3_stmt *stmt = NULL;
-	const char *current = SQL;
-
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
-	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
-		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
-		jdebug(D_DEBUG, id, tag, "binding inputs");
-		CATCHJOB(C, id, tag, bindinputs(C, id, tag));
+	for (list_seek(cur, 0); list_get(cur, (void **)&job); list_next(cur)) {
+		jdebug(D_DEBUG, job->id, job->tag, "binding inputs");
+		CATCHJOB(C, job->id, job->tag, bindinputs(C, job->id, job->tag));
+		job_refresh(C, job, cur, NULL);
 		C->operations++;
 	}
-	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	list_cursor_destroy(cur);
 
-	rc = 0;
-	goto out;
-out:
-	sqlite3_finalize(stmt);
-	return rc;
+	return 0;
 }
 
 static int dispatch (confuga *C, chirp_jobid_t id, const char *tag)
@@ -499,28 +916,38 @@ static int dispatch (confuga *C, chirp_jobid_t id, const char *tag)
 		"BEGIN TRANSACTION;"
 		"WITH"
 			/* We want every active SN, even if it has no input file. */
+		"	StorageNodeLoad AS ("
+		"		SELECT StorageNodeActive.id,"
+		"		       (SELECT COUNT(*) FROM ConfugaJobAllocated WHERE ConfugaJobAllocated.sid = StorageNodeActive.id) AS jobs,"
+		"		       (SELECT COUNT(*) FROM Confuga.ActiveTransfers WHERE ActiveTransfers.fsid = StorageNodeActive.id OR ActiveTransfers.tsid = StorageNodeActive.id) AS transfers"
+		"			FROM Confuga.StorageNodeActive"
+		"	),"
 		"	StorageNodeAvailable AS ("
-		"		SELECT StorageNodeActive.id"
-		"			FROM Confuga.StorageNodeActive LEFT OUTER JOIN ConfugaJobAllocated ON StorageNodeActive.id = ConfugaJobAllocated.sid"
-		"			GROUP BY StorageNodeActive.id"
-		"			HAVING COUNT(ConfugaJobAllocated.id) < 1" /* TODO: allow more than one job on a SN */
+		"		SELECT * FROM StorageNodeLoad WHERE jobs < ?3"
 		"	),"
 		"	ConfugaInputFileReplicas AS ("
 		"		SELECT ConfugaInputFile.jid, FileReplicas.*"
 		"			FROM ConfugaInputFile JOIN Confuga.FileReplicas ON ConfugaInputFile.fid = FileReplicas.fid"
 		"	),"
 		"	StorageNodeJobBytes AS ("
-		"		SELECT ConfugaJob.id AS jid, StorageNodeAvailable.id AS sid, COUNT(ConfugaInputFileReplicas.size) AS count, SUM(ConfugaInputFileReplicas.size) AS size, RANDOM() AS _r"
+		"		SELECT ConfugaJob.id AS jid, StorageNodeAvailable.id AS sid, StorageNodeAvailable.jobs AS jobs, StorageNodeAvailable.transfers AS transfers, COUNT(ConfugaInputFileReplicas.size) AS count, IFNULL(SUM(ConfugaInputFileReplicas.size), 0) AS size, RANDOM() AS _r"
 		"			FROM"
 		"				ConfugaJob CROSS JOIN StorageNodeAvailable"
 		"				LEFT OUTER JOIN ConfugaInputFileReplicas ON ConfugaJob.id = ConfugaInputFileReplicas.jid AND StorageNodeAvailable.id = ConfugaInputFileReplicas.sid"
+		"			WHERE ConfugaJob.id = ?1" /* only the job being dispatched */
 		"			GROUP BY ConfugaJob.id, StorageNodeAvailable.id"
 		"	)"
 		/* N.B. if there are no available storage nodes, sid will be NULL! */
 		"SELECT StorageNodeJobBytes.sid, StorageNodeJobBytes.count, StorageNodeJobBytes.size"
 		"	FROM StorageNodeJobBytes"
-		"	WHERE StorageNodeJobBytes.jid = ?1"
-		"	ORDER BY StorageNodeJobBytes.size DESC, _r DESC" /* choose a random storage node if equally desirable */
+		"	WHERE StorageNodeJobBytes.jid = ?1 AND (NOT ?2 OR StorageNodeJobBytes.jobs = 0 OR StorageNodeJobBytes.size > 0)" /* with locality, a busy SN is only worth it for its data */
+		"	ORDER BY"
+		/* FIFO: the most resident bytes. Locality: the most resident bytes
+		 * per job or transfer the SN is already busy with, then the least
+		 * busy SN. */
+		"		CASE WHEN ?2 THEN StorageNodeJobBytes.size/(1.0+StorageNodeJobBytes.jobs+StorageNodeJobBytes.transfers) ELSE StorageNodeJobBytes.size END DESC,"
+		"		CASE WHEN ?2 THEN StorageNodeJobBytes.jobs+StorageNodeJobBytes.transfers ELSE 0 END ASC,"
+		"		_r DESC" /* choose a random storage node if equally desirable */
 		"	LIMIT 1;"
 		"UPDATE ConfugaJob"
 		"	SET"
@@ -549,6 +976,11 @@ static int dispatch (confuga *C, chirp_jobid_t id, const char *tag)
 
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
 	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
+	sqlcatch(sqlite3_bind_int(stmt, 2, C->scheduler == CONFUGA_SCHEDULER_LOCALITY));
+	if (C->scheduler_slots)
+		sqlcatch(sqlite3_bind_int64(stmt, 3, C->scheduler_slots));
+	else
+		sqlcatch(sqlite3_bind_int(stmt, 3, C->scheduler == CONFUGA_SCHEDULER_LOCALITY ? JOB_SLOTS_LOCALITY : JOB_SLOTS_FIFO));
 	rc = sqlite3_step(stmt);
 	if (rc == SQLITE_ROW) {
 		if (sqlite3_column_type(stmt, 0) == SQLITE_INTEGER) {
@@ -556,7 +988,7 @@ static int dispatch (confuga *C, chirp_jobid_t id, const char *tag)
 			stats.repl_count = sqlite3_column_int64(stmt, 1);
 			stats.repl_bytes = sqlite3_column_int64(stmt, 2);
 			assert(sid > 0);
-			jdebug(D_CONFUGA, id, tag, "scheduling on " CONFUGA_SID_DEBFMT, sid);
+			jdebug(D_CONFUGA, id, tag, "scheduling on " CONFUGA_SID_DEBFMT " with %" PRIu64 " bytes of %" PRIu64 " inputs resident", sid, stats.repl_bytes, stats.repl_count);
 			C->operations++;
 		} else {
 			assert(sqlite3_column_type(stmt, 0) == SQLITE_NULL);
@@ -599,41 +1031,22 @@ out:
 
 static int job_schedule (confuga *C)
 {
-	static const char SQL[] =
-		"WITH"
-		"	ScheduledJob AS ("
-		"		SELECT id"
-		"			FROM ConfugaJob"
-		"			WHERE ConfugaJob.state = 'SCHEDULED'"
-		"	)"
-		"SELECT ConfugaJob.id, ConfugaJob.tag"
-		"	FROM Job INNER JOIN ConfugaJob ON Job.id = ConfugaJob.id"
-		"	WHERE ConfugaJob.state = 'BOUND_INPUTS'"
-		"	ORDER BY Job.priority, Job.time_commit"
-		"	LIMIT (CASE WHEN ?1 == 0 OR (SELECT COUNT(*) FROM ScheduledJob) < ?1 THEN 1 ELSE 0 END);";
-
-	int rc;
-	sqlite3 *db = C->db;
-	sqlite3_stmt *stmt = NULL;
-	const char *current = SQL;
-
-	assert(C->scheduler == CONFUGA_SCHEDULER_FIFO);
-
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
-	sqlcatch(sqlite3_bind_int64(stmt, 1, C->scheduler_n));
-	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
-		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
-		CATCHJOB(C, id, tag, dispatch(C, id, tag));
+	struct confuga_jobs *J = C->jobs;
+	struct confuga_job *job;
+
+	assert(C->scheduler == CONFUGA_SCHEDULER_FIFO || C->scheduler == CONFUGA_SCHEDULER_LOCALITY);
+
+	while ((C->scheduler_n == 0 || (uint64_t)list_size(J->queue[JOB_SCHEDULED]) < C->scheduler_n) && (job = list_peek_head(J->queue[JOB_BOUND_INPUTS]))) {
+		enum job_state state;
+		int rc = dispatch(C, job->id, job->tag);
+		CATCHJOB(C, job->id, job->tag, rc);
+		if (rc == EAGAIN)
+			break; /* no storage node is available */
+		if (job_refresh(C, job, NULL, &state) || state == JOB_BOUND_INPUTS)
+			break;
 	}
-	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
 
-	rc = 0;
-	goto out;
-out:
-	sqlite3_finalize(stmt);
-	return rc;
+	return 0;
 }
 
 static int replicate_push_synchronous (confuga *C)
@@ -760,7 +1173,7 @@ static int replicate_push_asynchronous (confuga *C)
 		"					JOIN ConfugaInputFile ON ConfugaJob.id = ConfugaInputFile.jid"
 		"					JOIN Confuga.File ON ConfugaInputFile.fid = File.id"
 		"					LEFT OUTER JOIN PotentialReplicas ON ConfugaInputFile.fid = PotentialReplicas.fid AND ConfugaJob.sid = PotentialReplicas.sid"
-		"				WHERE File.size >= (SELECT * FROM PullThreshold) AND PotentialReplicas.fid IS NULL AND PotentialReplicas.sid IS NULL"
+		"				WHERE ConfugaJob.state = 'SCHEDULED' AND File.size >= (SELECT * FROM PullThreshold) AND PotentialReplicas.fid IS NULL AND PotentialReplicas.sid IS NULL"
 		"		),"
 				/* Largest ready push transfer for each ConfugaJob. Large files first as they can delay the workflow. */
 		"		LargestReadyPushTransfers AS ("
@@ -770,6 +1183,7 @@ static int replicate_push_asynchronous (confuga *C)
 		"					JOIN StorageNodeTransferReady ON ConfugaJob.sid = StorageNodeTransferReady.id"
 		"					JOIN MissingDependencies ON ConfugaJob.id = MissingDependencies.id"
 		"					JOIN RandomSourceStorageNode ON MissingDependencies.fid = RandomSourceStorageNode.fid"
+		"				WHERE ConfugaJob.state = 'SCHEDULED'"
 		"			GROUP BY ConfugaJob.id"
 		"		)"
 		"	SELECT 'NEW', 'JOB', ConfugaJob.id, ConfugaJob.tag, LargestReadyPushTransfers.fid, LargestReadyPushTransfers.fsid, LargestReadyPushTransfers.tsid"
@@ -903,26 +1317,18 @@ out:
 	return rc;
 }
 
-static int job_replicate (confuga *C)
+static int replicated (confuga *C, struct confuga_job *job, int *lost, int *ready)
 {
 	static const char SQL[] =
-		"SELECT ConfugaJob.id, ConfugaJob.tag"
-		"	FROM ConfugaJob"
-		"	WHERE state = 'SCHEDULED' AND NOT EXISTS ("
-		"		SELECT ConfugaJob.id"
-		"			FROM"
-		"				ConfugaInputFile"
-		"				JOIN Confuga.File ON ConfugaInputFile.fid = File.id"
-		"				LEFT OUTER JOIN Confuga.Replica ON ConfugaInputFile.fid = Replica.fid AND ConfugaJob.sid = Replica.sid"
-		"			WHERE ConfugaInputFile.jid = ConfugaJob.id AND File.size >= ?1 AND Replica.fid IS NULL AND Replica.sid IS NULL"
-		"	)"
-		";"
-		"SELECT ConfugaJob.id, ConfugaJob.tag"
-		"	FROM"
-		"		ConfugaJob"
-		"		LEFT OUTER JOIN Confuga.StorageNodeActive ON ConfugaJob.sid = StorageNodeActive.id"
-		"	WHERE ConfugaJob.state = 'SCHEDULED' AND StorageNodeActive.id IS NULL"
-		";"
+		"SELECT NOT EXISTS (SELECT id FROM Confuga.StorageNodeActive WHERE id = ?1);"
+		"SELECT NOT EXISTS ("
+		"	SELECT ConfugaInputFile.fid"
+		"		FROM"
+		"			ConfugaInputFile"
+		"			JOIN Confuga.File ON ConfugaInputFile.fid = File.id"
+		"			LEFT OUTER JOIN Confuga.Replica ON ConfugaInputFile.fid = Replica.fid AND Replica.sid = ?2"
+		"		WHERE ConfugaInputFile.jid = ?1 AND File.size >= ?3 AND Replica.fid IS NULL AND Replica.sid IS NULL"
+		");"
 		;
 
 	int rc;
@@ -930,41 +1336,65 @@ static int job_replicate (confuga *C)
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
 
-	/* check for jobs with all dependencies replicated */
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
-	sqlcatch(sqlite3_bind_int64(stmt, 1, C->pull_threshold));
-	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
-		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
-		jdebug(D_DEBUG, id, tag, "all dependencies are replicated");
-		CATCHJOB(C, id, tag, set_replicated(C, id));
-		C->operations++;
-	}
-	sqlcatchcode(rc, SQLITE_DONE);
+	sqlcatch(sqlite3_bind_int64(stmt, 1, job->sid));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_ROW);
+	*lost = sqlite3_column_int(stmt, 0);
 	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
 
-	/* check for jobs scheduled on inactive storage nodes */
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
-	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
-		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
-		jdebug(D_DEBUG, id, tag, "storage node lost");
-		reschedule(C, id, tag, ESRCH); /* someone else killed it? reschedule */
-	}
-	sqlcatchcode(rc, SQLITE_DONE);
+	sqlcatch(sqlite3_bind_int64(stmt, 1, job->id));
+	sqlcatch(sqlite3_bind_int64(stmt, 2, job->sid));
+	sqlcatch(sqlite3_bind_int64(stmt, 3, C->pull_threshold));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_ROW);
+	*ready = sqlite3_column_int(stmt, 0);
 	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
 
+	rc = 0;
+	goto out;
+out:
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+static int job_replicate (confuga *C)
+{
+	int rc;
+	struct list_cursor *cur = list_cursor_create(C->jobs->queue[JOB_SCHEDULED]);
+	struct confuga_job *job;
+
+	for (list_seek(cur, 0); list_get(cur, (void **)&job); list_next(cur)) {
+		int lost, ready;
+		if (replicated(C, job, &lost, &ready))
+			continue;
+		if (lost) {
+			/* check for jobs scheduled on inactive storage nodes */
+			jdebug(D_DEBUG, job->id, job->tag, "storage node lost");
+			reschedule(C, job->id, job->tag, ESRCH); /* someone else killed it? reschedule */
+		} else if (ready) {
+			/* check for jobs with all dependencies replicated */
+			jdebug(D_DEBUG, job->id, job->tag, "all dependencies are replicated");
+			CATCHJOB(C, job->id, job->tag, set_replicated(C, job->id));
+			C->operations++;
+		} else {
+			continue;
+		}
+		job_refresh(C, job, cur, NULL);
+	}
+
 	/* now replicate missing dependencies */
-	if (C->replication == CONFUGA_REPLICATION_PUSH_ASYNCHRONOUS)
-		CATCH(replicate_push_asynchronous(C));
-	else if (C->replication == CONFUGA_REPLICATION_PUSH_SYNCHRONOUS)
-		CATCH(replicate_push_synchronous(C));
-	else assert(0);
+	if (list_size(C->jobs->queue[JOB_SCHEDULED]) > 0) {
+		if (C->replication == CONFUGA_REPLICATION_PUSH_ASYNCHRONOUS)
+			CATCH(replicate_push_asynchronous(C));
+		else if (C->replication == CONFUGA_REPLICATION_PUSH_SYNCHRONOUS)
+			CATCH(replicate_push_synchronous(C));
+		else assert(0);
+	}
 
 	rc = 0;
 	goto out;
 out:
-	sqlite3_finalize(stmt);
+	list_cursor_destroy(cur);
 	return rc;
 }
 
@@ -1184,37 +1614,27 @@ out:
 	return rc;
 }
 
+#define job_executing(J) ((uint64_t)(list_size((J)->queue[JOB_CREATED]) + list_size((J)->queue[JOB_COMMITTED]) + list_size((J)->queue[JOB_WAITED])))
+
 static int job_create (confuga *C)
 {
-	static const char SQL[] =
-		"SELECT ConfugaJob.id, ConfugaJob.tag, StorageNode.hostport"
-		"	FROM ConfugaJob INNER JOIN Confuga.StorageNode ON ConfugaJob.sid = StorageNode.id"
-		"	WHERE ConfugaJob.state = 'REPLICATED'"
-		"	ORDER BY RANDOM()" /* to ensure no starvation, create may result in a ROLLBACK that aborts this SELECT */
-		"	LIMIT (CASE WHEN ?1 == 0 THEN -1 ELSE MAX(0, (?1 - (SELECT COUNT(*) FROM ConfugaJobExecuting))) END);";
+	struct confuga_jobs *J = C->jobs;
+	struct list_cursor *cur = list_cursor_create(J->queue[JOB_REPLICATED]);
+	struct confuga_job *job;
 
-	int rc;
-	sqlite3 *db = C->db;
-	sqlite3_stmt *stmt = NULL;
-	const char *current = SQL;
-
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
-	sqlcatch(sqlite3_bind_int64(stmt, 1, C->concurrency));
-	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
-		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
-		const char *hostport = (const char *)sqlite3_column_text(stmt, 2);
-		CATCHJOB(C, id, tag, jcreate(C, id, tag, hostport));
+	for (list_seek(cur, 0); list_get(cur, (void **)&job); list_next(cur)) {
+		struct confuga_host host;
+		if (C->concurrency > 0 && job_executing(J) >= C->concurrency)
+			break;
+		if (job_host(C, job->sid, &host))
+			continue;
+		CATCHJOB(C, job->id, job->tag, jcreate(C, job->id, job->tag, host.hostport));
+		job_refresh(C, job, cur, NULL);
 		C->operations++;
 	}
-	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	list_cursor_destroy(cur);
 
-	rc = 0;
-	goto out;
-out:
-	sqlite3_finalize(stmt);
-	return rc;
+	return 0;
 }
 
 static int jcommit (confuga *C, chirp_jobid_t id, const char *tag, const char *hostport, chirp_jobid_t cid)
@@ -1250,33 +1670,20 @@ out:
 
 static int job_commit (confuga *C)
 {
-	static const char SQL[] =
-		"SELECT ConfugaJob.id, ConfugaJob.tag, StorageNode.hostport, ConfugaJob.cid"
-		"	FROM ConfugaJob INNER JOIN Confuga.StorageNode ON ConfugaJob.sid = StorageNode.id"
-		"	WHERE ConfugaJob.state = 'CREATED';";
-
-	int rc;
-	sqlite3 *db = C->db;
-	sqlite3_stmt *stmt = NULL;
-	const char *current = SQL;
-
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
-	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
-		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
-		const char *hostport = (const char *)sqlite3_column_text(stmt, 2);
-		chirp_jobid_t cid = sqlite3_column_int64(stmt, 3);
-		CATCHJOB(C, id, tag, jcommit(C, id, tag, hostport, cid));
+	struct list_cursor *cur = list_cursor_create(C->jobs->queue[JOB_CREATED]);
+	struct confuga_job *job;
+
+	for (list_seek(cur, 0); list_get(cur, (void **)&job); list_next(cur)) {
+		struct confuga_host host;
+		if (job_host(C, job->sid, &host))
+			continue;
+		CATCHJOB(C, job->id, job->tag, jcommit(C, job->id, job->tag, host.hostport, job->cid));
+		job_refresh(C, job, cur, NULL);
 		C->operations++;
 	}
-	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	list_cursor_destroy(cur);
 
-	rc = 0;
-	goto out;
-out:
-	sqlite3_finalize(stmt);
-	return rc;
+	return 0;
 }
 
 static int jwait (confuga *C, chirp_jobid_t id, const char *tag, confuga_sid_t sid, const char *hostport, chirp_jobid_t cid)
@@ -1419,34 +1826,19 @@ out:
 
 static int job_wait (confuga *C)
 {
-	static const char SQL[] =
-		"SELECT ConfugaJob.id, ConfugaJob.tag, StorageNode.id, StorageNode.hostport, ConfugaJob.cid"
-		"	FROM ConfugaJob INNER JOIN Confuga.StorageNode ON ConfugaJob.sid = StorageNode.id"
-		"	WHERE ConfugaJob.state = 'COMMITTED'"
-		"	ORDER BY RANDOM();"; /* to ensure no starvation, wait may result in a ROLLBACK that aborts this SELECT */
-
-	int rc;
-	sqlite3 *db = C->db;
-	sqlite3_stmt *stmt = NULL;
-	const char *current = SQL;
-
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
-	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
-		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
-		confuga_sid_t sid = sqlite3_column_int64(stmt, 2);
-		const char *hostport = (const char *)sqlite3_column_text(stmt, 3);
-		chirp_jobid_t cid = sqlite3_column_int64(stmt, 4);
-		CATCHJOB(C, id, tag, jwait(C, id, tag, sid, hostport, cid));
+	struct list_cursor *cur = list_cursor_create(C->jobs->queue[JOB_COMMITTED]);
+	struct confuga_job *job;
+
+	for (list_seek(cur, 0); list_get(cur, (void **)&job); list_next(cur)) {
+		struct confuga_host host;
+		if (job_host(C, job->sid, &host))
+			continue;
+		CATCHJOB(C, job->id, job->tag, jwait(C, job->id, job->tag, job->sid, host.hostport, job->cid));
+		job_refresh(C, job, cur, NULL);
 	}
-	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	list_cursor_destroy(cur);
 
-	rc = 0;
-	goto out;
-out:
-	sqlite3_finalize(stmt);
-	return rc;
+	return 0;
 }
 
 static int jreap (confuga *C, chirp_jobid_t id, const char *tag, const char *hostport, chirp_jobid_t cid)
@@ -1482,33 +1874,20 @@ out:
 
 static int job_reap (confuga *C)
 {
-	static const char SQL[] =
-		"SELECT ConfugaJob.id, ConfugaJob.tag, StorageNode.hostport, ConfugaJob.cid"
-		"	FROM ConfugaJob INNER JOIN Confuga.StorageNode ON ConfugaJob.sid = StorageNode.id"
-		"	WHERE ConfugaJob.state = 'WAITED';";
-
-	int rc;
-	sqlite3 *db = C->db;
-	sqlite3_stmt *stmt = NULL;
-	const char *current = SQL;
-
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
-	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
-		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
-		const char *hostport = (const char *)sqlite3_column_text(stmt, 2);
-		chirp_jobid_t cid = sqlite3_column_int64(stmt, 3);
-		CATCHJOB(C, id, tag, jreap(C, id, tag, hostport, cid));
+	struct list_cursor *cur = list_cursor_create(C->jobs->queue[JOB_WAITED]);
+	struct confuga_job *job;
+
+	for (list_seek(cur, 0); list_get(cur, (void **)&job); list_next(cur)) {
+		struct confuga_host host;
+		if (job_host(C, job->sid, &host))
+			continue;
+		CATCHJOB(C, job->id, job->tag, jreap(C, job->id, job->tag, host.hostport, job->cid));
+		job_refresh(C, job, cur, NULL);
 		C->operations++;
 	}
-	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	list_cursor_destroy(cur);
 
-	rc = 0;
-	goto out;
-out:
-	sqlite3_finalize(stmt);
-	return rc;
+	return 0;
 }
 
 static int bindoutputs (confuga *C, chirp_jobid_t id, const char *tag)
@@ -1591,52 +1970,75 @@ out:
 	return rc;
 }
 
-static int job_complete (confuga *C)
+static int complete (confuga *C, chirp_jobid_t id, const char *tag)
 {
 	static const char SQL[] =
-		"SELECT ConfugaJob.id, ConfugaJob.tag, ConfugaJobWaitResult.status, ConfugaJobWaitResult.error"
-		"	FROM ConfugaJob JOIN ConfugaJobWaitResult On ConfugaJob.id = ConfugaJobWaitResult.id"
-		"	WHERE ConfugaJob.state = 'REAPED'"
-		"	ORDER BY RANDOM();"; /* to ensure no starvation, bindoutputs/reschedule/fail may result in a ROLLBACK that aborts this SELECT */
+		"SELECT status, error FROM ConfugaJobWaitResult WHERE id = ?;";
 
 	int rc;
 	sqlite3 *db = C->db;
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
+	char *status = NULL;
+	char *error = NULL;
 
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
-	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
-		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
-		const char *status = (const char *)sqlite3_column_text(stmt, 2);
-		const char *error = (const char *)sqlite3_column_text(stmt, 3);
-		if (strcmp(status, "FINISHED") == 0) {
-			CATCHJOB(C, id, tag, bindoutputs(C, id, tag));
-		} else if (strcmp(status, "KILLED") == 0) {
-			reschedule(C, id, tag, ECHILD); /* someone else killed it? reschedule */
-		} else if (strcmp(status, "ERRORED") == 0) {
-			if (strstr(error, "No child processes")) {
-				reschedule(C, id, tag, ESRCH); /* someone else killed it? reschedule */
-			} else if (strstr(error, "No such file or directory")) {
-				reschedule(C, id, tag, ENOENT); /* files were lost? */
-			} else {
-				fail(C, id, tag, error);
-			}
+	sqlcatch(sqlite3_bind_int64(stmt, 1, id));
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_DONE) {
+		THROW_QUIET(ENOENT);
+	}
+	sqlcatchcode(rc, SQLITE_ROW);
+	status = strdup((const char *)sqlite3_column_text(stmt, 0));
+	CATCHUNIX(status == NULL ? -1 : 0);
+	if (sqlite3_column_type(stmt, 1) != SQLITE_NULL) {
+		error = strdup((const char *)sqlite3_column_text(stmt, 1));
+		CATCHUNIX(error == NULL ? -1 : 0);
+	}
+	/* now release locks */
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	if (strcmp(status, "FINISHED") == 0) {
+		CATCHJOB(C, id, tag, bindoutputs(C, id, tag));
+	} else if (strcmp(status, "KILLED") == 0) {
+		reschedule(C, id, tag, ECHILD); /* someone else killed it? reschedule */
+	} else if (strcmp(status, "ERRORED") == 0) {
+		if (error && strstr(error, "No child processes")) {
+			reschedule(C, id, tag, ESRCH); /* someone else killed it? reschedule */
+		} else if (error && strstr(error, "No such file or directory")) {
+			reschedule(C, id, tag, ENOENT); /* files were lost? */
 		} else {
-			assert(0);
+			fail(C, id, tag, error ? error : "unknown error");
 		}
-		C->operations++;
+	} else {
+		assert(0);
 	}
-	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
+	free(status);
+	free(error);
 	sqlite3_finalize(stmt);
 	return rc;
 }
 
+static int job_complete (confuga *C)
+{
+	struct list_cursor *cur = list_cursor_create(C->jobs->queue[JOB_REAPED]);
+	struct confuga_job *job;
+
+	for (list_seek(cur, 0); list_get(cur, (void **)&job); list_next(cur)) {
+		if (complete(C, job->id, job->tag))
+			continue;
+		job_refresh(C, job, cur, NULL);
+		C->operations++;
+	}
+	list_cursor_destroy(cur);
+
+	return 0;
+}
+
 static int jkill (confuga *C, chirp_jobid_t id, const char *tag, const char *hostport, chirp_jobid_t cid)
 {
 	static const char SQL[] =
@@ -1693,30 +2095,38 @@ out:
 	return rc;
 }
 
-static int job_kill (confuga *C)
+/* Find jobs killed by their owner. Only the rows of active jobs are examined,
+ * through the index on ConfugaJob.state, not the entire Job table.
+ */
+static int job_killed (confuga *C)
 {
 	static const char SQL[] =
-		"SELECT ConfugaJob.id, ConfugaJob.tag, StorageNode.hostport, ConfugaJob.cid"
-		"	FROM"
-		"		Job"
-		"		INNER JOIN ConfugaJob ON Job.id = ConfugaJob.id"
-		"		LEFT OUTER JOIN Confuga.StorageNode ON ConfugaJob.sid = StorageNode.id"
-		"	WHERE (Job.status = 'KILLED' OR Job.status = 'ERRORED') AND ConfugaJob.state != 'KILLED'"
-		"	ORDER BY RANDOM();"; /* to ensure no starvation, kill may result in a ROLLBACK that aborts this SELECT */
+		"SELECT ConfugaJob.id"
+		"	FROM ConfugaJob INNER JOIN Job ON ConfugaJob.id = Job.id"
+		"	WHERE ConfugaJob.state IN (" JOB_ACTIVE_STATES ") AND (Job.status = 'KILLED' OR Job.status = 'ERRORED');"
+		;
 
 	int rc;
 	sqlite3 *db = C->db;
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
+	struct confuga_jobs *J = C->jobs;
+	time_t now = time(NULL);
+
+	if (now < J->kill_checked+JOB_KILL_INTERVAL) {
+		rc = 0;
+		goto out;
+	}
+	J->kill_checked = now;
 
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		chirp_jobid_t id = sqlite3_column_int64(stmt, 0);
-		const char *tag = (const char *)sqlite3_column_text(stmt, 1);
-		const char *hostport = (const char *)sqlite3_column_text(stmt, 2);
-		chirp_jobid_t cid = sqlite3_column_int64(stmt, 3);
-		jkill(C, id, tag, hostport, cid);
-		C->operations++;
+		struct confuga_job *job = itable_lookup(J->table, sqlite3_column_int64(stmt, 0));
+		if (job && job->queue != J->killed && job->state != JOB_ERRORED) {
+			list_remove(job->queue, job);
+			job->queue = J->killed;
+			list_push_tail(job->queue, job);
+		}
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
 	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
@@ -1728,27 +2138,48 @@ out:
 	return rc;
 }
 
+static int job_kill (confuga *C)
+{
+	struct confuga_jobs *J = C->jobs;
+	struct list *queues[] = {J->queue[JOB_ERRORED], J->killed};
+	unsigned i;
+
+	job_killed(C);
+
+	for (i = 0; i < sizeof(queues)/sizeof(queues[0]); i++) {
+		struct list_cursor *cur = list_cursor_create(queues[i]);
+		struct confuga_job *job;
+		for (list_seek(cur, 0); list_get(cur, (void **)&job); list_next(cur)) {
+			struct confuga_host host;
+			const char *hostport = job_host(C, job->sid, &host) == 0 ? host.hostport : NULL;
+			jkill(C, job->id, job->tag, hostport, job->cid);
+			job_refresh(C, job, cur, NULL);
+			C->operations++;
+		}
+		list_cursor_destroy(cur);
+	}
+
+	return 0;
+}
+
 static int job_stats (confuga *C)
 {
 	static const char SQL[] =
-		"SELECT PRINTF('%s (%d)', ConfugaJob.state, COUNT(ConfugaJob.id))"
-		"	FROM ConfugaJob"
-		"	GROUP BY ConfugaJob.state"
-		"	ORDER BY ConfugaJob.state;"
 		"SELECT COUNT(*)"
 		"	FROM Confuga.StorageNodeActive;"
-		"SELECT COUNT(*)"
-		"	FROM ConfugaJobAllocated;"
-		"SELECT COUNT(*)"
-		"	FROM ConfugaJobExecuting;"
+		"BEGIN TRANSACTION;"
+		"INSERT OR REPLACE INTO Confuga.State (key, value) VALUES (?, ?);"
+		"END TRANSACTION;"
 		;
 
 	int rc;
 	sqlite3 *db = C->db;
 	sqlite3_stmt *stmt = NULL;
 	const char *current = SQL;
+	struct confuga_jobs *J = C->jobs;
 	buffer_t B[1];
 	time_t now = time(NULL);
+	int i, j;
 
 	buffer_init(B);
 
@@ -1758,13 +2189,12 @@ static int job_stats (confuga *C)
 	}
 	C->job_stats = now;
 
-	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
-	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		const char *state = (const char *)sqlite3_column_text(stmt, 0);
-		buffer_putfstring(B, "%s; ", state);
+	for (i = 0; i < JOB_STATE_MAX; i++) {
+		if (list_size(J->queue[i]))
+			buffer_putfstring(B, "%s (%d); ", job_state_names[i], list_size(J->queue[i]));
 	}
-	sqlcatchcode(rc, SQLITE_DONE);
-	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	if (list_size(J->killed))
+		buffer_putfstring(B, "killing (%d); ", list_size(J->killed));
 
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
@@ -1773,27 +2203,77 @@ static int job_stats (confuga *C)
 	sqlcatchcode(rc, SQLITE_DONE);
 	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
 
+	buffer_putfstring(B, "Allocated SN (%" PRIu64 "); ", (uint64_t)(list_size(J->queue[JOB_SCHEDULED]) + list_size(J->queue[JOB_REPLICATED])) + job_executing(J));
+	buffer_putfstring(B, "Executing SN (%" PRIu64 "); ", job_executing(J));
+
+	if (buffer_pos(B))
+		debug(D_DEBUG, "%s", buffer_tostring(B));
+
+	/* Time spent in each state, in power-of-two buckets of seconds, kept
+	 * in Confuga.State for confuga_adm job-stats. */
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
-	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		buffer_putfstring(B, "Allocated SN (%d); ", sqlite3_column_int(stmt, 0));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	for (i = 0; i < JOB_STATE_MAX; i++) {
+		struct histogram *h = J->latency[i];
+		double *buckets;
+		char key[64];
+		if (histogram_size(h) == 0)
+			continue;
+		buffer_rewind(B, 0);
+		buckets = histogram_buckets(h);
+		for (j = 0; j < histogram_size(h); j++)
+			buffer_putfstring(B, "%s<=%gs (%d)", j ? " " : "", pow(2.0, buckets[j]), histogram_count(h, buckets[j]));
+		free(buckets);
+		debug(D_DEBUG, "%s latency: %s", job_state_names[i], buffer_tostring(B));
+
+		snprintf(key, sizeof(key), "job-latency-%s", job_state_names[i]);
+		sqlcatch(sqlite3_bind_text(stmt, 1, key, -1, SQLITE_TRANSIENT));
+		sqlcatch(sqlite3_bind_text(stmt, 2, buffer_tostring(B), -1, SQLITE_TRANSIENT));
+		sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+		sqlcatch(sqlite3_reset(stmt));
 	}
-	sqlcatchcode(rc, SQLITE_DONE);
 	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
 
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	rc = 0;
+	goto out;
+out:
+	buffer_free(B);
+	sqlite3_finalize(stmt);
+	sqlend(db);
+	return rc;
+}
+
+CONFUGA_API int confuga_job_stats (confuga *C, FILE *stream)
+{
+	static const char SQL[] =
+		"SELECT key, value"
+		"	FROM Confuga.State"
+		"	WHERE key LIKE 'job-latency-%'"
+		"	ORDER BY key;"
+		;
+
+	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	const char *current = SQL;
+
 	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
 	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-		buffer_putfstring(B, "Executing SN (%d); ", sqlite3_column_int(stmt, 0));
+		CATCHUNIX(fprintf(stream, "%s: %s\n", (const char *)sqlite3_column_text(stmt, 0), (const char *)sqlite3_column_text(stmt, 1)));
 	}
 	sqlcatchcode(rc, SQLITE_DONE);
 	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
 
-	if (buffer_pos(B))
-		debug(D_DEBUG, "%s", buffer_tostring(B));
-
 	rc = 0;
 	goto out;
 out:
-	buffer_free(B);
 	sqlite3_finalize(stmt);
 	return rc;
 }
@@ -1802,6 +2282,10 @@ CONFUGA_IAPI int confugaJ_schedule (confuga *C)
 {
 	int rc;
 
+	if (C->jobs == NULL)
+		CATCH(jobs_init(C));
+
+	job_sync(C);
 	job_stats(C);
 	job_new(C);
 	job_bind_inputs(C);
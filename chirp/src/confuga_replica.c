@@ -15,11 +15,14 @@ See the file COPYING for details.
 #include "debug.h"
 #include "json.h"
 #include "json_aux.h"
+#include "list.h"
+#include "macros.h"
 #include "nvpair.h"
 #include "sha1.h"
 #include "stringtools.h"
 
 #include <sys/socket.h>
+#include <sys/stat.h>
 
 #include <assert.h>
 #include <errno.h>
@@ -596,40 +599,503 @@ out:
 	return rc;
 }
 
-/* Replica GC, Replica Health, Replication, SN Health */
-static int do_upkeep (confuga *C)
+/* Replica Health: keep every File at its target number of Replica, reclaim
+ * extra, orphaned and corrupt Replica, and move Replica from full to empty
+ * Storage Nodes. It runs every HEALTH_INTERVAL seconds from confugaR_manager.
+ * Replica younger than C->health_trim_age are not trimmed, as they may have
+ * been made for a job, and files younger than C->health_orphan_age are not
+ * reclaimed as orphans.
+ */
+
+#define HEALTH_INTERVAL 30
+#define HEALTH_TRIM_MAX 64 /* Replica trimmed per pass */
+#define HEALTH_ORPHAN_INTERVAL (10*60) /* one SN is searched for orphans per interval, or per orphan age if shorter */
+#define HEALTH_VERIFY_AGE (7*24*60*60) /* a Replica is hashed again after this long */
+#define HEALTH_VERIFY_BYTES (256*1024*1024) /* bytes hashed per pass, past the first Replica */
+#define HEALTH_REBALANCE_MAX 2 /* concurrent rebalancing transfers */
+#define HEALTH_BURST 60 /* seconds of bandwidth rebalancing may save up */
+
+/* Counters in Confuga.State, reported by confuga_health. */
+static int health_count (confuga *C, const char *key, uint64_t n)
 {
+	static const char SQL[] =
+		"INSERT OR REPLACE INTO Confuga.State (key, value)"
+		"	VALUES (?1, IFNULL((SELECT value FROM Confuga.State WHERE key = ?1), 0) + ?2);";
+
 	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	const char *current = SQL;
 
-	/* Replica GC:
-	 *
-	 * SELECT File.id, Replica.sid, last_used
-	 *     FROM (SELECT File.id, Replica.sid, last_used
-	 *               FROM File JOIN Replica ON File.id = Replica.fid
-	 *               GROUP BY File.id
-	 *               HAVING COUNT(Replica.sid) > File.minimum_replicas)
-	 *     WHERE last_used <= datetime('now', '-1 week')
-	 *     ORDER BY last_used
-	 *     LIMIT 1;
-	 *
-	 * Find all replicas that have no associated File (deleted by NM) and haven't been used in 1 month.
-	 *
-	 */
-
-	/* Replica Health:
-	 *
-	 * SELECT fid, sid
-	 *     FROM Replica
-	 *     WHERE time_health <= strftime('%s', 'now', '-7 days')
-	 *     ORDER BY time_health
-	 *
-	 * INSERT INTO ReplicaHealthCheckIntent
-	 *     VALUES (fid, sid, 0);
-	 */
+	if (n == 0) {
+		rc = 0;
+		goto out;
+	}
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC));
+	sqlcatch(sqlite3_bind_int64(stmt, 2, n));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
 
 	rc = 0;
 	goto out;
 out:
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+/* Delete Replica beyond the target of their File, on the fullest Storage Node
+ * first. The Replica becomes a DeadReplica, unlinked later by unlinkthedead.
+ */
+static int health_trim (confuga *C)
+{
+	static const char SQL[] =
+		"WITH"
+		"	FileExtra AS ("
+		"		SELECT File.id"
+		"			FROM"
+		"				Confuga.File"
+		"				JOIN Confuga.Replica ON File.id = Replica.fid"
+		"				JOIN Confuga.StorageNodeActive ON Replica.sid = StorageNodeActive.id"
+		"			GROUP BY File.id"
+		"			HAVING COUNT(Replica.sid) > MAX(File.minimum_replicas, ?1)"
+		"	)"
+		"SELECT Replica.fid, Replica.sid"
+		"	FROM"
+		"		FileExtra"
+		"		JOIN Confuga.Replica ON FileExtra.id = Replica.fid"
+		"		JOIN Confuga.StorageNodeActive ON Replica.sid = StorageNodeActive.id"
+		"	WHERE Replica.time_create < (strftime('%s', 'now')-?2)"
+		"		AND NOT EXISTS (SELECT 1 FROM Confuga.ActiveTransfers WHERE ActiveTransfers.fid = Replica.fid)"
+				/* Keep inputs of jobs allocated to the SN. */
+		"		AND NOT EXISTS ("
+		"			SELECT 1"
+		"				FROM ConfugaInputFile JOIN ConfugaJobAllocated ON ConfugaInputFile.jid = ConfugaJobAllocated.id"
+		"				WHERE ConfugaInputFile.fid = Replica.fid AND ConfugaJobAllocated.sid = Replica.sid"
+		"		)"
+		"	ORDER BY CAST(IFNULL(StorageNodeActive.avail, 0) AS REAL)/MAX(IFNULL(StorageNodeActive.total, 1), 1) ASC"
+		"	LIMIT 1;"
+		;
+
+	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	const char *current = SQL;
+	uint64_t trimmed = 0;
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(sqlite3_bind_int64(stmt, 1, C->replicas));
+	sqlcatch(sqlite3_bind_int64(stmt, 2, C->health_trim_age));
+	while (trimmed < HEALTH_TRIM_MAX) {
+		confuga_fid_t fid;
+		confuga_sid_t sid;
+
+		rc = sqlite3_step(stmt);
+		if (rc == SQLITE_DONE)
+			break;
+		sqlcatchcode(rc, SQLITE_ROW);
+		CATCH(confugaF_set(C, &fid, sqlite3_column_blob(stmt, 0)));
+		sid = sqlite3_column_int64(stmt, 1);
+		sqlcatch(sqlite3_reset(stmt));
+
+		debug(D_CONFUGA, "trimming extra replica fid = " CONFUGA_FID_PRIFMT " sid = " CONFUGA_SID_PRIFMT, CONFUGA_FID_PRIARGS(fid), sid);
+		CATCH(confugaR_delete(C, sid, fid));
+		trimmed++;
+		C->operations++;
+	}
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	rc = 0;
+	goto out;
+out:
+	sqlite3_finalize(stmt);
+	health_count(C, "health-trimmed", trimmed);
+	return rc;
+}
+
+/* Copy a Replica from the fullest to the emptiest Storage Node when their free
+ * space differs by more than C->rebalance percent; health_trim then removes
+ * the copy on the fullest SN. Storage Nodes moving job inputs are left alone
+ * and the transfers are limited to C->health_bandwidth.
+ */
+static int health_rebalance (confuga *C)
+{
+	static const char SQL[] =
+		"SELECT COUNT(*) FROM Confuga.ActiveTransfers WHERE tag = '(rebalance)';"
+		"WITH"
+		"	StorageNodeFree AS ("
+		"		SELECT id, avail, CAST(avail AS REAL)/total AS free"
+		"			FROM Confuga.StorageNodeActive"
+		"			WHERE avail IS NOT NULL AND total > 0"
+		"				AND NOT EXISTS (SELECT 1 FROM Confuga.ActiveTransfers WHERE source = 'JOB' AND (fsid = StorageNodeActive.id OR tsid = StorageNodeActive.id))"
+		"	),"
+		"	Fullest AS (SELECT * FROM StorageNodeFree ORDER BY free ASC LIMIT 1),"
+		"	Emptiest AS (SELECT * FROM StorageNodeFree ORDER BY free DESC LIMIT 1)"
+		"SELECT Replica.fid, Fullest.id, Emptiest.id, File.size"
+		"	FROM"
+		"		Fullest, Emptiest,"
+		"		Confuga.Replica JOIN Confuga.File ON Replica.fid = File.id"
+		"	WHERE Replica.sid = Fullest.id AND (Emptiest.free-Fullest.free)*100.0 > ?1"
+		"		AND File.time_create < (strftime('%s', 'now')-60) AND 0 < File.size AND File.size < Emptiest.avail/2"
+		"		AND NOT EXISTS (SELECT 1 FROM Confuga.Replica AS Target WHERE Target.fid = Replica.fid AND Target.sid = Emptiest.id)"
+		"		AND NOT EXISTS (SELECT 1 FROM Confuga.ActiveTransfers WHERE fid = Replica.fid OR fsid = Fullest.id)"
+				/* Moving the largest File first evens out the SN with the fewest transfers. */
+		"	ORDER BY File.size DESC"
+		"	LIMIT 1;"
+		"INSERT INTO Confuga.TransferJob (state, source, fid, fsid, tsid, tag)"
+		"	VALUES ('NEW', 'HEALTH', ?1, ?2, ?3, '(rebalance)');"
+		;
+
+	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	const char *current = SQL;
+	time_t now = time(NULL);
+	confuga_fid_t fid;
+	confuga_sid_t fsid, tsid;
+	confuga_off_t size;
+
+	if (C->rebalance == 0) {
+		rc = 0;
+		goto out;
+	}
+
+	if (C->health_bandwidth) {
+		double burst = (double)C->health_bandwidth*HEALTH_BURST;
+		C->health_budget += (double)(now-C->health_budget_time)*C->health_bandwidth;
+		if (C->health_budget > burst)
+			C->health_budget = burst;
+		C->health_budget_time = now;
+		if (C->health_budget <= 0) {
+			rc = 0;
+			goto out;
+		}
+	}
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_ROW);
+	if (sqlite3_column_int(stmt, 0) >= HEALTH_REBALANCE_MAX) {
+		rc = 0;
+		goto out;
+	}
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(sqlite3_bind_int64(stmt, 1, C->rebalance));
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_DONE) {
+		rc = 0;
+		goto out;
+	}
+	sqlcatchcode(rc, SQLITE_ROW);
+	CATCH(confugaF_set(C, &fid, sqlite3_column_blob(stmt, 0)));
+	fsid = sqlite3_column_int64(stmt, 1);
+	tsid = sqlite3_column_int64(stmt, 2);
+	size = sqlite3_column_int64(stmt, 3);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(sqlite3_bind_blob(stmt, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
+	sqlcatch(sqlite3_bind_int64(stmt, 2, fsid));
+	sqlcatch(sqlite3_bind_int64(stmt, 3, tsid));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	debug(D_CONFUGA, "rebalancing fid = " CONFUGA_FID_PRIFMT " (%" PRICONFUGA_OFF_T " bytes) from " CONFUGA_SID_DEBFMT " to " CONFUGA_SID_DEBFMT, CONFUGA_FID_PRIARGS(fid), size, fsid, tsid);
+	C->health_budget -= size;
+	C->operations++;
+	health_count(C, "health-rebalanced", 1);
+
+	rc = 0;
+	goto out;
+out:
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
+struct orphans {
+	struct list *names;
+	time_t before;
+	int error;
+};
+
+static void orphan_candidate (const char *name, struct chirp_stat *info, void *arg)
+{
+	struct orphans *O = arg;
+
+	if (S_ISREG(info->cst_mode) && info->cst_mtime < O->before && info->cst_ctime < O->before) {
+		char *copy = strdup(name);
+		if (copy)
+			list_push_tail(O->names, copy);
+		else
+			O->error = errno;
+	}
+}
+
+static int orphan_list (confuga *C, const char *hostport, const char *path, struct list *names)
+{
+	int rc;
+	struct orphans O = {names, time(NULL)-(time_t)C->health_orphan_age, 0};
+
+	CATCHUNIX(chirp_reli_getlongdir(hostport, path, orphan_candidate, &O, time(NULL)+300));
+	CATCH(O.error);
+
+	rc = 0;
+	goto out;
+out:
+	return rc;
+}
+
+/* Search one Storage Node for files Confuga does not know about: Replica left
+ * by failed jobs or transfers and partial transfers in open/.
+ */
+static int health_orphans (confuga *C)
+{
+	static const char SQL[] =
+		"SELECT id, hostport, root"
+		"	FROM Confuga.StorageNodeActive"
+		"	WHERE id > ?"
+		"	ORDER BY id"
+		"	LIMIT 1;"
+		"SELECT EXISTS (SELECT 1 FROM Confuga.Replica WHERE fid = ?1 AND sid = ?2)"
+		"    OR EXISTS (SELECT 1 FROM Confuga.DeadReplica WHERE fid = ?1 AND sid = ?2)"
+		"    OR EXISTS (SELECT 1 FROM Confuga.ActiveTransfers WHERE fid = ?1 AND tsid = ?2)"
+		"    OR EXISTS (SELECT 1 FROM ConfugaOutputFile WHERE fid = ?1);" /* not yet bound to the namespace */
+		"INSERT OR IGNORE INTO Confuga.DeadReplica (fid, sid) VALUES (?1, ?2);"
+		"SELECT EXISTS (SELECT 1 FROM Confuga.ActiveTransfers WHERE tsid = ?1 AND open = ?2);"
+		;
+
+	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	sqlite3_stmt *known = NULL;
+	sqlite3_stmt *dead = NULL;
+	sqlite3_stmt *open = NULL;
+	const char *current = SQL;
+	time_t now = time(NULL);
+	confuga_sid_t sid;
+	struct confuga_host host;
+	struct list *files = NULL;
+	struct list *opens = NULL;
+	char path[CONFUGA_PATH_MAX];
+	char *name;
+	uint64_t found = 0;
+
+	if (now < C->health_orphans+(time_t)MIN(HEALTH_ORPHAN_INTERVAL, C->health_orphan_age)) {
+		rc = 0;
+		goto out;
+	}
+	C->health_orphans = now;
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatch(sqlite3_bind_int64(stmt, 1, C->health_orphans_sid));
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_DONE) {
+		C->health_orphans_sid = 0; /* start over with the next interval */
+		rc = 0;
+		goto out;
+	}
+	sqlcatchcode(rc, SQLITE_ROW);
+	sid = sqlite3_column_int64(stmt, 0);
+	snprintf(host.hostport, sizeof(host.hostport), "%s", (const char *)sqlite3_column_text(stmt, 1));
+	snprintf(host.root, sizeof(host.root), "%s", (const char *)sqlite3_column_text(stmt, 2));
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	C->health_orphans_sid = sid;
+
+	debug(D_DEBUG, "searching " CONFUGA_SID_DEBFMT " for orphaned replicas", sid);
+
+	files = list_create();
+	opens = list_create();
+	CATCHUNIX(files && opens ? 0 : -1);
+	CATCHUNIX(snprintf(path, sizeof(path), "%s/file", host.root));
+	CATCH(orphan_list(C, host.hostport, path, files));
+	CATCHUNIX(snprintf(path, sizeof(path), "%s/open", host.root));
+	CATCH(orphan_list(C, host.hostport, path, opens));
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &known, &current));
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &dead, &current));
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &open, &current));
+
+	while ((name = list_pop_head(files))) {
+		confuga_fid_t fid;
+		const char *end;
+		if (strlen(name) == 2*confugaF_size(fid) && confugaF_extract(C, &fid, name, &end) == 0 && *end == '\0') {
+			sqlcatch(sqlite3_reset(known));
+			sqlcatch(sqlite3_bind_blob(known, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_TRANSIENT));
+			sqlcatch(sqlite3_bind_int64(known, 2, sid));
+			sqlcatchcode(sqlite3_step(known), SQLITE_ROW);
+			if (!sqlite3_column_int(known, 0)) {
+				debug(D_CONFUGA, "found orphaned replica fid = " CONFUGA_FID_PRIFMT " sid = " CONFUGA_SID_PRIFMT, CONFUGA_FID_PRIARGS(fid), sid);
+				sqlcatch(sqlite3_reset(dead));
+				sqlcatch(sqlite3_bind_blob(dead, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_TRANSIENT));
+				sqlcatch(sqlite3_bind_int64(dead, 2, sid));
+				sqlcatchcode(sqlite3_step(dead), SQLITE_DONE);
+				found++;
+			}
+		}
+		free(name);
+	}
+
+	while ((name = list_pop_head(opens))) {
+		CATCHUNIX(snprintf(path, sizeof(path), "%s/open/%s", host.root, name));
+		free(name);
+		sqlcatch(sqlite3_reset(open));
+		sqlcatch(sqlite3_bind_int64(open, 1, sid));
+		sqlcatch(sqlite3_bind_text(open, 2, path, -1, SQLITE_TRANSIENT));
+		sqlcatchcode(sqlite3_step(open), SQLITE_ROW);
+		if (!sqlite3_column_int(open, 0)) {
+			debug(D_CONFUGA, "unlinking abandoned transfer %s on " CONFUGA_SID_DEBFMT, path, sid);
+			if (chirp_reli_unlink(host.hostport, path, STOPTIME) == 0)
+				found++;
+		}
+	}
+
+	rc = 0;
+	goto out;
+out:
+	sqlite3_finalize(stmt);
+	sqlite3_finalize(known);
+	sqlite3_finalize(dead);
+	sqlite3_finalize(open);
+	if (files) {
+		list_free(files);
+		list_delete(files);
+	}
+	if (opens) {
+		list_free(opens);
+		list_delete(opens);
+	}
+	health_count(C, "health-orphans", found);
+	return rc;
+}
+
+/* Have Storage Nodes hash the Replica verified longest ago, since the FID is
+ * the SHA1 of the contents. A missing or corrupt Replica is deleted if the
+ * File has another, which schedule_replication then copies; the only Replica
+ * of a File is kept, as there is nothing to repair it from. Hashing blocks the
+ * manager, so each pass stops after HEALTH_VERIFY_BYTES.
+ */
+static int health_verify (confuga *C)
+{
+	static const char SQL[] =
+		"SELECT Replica.fid, Replica.sid, StorageNodeActive.hostport, StorageNodeActive.root, File.size,"
+		"       (SELECT COUNT(*) FROM Confuga.Replica AS Other WHERE Other.fid = Replica.fid AND Other.sid != Replica.sid)"
+		"	FROM"
+		"		Confuga.Replica"
+		"		JOIN Confuga.File ON Replica.fid = File.id"
+		"		JOIN Confuga.StorageNodeActive ON Replica.sid = StorageNodeActive.id"
+		"	WHERE IFNULL(Replica.time_health, 0) < (strftime('%s', 'now')-?1)"
+		"		AND NOT EXISTS (SELECT 1 FROM Confuga.ActiveTransfers WHERE ActiveTransfers.fid = Replica.fid)"
+		"	ORDER BY IFNULL(Replica.time_health, 0) ASC"
+		"	LIMIT 1;"
+		"UPDATE Confuga.Replica"
+		"	SET time_health = (strftime('%s', 'now'))"
+		"	WHERE fid = ?1 AND sid = ?2;"
+		;
+
+	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	const char *current;
+	uint64_t bytes = 0;
+	uint64_t corrupt = 0;
+
+	while (bytes < HEALTH_VERIFY_BYTES) {
+		confuga_fid_t fid;
+		confuga_sid_t sid;
+		confuga_off_t size;
+		int others;
+		char hostport[CONFUGA_PATH_MAX];
+		char path[CONFUGA_PATH_MAX];
+		unsigned char digest[CHIRP_DIGEST_MAX];
+
+		current = SQL;
+		sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+		sqlcatch(sqlite3_bind_int64(stmt, 1, HEALTH_VERIFY_AGE));
+		rc = sqlite3_step(stmt);
+		if (rc == SQLITE_DONE)
+			break;
+		sqlcatchcode(rc, SQLITE_ROW);
+		CATCH(confugaF_set(C, &fid, sqlite3_column_blob(stmt, 0)));
+		sid = sqlite3_column_int64(stmt, 1);
+		snprintf(hostport, sizeof(hostport), "%s", (const char *)sqlite3_column_text(stmt, 2));
+		CATCHUNIX(snprintf(path, sizeof(path), "%s/file/" CONFUGA_FID_PRIFMT, (const char *)sqlite3_column_text(stmt, 3), CONFUGA_FID_PRIARGS(fid)));
+		size = sqlite3_column_int64(stmt, 4);
+		others = sqlite3_column_int(stmt, 5);
+		sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+		/* about a second per 100MB, and at least a minute */
+		rc = chirp_reli_hash(hostport, path, "sha1", digest, time(NULL)+60+size/(100*1024*1024));
+		if (rc == -1 && errno != ENOENT) {
+			debug(D_DEBUG, "could not verify replica fid = " CONFUGA_FID_PRIFMT " sid = " CONFUGA_SID_PRIFMT ": %s", CONFUGA_FID_PRIARGS(fid), sid, strerror(errno));
+			break; /* try again next pass */
+		}
+		bytes += size;
+		C->operations++;
+
+		if (rc >= 0 && memcmp(digest, confugaF_id(fid), confugaF_size(fid)) == 0) {
+			debug(D_DEBUG, "verified replica fid = " CONFUGA_FID_PRIFMT " sid = " CONFUGA_SID_PRIFMT, CONFUGA_FID_PRIARGS(fid), sid);
+		} else if (others > 0) {
+			debug(D_CONFUGA, "deleting %s replica fid = " CONFUGA_FID_PRIFMT " sid = " CONFUGA_SID_PRIFMT, rc >= 0 ? "corrupt" : "missing", CONFUGA_FID_PRIARGS(fid), sid);
+			CATCH(confugaR_delete(C, sid, fid));
+			corrupt++;
+			continue;
+		} else {
+			/* nothing to repair it from, but don't hash it again every pass */
+			debug(D_NOTICE|D_CONFUGA, "only replica fid = " CONFUGA_FID_PRIFMT " sid = " CONFUGA_SID_PRIFMT " is %s", CONFUGA_FID_PRIARGS(fid), sid, rc >= 0 ? "corrupt" : "missing");
+			corrupt++;
+		}
+
+		sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+		sqlcatch(sqlite3_bind_blob(stmt, 1, confugaF_id(fid), confugaF_size(fid), SQLITE_STATIC));
+		sqlcatch(sqlite3_bind_int64(stmt, 2, sid));
+		sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+		sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	}
+
+	rc = 0;
+	goto out;
+out:
+	sqlite3_finalize(stmt);
+	health_count(C, "health-corrupt", corrupt);
+	return rc;
+}
+
+static int health (confuga *C)
+{
+	static const char SQL[] =
+		/* for schedule_replication and confuga_health */
+		"INSERT OR REPLACE INTO Confuga.State (key, value) VALUES ('replicas', ?);";
+
+	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	const char *current = SQL;
+	time_t now = time(NULL);
+
+	if (now < C->health+HEALTH_INTERVAL) {
+		rc = 0;
+		goto out;
+	}
+
+	if (C->health == 0) {
+		sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+		sqlcatch(sqlite3_bind_int64(stmt, 1, C->replicas));
+		sqlcatchcode(sqlite3_step(stmt), SQLITE_DONE);
+		sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	}
+	C->health = now;
+
+	health_trim(C);
+	health_rebalance(C);
+	health_orphans(C);
+	health_verify(C);
+
+	rc = 0;
+	goto out;
+out:
+	sqlite3_finalize(stmt);
 	return rc;
 }
 
@@ -680,7 +1146,7 @@ static int schedule_replication (confuga *C)
 		"				FROM Confuga.File LEFT OUTER JOIN Replicas ON File.id = Replicas.fid"
 		"				WHERE File.time_create < (strftime('%s', 'now')-60)"
 		"				GROUP BY File.id"
-		"				HAVING COUNT(Replicas.sid) < File.minimum_replicas"
+		"				HAVING COUNT(Replicas.sid) < MAX(File.minimum_replicas, IFNULL((SELECT value FROM Confuga.State WHERE key = 'replicas'), 1))"
 						/* We want to focus on degraded files which have low replica counts. */
 		"				ORDER BY count ASC"
 						/* This is an optimization because the complete SELECT query is limited to 1. */
@@ -1561,10 +2027,94 @@ out:
 	return rc;
 }
 
+CONFUGA_API int confuga_health (confuga *C, FILE *stream)
+{
+	static const char SQL[] =
+		"SELECT StorageNode.id, IFNULL(StorageNode.hostport, StorageNode.uuid), StorageNode.state, StorageNode.avail, StorageNode.total,"
+		"       (SELECT COUNT(*) FROM Confuga.Replica WHERE Replica.sid = StorageNode.id),"
+		"       (SELECT IFNULL(SUM(File.size), 0) FROM Confuga.Replica JOIN Confuga.File ON Replica.fid = File.id WHERE Replica.sid = StorageNode.id),"
+		"       (SELECT COUNT(*) FROM Confuga.DeadReplica WHERE DeadReplica.sid = StorageNode.id),"
+		"       (SELECT COUNT(*) FROM Confuga.ActiveTransfers WHERE ActiveTransfers.tsid = StorageNode.id),"
+		"       (SELECT COUNT(*) FROM Confuga.ActiveTransfers WHERE ActiveTransfers.fsid = StorageNode.id)"
+		"	FROM Confuga.StorageNode"
+		"	ORDER BY StorageNode.id;"
+		"WITH"
+		"	Target AS ("
+		"		SELECT IFNULL((SELECT value FROM Confuga.State WHERE key = 'replicas'), 1) AS n, (SELECT COUNT(*) FROM Confuga.StorageNodeActive) AS nodes"
+		"	),"
+		"	FileReplicaCount AS ("
+		"		SELECT File.id, MIN(MAX(File.minimum_replicas, Target.n), Target.nodes) AS target, COUNT(StorageNodeActive.id) AS count"
+		"			FROM"
+		"				Target,"
+		"				Confuga.File"
+		"				LEFT OUTER JOIN Confuga.Replica ON File.id = Replica.fid"
+		"				LEFT OUTER JOIN Confuga.StorageNodeActive ON Replica.sid = StorageNodeActive.id"
+		"			GROUP BY File.id"
+		"	)"
+		"SELECT (SELECT n FROM Target), COUNT(*), IFNULL(SUM(count < target), 0), IFNULL(SUM(count > target), 0)"
+		"	FROM FileReplicaCount;"
+		"SELECT CASE WHEN source = 'JOB' THEN '(job)' ELSE tag END AS kind, COUNT(*)"
+		"	FROM Confuga.ActiveTransfers"
+		"	GROUP BY kind"
+		"	ORDER BY kind;"
+		"SELECT key, value"
+		"	FROM Confuga.State"
+		"	WHERE key LIKE 'health-%'"
+		"	ORDER BY key;"
+		;
+
+	int rc;
+	sqlite3 *db = C->db;
+	sqlite3_stmt *stmt = NULL;
+	const char *current = SQL;
+	char size[100];
+
+	CATCHUNIX(fprintf(stream, "storage nodes:\n"));
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		const char *name = (const char *)sqlite3_column_text(stmt, 1);
+		CATCHUNIX(fprintf(stream, "  " CONFUGA_SID_DEBFMT " %s %s", (confuga_sid_t)sqlite3_column_int64(stmt, 0), name ? name : "(unknown)", (const char *)sqlite3_column_text(stmt, 2)));
+		if (sqlite3_column_int64(stmt, 4) > 0)
+			CATCHUNIX(fprintf(stream, " free %.1f%%", 100.0*sqlite3_column_int64(stmt, 3)/sqlite3_column_int64(stmt, 4)));
+		string_metric(sqlite3_column_int64(stmt, 6), -1, size);
+		CATCHUNIX(fprintf(stream, " replicas %" PRId64 " (%sB) dead %" PRId64 " transfers in %" PRId64 " out %" PRId64 "\n", (int64_t)sqlite3_column_int64(stmt, 5), size, (int64_t)sqlite3_column_int64(stmt, 7), (int64_t)sqlite3_column_int64(stmt, 8), (int64_t)sqlite3_column_int64(stmt, 9)));
+	}
+	sqlcatchcode(rc, SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	sqlcatchcode(sqlite3_step(stmt), SQLITE_ROW);
+	CATCHUNIX(fprintf(stream, "files: %" PRId64 " target replicas %" PRId64 " under-replicated %" PRId64 " over-replicated %" PRId64 "\n", (int64_t)sqlite3_column_int64(stmt, 1), (int64_t)sqlite3_column_int64(stmt, 0), (int64_t)sqlite3_column_int64(stmt, 2), (int64_t)sqlite3_column_int64(stmt, 3)));
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	CATCHUNIX(fprintf(stream, "active transfers:"));
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		CATCHUNIX(fprintf(stream, " %s (%d)", (const char *)sqlite3_column_text(stmt, 0), sqlite3_column_int(stmt, 1)));
+	}
+	sqlcatchcode(rc, SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+	CATCHUNIX(fprintf(stream, "\n"));
+
+	sqlcatch(sqlite3_prepare_v2(db, current, -1, &stmt, &current));
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		CATCHUNIX(fprintf(stream, "%s: %s\n", (const char *)sqlite3_column_text(stmt, 0), (const char *)sqlite3_column_text(stmt, 1)));
+	}
+	sqlcatchcode(rc, SQLITE_DONE);
+	sqlcatch(sqlite3_finalize(stmt); stmt = NULL);
+
+	rc = 0;
+	goto out;
+out:
+	sqlite3_finalize(stmt);
+	return rc;
+}
+
 CONFUGA_IAPI int confugaR_manager (confuga *C)
 {
 	int rc;
 
+	health(C);
 	schedule_replication(C);
 
 	transfer_stats(C);
@@ -1577,8 +2127,6 @@ CONFUGA_IAPI int confugaR_manager (confuga *C)
 
 	unlinkthedead(C);
 
-	(void)do_upkeep;
-
 	rc = 0;
 	goto out;
 out:
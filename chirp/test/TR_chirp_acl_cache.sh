@@ -0,0 +1,63 @@
+#!/bin/sh
+
+set -e
+
+. ../../dttools/test/test_runner_common.sh
+. ./chirp-common.sh
+
+c="./hostport.$PPID"
+cr="./root.$PPID"
+
+prepare()
+{
+	# a handler keeps its acl cache for a whole session, and between sessions unless it changes users.
+	chirp_start local --auth=address --pool-size=1
+	echo "$hostport" > "$c"
+	echo "$root" > "$cr"
+	return 0
+}
+
+run()
+{
+	hostport=$(cat "$c")
+	root=$(cat "$cr")
+
+	chirp -a unix "$hostport" mkdir /d
+	chirp -a unix "$hostport" put /etc/hosts /d/hosts
+	chirp -a unix "$hostport" setacl /d address:127.0.0.1 rl
+
+	# acl files changed in the last seconds are not cached.
+	sleep 3
+
+	chirp -a address "$hostport" <<EOF
+ls /d
+ls /d
+stat /d/hosts
+get /d/hosts acl_cache.get
+EOF
+	cmp /etc/hosts acl_cache.get
+
+	# a change through chirp is seen at once.
+	chirp -a unix "$hostport" setacl /d address:127.0.0.1 none
+	chirp -a address "$hostport" ls /d && return 1
+	chirp -a unix "$hostport" setacl /d address:127.0.0.1 rl
+	sleep 3
+	chirp -a address "$hostport" ls /d
+
+	# and so is a change made to the acl file directly.
+	echo "unix:nobody rl" > "$root"/d/.__acl
+	chirp -a address "$hostport" ls /d && return 1
+
+	return 0
+}
+
+clean()
+{
+	chirp_clean
+	rm -f "$c" "$cr" acl_cache.get
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,70 @@
+#!/bin/sh
+
+# Writers in separate server processes share one allocation: of eight
+# concurrent 64KB puts into a 256KB allocation, exactly four must fit. The
+# allocation is then removed and created again with another size, which must
+# not inherit the old one's accounting.
+
+set -ex
+
+. ../../dttools/test/test_runner_common.sh
+. ./chirp-common.sh
+
+c1="./hostport.1.$PPID"
+WRITERS=8
+
+prepare()
+{
+	chirp_start local --root-quota=1048576
+	echo "$hostport" > "$c1"
+	return 0
+}
+
+run()
+{
+	if ! [ -s "$c1" ]; then
+		return 0
+	fi
+	hostport1=$(cat "$c1")
+	local i ok
+
+	chirp "$hostport1" mkalloc /a 262144 || return 1
+
+	dd if=/dev/zero of=alloc.64k bs=64k count=1
+	i=0
+	while [ $i -lt $WRITERS ]; do
+		(chirp "$hostport1" put alloc.64k /a/f$i > alloc.out.$i 2>&1; echo $? > alloc.status.$i) &
+		i=$((i+1))
+	done
+	wait
+
+	ok=0
+	i=0
+	while [ $i -lt $WRITERS ]; do
+		[ "$(cat alloc.status.$i)" -eq 0 ] && ok=$((ok+1))
+		i=$((i+1))
+	done
+	[ $ok -eq 4 ] || return 1
+	chirp "$hostport1" lsalloc /a | grep '^256.0 KB INUSE$' || return 1
+
+	chirp "$hostport1" rm /a || return 1
+	chirp "$hostport1" mkalloc /a 131072 || return 1
+	chirp "$hostport1" lsalloc /a | grep '^128.0 KB TOTAL$' || return 1
+	chirp "$hostport1" lsalloc /a | grep '^0.0 *B INUSE$' || return 1
+	chirp "$hostport1" put alloc.64k /a/f0 || return 1
+	chirp "$hostport1" put alloc.64k /a/f1 || return 1
+	chirp "$hostport1" put alloc.64k /a/f2 && return 1
+
+	return 0
+}
+
+clean()
+{
+	chirp_clean
+	rm -f "$c1" alloc.64k alloc.out.* alloc.status.*
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,149 @@
+#!/bin/sh
+
+# Exercise the asynchronous requests of chirp_client directly: several requests
+# in flight waited for in reverse order, a synchronous call made while requests
+# are outstanding, and a disconnect with requests pending, which must fail them
+# without touching the connection again.
+
+set -e
+
+. ../../dttools/test/test_runner_common.sh
+. ./chirp-common.sh
+
+c="./hostport.$PPID"
+exe="async.test"
+
+prepare()
+{
+	chirp_start local
+	echo "$hostport" > "$c"
+
+	${CC} -I../src/ -I../../dttools/src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libchirp.a ../../dttools/src/libdttools.a -lm -lz -lpthread -ldl -lresolv <<EOF
+#include "chirp_client.h"
+#include "chirp_types.h"
+#include "auth_all.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIZE (1<<20)
+#define BLOCK (64<<10)
+#define N 8
+
+static char data[SIZE];
+
+static void check_block(const char *buffer, INT64_T result, INT64_T offset)
+{
+	if(result != BLOCK)
+		fatal("read %lld bytes at %lld instead of %d: %s", (long long) result, (long long) offset, BLOCK, strerror(errno));
+	if(memcmp(buffer, data + offset, BLOCK))
+		fatal("wrong data at %lld", (long long) offset);
+}
+
+int main(int argc, char *argv[])
+{
+	struct chirp_client *c;
+	struct chirp_client_request *r[N], *rstat, *rbad;
+	struct chirp_stat info;
+	static char buffers[N][BLOCK];
+	char buffer[BLOCK];
+	time_t stoptime = time(0) + 60;
+	INT64_T fd, result;
+	int i;
+
+	/* a hang fails the test. */
+	alarm(60);
+
+	for(i = 0; i < SIZE; i++)
+		data[i] = rand();
+
+	auth_register_all();
+	c = chirp_client_connect(argv[1], 1, stoptime);
+	if(!c)
+		fatal("couldn't connect to %s: %s", argv[1], strerror(errno));
+
+	if(chirp_client_putfile_buffer(c, "/async", data, 0644, SIZE, stoptime) != SIZE)
+		fatal("couldn't put /async: %s", strerror(errno));
+	fd = chirp_client_open(c, "/async", O_RDONLY, 0, &info, stoptime);
+	if(fd < 0)
+		fatal("couldn't open /async: %s", strerror(errno));
+
+	/* several requests in flight, waited for in reverse order, with a failing one among them. */
+	for(i = 0; i < N; i++) {
+		r[i] = chirp_client_pread_async(c, fd, buffers[i], BLOCK, (INT64_T) (N-1-i) * BLOCK * 2, stoptime);
+		if(!r[i])
+			fatal("couldn't send request %d: %s", i, strerror(errno));
+		if(i == N/2) {
+			rbad = chirp_client_pread_async(c, fd+100, buffer, BLOCK, 0, stoptime);
+			rstat = chirp_client_fstat_async(c, fd, &info, stoptime);
+			if(!rbad || !rstat)
+				fatal("couldn't send requests: %s", strerror(errno));
+		}
+	}
+	if(chirp_client_requests_outstanding(c) != N+2)
+		fatal("%d requests outstanding instead of %d", chirp_client_requests_outstanding(c), N+2);
+
+	result = chirp_client_request_wait(c, rstat, stoptime);
+	if(result < 0 || info.cst_size != SIZE)
+		fatal("fstat returned %lld with size %lld", (long long) result, (long long) info.cst_size);
+	for(i = 0; i <= N/2; i++)
+		if(!chirp_client_request_done(r[i]))
+			fatal("request %d sent before fstat is not done", i);
+	for(i = N-1; i >= 0; i--)
+		check_block(buffers[i], chirp_client_request_wait(c, r[i], stoptime), (INT64_T) (N-1-i) * BLOCK * 2);
+	if(chirp_client_request_wait(c, rbad, stoptime) >= 0)
+		fatal("pread of a bad fd did not fail");
+	if(chirp_client_requests_outstanding(c) != 0)
+		fatal("requests still outstanding");
+
+	/* a synchronous call reads the replies of the requests before it. */
+	for(i = 0; i < N; i++)
+		r[i] = chirp_client_pread_async(c, fd, buffers[i], BLOCK, (INT64_T) i * BLOCK, stoptime);
+	check_block(buffer, chirp_client_pread(c, fd, buffer, BLOCK, 3 * BLOCK, stoptime), 3 * BLOCK);
+	if(chirp_client_requests_outstanding(c) != 0)
+		fatal("%d requests outstanding after a synchronous call", chirp_client_requests_outstanding(c));
+	for(i = 0; i < N; i++) {
+		if(!chirp_client_request_done(r[i]))
+			fatal("request %d is not done after a synchronous call", i);
+		check_block(buffers[i], chirp_client_request_wait(c, r[i], stoptime), (INT64_T) i * BLOCK);
+	}
+
+	/* a disconnect fails the pending requests, which are then waited for without the client. */
+	for(i = 0; i < N; i++)
+		r[i] = chirp_client_pread_async(c, fd, buffers[i], BLOCK, (INT64_T) i * BLOCK, stoptime);
+	chirp_client_disconnect(c);
+	for(i = 0; i < N; i++) {
+		if(!chirp_client_request_done(r[i]))
+			fatal("request %d is not done after disconnect", i);
+		if(chirp_client_request_wait(NULL, r[i], stoptime) >= 0 || errno != ECONNRESET)
+			fatal("request %d did not fail with ECONNRESET: %s", i, strerror(errno));
+	}
+
+	return 0;
+}
+EOF
+	return 0
+}
+
+run()
+{
+	hostport=$(cat "$c")
+	"./$exe" "$hostport"
+}
+
+clean()
+{
+	chirp_clean
+	rm -f "$c" "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,53 @@
+#!/bin/sh
+
+set -e
+
+. ../../dttools/test/test_runner_common.sh
+. ./chirp-common.sh
+
+c="./hostport.$PPID"
+
+prepare()
+{
+	chirp_start local --pool-size=2
+	echo "$hostport" > "$c"
+	return 0
+}
+
+run()
+{
+	hostport=$(cat "$c")
+
+	chirp "$hostport" put /etc/hosts /hosts
+
+	# more clients than handlers, one after the other and then at once.
+	for i in 1 2 3 4 5 6; do
+		../../chirp/src/chirp_get "$hostport" /hosts pool.get.$i
+		cmp /etc/hosts pool.get.$i
+	done
+
+	pids=""
+	for i in 1 2 3 4 5 6; do
+		../../chirp/src/chirp_get "$hostport" /hosts pool.get.$i &
+		pids="$pids $!"
+	done
+	for pid in $pids; do
+		wait $pid
+	done
+	for i in 1 2 3 4 5 6; do
+		cmp /etc/hosts pool.get.$i
+	done
+
+	return 0
+}
+
+clean()
+{
+	chirp_clean
+	rm -f "$c" pool.get.*
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
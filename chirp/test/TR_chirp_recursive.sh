@@ -0,0 +1,47 @@
+#!/bin/sh
+
+set -e
+
+. ../../dttools/test/test_runner_common.sh
+. ./chirp-common.sh
+
+c="./hostport.$PPID"
+
+prepare()
+{
+	chirp_start local
+	echo "$hostport" > "$c"
+
+	mkdir -p recursive.src/a/b
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		echo "file $i" > recursive.src/file.$i
+		echo "file $i" > recursive.src/a/file.$i
+	done
+	cp /etc/hosts recursive.src/a/b/hosts
+	ln -s file.1 recursive.src/link
+	return 0
+}
+
+run()
+{
+	hostport=$(cat "$c")
+
+	# the entries of each directory are examined with a single bulkstat.
+	../../chirp/src/chirp_put recursive.src "$hostport" /recursive
+	../../chirp/src/chirp_get "$hostport" /recursive recursive.dst
+	diff -r recursive.src recursive.dst
+	[ "$(readlink recursive.dst/link)" = file.1 ]
+
+	return 0
+}
+
+clean()
+{
+	chirp_clean
+	rm -rf "$c" recursive.src recursive.dst
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
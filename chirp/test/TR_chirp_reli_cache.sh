@@ -0,0 +1,163 @@
+#!/bin/sh
+
+# Exercise the block cache and write behind of chirp_reli: sequential reads
+# must be served from blocks read ahead, random reads must not read ahead, a
+# write must be seen by a later read of the same block, and a write behind
+# that fails for lack of space must be reported by close. The counters kept in
+# the stats module must agree.
+
+set -e
+
+. ../../dttools/test/test_runner_common.sh
+. ./chirp-common.sh
+
+c="./hostport.$PPID"
+exe="reli_cache.test"
+
+prepare()
+{
+	chirp_start local --root-quota=4194304
+	echo "$hostport" > "$c"
+
+	${CC} -I../src/ -I../../dttools/src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libchirp.a ../../dttools/src/libdttools.a -lm -lz -lpthread -ldl -lresolv <<EOF
+#include "chirp_reli.h"
+#include "auth_all.h"
+#include "debug.h"
+#include "jx.h"
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIZE (2<<20)
+#define BLOCK (64<<10)
+#define SMALL 4096
+
+static char data[SIZE];
+
+static INT64_T counter(const char *name)
+{
+	char key[64];
+	struct jx *j = stats_get();
+	INT64_T value;
+
+	snprintf(key, sizeof(key), "chirp.reli.%s", name);
+	value = jx_lookup_integer(j, key);
+	jx_delete(j);
+
+	return value;
+}
+
+static void check_read(struct chirp_file *file, INT64_T offset, time_t stoptime)
+{
+	char buffer[SMALL];
+	INT64_T result = chirp_reli_pread(file, buffer, SMALL, offset, stoptime);
+	if(result != SMALL)
+		fatal("read %lld bytes at %lld instead of %d: %s", (long long) result, (long long) offset, SMALL, strerror(errno));
+	if(memcmp(buffer, data + offset, SMALL))
+		fatal("wrong data at %lld", (long long) offset);
+}
+
+int main(int argc, char *argv[])
+{
+	struct chirp_file *file;
+	time_t stoptime = time(0) + 60;
+	INT64_T offset, prefetches, misses;
+	char buffer[SMALL];
+	int i;
+
+	/* a hang fails the test. */
+	alarm(60);
+
+	for(i = 0; i < SIZE; i++)
+		data[i] = rand();
+
+	stats_enable();
+	auth_register_all();
+
+	if(chirp_reli_putfile_buffer(argv[1], "/reli", data, 0644, SIZE, stoptime) != SIZE)
+		fatal("couldn't put /reli: %s", strerror(errno));
+	file = chirp_reli_open(argv[1], "/reli", O_RDWR, 0, stoptime);
+	if(!file)
+		fatal("couldn't open /reli: %s", strerror(errno));
+
+	/* sequential reads are served from the blocks read ahead. */
+	for(offset = 0; offset < SIZE; offset += SMALL)
+		check_read(file, offset, stoptime);
+	if(counter("prefetches") < SIZE / BLOCK / 2)
+		fatal("%lld blocks read ahead", (long long) counter("prefetches"));
+	if(counter("prefetch_hits") < SIZE / BLOCK / 2)
+		fatal("%lld blocks read ahead were read", (long long) counter("prefetch_hits"));
+	if(counter("hits") < SIZE / SMALL - SIZE / BLOCK)
+		fatal("%lld reads hit the cache", (long long) counter("hits"));
+	if(counter("misses") > 2)
+		fatal("%lld sequential reads missed the cache", (long long) counter("misses"));
+
+	/* random reads into blocks no longer cached miss, and do not read ahead. */
+	prefetches = counter("prefetches");
+	misses = counter("misses");
+	for(i = 0; i < 8; i++)
+		check_read(file, (INT64_T) (i * 5 % 8) * BLOCK + 100, stoptime);
+	if(counter("misses") != misses + 8)
+		fatal("%lld random reads missed instead of 8", (long long) (counter("misses") - misses));
+	if(counter("prefetches") != prefetches)
+		fatal("random reads were read ahead");
+
+	/* a write into a cached block is seen by an overlapping read. */
+	offset = 3 * BLOCK + 100;
+	check_read(file, offset, stoptime);
+	for(i = 0; i < SMALL; i++)
+		data[offset + SMALL / 2 + i] = ~data[offset + SMALL / 2 + i];
+	if(chirp_reli_pwrite(file, data + offset + SMALL / 2, SMALL, offset + SMALL / 2, stoptime) != SMALL)
+		fatal("couldn't write /reli: %s", strerror(errno));
+	check_read(file, offset, stoptime);
+	if(chirp_reli_pread_unbuffered(file, buffer, SMALL, offset + SMALL / 2, stoptime) != SMALL || memcmp(buffer, data + offset + SMALL / 2, SMALL))
+		fatal("write was not sent to the server");
+	if(chirp_reli_close(file, stoptime) < 0)
+		fatal("couldn't close /reli: %s", strerror(errno));
+
+	/* the writes behind past the end of the allocation fail, and close reports it. */
+	file = chirp_reli_open(argv[1], "/a/f", O_WRONLY|O_CREAT|O_TRUNC, 0644, stoptime);
+	if(!file)
+		fatal("couldn't open /a/f: %s", strerror(errno));
+	for(offset = 0; offset < 8 * BLOCK; offset += SMALL) {
+		if(chirp_reli_pwrite(file, data + offset, SMALL, offset, stoptime) != SMALL)
+			fatal("write at %lld failed before close: %s", (long long) offset, strerror(errno));
+	}
+	if(counter("writes_behind") != 8)
+		fatal("%lld writes behind instead of 8", (long long) counter("writes_behind"));
+	if(chirp_reli_close(file, stoptime) == 0)
+		fatal("close did not report the failed writes behind");
+	if(errno != ENOSPC)
+		fatal("close failed with %s instead of ENOSPC", strerror(errno));
+	if(counter("write_retries") < 1)
+		fatal("failed writes behind were not sent again");
+
+	return 0;
+}
+EOF
+	return 0
+}
+
+run()
+{
+	hostport=$(cat "$c")
+	chirp "$hostport" mkalloc /a 262144
+	"./$exe" "$hostport"
+}
+
+clean()
+{
+	chirp_clean
+	rm -f "$c" "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,50 @@
+#!/bin/sh
+
+set -e
+
+. ../../dttools/test/test_runner_common.sh
+. ./chirp-common.sh
+
+c="./hostport.$PPID"
+
+prepare()
+{
+	chirp_start local
+	echo "$hostport" > "$c"
+
+	dd if=/dev/urandom of=stripe.src bs=1048576 count=24
+	return 0
+}
+
+run()
+{
+	hostport=$(cat "$c")
+
+	../../chirp/src/chirp_put -p 4 stripe.src "$hostport" /stripe.4
+	../../chirp/src/chirp_put -p auto stripe.src "$hostport" /stripe.auto
+	../../chirp/src/chirp_get -p 3 "$hostport" /stripe.4 stripe.get.4
+	../../chirp/src/chirp_get -p auto "$hostport" /stripe.auto stripe.get.auto
+	cmp stripe.src stripe.get.4
+	cmp stripe.src stripe.get.auto
+
+	# an empty file needs no chunks at all.
+	: > stripe.empty
+	../../chirp/src/chirp_put -p 2 stripe.empty "$hostport" /stripe.empty
+	../../chirp/src/chirp_get -p 2 "$hostport" /stripe.empty stripe.get.empty
+	cmp stripe.empty stripe.get.empty
+
+	../../chirp/src/chirp_get -p 2 "$hostport" /missing stripe.get.missing && return 1
+
+	return 0
+}
+
+clean()
+{
+	chirp_clean
+	rm -f "$c" stripe.src stripe.empty stripe.get.*
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
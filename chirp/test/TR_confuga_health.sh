@@ -0,0 +1,92 @@
+#!/bin/sh
+
+# Keep a file at two replicas on a two node Confuga cluster and check that the
+# storage nodes verify both against the file's checksum. Then restart the head
+# node with a target of one replica and check that the extra replica is
+# trimmed, and that a file unknown to Confuga on a storage node is reclaimed.
+
+. ../../dttools/test/test_runner_common.sh
+. ./confuga-common.sh
+
+c="./hostport.$PPID"
+
+chirp() {
+	../src/chirp -a hostname "$@"
+}
+
+# replicas of the file with this content on the storage nodes
+replicas() {
+	ls "$cluster"/sn*.root/.confuga/file/"$(fid "$1")" 2> /dev/null | wc -l
+}
+
+fid() {
+	printf '%s' "$1" | sha1sum | cut -d ' ' -f 1 | tr a-f A-F
+}
+
+counter() {
+	confuga_adm "$confuga" health | sed -n "s/^$1: //p"
+}
+
+prepare()
+{
+	confuga_start 2 'replicas=2&trim-age=1&orphan-age=2' || return 1
+	echo "$hostport $cluster" > "$c"
+	return 0
+}
+
+run()
+{
+	read hostport cluster < "$c"
+	confuga="confuga://$cluster/root/"
+	local i orphan
+
+	printf '%s' "healthy file" | chirp "$hostport" put /dev/stdin /file || return 1
+
+	# A file is only replicated once it is a minute old; health runs every 30s.
+	i=0
+	until [ "$(replicas "healthy file")" -eq 2 ] && [ "$(grep -c "verified replica fid = $(fid "healthy file")" "$cluster/head.debug")" -ge 2 ]; do
+		i=$((i+1))
+		[ $i -lt 180 ] || return 1
+		sleep 1
+	done
+	[ -z "$(counter health-corrupt)" ] || return 1
+
+	orphan="$cluster/sn1.root/.confuga/file/$(fid "orphan")"
+	printf '%s' "orphan" > "$orphan"
+	if [ "$(id -u)" -eq 0 ]; then
+		chown 9999 "$orphan"
+	fi
+
+	kill "$(cat "$cluster/head.pid")" || return 1
+	i=0
+	while kill -0 "$(cat "$cluster/head.pid")" 2> /dev/null; do
+		i=$((i+1))
+		[ $i -lt 10 ] || return 1
+		sleep 1
+	done
+	rm -rf "$cluster/head.root" "$cluster/head.transient" "$cluster/head.pid" "$cluster/head.port"
+	confuga_server head --root="$confuga?auth=hostname&replicas=1&trim-age=1&orphan-age=2" || return 1
+	wait_for_file_creation "$cluster/head.port" 5 || return 1
+
+	i=0
+	until [ "$(replicas "healthy file")" -eq 1 ] && [ ! -e "$orphan" ]; do
+		i=$((i+1))
+		[ $i -lt 180 ] || return 1
+		sleep 1
+	done
+	[ "$(counter health-trimmed)" -eq 1 ] || return 1
+	[ "$(counter health-orphans)" -ge 1 ] || return 1
+	[ "$(chirp "$hostport" cat /file)" = "healthy file" ] || return 1
+	confuga_adm "$confuga" health
+}
+
+clean()
+{
+	confuga_clean
+	rm -f "$c"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
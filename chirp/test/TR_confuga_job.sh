@@ -0,0 +1,73 @@
+#!/bin/sh
+
+# Run a batch of jobs through a two node Confuga cluster allowing three jobs
+# per storage node, and check their outputs and the scheduler latencies
+# reported by confuga_adm job-stats.
+
+. ../../dttools/test/test_runner_common.sh
+. ./confuga-common.sh
+
+c="./hostport.$PPID"
+JOBS=6
+
+chirp() {
+	../src/chirp -a hostname "$@"
+}
+
+prepare()
+{
+	confuga_start 2 slots=3 || return 1
+	echo "$hostport $cluster" > "$c"
+	return 0
+}
+
+run()
+{
+	read hostport cluster < "$c"
+	confuga="confuga://$cluster/root/"
+	local i jobs
+
+	jobs=""
+	i=0
+	while [ $i -lt $JOBS ]; do
+		echo "input $i" | chirp "$hostport" put /dev/stdin "/input.$i" || return 1
+		jobs="$jobs${jobs:+,}$(chirp "$hostport" job_create "{\"executable\": \"/bin/sh\", \"arguments\": [\"sh\", \"-c\", \"cat input > output\"], \"files\": [{\"serv_path\": \"/input.$i\", \"task_path\": \"input\", \"type\": \"INPUT\"}, {\"serv_path\": \"/output.$i\", \"task_path\": \"output\", \"type\": \"OUTPUT\"}]}")" || return 1
+		i=$((i+1))
+	done
+	chirp "$hostport" job_commit "[$jobs]" || return 1
+
+	i=0
+	while [ "$(chirp "$hostport" job_status "[$jobs]" | grep -o '"status":"FINISHED"' | wc -l)" -lt $JOBS ]; do
+		i=$((i+1))
+		[ $i -lt 60 ] || return 1
+		sleep 1
+	done
+	[ "$(chirp "$hostport" job_status "[$jobs]" | grep -o '"exit_code":0' | wc -l)" -eq $JOBS ] || return 1
+	chirp "$hostport" job_reap "[$jobs]" || return 1
+
+	i=0
+	while [ $i -lt $JOBS ]; do
+		[ "$(chirp "$hostport" cat "/output.$i")" = "input $i" ] || return 1
+		i=$((i+1))
+	done
+
+	# Every job waited to be scheduled; the head node stores the latencies every 30s.
+	i=0
+	until confuga_adm "$confuga" job-stats | grep '^job-latency-BOUND_INPUTS: <=.*s ([0-9]*)$'; do
+		i=$((i+1))
+		[ $i -lt 45 ] || return 1
+		sleep 1
+	done
+	confuga_adm "$confuga" job-stats
+}
+
+clean()
+{
+	confuga_clean
+	rm -f "$c"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
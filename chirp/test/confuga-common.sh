@@ -0,0 +1,92 @@
+. ./chirp-common.sh
+
+# Start a Confuga cluster on this host: a catalog server, storage nodes and a
+# head node reporting to it. Everything is kept under one ./confuga.XXXXXX
+# directory. On success, $hostport is the head node, $confuga its Confuga URI
+# without options, and $cluster the directory.
+#
+#     confuga_start <nodes> [URI options]
+
+confuga_adm() {
+	verbose ../../chirp/src/confuga_adm "$@"
+	result=$?
+	if [ "$(id -u)" -eq 0 ]; then
+		# the head node runs as 9999 and shares the database with confuga_adm.
+		chown -R 9999 "$cluster/root"
+	fi
+	return $result
+}
+
+confuga_server() {
+	local name=$1
+	shift
+	mkdir "$cluster/$name.root" "$cluster/$name.transient"
+	touch "$cluster/$name.debug"
+	if [ "$(id -u)" -eq 0 ]; then
+		chown 9999 "$cluster/$name.root" "$cluster/$name.transient" "$cluster/$name.debug"
+		set -- --user=9999 "$@"
+	fi
+	chirp_server --advertise="127.0.0.1:$(cat "$cluster/catalog.port")" --auth=hostname --background --catalog-update=2s --debug=all --debug-file="$cluster/$name.debug" --debug-rotate-max=0 --default-acl="$cluster/acl" --interface=127.0.0.1 --jobs --pid-file="$cluster/$name.pid" --port-file="$cluster/$name.port" --transient="$cluster/$name.transient" "$@"
+}
+
+confuga_start() {
+	local nodes=$1
+	local options=$2
+	local i
+
+	cluster=$(mktemp -d "$PWD/confuga.XXXXXX")
+	confuga="confuga://$cluster/root/"
+	echo 'hostname:* rwlda' > "$cluster/acl"
+	if [ "$(id -u)" -eq 0 ]; then
+		chown 9999 "$cluster" "$cluster/acl"
+	fi
+
+	verbose ../../dttools/src/catalog_server --background --debug-file="$cluster/catalog.debug" --history="$cluster/catalog.history" --interface=127.0.0.1 --pid-file="$cluster/catalog.pid" --port-file="$cluster/catalog.port" --update-host=127.0.0.1:1 || return 1
+	wait_for_file_creation "$cluster/catalog.port" 5 || return 1
+
+	i=1
+	while [ $i -le "$nodes" ]; do
+		confuga_server sn$i --job-concurrency=10 --root="$cluster/sn$i.root" || return 1
+		wait_for_file_creation "$cluster/sn$i.port" 5 || return 1
+		i=$((i+1))
+	done
+
+	# storage nodes must be known to the catalog before they are added.
+	sleep 3
+	mkdir "$cluster/root"
+	i=1
+	while [ $i -le "$nodes" ]; do
+		confuga_adm "$confuga" sn-add address "127.0.0.1:$(cat "$cluster/sn$i.port")" || return 1
+		i=$((i+1))
+	done
+
+	confuga_server head --root="$confuga?auth=hostname${options:+&$options}" || return 1
+	wait_for_file_creation "$cluster/head.port" 5 || return 1
+	hostport="127.0.0.1:$(cat "$cluster/head.port")"
+
+	i=0
+	while [ $i -lt 30 ]; do
+		if [ "$(confuga_adm "$confuga" health | grep -c ' ONLINE ')" -eq "$nodes" ]; then
+			return 0
+		fi
+		echo $i sleeping waiting for storage nodes
+		sleep 1
+		i=$((i+1))
+	done
+	echo "storage nodes did not come online:"
+	cat "$cluster/head.debug"
+	return 1
+}
+
+confuga_clean() {
+	for pid in ./confuga.*/*.pid; do
+		if [ -s "$pid" ]; then
+			echo kill $(cat "$pid")
+			kill $(cat "$pid")
+		fi
+	done
+	verbose rm -rf ./confuga.*
+	return 0
+}
+
+# vim: set noexpandtab tabstop=4:
@@ -20,6 +20,7 @@ SECTION(OPTIONS)
 OPTIONS_BEGIN
 OPTION_TRIPLET(-a,auth,flag)Require this authentication mode.
 OPTION_TRIPLET(-d,debug,flag)Enable debugging for this subsystem.
+OPTION_TRIPLET(-p,parallel,n|auto)Get a large file over this many streams at once, or find the best number while transferring with CODE(auto). (max 16)
 OPTION_TRIPLET(-t,timeout,time)Timeout for failure. (default is 3600s)
 OPTION_TRIPLET(-i,tickets,files)Comma-delimited list of tickets to use for authentication.
 OPTION_ITEM(`-v, --version')Show program version.
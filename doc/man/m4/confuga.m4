@@ -35,10 +35,16 @@ the end of this manual.
 OPTIONS_BEGIN
 OPTION_PAIR(auth,method)Enable this method for Head Node to Storage Node authentication. The default is to enable all available authentication mechanisms.
 OPTION_PAIR(concurrency,limit)Limits the number of concurrent jobs executed by the cluster. The default is 0 for limitless.
+OPTION_PAIR(health-bandwidth,bytes)Limits the transfers made to rebalance storage nodes to this many bytes per second. 0 is unlimited. The default is 16MB.
+OPTION_PAIR(orphan-age,seconds)Files on a storage node that Confuga does not know of are removed once they are older than this. The default is 86400 (one day).
 OPTION_PAIR(pull-threshold,bytes)Sets the threshold for pull transfers. The default is 128MB.
+OPTION_PAIR(rebalance,percent)Replicas are moved from the fullest to the emptiest storage node when their free space differs by more than this percentage. 0 disables rebalancing. The default is 10. Rebalancing leaves storage nodes alone while they transfer job inputs.
+OPTION_PAIR(replicas,count)Sets the target number of replicas for every file. Missing replicas are created and, after BOLD(trim-age), replicas in excess of the target which are not in use by a job are removed from the fullest storage nodes first. A file may require more replicas than this target. Storage nodes periodically verify the checksum of every replica; a missing or corrupt replica is removed and copied again from another replica, when there is one. The default is 1.
 OPTION_PAIR(replication,type)Sets the replication mode for satisfying job dependencies. BOLD(type) may be BOLD(push-sync) or BOLD(push-async-N). The default is BOLD(push-async-1).
-OPTION_PAIR(scheduler,type)Sets the scheduler used to assign jobs to storage nodes. The default is BOLD(fifo-0).
+OPTION_PAIR(scheduler,type)Sets the scheduler used to assign jobs to storage nodes. BOLD(type) may be BOLD(fifo-N) or BOLD(locality-N), where N limits the number of scheduled jobs waiting for their inputs to be replicated (0 for no limit). The BOLD(locality) scheduler prefers the storage node holding the most input bytes of a job, weighted by the jobs and transfers that node is already busy with, and lets a node holding inputs run a second job rather than replicating them elsewhere. The default is BOLD(fifo-0).
+OPTION_PAIR(slots,count)Sets the maximum number of jobs allocated to one storage node at once. The default is 1 with the BOLD(fifo) scheduler and 2 with the BOLD(locality) scheduler. Storage nodes must allow at least one more job than this, for replication: BOLD(--job-concurrency=2) for BOLD(fifo) and BOLD(--job-concurrency=3) for BOLD(locality) with the default slots (see below).
 OPTION_PAIR(tickets,tickets)Sets tickets to use for authenticating with storage nodes. Paths must be absolute.
+OPTION_PAIR(trim-age,seconds)Replicas in excess of the target are only removed once they are older than this. The default is 3600 (one hour).
 OPTIONS_END
 
 SECTION(STORAGE NODES)
@@ -51,7 +57,7 @@ node Chirp servers must be run with:
 LIST_BEGIN
 LIST_ITEM(Ticket authentication enabled (BOLD(--auth=ticket)). Remember by default all authentication mechanisms are enabled.)
 LIST_ITEM(Job execution enabled (BOLD(--jobs)).)
-LIST_ITEM(Job concurrency of at least two (BOLD(--job-concurrency=2)).)
+LIST_ITEM(Job concurrency of at least one more than the BOLD(slots) option. With the default slots that is BOLD(--job-concurrency=2) for the BOLD(fifo) scheduler and BOLD(--job-concurrency=3) for the BOLD(locality) scheduler.)
 LIST_END
 
 PARA
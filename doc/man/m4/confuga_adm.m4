@@ -29,6 +29,8 @@ SECTION(COMMANDS)
 LIST_BEGIN
 LIST_ITEM(BOLD(sn-add [-r <root>] [-p <password file>] <"uuid"|"address"> <uuid|address>)) Add a storage node to the cluster. Using the UUID of the Chirp server is recommended.
 LIST_ITEM(BOLD(sn-rm [options] <"uuid"|"address"> <uuid|address>)) Remove a storage from the cluster. Using the UUID of the Chirp server is recommended. The storage node is removed when Confuga no longer relies on it to maintain minimum replication for files and when the storage node completes all running jobs.
+LIST_ITEM(BOLD(health)) Show replica health: the free space, replicas, dead replicas and transfers of each storage node, the number of under- and over-replicated files, active transfers by kind and counters of replicas trimmed, orphaned replicas reclaimed and replicas moved to rebalance the storage nodes.
+LIST_ITEM(BOLD(job-stats)) Show how long jobs spent in each state of the scheduler since the head node started, in power-of-two buckets of seconds. The head node updates these every 30 seconds.
 LIST_END
 
 SECTION(EXAMPLES)
@@ -19,6 +19,7 @@ OPTIONS_BEGIN
 OPTION_PAIR(--check-driver,driver) Check for the presence of a given driver (e.g. http, ftp, etc) and return success if it is currently enabled.
 OPTION_TRIPLET(-a,chirp-auth,unix|hostname|ticket|globus|kerberos)Use this Chirp authentication method.  May be invoked multiple times to indicate a preferred list, in order.
 OPTION_TRIPLET(-b, block-size, bytes)Set the I/O block size hint.
+OPTION_PAIR(--cache-size, bytes)Bound the file cache in the temp dir to this many bytes, evicting the least recently used files. Blocks cached from HTTP servers that support range requests count against the same budget. Every Parrot sharing the temp dir (see CODE(-t)) shares the cache and its budget. Statistics are written to the CODE(cache) debug log on each call to CODE(parrot_debug). Also set by CODE(PARROT_CACHE_SIZE).
 OPTION_TRIPLET(-c, status-file, file)Print exit status information to file.
 OPTION_ITEM(-C, channel-auth)Enable data channel authentication in GridFTP.
 OPTION_TRIPLET(-d, debug, flag)Enable debugging for this sub-system.
@@ -38,6 +39,7 @@ OPTION_TRIPLET(-m, ftab-file, file)Use this file as a mountlist.
 OPTION_TRIPLET(-M, mount, /foo=/bar)Mount (redirect) /foo to /bar.
 OPTION_TRIPLET(-e, env-list, path)Record the environment variables.
 OPTION_TRIPLET(-n, name-list, path)Record all the file names.
+OPTION_ITEM(--native-local)Give the application a native file descriptor for plain local files, so that the data it reads and writes is not copied through Parrot. Each call on the descriptor still stops in Parrot, even with CODE(--seccomp), which cannot tell native descriptors apart. The number of files handed over is reported as CODE(parrot.local.native) by CODE(--stats-file). Has no effect with an identity box (CODE(-u)).
 OPTION_ITEM(--no-set-foreground)Disable changing the foreground process group of the session.
 OPTION_TRIPLET(-N, hostname, name)Pretend that this is my hostname.
 OPTION_TRIPLET(-o,debug-file,file)Write debugging output to this file. By default, debugging is sent to stderr (":stderr"). You may specify logs to be sent to stdout (":stdout") instead.
@@ -49,6 +51,10 @@ OPTION_ITEM(--cvmfs-repo-switching) Allow repository switching with CVMFS.
 OPTION_TRIPLET(-R, root-checksum, cksum)Enforce this root filesystem checksum, where available.
 OPTION_ITEM(-s, --stream-no-cache)Use streaming protocols without caching.
 OPTION_ITEM(-S, --session-caching)Enable whole session caching for all protocols.
+OPTION_ITEM(--sparse-cache)For seekable protocols such as chirp, xrootd and http with range support, cache only the blocks of each file that are read. Cached blocks and a bitmap of which are present are kept in the file cache under the temp dir, count against CODE(--cache-size), and are shared with other Parrots. A file whose server makes up its modification time is only shared if the server gives a validator such as an HTTP ETag.
+OPTION_ITEM(--prefetch)With CODE(--sparse-cache), fetch the remaining blocks of open files while Parrot is otherwise idle.
+OPTION_ITEM(--seccomp)Only trap the system calls that Parrot must handle, using a seccomp filter. Other calls run at native speed. Requires Linux 4.8 or later.
+OPTION_PAIR(--stats-file, file)Save runtime statistics to this file when Parrot exits. The block cache and write behind of Chirp files are reported as CODE(chirp.reli.hits), CODE(chirp.reli.misses), CODE(chirp.reli.prefetches), CODE(chirp.reli.prefetch_hits), CODE(chirp.reli.writes_behind) and CODE(chirp.reli.write_retries).
 OPTION_ITEM(--syscall-disable-debug)Disable tracee access to the Parrot debug syscall.
 OPTION_TRIPLET(-t, tempdir, dir)Where to store temporary files.
 OPTION_TRIPLET(-T, timeout, time)Maximum amount of time to retry failures.
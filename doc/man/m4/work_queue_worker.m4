@@ -53,7 +53,7 @@ OPTION_PAIR(--foreman-port, port[:highport]) Set the port for the foreman to lis
 OPTION_TRIPLET(-Z, foreman-port-file, file)Select port to listen to at random and write to this file.  Implies --foreman.
 OPTION_TRIPLET(-F, fast-abort, mult)Set the fast abort multiplier for foreman (default=disabled).
 OPTION_PAIR(--specify-log, logfile)Send statistics about foreman to this file.
-OPTION_TRIPLET(-P, password, pwfile)Password file for authenticating to the master.
+OPTION_TRIPLET(-P, password, pwfile)Password file for authenticating to the master. When the master enables peer transfers, the worker serves its cached files on a port of its own to peers that present a token issued by the master, and also the password, if given.
 OPTION_TRIPLET(-t, timeout, time)Abort after this amount of idle time. (default=900s)
 OPTION_TRIPLET(-w, tcp-window-size, size)Set TCP window size.
 OPTION_TRIPLET(-i, min-backoff, time)Set initial value for backoff interval when worker fails to connect to a master. (default=1s)
@@ -70,6 +70,8 @@ OPTION_PAIR(--memory, mb)Manually set the amount of memory (in MB) reported by t
 OPTION_PAIR(--disk, mb)Manually set the amount of disk space (in MB) reported by this worker.
 OPTION_PAIR(--wall-time, s)Set the maximum number of seconds the worker may be active.
 OPTION_PAIR(--feature, feature)Specifies a user-defined feature the worker provides (option can be repeated).
+OPTION_PAIR(--cache-dir, path)Keep the content addressed files received by the worker in this directory, so that later workers on the same host do not fetch them again. The directory may be shared by several workers at once, and must be on the same filesystem as the workspace (see PARAM(--workdir)), since files are hard linked in and out of it; otherwise it is not used. Files restored from it count towards the disk used by the worker.
+OPTION_PAIR(--cache-size, mb)Maximum size of PARAM(--cache-dir) in MB. The least recently used files are removed first. (default=10240)
 OPTION_PAIR(--docker, image) Enable the worker to run each task with a container based on this image.
 OPTION_PAIR(--docker-preserve, image) Enable the worker to run all tasks with a shared container based on this image.
 OPTION_PAIR(--docker-tar, tarball) Load docker image from this tarball.
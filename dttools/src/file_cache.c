@@ -14,10 +14,13 @@ See the file COPYING for details.
 
 #include <string.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <limits.h>
@@ -33,8 +36,58 @@ See the file COPYING for details.
 #define mkstemp64 mkstemp
 #endif
 
+/*
+With a budget set, every cache sharing a root keeps an index of its
+entries in a shared mapping of root/index. Updates happen under flock
+on the index. A logical clock orders uses, and the least recently used
+entries are evicted when a commit pushes the total over the budget or
+the index fills up. Evicting only unlinks the data, so readers that
+already have it open are not disturbed.
+
+Besides whole files, the index charges files that callers fill in
+themselves a block at a time (see file_cache_name), together with the
+map of present blocks kept beside each of them.
+*/
+
+#define FILE_CACHE_INDEX_MAGIC 0x66636932
+#define FILE_CACHE_INDEX_MAX 16384
+
+#define INDEX_EMPTY 0
+#define INDEX_USED 1
+#define INDEX_DELETED 2
+
+#define INDEX_HIT 0
+#define INDEX_STORE 1
+#define INDEX_CHARGE 2
+
+struct index_entry {
+	char key[MD5_DIGEST_LENGTH_HEX+1];
+	char state;
+	char blocks; /* filled in by the caller, with a map at lpath.map */
+	INT64_T size;
+	INT64_T used;
+	INT64_T uses;
+};
+
+struct index {
+	unsigned magic;
+	unsigned max;
+	INT64_T clock;
+	INT64_T entries;
+	INT64_T bytes;
+	INT64_T budget;
+	INT64_T hits;
+	INT64_T misses;
+	INT64_T stores;
+	INT64_T evictions;
+	struct index_entry entry[FILE_CACHE_INDEX_MAX];
+};
+
 struct file_cache {
 	char *root;
+	INT64_T budget;
+	int index_fd;
+	struct index *index;
 };
 
 static void cached_name(struct file_cache *c, const char *path, char *lpath)
@@ -125,6 +178,9 @@ struct file_cache *file_cache_init(const char *root)
 		free(f);
 		return 0;
 	}
+	f->budget = 0;
+	f->index_fd = -1;
+	f->index = 0;
 
 	sprintf(path, "%s/ff", root);
 	result = stat64(path, &buf);
@@ -152,11 +208,212 @@ struct file_cache *file_cache_init(const char *root)
 void file_cache_fini(struct file_cache *f)
 {
 	if(f) {
+		if(f->index)
+			munmap(f->index, sizeof(*f->index));
+		if(f->index_fd >= 0)
+			close(f->index_fd);
 		free(f->root);
 		free(f);
 	}
 }
 
+static int index_lock(struct file_cache *c)
+{
+	if(!c->index)
+		return 0;
+	while(flock(c->index_fd, LOCK_EX) == -1) {
+		if(errno != EINTR) {
+			debug(D_CACHE, "couldn't lock cache index: %s", strerror(errno));
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void index_unlock(struct file_cache *c)
+{
+	flock(c->index_fd, LOCK_UN);
+}
+
+static void index_key(const char *path, char *key)
+{
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	md5_buffer(path, strlen(path), digest);
+	strcpy(key, md5_string(digest));
+}
+
+/* Find the entry for key, or a free slot to put it in if insert is set. */
+static struct index_entry *index_find(struct file_cache *c, const char *key, int insert)
+{
+	struct index_entry *free_slot = 0;
+	unsigned slot = hash_string(key) % FILE_CACHE_INDEX_MAX;
+	unsigned i;
+
+	for(i = 0; i < FILE_CACHE_INDEX_MAX; i++) {
+		struct index_entry *e = &c->index->entry[(slot + i) % FILE_CACHE_INDEX_MAX];
+		if(e->state == INDEX_EMPTY) {
+			return insert ? (free_slot ? free_slot : e) : 0;
+		} else if(e->state == INDEX_DELETED) {
+			if(!free_slot)
+				free_slot = e;
+		} else if(!strcmp(e->key, key)) {
+			return e;
+		}
+	}
+
+	return insert ? free_slot : 0;
+}
+
+static void index_remove(struct file_cache *c, struct index_entry *e)
+{
+	c->index->bytes -= e->size;
+	c->index->entries--;
+	e->state = INDEX_DELETED;
+}
+
+/* Unlink the least recently used entry other than keep. */
+static int index_evict(struct file_cache *c, struct index_entry *keep)
+{
+	struct index_entry *victim = 0;
+	char lpath[PATH_MAX];
+	unsigned i;
+
+	for(i = 0; i < FILE_CACHE_INDEX_MAX; i++) {
+		struct index_entry *e = &c->index->entry[i];
+		if(e->state == INDEX_USED && e != keep && (!victim || e->used < victim->used))
+			victim = e;
+	}
+	if(!victim)
+		return 0;
+
+	sprintf(lpath, "%s/%.2s/%s", c->root, victim->key, victim->key);
+	debug(D_CACHE, "evict %s (%" PRId64 " bytes, %" PRId64 " uses)", lpath, victim->size, victim->uses);
+	if(unlink(lpath) == -1 && errno != ENOENT)
+		debug(D_CACHE, "couldn't evict %s: %s", lpath, strerror(errno));
+	if(victim->blocks) {
+		strcat(lpath, ".map");
+		unlink(lpath);
+	}
+	index_remove(c, victim);
+	c->index->evictions++;
+	return 1;
+}
+
+/* Record a use of path, adding it to the index if the caller just stored or charged it, or found it there untracked. */
+static void index_touch(struct file_cache *c, const char *path, INT64_T size, int how)
+{
+	char key[MD5_DIGEST_LENGTH_HEX+1];
+	struct index_entry *e;
+
+	if(!index_lock(c))
+		return;
+
+	index_key(path, key);
+	e = index_find(c, key, 1);
+	while(!e && index_evict(c, 0))
+		e = index_find(c, key, 1);
+
+	if(e) {
+		if(e->state != INDEX_USED) {
+			strcpy(e->key, key);
+			e->state = INDEX_USED;
+			e->blocks = how == INDEX_CHARGE;
+			e->size = 0;
+			e->uses = 0;
+			c->index->entries++;
+		}
+		c->index->bytes += size - e->size;
+		e->size = size;
+		e->used = ++c->index->clock;
+		e->uses++;
+
+		if(how == INDEX_HIT) {
+			c->index->hits++;
+		} else {
+			if(how == INDEX_STORE)
+				c->index->stores++;
+			while(c->budget > 0 && c->index->bytes > c->budget && index_evict(c, e)) {}
+		}
+	}
+
+	index_unlock(c);
+}
+
+static void index_miss(struct file_cache *c)
+{
+	if(!index_lock(c))
+		return;
+	c->index->misses++;
+	index_unlock(c);
+}
+
+int file_cache_budget(struct file_cache *c, INT64_T bytes)
+{
+	char path[PATH_MAX];
+	struct stat64 info;
+
+	if(!c->index) {
+		sprintf(path, "%s/index", c->root);
+		c->index_fd = open64(path, O_RDWR|O_CREAT|O_CLOEXEC, 0666);
+		if(c->index_fd == -1)
+			return -1;
+		if(flock(c->index_fd, LOCK_EX) == -1)
+			goto failure;
+		if(fstat64(c->index_fd, &info) == -1)
+			goto failure;
+		if(info.st_size < (off_t)sizeof(*c->index) && ftruncate(c->index_fd, sizeof(*c->index)) == -1)
+			goto failure;
+		c->index = mmap(NULL, sizeof(*c->index), PROT_READ|PROT_WRITE, MAP_SHARED, c->index_fd, 0);
+		if(c->index == MAP_FAILED) {
+			c->index = 0;
+			goto failure;
+		}
+		if(c->index->magic != FILE_CACHE_INDEX_MAGIC) {
+			memset(c->index, 0, sizeof(*c->index));
+			c->index->magic = FILE_CACHE_INDEX_MAGIC;
+			c->index->max = FILE_CACHE_INDEX_MAX;
+		}
+		flock(c->index_fd, LOCK_UN);
+	}
+
+	c->budget = bytes;
+
+	/* The last cache to set a budget shrinks everyone to it. */
+	if(index_lock(c)) {
+		c->index->budget = bytes;
+		while(bytes > 0 && c->index->bytes > bytes && index_evict(c, 0)) {}
+		index_unlock(c);
+	}
+
+	return 0;
+
+	failure:
+	{
+		int s = errno;
+		close(c->index_fd);
+		c->index_fd = -1;
+		errno = s;
+		return -1;
+	}
+}
+
+int file_cache_stats(struct file_cache *c, struct file_cache_stats *s)
+{
+	if(!index_lock(c)) {
+		errno = ENOENT;
+		return -1;
+	}
+	s->entries = c->index->entries;
+	s->bytes = c->index->bytes;
+	s->budget = c->index->budget;
+	s->hits = c->index->hits;
+	s->misses = c->index->misses;
+	s->stores = c->index->stores;
+	s->evictions = c->index->evictions;
+	index_unlock(c);
+	return 0;
+}
+
 void file_cache_cleanup(struct file_cache *f)
 {
 	char path[PATH_MAX];
@@ -240,8 +497,11 @@ int file_cache_open(struct file_cache *c, const char *path, int flags, char *lpa
 	fd = open64(lpath, flags, 0);
 	if (fd == -1) {
 		debug(D_DEBUG, "waiting for txn('%s')", path);
-		if(!wait_for_running_txn(c, path))
+		if(!wait_for_running_txn(c, path)) {
+			debug(D_CACHE, "miss %s %s", path, lpath);
+			index_miss(c);
 			return -1;
+		}
 		fd = open64(lpath, flags, 0);
 	}
 
@@ -251,9 +511,11 @@ int file_cache_open(struct file_cache *c, const char *path, int flags, char *lpa
 		if (fstat64(fd, &info) == 0) {
 			if((size == 0 || (size == info.st_size)) && ((mtime == 0) || (info.st_mtime >= mtime))) {
 				debug(D_CACHE, "hit %s %s", path, lpath);
+				index_touch(c, path, info.st_size, INDEX_HIT);
 				return fd;
 			} else {
 				debug(D_CACHE, "stale %s %s", path, lpath);
+				index_miss(c);
 				close(fd);
 				errno = ENOENT;
 				return -1;
@@ -266,6 +528,7 @@ int file_cache_open(struct file_cache *c, const char *path, int flags, char *lpa
 		}
 	} else {
 		debug(D_CACHE, "miss %s %s", path, lpath);
+		index_miss(c);
 		return -1;
 	}
 }
@@ -275,9 +538,31 @@ int file_cache_delete(struct file_cache *f, const char *path)
 	char lpath[PATH_MAX];
 	cached_name(f, path, lpath);
 	debug(D_CACHE, "remove %s %s", path, lpath);
+	if(index_lock(f)) {
+		char key[MD5_DIGEST_LENGTH_HEX+1];
+		struct index_entry *e;
+		index_key(path, key);
+		e = index_find(f, key, 0);
+		if(e)
+			index_remove(f, e);
+		index_unlock(f);
+	}
 	return unlink(lpath);
 }
 
+void file_cache_name(struct file_cache *c, const char *key, char *lpath)
+{
+	cached_name(c, key, lpath);
+}
+
+int file_cache_charge(struct file_cache *c, const char *key, INT64_T size)
+{
+	if(!c->index)
+		return 0;
+	index_touch(c, key, size, INDEX_CHARGE);
+	return 0;
+}
+
 int file_cache_begin(struct file_cache *f, const char *path, char *txn)
 {
 	int result;
@@ -303,8 +588,16 @@ int file_cache_commit(struct file_cache *f, const char *path, const char *txn)
 	cached_name(f, path, lpath);
 	debug(D_CACHE, "commit %s %s %s", path, txn, lpath);
 	result = rename(txn, lpath);
-	if(result < 0)
+	if(result < 0) {
 		debug(D_CACHE, "commit failed: %s", strerror(errno));
+		return result;
+	}
+	/* Only a committed file is charged, and evicting for it cannot remove it. */
+	if(f->index) {
+		struct stat64 info;
+		if(stat64(lpath, &info) == 0)
+			index_touch(f, path, info.st_size, INDEX_STORE);
+	}
 	return result;
 }
 
@@ -12,14 +12,34 @@ See the file COPYING for details.
 
 #include "int_sizes.h"
 
+struct file_cache_stats {
+	INT64_T entries;
+	INT64_T bytes;
+	INT64_T budget;
+	INT64_T hits;
+	INT64_T misses;
+	INT64_T stores;
+	INT64_T evictions;
+};
+
 struct file_cache *file_cache_init(const char *root);
 void file_cache_fini(struct file_cache *c);
 void file_cache_cleanup(struct file_cache *c);
 
+/* Bound the cache to the given bytes, shared with every cache using the same root; zero keeps it unbounded but indexed. */
+int file_cache_budget(struct file_cache *c, INT64_T bytes);
+/* Node-wide counters from the shared index; fails if no budget was set. */
+int file_cache_stats(struct file_cache *c, struct file_cache_stats *s);
+
 int file_cache_open(struct file_cache *c, const char *path, int flags, char *lpath, INT64_T size, time_t mtime);
 int file_cache_delete(struct file_cache *f, const char *path);
 int file_cache_contains(struct file_cache *f, const char *path, char *lpath);
 
+/* Name a cache file for key that the caller fills in itself, keeping a map of what it holds at lpath.map. */
+void file_cache_name(struct file_cache *c, const char *key, char *lpath);
+/* Charge the file named for key with its current size against the budget, which may evict others; both files go with it. */
+int file_cache_charge(struct file_cache *c, const char *key, INT64_T size);
+
 int file_cache_begin(struct file_cache *c, const char *path, char *txn);
 int file_cache_commit(struct file_cache *c, const char *path, const char *txn);
 int file_cache_abort(struct file_cache *c, const char *path, const char *txn);
@@ -11,6 +11,7 @@ See the file COPYING for details.
 #include "full_io.h"
 #include "link.h"
 #include "macros.h"
+#include "set.h"
 #include "stringtools.h"
 #include "address.h"
 
@@ -25,6 +26,12 @@ See the file COPYING for details.
 #include <sys/un.h>
 #include <sys/utsname.h>
 
+#ifdef CCTOOLS_OPSYS_LINUX
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#endif
+
 #include <fcntl.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -60,6 +67,16 @@ struct link {
 	char buffer[1<<16];
 	char raddr[LINK_ADDRESS_MAX];
 	int rport;
+	struct link_poll_set *poll_set;  /* set this link is registered with, if any. */
+	int poll_events;
+};
+
+struct link_poll_set {
+	int epfd;                /* -1 if epoll is not available. */
+	struct set *links;       /* all the registered links. */
+	struct set *buffered;    /* registered links that may have data waiting in their buffer. */
+	void *events;            /* scratch array for the results of epoll_wait/link_poll */
+	int events_size;
 };
 
 static int link_send_window = 65536;
@@ -284,6 +301,8 @@ static struct link *link_create()
 	link->raddr[0] = 0;
 	link->rport = 0;
 	link->type = LINK_TYPE_STANDARD;
+	link->poll_set = 0;
+	link->poll_events = 0;
 
 	return link;
 }
@@ -571,6 +590,8 @@ static ssize_t fill_buffer(struct link *link, time_t stoptime)
 			link->read += chunk;
 			link->buffer_start = link->buffer;
 			link->buffer_length = chunk;
+			if(link->poll_set)
+				set_insert(link->poll_set->buffered, link);
 			return chunk;
 		} else if(chunk == 0) {
 			link->buffer_start = link->buffer;
@@ -828,6 +849,8 @@ ssize_t link_putfstring(struct link *link, const char *fmt, time_t stoptime, ...
 void link_close(struct link *link)
 {
 	if(link) {
+		if(link->poll_set)
+			link_poll_set_remove(link->poll_set, link);
 		if(link->fd >= 0)
 			close(link->fd);
 		if(link->rport)
@@ -839,6 +862,8 @@ void link_close(struct link *link)
 void link_detach(struct link *link)
 {
 	if(link) {
+		if(link->poll_set)
+			link_poll_set_remove(link->poll_set, link);
 		free(link);
 	}
 }
@@ -929,10 +954,186 @@ ssize_t link_stream_to_buffer(struct link * link, char **buffer, time_t stoptime
 	return total;
 }
 
+#ifdef CCTOOLS_OPSYS_LINUX
+/*
+Move data between a link and a file descriptor without copying it through
+user space. Each function moves at most length bytes and returns the number
+of bytes moved, or -1 on failure. If the kernel cannot splice the given
+descriptors, *fallback is set and the caller should move the rest of the data
+with the copy loop.
+*/
+
+static int64_t link_splice_to_fd(struct link *link, int fd, int64_t length, time_t stoptime, int *fallback)
+{
+	int64_t total = 0;
+	struct stat info;
+	int pipefd[2] = {-1, -1};
+	int outfd = fd;
+	size_t max_chunk = 1<<16;
+
+	if(fstat(fd, &info) < 0 || !(S_ISREG(info.st_mode) || S_ISFIFO(info.st_mode))) {
+		*fallback = 1;
+		return 0;
+	}
+
+	/* splice needs a pipe on one end, so data for a regular file goes through an intermediate pipe. */
+	if(!S_ISFIFO(info.st_mode)) {
+		if(pipe2(pipefd, O_CLOEXEC) < 0) {
+			*fallback = 1;
+			return 0;
+		}
+		int pipe_size = fcntl(pipefd[1], F_SETPIPE_SZ, 1<<20);
+		if(pipe_size > 0)
+			max_chunk = pipe_size;
+		outfd = pipefd[1];
+	}
+
+	while(length > 0) {
+		ssize_t chunk = splice(link->fd, NULL, outfd, NULL, MIN(max_chunk, (size_t)length), SPLICE_F_MOVE | SPLICE_F_MORE);
+		if(chunk == 0) {
+			break;
+		} else if(chunk < 0) {
+			if(errno_is_temporary(errno)) {
+				if(link_sleep(link, stoptime, 1, 0)) {
+					continue;
+				} else {
+					break;
+				}
+			} else if(total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+				*fallback = 1;
+			} else {
+				total = -1;
+			}
+			break;
+		}
+
+		link->read += chunk;
+
+		/* drain the intermediate pipe into the file */
+		ssize_t pending = pipefd[0] >= 0 ? chunk : 0;
+		while(pending > 0) {
+			ssize_t wactual = splice(pipefd[0], NULL, fd, NULL, pending, SPLICE_F_MOVE | SPLICE_F_MORE);
+			if(wactual > 0) {
+				pending -= wactual;
+			} else if(wactual < 0 && errno == EINTR) {
+				continue;
+			} else {
+				break;
+			}
+		}
+
+		/* the file does not accept splice, so finish the chunk with a plain copy. */
+		while(pending > 0) {
+			char buffer[1<<16];
+			ssize_t ractual = read(pipefd[0], buffer, MIN(sizeof(buffer), (size_t)pending));
+			if(ractual <= 0 || full_write(fd, buffer, ractual) != ractual)
+				break;
+			pending -= ractual;
+			*fallback = 1;
+		}
+
+		if(pending > 0) {
+			total = -1;
+			break;
+		}
+
+		total += chunk;
+		length -= chunk;
+
+		if(*fallback)
+			break;
+	}
+
+	if(pipefd[0] >= 0) {
+		close(pipefd[0]);
+		close(pipefd[1]);
+	}
+
+	return total;
+}
+
+static int64_t link_sendfile_from_fd(struct link *link, int fd, int64_t length, time_t stoptime, int *fallback)
+{
+	int64_t total = 0;
+	struct stat info;
+	int use_splice;
+
+	if(fstat(fd, &info) < 0 || !(S_ISREG(info.st_mode) || S_ISFIFO(info.st_mode))) {
+		*fallback = 1;
+		return 0;
+	}
+
+	/* sendfile reads from files, splice reads from pipes. */
+	use_splice = S_ISFIFO(info.st_mode);
+
+	while(length > 0) {
+		size_t count = MIN((int64_t) 1<<30, length);
+		ssize_t chunk;
+
+		if(use_splice) {
+			chunk = splice(fd, NULL, link->fd, NULL, count, SPLICE_F_MOVE | SPLICE_F_MORE);
+		} else {
+			chunk = sendfile(link->fd, fd, NULL, count);
+		}
+
+		if(chunk == 0) {
+			break;
+		} else if(chunk < 0) {
+			if(errno_is_temporary(errno)) {
+				if(link_sleep(link, stoptime, 0, 1)) {
+					continue;
+				} else {
+					total = -1;
+					break;
+				}
+			} else if(total == 0 && (errno == EINVAL || errno == ENOSYS)) {
+				*fallback = 1;
+			} else {
+				total = -1;
+			}
+			break;
+		}
+
+		link->written += chunk;
+		total += chunk;
+		length -= chunk;
+	}
+
+	return total;
+}
+#endif
+
 int64_t link_stream_to_fd(struct link * link, int fd, int64_t length, time_t stoptime)
 {
 	int64_t total = 0;
 
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(link->type == LINK_TYPE_STANDARD && length > 0) {
+		/* Data already read into the link buffer is written out first. */
+		if(link->buffer_length > 0) {
+			size_t chunk = MIN(link->buffer_length, (size_t)length);
+			ssize_t wactual = full_write(fd, link->buffer_start, chunk);
+			if(wactual != (ssize_t)chunk)
+				return -1;
+			link->buffer_start += chunk;
+			link->buffer_length -= chunk;
+			total += chunk;
+			length -= chunk;
+		}
+
+		int fallback = 0;
+		int64_t actual = link_splice_to_fd(link, fd, length, stoptime, &fallback);
+		if(actual < 0)
+			return -1;
+
+		total += actual;
+		length -= actual;
+
+		if(!fallback)
+			return total;
+	}
+#endif
+
 	while(length > 0) {
 		char buffer[1<<16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
@@ -983,6 +1184,15 @@ int64_t link_stream_from_fd(struct link * link, int fd, int64_t length, time_t s
 {
 	int64_t total = 0;
 
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(link->type == LINK_TYPE_STANDARD && length > 0) {
+		int fallback = 0;
+		total = link_sendfile_from_fd(link, fd, length, stoptime, &fallback);
+		if(!fallback)
+			return total;
+	}
+#endif
+
 	while(length > 0) {
 		char buffer[1<<16];
 		size_t chunk = MIN(sizeof(buffer), (size_t)length);
@@ -1130,4 +1340,229 @@ int link_poll(struct link_info *links, int nlinks, int msec)
 	return result;
 }
 
+struct link_poll_set *link_poll_set_create(void)
+{
+	struct link_poll_set *s = malloc(sizeof(*s));
+	if(!s)
+		return 0;
+
+	s->epfd = -1;
+#ifdef CCTOOLS_OPSYS_LINUX
+	s->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if(s->epfd < 0) {
+		debug(D_DEBUG, "epoll not available, falling back to poll: %s", strerror(errno));
+	}
+#endif
+
+	s->links = set_create(0);
+	s->buffered = set_create(0);
+	s->events = 0;
+	s->events_size = 0;
+
+	return s;
+}
+
+void link_poll_set_delete(struct link_poll_set *s)
+{
+	struct link *l;
+
+	if(!s)
+		return;
+
+	set_first_element(s->links);
+	while((l = set_next_element(s->links))) {
+		l->poll_set = 0;
+	}
+
+	if(s->epfd >= 0)
+		close(s->epfd);
+
+	set_delete(s->links);
+	set_delete(s->buffered);
+	free(s->events);
+	free(s);
+}
+
+int link_poll_set_add(struct link_poll_set *s, struct link *link, int events)
+{
+	if(link->poll_set == s)
+		return 1;
+
+	if(link->poll_set) {
+		errno = EEXIST;
+		return 0;
+	}
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(s->epfd >= 0) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		if(events & LINK_READ)
+			ev.events |= EPOLLIN;
+		if(events & LINK_WRITE)
+			ev.events |= EPOLLOUT;
+		ev.data.ptr = link;
+
+		if(epoll_ctl(s->epfd, EPOLL_CTL_ADD, link->fd, &ev) < 0) {
+			debug(D_NOTICE, "couldn't add fd %d to the poll set: %s", link->fd, strerror(errno));
+			return 0;
+		}
+	}
+#endif
+
+	link->poll_set = s;
+	link->poll_events = events;
+	set_insert(s->links, link);
+
+	if(link->buffer_length > 0)
+		set_insert(s->buffered, link);
+
+	return 1;
+}
+
+int link_poll_set_remove(struct link_poll_set *s, struct link *link)
+{
+	if(link->poll_set != s)
+		return 0;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(s->epfd >= 0 && link->fd >= 0) {
+		struct epoll_event ev;
+		epoll_ctl(s->epfd, EPOLL_CTL_DEL, link->fd, &ev);
+	}
+#endif
+
+	set_remove(s->links, link);
+	set_remove(s->buffered, link);
+	link->poll_set = 0;
+	link->poll_events = 0;
+
+	return 1;
+}
+
+int link_poll_set_size(struct link_poll_set *s)
+{
+	return set_size(s->links);
+}
+
+/* Wait on all the links of the set with link_poll. Used when epoll is not available. */
+static int link_poll_set_wait_fallback(struct link_poll_set *s, struct link_info *ready, int max, int msec)
+{
+	int nlinks = set_size(s->links);
+	struct link_info *table;
+	struct link *l;
+	int i, n;
+
+	if(nlinks > s->events_size) {
+		free(s->events);
+		s->events_size = MAX(nlinks, 2 * s->events_size);
+		s->events = malloc(s->events_size * sizeof(struct link_info));
+		if(!s->events) {
+			s->events_size = 0;
+			return -1;
+		}
+	}
+
+	table = s->events;
+
+	i = 0;
+	set_first_element(s->links);
+	while((l = set_next_element(s->links))) {
+		table[i].link = l;
+		table[i].events = l->poll_events;
+		table[i].revents = 0;
+		i++;
+	}
+
+	if(link_poll(table, nlinks, msec) < 0)
+		return -1;
+
+	n = 0;
+	for(i = 0; i < nlinks && n < max; i++) {
+		if(table[i].revents) {
+			ready[n++] = table[i];
+		}
+	}
+
+	return n;
+}
+
+int link_poll_set_wait(struct link_poll_set *s, struct link_info *ready, int max, int msec)
+{
+	struct link *l;
+	int n = 0;
+
+	if(max < 1)
+		return 0;
+
+	if(s->epfd < 0)
+		return link_poll_set_wait_fallback(s, ready, max, msec);
+
+	// Links with data already in their buffers are ready without waiting.
+	// Links whose buffers have been drained are forgotten.
+	int nbuffered = set_size(s->buffered);
+	while(nbuffered > 0 && n < max) {
+		nbuffered--;
+		l = set_pop(s->buffered);
+		if(l->buffer_length > 0) {
+			ready[n].link = l;
+			ready[n].events = l->poll_events;
+			ready[n].revents = LINK_READ;
+			n++;
+		}
+	}
+
+	// Those links stay buffered until they are read.
+	int i;
+	for(i = 0; i < n; i++) {
+		set_insert(s->buffered, ready[i].link);
+	}
+
+	if(n > 0)
+		msec = 0;
+
+	if(n >= max)
+		return n;
+
+#ifdef CCTOOLS_OPSYS_LINUX
+	if(max > s->events_size) {
+		free(s->events);
+		s->events_size = MAX(max, 2 * s->events_size);
+		s->events = malloc(s->events_size * sizeof(struct epoll_event));
+		if(!s->events) {
+			s->events_size = 0;
+			return -1;
+		}
+	}
+
+	struct epoll_event *events = s->events;
+
+	int result = epoll_wait(s->epfd, events, max - n, msec);
+	if(result < 0) {
+		if(errno == EINTR)
+			return n;
+		return -1;
+	}
+
+	for(i = 0; i < result; i++) {
+		l = events[i].data.ptr;
+
+		// already reported because of its buffer.
+		if(set_lookup(s->buffered, l))
+			continue;
+
+		ready[n].link = l;
+		ready[n].events = l->poll_events;
+		ready[n].revents = 0;
+		if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			ready[n].revents |= LINK_READ;
+		if(events[i].events & EPOLLOUT)
+			ready[n].revents |= LINK_WRITE;
+		n++;
+	}
+#endif
+
+	return n;
+}
+
 /* vim: set noexpandtab tabstop=4: */
@@ -68,6 +68,12 @@ link_close(link);
 */
 struct link *link_connect(const char *addr, int port, time_t stoptime);
 
+/** Turn a connected socket into a link.  Useful when a connection accepted by one process is passed to another.
+@param fd The connected socket.
+@return On success, returns a pointer to a link object.  On failure, returns a null pointer with errno set appropriately.
+*/
+struct link *link_attach(int fd);
+
 /** Turn a FILE* into a link.  Useful when trying to poll both remote and local connections using @ref link_poll
 @param file File to create the link from.
 @return On success, returns a pointer to a link object.  On failure, returns a null pointer with errno set appropriately.
@@ -347,6 +353,58 @@ Wait for a activity on a an array of links.
 
 int link_poll(struct link_info *array, int nlinks, int msec);
 
+/** Create a persistent set of links to be polled for activity.
+Unlike @ref link_poll, which examines every link given on each call, links are
+registered once with the set, and each call to @ref link_poll_set_wait only
+returns the links that are ready. Uses epoll when available.
+@return A pointer to a new poll set, or null on failure.
+*/
+
+struct link_poll_set *link_poll_set_create(void);
+
+/** Delete a poll set. The links registered with the set are not closed.
+@param s The poll set to delete.
+*/
+
+void link_poll_set_delete(struct link_poll_set *s);
+
+/** Register a link with a poll set.
+A link may be registered with at most one poll set. It is removed from the set
+automatically when closed with @ref link_close or @ref link_detach.
+@param s The poll set.
+@param link The link to register.
+@param events The events to wait for (@ref LINK_READ or @ref LINK_WRITE).
+@return True on success (or if the link was already registered with the set), false otherwise.
+*/
+
+int link_poll_set_add(struct link_poll_set *s, struct link *link, int events);
+
+/** Remove a link from a poll set.
+@param s The poll set.
+@param link The link to remove.
+@return True if the link was registered with the set, false otherwise.
+*/
+
+int link_poll_set_remove(struct link_poll_set *s, struct link *link);
+
+/** Count the links registered with a poll set.
+@param s The poll set.
+@return The number of registered links.
+*/
+
+int link_poll_set_size(struct link_poll_set *s);
+
+/** Wait for activity on the links of a poll set.
+Links with data already waiting in their buffers are reported as ready without waiting.
+@param s The poll set.
+@param ready Pointer to an array of @ref link_info structures, filled with the links that are ready, and their revents.
+@param max The length of the ready array. Links ready beyond this number are reported in later calls.
+@param msec The number of milliseconds to wait for activity.  Zero indicates do not wait at all, while -1 indicates wait forever.
+@return The number of entries filled in ready, or -1 on failure.
+*/
+
+int link_poll_set_wait(struct link_poll_set *s, struct link_info *ready, int max, int msec);
+
 int errno_is_temporary(int e);
 
 #endif
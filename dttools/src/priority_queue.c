@@ -0,0 +1,258 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "priority_queue.h"
+#include "xxmalloc.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define DEFAULT_SIZE 127
+
+/*
+The queue is a binary max-heap of nodes stored in an array. Each node records
+its index in the array, so that it can be removed from the middle of the heap.
+Nodes are ordered by:
+
+1. head pushes first, the most recent one first (as in list_push_head),
+2. then by priority, highest first,
+3. then by order of push, earliest first.
+*/
+
+struct priority_queue_node {
+	void *data;
+	double priority;
+	int head;
+	int64_t sequence;
+	int index;         /* position in pq->nodes, or -1 if detached. */
+};
+
+struct priority_queue {
+	struct priority_queue_node **nodes;
+	int size;
+	int capacity;
+	int64_t sequence;
+	int iter;
+};
+
+/* returns true if a should be removed before b */
+static int before(const struct priority_queue_node *a, const struct priority_queue_node *b)
+{
+	if(a->head != b->head)
+		return a->head;
+
+	if(a->head)
+		return a->sequence > b->sequence;
+
+	if(a->priority != b->priority)
+		return a->priority > b->priority;
+
+	return a->sequence < b->sequence;
+}
+
+static void place(struct priority_queue *pq, struct priority_queue_node *n, int index)
+{
+	pq->nodes[index] = n;
+	n->index = index;
+}
+
+static void sift_up(struct priority_queue *pq, int index)
+{
+	struct priority_queue_node *n = pq->nodes[index];
+
+	while(index > 0) {
+		int parent = (index - 1) / 2;
+		if(!before(n, pq->nodes[parent]))
+			break;
+		place(pq, pq->nodes[parent], index);
+		index = parent;
+	}
+
+	place(pq, n, index);
+}
+
+static void sift_down(struct priority_queue *pq, int index)
+{
+	struct priority_queue_node *n = pq->nodes[index];
+
+	while(1) {
+		int child = 2 * index + 1;
+		if(child >= pq->size)
+			break;
+
+		if(child + 1 < pq->size && before(pq->nodes[child + 1], pq->nodes[child]))
+			child++;
+
+		if(!before(pq->nodes[child], n))
+			break;
+
+		place(pq, pq->nodes[child], index);
+		index = child;
+	}
+
+	place(pq, n, index);
+}
+
+static void insert(struct priority_queue *pq, struct priority_queue_node *n)
+{
+	if(pq->size == pq->capacity) {
+		pq->capacity *= 2;
+		pq->nodes = xxrealloc(pq->nodes, pq->capacity * sizeof(*pq->nodes));
+	}
+
+	place(pq, n, pq->size);
+	pq->size++;
+	sift_up(pq, n->index);
+}
+
+/* takes n out of the heap, leaving it detached. */
+static void extract(struct priority_queue *pq, struct priority_queue_node *n)
+{
+	int index = n->index;
+
+	pq->size--;
+	n->index = -1;
+
+	if(index == pq->size)
+		return;
+
+	/* fill the hole with the last node, and restore the heap property. */
+	place(pq, pq->nodes[pq->size], index);
+
+	if(index > 0 && before(pq->nodes[index], pq->nodes[(index - 1) / 2])) {
+		sift_up(pq, index);
+	} else {
+		sift_down(pq, index);
+	}
+}
+
+struct priority_queue *priority_queue_create(int size)
+{
+	struct priority_queue *pq = xxmalloc(sizeof(*pq));
+
+	if(size < 1)
+		size = DEFAULT_SIZE;
+
+	pq->nodes = xxmalloc(size * sizeof(*pq->nodes));
+	pq->size = 0;
+	pq->capacity = size;
+	pq->sequence = 0;
+	pq->iter = 0;
+
+	return pq;
+}
+
+void priority_queue_delete(struct priority_queue *pq)
+{
+	int i;
+
+	if(!pq)
+		return;
+
+	for(i = 0; i < pq->size; i++)
+		free(pq->nodes[i]);
+
+	free(pq->nodes);
+	free(pq);
+}
+
+int priority_queue_size(struct priority_queue *pq)
+{
+	return pq->size;
+}
+
+static struct priority_queue_node *push(struct priority_queue *pq, void *data, double priority, int head)
+{
+	struct priority_queue_node *n = xxmalloc(sizeof(*n));
+
+	n->data = data;
+	n->priority = priority;
+	n->head = head;
+	n->sequence = pq->sequence++;
+
+	insert(pq, n);
+
+	return n;
+}
+
+struct priority_queue_node *priority_queue_push(struct priority_queue *pq, void *data, double priority)
+{
+	return push(pq, data, priority, 0);
+}
+
+struct priority_queue_node *priority_queue_push_head(struct priority_queue *pq, void *data)
+{
+	return push(pq, data, 0, 1);
+}
+
+void *priority_queue_peek(struct priority_queue *pq)
+{
+	if(pq->size < 1)
+		return NULL;
+
+	return pq->nodes[0]->data;
+}
+
+void *priority_queue_pop(struct priority_queue *pq)
+{
+	if(pq->size < 1)
+		return NULL;
+
+	return priority_queue_remove(pq, pq->nodes[0]);
+}
+
+void *priority_queue_remove(struct priority_queue *pq, struct priority_queue_node *n)
+{
+	void *data = n->data;
+
+	if(n->index >= 0)
+		extract(pq, n);
+
+	free(n);
+
+	return data;
+}
+
+struct priority_queue_node *priority_queue_detach(struct priority_queue *pq)
+{
+	struct priority_queue_node *n;
+
+	if(pq->size < 1)
+		return NULL;
+
+	n = pq->nodes[0];
+	extract(pq, n);
+
+	return n;
+}
+
+void priority_queue_attach(struct priority_queue *pq, struct priority_queue_node *n)
+{
+	if(n->index >= 0)
+		return;
+
+	insert(pq, n);
+}
+
+void *priority_queue_node_data(struct priority_queue_node *n)
+{
+	return n->data;
+}
+
+void priority_queue_first_item(struct priority_queue *pq)
+{
+	pq->iter = 0;
+}
+
+void *priority_queue_next_item(struct priority_queue *pq)
+{
+	if(pq->iter >= pq->size)
+		return NULL;
+
+	return pq->nodes[pq->iter++]->data;
+}
+
+/* vim: set noexpandtab tabstop=4: */
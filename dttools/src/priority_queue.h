@@ -0,0 +1,155 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PRIORITY_QUEUE_H
+#define PRIORITY_QUEUE_H
+
+/** @file priority_queue.h A priority queue of arbitrary objects.
+Objects with the highest priority are removed first.  Objects of equal
+priority are removed in the order in which they were pushed (FIFO).  Objects
+may also be pushed to the head of the queue, ahead of all other objects
+regardless of priority.  Push and pop take O(log n) time.
+
+Each push returns a @ref priority_queue_node handle, which may later be given
+to @ref priority_queue_remove to remove the object from any position in the
+queue in O(log n) time. For example:
+
+<pre>
+struct priority_queue *pq = priority_queue_create(0);
+
+struct priority_queue_node *n = priority_queue_push(pq, task_a, 1.0);
+priority_queue_push(pq, task_b, 5.0);
+
+priority_queue_remove(pq, n);
+
+assert(priority_queue_pop(pq) == task_b);
+</pre>
+
+To visit the objects in priority order without losing their relative order,
+take nodes out with @ref priority_queue_detach and put them back with
+@ref priority_queue_attach, which keeps the original position of each node:
+
+<pre>
+struct priority_queue_node *n;
+struct list *skipped = list_create();
+
+while((n = priority_queue_detach(pq))) {
+	if(!use(priority_queue_node_data(n))) {
+		list_push_tail(skipped, n);
+	}
+}
+
+while((n = list_pop_head(skipped))) {
+	priority_queue_attach(pq, n);
+}
+</pre>
+
+To visit all of the objects in no particular order, use
+@ref priority_queue_first_item and @ref priority_queue_next_item.
+*/
+
+/** Create a new priority queue.
+@param size The initial capacity of the queue. If zero, a default capacity is used. Grows as needed.
+@return A pointer to a new priority queue.
+*/
+
+struct priority_queue *priority_queue_create(int size);
+
+/** Delete a priority queue.
+Any nodes still in the queue are freed, but the objects they refer to are not.
+@param pq A pointer to a priority queue.
+*/
+
+void priority_queue_delete(struct priority_queue *pq);
+
+/** Count the objects in a priority queue.
+Detached nodes are not counted.
+@param pq A pointer to a priority queue.
+@return The number of objects in the queue.
+*/
+
+int priority_queue_size(struct priority_queue *pq);
+
+/** Push an object according to its priority.
+The object is placed after all objects of greater or equal priority.
+@param pq A pointer to a priority queue.
+@param data The object to push.
+@param priority The priority of the object. Higher priorities are removed first.
+@return A handle for the object, valid until the object is popped or removed.
+*/
+
+struct priority_queue_node *priority_queue_push(struct priority_queue *pq, void *data, double priority);
+
+/** Push an object to the head of the queue.
+The object is placed ahead of all objects currently in the queue, regardless of their priority.
+@param pq A pointer to a priority queue.
+@param data The object to push.
+@return A handle for the object, valid until the object is popped or removed.
+*/
+
+struct priority_queue_node *priority_queue_push_head(struct priority_queue *pq, void *data);
+
+/** Look at the object at the head of the queue without removing it.
+@param pq A pointer to a priority queue.
+@return The object at the head of the queue, or null if the queue is empty.
+*/
+
+void *priority_queue_peek(struct priority_queue *pq);
+
+/** Remove the object at the head of the queue.
+@param pq A pointer to a priority queue.
+@return The object at the head of the queue, or null if the queue is empty.
+*/
+
+void *priority_queue_pop(struct priority_queue *pq);
+
+/** Remove an object from the queue given its handle.
+The handle may refer to an object in the queue, or to a node taken out with @ref priority_queue_detach.
+In either case the handle is freed, and is not valid after this call.
+@param pq A pointer to a priority queue.
+@param node A handle returned by @ref priority_queue_push or @ref priority_queue_push_head.
+@return The object referred to by the handle.
+*/
+
+void *priority_queue_remove(struct priority_queue *pq, struct priority_queue_node *node);
+
+/** Take the node at the head of the queue out of the queue, without freeing it.
+The node keeps its position relative to the other nodes, and may be put back with @ref priority_queue_attach.
+@param pq A pointer to a priority queue.
+@return The node at the head of the queue, or null if the queue is empty.
+*/
+
+struct priority_queue_node *priority_queue_detach(struct priority_queue *pq);
+
+/** Put back a node taken out with @ref priority_queue_detach.
+@param pq A pointer to a priority queue.
+@param node A node returned by @ref priority_queue_detach.
+*/
+
+void priority_queue_attach(struct priority_queue *pq, struct priority_queue_node *node);
+
+/** Get the object referred to by a handle.
+@param node A handle returned by @ref priority_queue_push, @ref priority_queue_push_head, or @ref priority_queue_detach.
+@return The object referred to by the handle.
+*/
+
+void *priority_queue_node_data(struct priority_queue_node *node);
+
+/** Begin iterating over all objects in the queue, in no particular order.
+The queue must not be modified while iterating.
+@param pq A pointer to a priority queue.
+*/
+
+void priority_queue_first_item(struct priority_queue *pq);
+
+/** Continue iterating over the queue.
+@param pq A pointer to a priority queue.
+@return The next object, or null if there are no more objects.
+*/
+
+void *priority_queue_next_item(struct priority_queue *pq);
+
+#endif
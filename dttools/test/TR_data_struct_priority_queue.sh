@@ -0,0 +1,104 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="data_struct_priority_queue.test"
+
+prepare()
+{
+	${CC} -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -I ../src/ -x c - -x none ../src/libdttools.a -lm <<EOF
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "list.h"
+#include "priority_queue.h"
+
+#define N 1000
+
+int main(int argc, char **argv)
+{
+  struct priority_queue *pq = priority_queue_create(1);
+  struct priority_queue_node *nodes[N];
+  uintptr_t i;
+
+  /* priorities 0..9, pushed in order of i */
+  for(i = 1; i < N; i++)
+	nodes[i] = priority_queue_push(pq, (void *) i, (double) (i % 10));
+  assert( priority_queue_size(pq) == N - 1 );
+
+  /* remove every third element from the middle of the queue */
+  for(i = 3; i < N; i += 3)
+	assert( priority_queue_remove(pq, nodes[i]) == (void *) i );
+
+  /* pushes to the head go before everything, most recent first */
+  priority_queue_push_head(pq, (void *) (uintptr_t) (N + 1));
+  priority_queue_push_head(pq, (void *) (uintptr_t) (N + 2));
+
+  assert( priority_queue_peek(pq) == (void *) (uintptr_t) (N + 2) );
+  assert( priority_queue_pop(pq) == (void *) (uintptr_t) (N + 2) );
+  assert( priority_queue_pop(pq) == (void *) (uintptr_t) (N + 1) );
+
+  /* detach everything with an odd value and put it back; order must not change */
+  struct list *skipped = list_create();
+  struct list *kept = list_create();
+  struct priority_queue_node *n;
+  while((n = priority_queue_detach(pq))) {
+	i = (uintptr_t) priority_queue_node_data(n);
+	if(i % 2) {
+	  list_push_tail(skipped, n);
+	} else {
+	  list_push_tail(kept, n);
+	}
+  }
+  assert( priority_queue_size(pq) == 0 );
+
+  while((n = list_pop_head(skipped)))
+	priority_queue_attach(pq, n);
+  while((n = list_pop_head(kept)))
+	priority_queue_attach(pq, n);
+
+  int count = 0;
+  priority_queue_first_item(pq);
+  while(priority_queue_next_item(pq))
+	count++;
+  assert( count == priority_queue_size(pq) );
+
+  /* higher priority first, and FIFO among equal priority */
+  uintptr_t last = 0;
+  while((i = (uintptr_t) priority_queue_pop(pq))) {
+	assert( i % 3 != 0 );
+	if(last) {
+	  assert( (last % 10) > (i % 10) || ((last % 10) == (i % 10) && last < i) );
+	}
+	last = i;
+	count--;
+  }
+  assert( count == 0 );
+
+  priority_queue_delete(pq);
+  list_delete(skipped);
+  list_delete(kept);
+
+  return 0;
+}
+EOF
+	return $?
+}
+
+run()
+{
+	./"$exe"
+	return $?
+}
+
+clean()
+{
+	rm -f "$exe"
+	return 0
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
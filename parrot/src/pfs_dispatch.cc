@@ -8,6 +8,7 @@ See the file COPYING for details.
 #include "linux-version.h"
 #include "pfs_channel.h"
 #include "pfs_dispatch.h"
+#include "pfs_file_cache.h"
 #include "pfs_pointer.h"
 #include "pfs_process.h"
 #include "pfs_service.h"
@@ -3416,6 +3417,7 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 				/* Immediately print the version for debugging. */
 				cctools_version_debug(D_DEBUG, "parrot_debug");
+				pfs_cache_debug();
 
 				divert_to_dummy(p,0);
 			}
@@ -3612,6 +3614,7 @@ void pfs_dispatch32( struct pfs_process *p )
 	switch(p->state) {
 		case PFS_PROCESS_STATE_KERNEL:
 		case PFS_PROCESS_STATE_USER:
+			tracer_insyscall(p->tracer,p->state==PFS_PROCESS_STATE_KERNEL);
 			tracer_continue(p->tracer,0);
 			break;
 		default:
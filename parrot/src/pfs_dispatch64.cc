@@ -22,6 +22,7 @@ int pfs_dispatch64( struct pfs_process *p )
 #include "linux-version.h"
 #include "pfs_channel.h"
 #include "pfs_dispatch.h"
+#include "pfs_file_cache.h"
 #include "pfs_pointer.h"
 #include "pfs_process.h"
 #include "pfs_service.h"
@@ -3094,6 +3095,7 @@ static void decode_syscall( struct pfs_process *p, int entering )
 
 				/* Immediately print the version for debugging. */
 				cctools_version_debug(D_DEBUG, "parrot_debug");
+				pfs_cache_debug();
 
 				divert_to_dummy(p,0);
 			}
@@ -3277,6 +3279,7 @@ void pfs_dispatch64( struct pfs_process *p )
 	switch(p->state) {
 		case PFS_PROCESS_STATE_KERNEL:
 		case PFS_PROCESS_STATE_USER:
+			tracer_insyscall(p->tracer,p->state==PFS_PROCESS_STATE_KERNEL);
 			tracer_continue(p->tracer,0);
 			break;
 		default:
@@ -154,6 +154,12 @@ int pfs_file::get_local_name( char *n )
 	return -1;
 }
 
+/* A string that changes whenever the contents do, such as an HTTP ETag. */
+int pfs_file::get_validator( char *v, size_t len )
+{
+	return -1;
+}
+
 int pfs_file::get_block_size()
 {
 	return name.service->get_block_size();
@@ -16,6 +16,9 @@ extern "C" {
 #include "file_cache.h"
 #include "full_io.h"
 #include "hash_table.h"
+#include "list.h"
+#include "macros.h"
+#include "stats.h"
 }
 
 #include <unistd.h>
@@ -32,8 +35,13 @@ extern "C" {
 extern struct file_cache *pfs_file_cache;
 extern int pfs_session_cache;
 extern int pfs_master_timeout;
+extern char pfs_temp_per_instance_dir[PATH_MAX];
 
 static struct hash_table * not_found_table = 0;
+static int loading = 0;
+
+/* Sparse files that still have blocks to prefetch. */
+static struct list * prefetch_list = 0;
 
 #define BUFFER_SIZE 65536
 
@@ -170,6 +178,263 @@ public:
 	}
 };
 
+static pfs_file * open_source( pfs_name *name, int how )
+{
+	pfs_file *file;
+	loading = how;
+	file = name->service->open(name,O_RDONLY,0);
+	loading = 0;
+	return file;
+}
+
+int pfs_cache_is_loading()
+{
+	return loading;
+}
+
+/*
+A sparse cache file holds the blocks of a remote file fetched so far, at
+their own offsets. Beside it, a bitmap records which blocks are present.
+Reads fetch only the runs of blocks they are missing. Both live in the
+file cache, shared by every Parrot using the same temp dir and counted
+against its budget. A bit is set only after its block has been written.
+Two writers racing on the same bitmap byte can drop a bit, but that only
+costs a later refetch.
+*/
+
+#define SPARSE_BLOCK_SIZE (256*1024)
+#define SPARSE_FETCH_MAX 16
+#define SPARSE_PREFETCH_MAX 4
+
+class pfs_file_sparse : public pfs_file
+{
+private:
+	pfs_file *rfile;
+	struct pfs_stat info;
+	int fd;
+	int mapfd;
+	INT64_T nblocks;
+	unsigned char *bitmap;
+	INT64_T prefetch_next;
+	char key[PFS_PATH_MAX+PFS_LINE_MAX+64];
+
+	int is_present( INT64_T block ) {
+		unsigned char c;
+		if(bitmap[block/8] & (1<<(block%8))) return 1;
+		if(full_pread64(mapfd,&c,1,block/8)==1) bitmap[block/8] |= c;
+		return (bitmap[block/8] & (1<<(block%8))) != 0;
+	}
+
+	void set_present( INT64_T first, INT64_T count ) {
+		INT64_T b;
+		for(b=first; b<first+count; b++) {
+			unsigned char c;
+			if(full_pread64(mapfd,&c,1,b/8)==1) bitmap[b/8] |= c;
+			bitmap[b/8] |= 1<<(b%8);
+			full_pwrite64(mapfd,&bitmap[b/8],1,b/8);
+		}
+	}
+
+public:
+	pfs_file_sparse( pfs_name *n, pfs_file *r, struct pfs_stat *buf, int f, int m, const char *k ) : pfs_file(n) {
+		rfile = r;
+		info = *buf;
+		fd = f;
+		mapfd = m;
+		nblocks = (info.st_size+SPARSE_BLOCK_SIZE-1)/SPARSE_BLOCK_SIZE;
+		bitmap = (unsigned char *) calloc(nblocks/8+1,1);
+		prefetch_next = 0;
+		snprintf(key,sizeof(key),"%s",k);
+		charge();
+	}
+
+	/* Count the blocks held against the cache budget, unless they are private or were evicted while open. */
+	void charge() {
+		struct stat lbuf;
+		if(key[0] && ::fstat(fd,&lbuf)==0 && lbuf.st_nlink>0)
+			file_cache_charge(pfs_file_cache,key,(INT64_T)lbuf.st_blocks*512+nblocks/8+1);
+	}
+
+	/* Fetch count blocks starting at first, stopping early at any already present. */
+	int fetch( INT64_T first, INT64_T count ) {
+		INT64_T n, start, length, actual;
+		char *buffer;
+
+		for(n=1; n<count && first+n<nblocks && !is_present(first+n); n++) {}
+
+		start = first*SPARSE_BLOCK_SIZE;
+		length = MIN(n*SPARSE_BLOCK_SIZE,info.st_size-start);
+		buffer = (char *) malloc(length);
+		if(!buffer) return -1;
+
+		debug(D_CACHE,"fetching %" PRId64 " blocks at %" PRId64 " of %s",n,first,name.path);
+
+		for(actual=0; actual<length;) {
+			pfs_ssize_t result = rfile->read(buffer+actual,length-actual,start+actual);
+			if(result<=0) break;
+			actual += result;
+		}
+
+		if(actual<length || full_pwrite64(fd,buffer,length,start)!=length) {
+			free(buffer);
+			if(actual<length) errno = EIO;
+			return -1;
+		}
+		free(buffer);
+
+		set_present(first,n);
+		charge();
+		stats_inc("parrot.cache.block.miss",n);
+		stats_inc("parrot.cache.block.bytes",length);
+		return n;
+	}
+
+	/* Fetch the next missing run for the idle loop; returns zero once complete. */
+	int prefetch() {
+		while(prefetch_next<nblocks && is_present(prefetch_next)) prefetch_next++;
+		if(prefetch_next>=nblocks) return 0;
+		if(fetch(prefetch_next,SPARSE_PREFETCH_MAX)<0) {
+			debug(D_CACHE,"prefetch of %s failed: %s",name.path,strerror(errno));
+			return 0;
+		}
+		return 1;
+	}
+
+	virtual int close() {
+		if(prefetch_list) list_remove(prefetch_list,this);
+		rfile->close();
+		delete rfile;
+		::close(fd);
+		::close(mapfd);
+		free(bitmap);
+		return 0;
+	}
+
+	virtual pfs_ssize_t read( void *d, pfs_size_t length, pfs_off_t offset ) {
+		INT64_T first, last, block;
+
+		if(offset>=info.st_size) return 0;
+		if(length>info.st_size-offset) length = info.st_size-offset;
+		if(length<=0) return 0;
+
+		first = offset/SPARSE_BLOCK_SIZE;
+		last = (offset+length-1)/SPARSE_BLOCK_SIZE;
+
+		for(block=first; block<=last; block++) {
+			INT64_T n;
+			if(is_present(block)) {
+				stats_inc("parrot.cache.block.hit",1);
+				continue;
+			}
+			n = fetch(block,MIN(last-block+1,SPARSE_FETCH_MAX));
+			if(n<0) return -1;
+			block += n-1;
+		}
+
+		return full_pread64(fd,d,length,offset);
+	}
+
+	virtual int fstat( struct pfs_stat *buf ) {
+		*buf = info;
+		return 0;
+	}
+
+	virtual pfs_ssize_t get_size() {
+		return info.st_size;
+	}
+
+	virtual int is_seekable() {
+		return 1;
+	}
+};
+
+pfs_file * pfs_cache_open_sparse( pfs_name *name, int flags, mode_t mode, int prefetch )
+{
+	struct pfs_stat buf;
+	char path[PATH_MAX];
+	char key[PFS_PATH_MAX+PFS_LINE_MAX+64];
+	char validator[PFS_LINE_MAX];
+	pfs_file *rfile;
+	pfs_file_sparse *file;
+	int fd, mapfd;
+
+	if(name->service->stat(name,&buf)!=0) return 0;
+	if(S_ISDIR(buf.st_mode)) {
+		errno = EISDIR;
+		return 0;
+	}
+
+	rfile = open_source(name,PFS_CACHE_LOADING_BLOCKS);
+	if(!rfile) return 0;
+
+	/*
+	Key on size and a validator from the service, or else the mtime, so that
+	a changed file starts a fresh cache. A made-up mtime says nothing about
+	the contents, so then the blocks are kept private to this open.
+	*/
+	if(rfile->get_validator(validator,sizeof(validator))==0) {
+		snprintf(key,sizeof(key),"sparse:%s\n%" PRId64 "\n%s",name->path,(INT64_T)buf.st_size,validator);
+	} else if(!pfs_service_emulated_stat(&buf)) {
+		snprintf(key,sizeof(key),"sparse:%s\n%" PRId64 "\n%" PRId64,name->path,(INT64_T)buf.st_size,(INT64_T)buf.st_mtime);
+	} else {
+		key[0] = 0;
+	}
+
+	if(key[0]) {
+		file_cache_name(pfs_file_cache,key,path);
+		fd = ::open(path,O_RDWR|O_CREAT|O_CLOEXEC,S_IRUSR|S_IWUSR);
+		strcat(path,".map");
+		mapfd = ::open(path,O_RDWR|O_CREAT|O_CLOEXEC,S_IRUSR|S_IWUSR);
+	} else {
+		string_nformat(path,sizeof(path),"%s/sparse.XXXXXX",pfs_temp_per_instance_dir);
+		fd = mkstemp(path);
+		if(fd>=0) ::unlink(path);
+		string_nformat(path,sizeof(path),"%s/sparse.XXXXXX",pfs_temp_per_instance_dir);
+		mapfd = mkstemp(path);
+		if(mapfd>=0) ::unlink(path);
+	}
+
+	if(fd<0 || mapfd<0) {
+		int save_errno = errno;
+		debug(D_CACHE,"couldn't create sparse cache for %s: %s",name->path,strerror(errno));
+		if(fd>=0) ::close(fd);
+		if(mapfd>=0) ::close(mapfd);
+		rfile->close();
+		delete rfile;
+		errno = save_errno;
+		return 0;
+	}
+
+	debug(D_CACHE,"sparse %s %s",name->path,path);
+	file = new pfs_file_sparse(name,rfile,&buf,fd,mapfd,key);
+	if(prefetch) {
+		if(!prefetch_list) prefetch_list = list_create();
+		list_push_tail(prefetch_list,file);
+	}
+	return file;
+}
+
+int pfs_cache_prefetch_pending()
+{
+	return prefetch_list && list_size(prefetch_list)>0;
+}
+
+int pfs_cache_prefetch()
+{
+	pfs_file_sparse *file;
+
+	if(!prefetch_list) return 0;
+
+	/* Take turns so that one large file does not starve the rest. */
+	while((file = (pfs_file_sparse *) list_pop_head(prefetch_list))) {
+		if(file->prefetch()) {
+			list_push_tail(prefetch_list,file);
+			return 1;
+		}
+	}
+	return 0;
+}
+
 pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode )
 {
 	struct pfs_stat buf;
@@ -208,9 +473,11 @@ pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode )
 
 	fd = file_cache_open(pfs_file_cache,name->path,flags,txn,buf.st_size,0);
 	if(fd>=0) {
+		stats_inc("parrot.cache.hit",1);
 		if(flags&O_TRUNC) ftruncate(fd,0);
 		return new pfs_file_cached(name,fd,mode,buf.st_ctime,buf.st_ino);
 	} else {
+		stats_inc("parrot.cache.miss",1);
 		debug(D_DEBUG, "file cache lookup failed: %s", strerror(errno));
 	}
 
@@ -223,10 +490,10 @@ pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode )
 		rfile = 0;
 		ok_to_fail = 1;
 	} else if(flags&O_CREAT) {
-		rfile = name->service->open(name,O_RDONLY,0);
+		rfile = open_source(name,PFS_CACHE_LOADING_WHOLE);
 		ok_to_fail = 1;
 	} else {
-		rfile = name->service->open(name,O_RDONLY,0);
+		rfile = open_source(name,PFS_CACHE_LOADING_WHOLE);
 		ok_to_fail = 0;
 	}
 
@@ -249,6 +516,7 @@ pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode )
 				ut.modtime = buf.st_mtime;
 				::utime(txn,&ut);
 				if(file_cache_commit(pfs_file_cache,name->path,txn)==0) {
+					stats_inc("parrot.cache.store",1);
 					result = new pfs_file_cached(name,fd,mode,buf.st_ctime,buf.st_ino);
 				} else {
 					result = 0;
@@ -298,4 +566,14 @@ int pfs_cache_invalidate( pfs_name *name )
 	}
 }
 
+void pfs_cache_debug()
+{
+	struct file_cache_stats s;
+
+	if(file_cache_stats(pfs_file_cache,&s)==0) {
+		debug(D_CACHE,"shared cache: %" PRId64 " files, %" PRId64 " of %" PRId64 " bytes, %" PRId64 " hits, %" PRId64 " misses, %" PRId64 " stores, %" PRId64 " evictions",
+			s.entries,s.bytes,s.budget,s.hits,s.misses,s.stores,s.evictions);
+	}
+}
+
 /* vim: set noexpandtab tabstop=4: */
@@ -10,7 +10,15 @@ See the file COPYING for details.
 
 #include "pfs_file.h"
 
+#define PFS_CACHE_LOADING_WHOLE 1
+#define PFS_CACHE_LOADING_BLOCKS 2
+
 pfs_file * pfs_cache_open( pfs_name *name, int flags, mode_t mode );
+pfs_file * pfs_cache_open_sparse( pfs_name *name, int flags, mode_t mode, int prefetch );
 int        pfs_cache_invalidate( pfs_name *name );
+int        pfs_cache_is_loading();
+int        pfs_cache_prefetch_pending();
+int        pfs_cache_prefetch();
+void       pfs_cache_debug();
 
 #endif
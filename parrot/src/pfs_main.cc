@@ -9,8 +9,10 @@ See the file COPYING for details.
 #include "pfs_channel.h"
 #include "pfs_critical.h"
 #include "pfs_dispatch.h"
+#include "pfs_file_cache.h"
 #include "pfs_paranoia.h"
 #include "pfs_process.h"
+#include "pfs_seccomp.h"
 #include "pfs_service.h"
 #include "pfs_table.h"
 #include "pfs_time.h"
@@ -98,6 +100,11 @@ int pfs_use_helper = 0;
 int pfs_checksum_files = 1;
 int pfs_write_rval = 0;
 int pfs_no_flock = 0;
+int pfs_seccomp = 0;
+int pfs_native_local = 0;
+INT64_T pfs_cache_size = -1;
+int pfs_sparse_cache = 0;
+int pfs_prefetch = 0;
 int pfs_paranoid_mode = 0;
 const char *pfs_write_rval_file = "parrot.rval";
 int pfs_enable_small_file_optimizations = 1;
@@ -180,6 +187,11 @@ enum {
 	LONG_OPT_DISABLE_SERVICE,
 	LONG_OPT_NO_FLOCK,
 	LONG_OPT_EXT_IMAGE,
+	LONG_OPT_SECCOMP,
+	LONG_OPT_NATIVE_LOCAL,
+	LONG_OPT_CACHE_SIZE,
+	LONG_OPT_SPARSE_CACHE,
+	LONG_OPT_PREFETCH,
 };
 
 static void get_linux_version(const char *cmd)
@@ -280,15 +292,20 @@ static void show_help( const char *cmd )
 	printf("\n");
 	printf("Performance and consistency options:\n");
 	printf( " %-30s Set the I/O block size hint.              (PARROT_BLOCK_SIZE)\n", "-b,--block-size=<bytes>");
+	printf( " %-30s Share a file cache of this size with other Parrots.(PARROT_CACHE_SIZE)\n", "   --cache-size=<bytes>");
 	printf( " %-30s Disable small file optimizations.\n", "-D,--no-optimize");
 	printf( " %-30s Enable file snapshot caching for all protocols.\n", "-F,--with-snapshots");
 	printf( " %-30s Disable following symlinks.\n", "-f,--no-follow-symlinks");
 	printf( " %-30s Use streaming protocols without caching.(PARROT_FORCE_STREAM)\n", "-s,--stream-no-cache");
 	printf( " %-30s Enable whole session caching for all protocols.\n", "-S,--session-caching");
+	printf( " %-30s Cache only the blocks read from seekable protocols.\n", "   --sparse-cache");
+	printf( " %-30s With --sparse-cache, fetch the rest while Parrot is idle.\n", "   --prefetch");
 	printf( " %-30s Force synchronous disk writes.            (PARROT_FORCE_SYNC)\n", "-Y,--sync-write");
 	printf( " %-30s Enable automatic decompression on .gz files.\n", "-Z,--auto-decompress");
 	printf( " %-30s Disable the given service.\n", "--disable-service");
 	printf( " %-30s Make flock a no-op.\n", "--no-flock");
+	printf( " %-30s Give the application native fds for local files (calls still trap).\n", "--native-local");
+	printf( " %-30s Only trap the system calls Parrot must handle.\n", "--seccomp");
 	printf("\n");
 	printf("Filesystem Options:\n");
 	printf( " %-30s Mount a read-only ext[234] disk image.\n", "--ext <image>=<mountpoint>");
@@ -398,6 +415,16 @@ static void handle_event( pid_t pid, int status, struct rusage *usage )
 	if (WIFSTOPPED(status) && WSTOPSIG(status) == (SIGTRAP|0x80)) {
 		/* The common case, a syscall delivery stop. */
 		pfs_dispatch(p);
+	} else if (status>>8 == (SIGTRAP | (PTRACE_EVENT_SECCOMP<<8))) {
+		/* Since Linux 4.8, the seccomp stop serves as the syscall-enter-stop
+		 * of a call selected by the filter, unless we already stopped at its
+		 * entry because the tracee was resumed with PTRACE_SYSCALL.
+		 */
+		if (p->state == PFS_PROCESS_STATE_USER) {
+			pfs_dispatch(p);
+		} else if (tracer_continue(p->tracer,0) == -1) {
+			return;
+		}
 	} else if (status>>8 == (SIGTRAP | (PTRACE_EVENT_CLONE<<8)) || status>>8 == (SIGTRAP | (PTRACE_EVENT_FORK<<8)) || status>>8 == (SIGTRAP | (PTRACE_EVENT_VFORK<<8))) {
 		pid_t cpid;
 		struct pfs_process *child;
@@ -720,6 +747,9 @@ int main( int argc, char *argv[] )
 	s = getenv("PARROT_FORCE_CACHE");
 	if(s) pfs_force_cache = 1;
 
+	s = getenv("PARROT_CACHE_SIZE");
+	if(s) pfs_cache_size = string_metric_parse(s);
+
 	s = getenv("PARROT_FOLLOW_SYMLINKS");
 	if(s) pfs_follow_symlinks = atoi(s);
 
@@ -815,6 +845,7 @@ int main( int argc, char *argv[] )
 	static const struct option long_options[] = {
 		{"auto-decompress", no_argument, 0, 'Z'},
 		{"block-size", required_argument, 0, 'b'},
+		{"cache-size", required_argument, 0, LONG_OPT_CACHE_SIZE},
 		{"channel-auth", no_argument, 0, 'C'},
 		{"check-driver", required_argument, 0, LONG_OPT_CHECK_DRIVER },
 		{"chirp-auth",  required_argument, 0, 'a'},
@@ -841,6 +872,7 @@ int main( int argc, char *argv[] )
 		{"ld-path", required_argument, 0, 'l'},
 		{"mount", required_argument, 0, 'M'},
 		{"name-list", required_argument, 0, 'n'},
+		{"native-local", no_argument, 0, LONG_OPT_NATIVE_LOCAL},
 		{"no-checksums", no_argument, 0, 'k'},
 		{"no-chirp-catalog", no_argument, 0, 'Q'},
 		{"no-follow-symlinks", no_argument, 0, 'f'},
@@ -852,9 +884,12 @@ int main( int argc, char *argv[] )
 		{"parrot-path", required_argument, 0, LONG_OPT_PARROT_PATH},
 		{"pid-fixed", no_argument, 0, LONG_OPT_PID_FIXED},
 		{"pid-warp", no_argument, 0, LONG_OPT_PID_WARP},
+		{"prefetch", no_argument, 0, LONG_OPT_PREFETCH},
 		{"proxy", required_argument, 0, 'p'},
 		{"root-checksum", required_argument, 0, 'R'},
+		{"seccomp", no_argument, 0, LONG_OPT_SECCOMP},
 		{"session-caching", no_argument, 0, 'S'},
+		{"sparse-cache", no_argument, 0, LONG_OPT_SPARSE_CACHE},
 		{"stats-file", required_argument, 0, LONG_OPT_STATS_FILE},
 		{"status-file", required_argument, 0, 'c'},
 		{"stream-no-cache", no_argument, 0, 's'},
@@ -1130,6 +1165,21 @@ int main( int argc, char *argv[] )
 		case LONG_OPT_NO_FLOCK:
 			pfs_no_flock = 1;
 			break;
+		case LONG_OPT_SECCOMP:
+			pfs_seccomp = 1;
+			break;
+		case LONG_OPT_NATIVE_LOCAL:
+			pfs_native_local = 1;
+			break;
+		case LONG_OPT_CACHE_SIZE:
+			pfs_cache_size = string_metric_parse(optarg);
+			break;
+		case LONG_OPT_SPARSE_CACHE:
+			pfs_sparse_cache = 1;
+			break;
+		case LONG_OPT_PREFETCH:
+			pfs_prefetch = 1;
+			break;
 		case LONG_OPT_EXT_IMAGE: {
 			char service[128];
 			char image[PATH_MAX] = {0};
@@ -1200,6 +1250,18 @@ int main( int argc, char *argv[] )
 
 	get_linux_version(argv[0]);
 
+	if(pfs_seccomp && !linux_available(4,8,0)) {
+		debug(D_NOTICE, "--seccomp requires Linux 4.8 or later, tracing every system call instead");
+		pfs_seccomp = 0;
+	} else if(pfs_seccomp && valgrind) {
+		debug(D_NOTICE, "--seccomp cannot be used with --valgrind, tracing every system call instead");
+		pfs_seccomp = 0;
+	}
+
+	if(pfs_native_local && pfs_username) {
+		debug(D_NOTICE, "--native-local has no effect when an identity box is in use");
+	}
+
 	if (envlist[0]) {
 		extern char **environ;
 		if(access(envlist, F_OK) == 0)
@@ -1233,6 +1295,8 @@ int main( int argc, char *argv[] )
 	pfs_file_cache = file_cache_init(pfs_temp_dir);
 	if(!pfs_file_cache) fatal("couldn't setup cache in %s: %s\n",pfs_temp_dir,strerror(errno));
 	file_cache_cleanup(pfs_file_cache);
+	if(pfs_cache_size >= 0 && file_cache_budget(pfs_file_cache, pfs_cache_size) == -1)
+		debug(D_NOTICE, "couldn't share the file cache index in %s, the cache is unbounded: %s", pfs_temp_dir, strerror(errno));
 
 	string_nformat(pfs_cvmfs_locks_dir, sizeof(pfs_cvmfs_locks_dir), "%s/cvmfs_locks_XXXXXX", pfs_temp_per_instance_dir);
 
@@ -1338,6 +1402,9 @@ int main( int argc, char *argv[] )
 			signal(SIGUSR1, set_attached_and_ready);
 			raise(SIGSTOP); /* synchronize with parent, above */
 			while (!attached_and_ready) ; /* spin waiting to be traced (NO SLEEPING/STOPPING) */
+			/* The tracer resumes us with PTRACE_CONT from here on, so without the filter nothing would be trapped. */
+			if (pfs_seccomp && pfs_seccomp_filter() == -1)
+				fatal("could not install seccomp filter: %s", strerror(errno));
 			execvp(argv[optind],&argv[optind]);
 		}
 		fprintf(stderr, "unable to execute %s: %s\n", argv[optind], strerror(errno));
@@ -1358,7 +1425,7 @@ int main( int argc, char *argv[] )
 
 	root_pid = pid;
 	debug(D_PROCESS,"attaching to pid %d",pid);
-	if (tracer_attach(pid) == -1) {
+	if (tracer_attach(pid, pfs_seccomp) == -1) {
 		if (errno == EPERM) {
 			fprintf(stderr,
 				"The `ptrace` system call appears to be disabled.\n"
@@ -1402,11 +1469,17 @@ int main( int argc, char *argv[] )
 		std::vector<struct pfswait> pevents;
 		struct pfswait p;
 
-		while (pfswait(&p, -1, !pevents.size())) {
+		/* Don't block while there are blocks to prefetch; fetch them when idle instead. */
+		while (pfswait(&p, -1, !pevents.size() && !pfs_cache_prefetch_pending())) {
 			pevents.push_back(p);
 		}
-		if (pevents.size() == 0)
+		if (pevents.size() == 0) {
+			if (pfs_cache_prefetch_pending()) {
+				pfs_cache_prefetch();
+				continue;
+			}
 			break;
+		}
 
 		for (std::vector<struct pfswait>::iterator it = pevents.begin(); it != pevents.end(); ++it) {
 			if(it->pid == pfs_watchdog_pid) {
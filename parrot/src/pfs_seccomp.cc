@@ -0,0 +1,232 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "pfs_seccomp.h"
+#include "pfs_time.h"
+
+extern "C" {
+#include "tracer.h"
+}
+
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(CCTOOLS_CPU_I386)
+
+int pfs_seccomp_filter(void)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#else
+
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+
+#ifndef PR_SET_NO_NEW_PRIVS
+#	define PR_SET_NO_NEW_PRIVS 38
+#endif
+
+#define X32_SYSCALL_BIT 0x40000000
+
+/*
+These are the calls that pfs_dispatch64 sends along to the kernel untouched.
+Keep this list in step with the first case of the switch in decode_syscall.
+*/
+
+static const unsigned passthrough64[] = {
+	SYSCALL64__sysctl,
+	SYSCALL64_adjtimex,
+	SYSCALL64_afs_syscall,
+	SYSCALL64_alarm,
+	SYSCALL64_arch_prctl,
+	SYSCALL64_brk,
+	SYSCALL64_capget,
+	SYSCALL64_capset,
+	SYSCALL64_clock_getres,
+	SYSCALL64_clock_nanosleep,
+	SYSCALL64_clock_settime,
+	SYSCALL64_create_module,
+	SYSCALL64_delete_module,
+	SYSCALL64_exit,
+	SYSCALL64_exit_group,
+	SYSCALL64_futex,
+	SYSCALL64_get_kernel_syms,
+	SYSCALL64_get_robust_list,
+	SYSCALL64_get_thread_area,
+	SYSCALL64_getcpu,
+	SYSCALL64_getitimer,
+	SYSCALL64_getpgid,
+	SYSCALL64_getpgrp,
+	SYSCALL64_getpriority,
+	SYSCALL64_getrandom,
+	SYSCALL64_getrlimit,
+	SYSCALL64_getrusage,
+	SYSCALL64_getsid,
+	SYSCALL64_gettid,
+	SYSCALL64_init_module,
+	SYSCALL64_ioperm,
+	SYSCALL64_iopl,
+	SYSCALL64_kcmp,
+	SYSCALL64_madvise,
+	SYSCALL64_membarrier,
+	SYSCALL64_migrate_pages,
+	SYSCALL64_mincore,
+	SYSCALL64_mlock,
+	SYSCALL64_mlockall,
+	SYSCALL64_modify_ldt,
+	SYSCALL64_move_pages,
+	SYSCALL64_mprotect,
+	SYSCALL64_mremap,
+	SYSCALL64_msync,
+	SYSCALL64_munlock,
+	SYSCALL64_munlockall,
+	SYSCALL64_nanosleep,
+	SYSCALL64_pause,
+	SYSCALL64_prctl,
+	SYSCALL64_prlimit64,
+	SYSCALL64_process_vm_readv,
+	SYSCALL64_process_vm_writev,
+	SYSCALL64_query_module,
+	SYSCALL64_quotactl,
+	SYSCALL64_reboot,
+	SYSCALL64_restart_syscall,
+	SYSCALL64_rt_sigaction,
+	SYSCALL64_rt_sigpending,
+	SYSCALL64_rt_sigprocmask,
+	SYSCALL64_rt_sigqueueinfo,
+	SYSCALL64_rt_sigreturn,
+	SYSCALL64_rt_sigsuspend,
+	SYSCALL64_rt_sigtimedwait,
+	SYSCALL64_sched_get_priority_max,
+	SYSCALL64_sched_get_priority_min,
+	SYSCALL64_sched_getaffinity,
+	SYSCALL64_sched_getattr,
+	SYSCALL64_sched_getparam,
+	SYSCALL64_sched_getscheduler,
+	SYSCALL64_sched_rr_get_interval,
+	SYSCALL64_sched_setaffinity,
+	SYSCALL64_sched_setattr,
+	SYSCALL64_sched_setparam,
+	SYSCALL64_sched_setscheduler,
+	SYSCALL64_sched_yield,
+	SYSCALL64_set_robust_list,
+	SYSCALL64_set_thread_area,
+	SYSCALL64_set_tid_address,
+	SYSCALL64_setdomainname,
+	SYSCALL64_sethostname,
+	SYSCALL64_setitimer,
+	SYSCALL64_setpgid,
+	SYSCALL64_setpriority,
+	SYSCALL64_setrlimit,
+	SYSCALL64_setsid,
+	SYSCALL64_settimeofday,
+	SYSCALL64_shmat,
+	SYSCALL64_shmctl,
+	SYSCALL64_shmdt,
+	SYSCALL64_shmget,
+	SYSCALL64_sigaltstack,
+	SYSCALL64_swapoff,
+	SYSCALL64_swapon,
+	SYSCALL64_sync,
+	SYSCALL64_sysinfo,
+	SYSCALL64_syslog,
+	SYSCALL64_timer_create,
+	SYSCALL64_timer_delete,
+	SYSCALL64_timer_getoverrun,
+	SYSCALL64_timer_gettime,
+	SYSCALL64_timer_settime,
+	SYSCALL64_times,
+	SYSCALL64_ustat,
+	SYSCALL64_vhangup,
+	SYSCALL64_wait4,
+	SYSCALL64_waitid,
+};
+
+/* Only emulated when the virtual clock is stopped or warped. */
+static const unsigned time64[] = {
+	SYSCALL64_clock_gettime,
+	SYSCALL64_gettimeofday,
+	SYSCALL64_time,
+};
+
+#define FILTER_MAX 512
+
+#define FILTER_STMT(code,k) \
+	do {\
+		struct sock_filter insn = BPF_STMT(code,k);\
+		assert(n < FILTER_MAX);\
+		filter[n++] = insn;\
+	} while (0)
+
+#define FILTER_JUMP(code,k,jt,jf) \
+	do {\
+		struct sock_filter insn = BPF_JUMP(code,k,jt,jf);\
+		assert(n < FILTER_MAX);\
+		filter[n++] = insn;\
+	} while (0)
+
+#define FILTER_ALLOW(nr) \
+	do {\
+		FILTER_JUMP(BPF_JMP|BPF_JEQ|BPF_K, (nr), 0, 1);\
+		FILTER_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW);\
+	} while (0)
+
+int pfs_seccomp_filter(void)
+{
+	struct sock_filter filter[FILTER_MAX];
+	struct sock_fprog prog;
+	unsigned short n = 0;
+	unsigned i;
+
+	/* Anything but a native 64-bit call (i386 or x32) always stops. */
+	FILTER_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, arch));
+	FILTER_JUMP(BPF_JMP|BPF_JEQ|BPF_K, AUDIT_ARCH_X86_64, 1, 0);
+	FILTER_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE);
+	FILTER_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, nr));
+	FILTER_JUMP(BPF_JMP|BPF_JGE|BPF_K, X32_SYSCALL_BIT, 0, 1);
+	FILTER_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE);
+
+	for(i = 0; i < sizeof(passthrough64)/sizeof(passthrough64[0]); i++)
+		FILTER_ALLOW(passthrough64[i]);
+
+	if(pfs_time_mode == PFS_TIME_MODE_NORMAL) {
+		for(i = 0; i < sizeof(time64)/sizeof(time64[0]); i++)
+			FILTER_ALLOW(time64[i]);
+	}
+
+	/* Anonymous memory is never redirected through the channel; see decode_mmap. */
+	FILTER_JUMP(BPF_JMP|BPF_JEQ|BPF_K, SYSCALL64_mmap, 0, 3);
+	FILTER_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, args[3]));
+	FILTER_JUMP(BPF_JMP|BPF_JSET|BPF_K, MAP_ANONYMOUS, 0, 1);
+	FILTER_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW);
+
+	FILTER_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE);
+
+	memset(&prog, 0, sizeof(prog));
+	prog.len = n;
+	prog.filter = filter;
+
+	/* Required to install a filter without CAP_SYS_ADMIN. Parrot already
+	 * ignores setuid bits on exec, as any tracer does. */
+	if(prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == -1)
+		return -1;
+	if(prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog, 0, 0) == -1)
+		return -1;
+
+	return 0;
+}
+
+#endif
+
+/* vim: set noexpandtab tabstop=4: */
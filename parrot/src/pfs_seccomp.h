@@ -0,0 +1,23 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef PFS_SECCOMP_H
+#define PFS_SECCOMP_H
+
+/*
+ * Install a seccomp filter in the calling process (the payload, after it is
+ * attached and before it execs) so that only the system calls Parrot must
+ * rewrite stop the tracee. Every other call runs without a ptrace stop.
+ * The filter is inherited by all children of the payload.
+ *
+ * The tracer must be attached with PTRACE_O_TRACESECCOMP.
+ * Returns -1 on failure.
+ */
+int pfs_seccomp_filter(void);
+
+#endif
+
+/* vim: set noexpandtab tabstop=4: */
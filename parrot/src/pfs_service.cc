@@ -399,9 +399,10 @@ int  pfs_service::get_block_size()
 	}
 }
 
+static time_t start_time = 0;
+
 void pfs_service_emulate_stat( pfs_name *name, struct pfs_stat *buf )
 {
-	static time_t start_time = 0;
 	memset(buf,0,sizeof(*buf));
 	buf->st_dev = (dev_t) -1;
 	if(name) {
@@ -419,6 +420,12 @@ void pfs_service_emulate_stat( pfs_name *name, struct pfs_stat *buf )
 	buf->st_blksize = default_block_size;
 }
 
+/* True if the times in buf were made up by pfs_service_emulate_stat, and so say nothing about the contents. */
+int pfs_service_emulated_stat( struct pfs_stat *buf )
+{
+	return buf->st_dev == (INT64_T)(dev_t) -1 && start_time != 0 && buf->st_mtime == start_time;
+}
+
 static struct hash_table *table = 0;
 
 void * pfs_service_connect_cache( pfs_name *name )
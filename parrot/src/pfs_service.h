@@ -83,6 +83,7 @@ void pfs_service_print();
 
 void pfs_service_emulate_statfs( struct pfs_statfs *buf );
 void pfs_service_emulate_stat( pfs_name *name, struct pfs_stat *buf );
+int  pfs_service_emulated_stat( struct pfs_stat *buf );
 
 void pfs_service_set_block_size( int bs );
 int  pfs_service_get_block_size();
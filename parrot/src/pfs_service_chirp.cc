@@ -36,6 +36,19 @@ extern int pfs_enable_small_file_optimizations;
 
 char chirp_rootpath[] = "/";
 
+/*
+The entries of the last directory listed with getlongdir are kept with their
+status, for the stat and lstat calls that usually follow a listing. The
+targets of symbolic links are found with one bulkstat request for all of them.
+*/
+
+struct chirp_dircache_entry {
+	struct chirp_stat info;    /* the entry itself, as from lstat. */
+	struct chirp_stat target;  /* what a symbolic link refers to, as from stat. */
+	int target_valid;
+	int target_errno;          /* nonzero if the stat of the link failed. */
+};
+
 static struct hash_table * chirp_dircache = 0;
 static char * chirp_dircache_path = 0;
 
@@ -73,23 +86,67 @@ static void chirp_dircache_insert( const char *name, struct chirp_stat *info, vo
 	pfs_dir *dir = (pfs_dir *)arg;
 	dir->append(name);
 
-	struct chirp_stat *copy_info = (struct chirp_stat *)malloc(sizeof(*info));
-	*copy_info = *info;
+	struct chirp_dircache_entry *e = (struct chirp_dircache_entry *)xxcalloc(1,sizeof(*e));
+	e->info = *info;
 
 	sprintf(path,"%s/%s",chirp_dircache_path,name);
 
-	hash_table_insert(chirp_dircache,path,copy_info);
+	hash_table_insert(chirp_dircache,path,e);
+}
+
+static void chirp_dircache_follow_links( const char *hostport, const char *dirpath )
+{
+	char *key;
+	void *value;
+	int i, n = 0;
+
+	if(!chirp_dircache) return;
+
+	hash_table_firstkey(chirp_dircache);
+	while(hash_table_nextkey(chirp_dircache,&key,&value)) {
+		struct chirp_dircache_entry *e = (struct chirp_dircache_entry *)value;
+		if(S_ISLNK(e->info.cst_mode)) n++;
+	}
+
+	if(n==0) return;
+
+	struct chirp_bulkstat *bulk = (struct chirp_bulkstat *)xxcalloc(n,sizeof(*bulk));
+	struct chirp_dircache_entry **entries = (struct chirp_dircache_entry **)xxcalloc(n,sizeof(*entries));
+	size_t prefix = strlen(chirp_dircache_path)+1;
+
+	i = 0;
+	hash_table_firstkey(chirp_dircache);
+	while(hash_table_nextkey(chirp_dircache,&key,&value)) {
+		struct chirp_dircache_entry *e = (struct chirp_dircache_entry *)value;
+		if(!S_ISLNK(e->info.cst_mode)) continue;
+		entries[i] = e;
+		bulk[i].type = CHIRP_BULKSTAT_STAT;
+		bulk[i].path = string_format("%s/%s",dirpath,key+prefix);
+		bulk[i].info = &e->target;
+		i++;
+	}
+
+	if(chirp_global_bulkstat(hostport,bulk,n,time(0)+pfs_master_timeout)>=0) {
+		for(i=0;i<n;i++) {
+			entries[i]->target_valid = 1;
+			entries[i]->target_errno = bulk[i].result<0 ? bulk[i].errnum : 0;
+		}
+	}
+
+	for(i=0;i<n;i++) free((char*)bulk[i].path);
+	free(bulk);
+	free(entries);
 }
 
-static int chirp_dircache_lookup( const char *path, struct chirp_stat *info )
+static int chirp_dircache_lookup( const char *path, struct chirp_dircache_entry *entry )
 {
-	struct chirp_stat *value;
+	struct chirp_dircache_entry *value;
 
 	if(!chirp_dircache) chirp_dircache = hash_table_create(0,0);
 
-	value = (struct chirp_stat*) hash_table_lookup(chirp_dircache,path);
+	value = (struct chirp_dircache_entry*) hash_table_lookup(chirp_dircache,path);
 	if(value) {
-		*info = *value;
+		*entry = *value;
 		hash_table_remove(chirp_dircache,path);
 		free(value);
 		return 1;
@@ -299,6 +356,7 @@ public:
 		if(pfs_enable_small_file_optimizations) {
 			chirp_dircache_begin(name->path);
 			result = chirp_global_getlongdir(name->hostport,name->rest,chirp_dircache_insert,dir,time(0)+pfs_master_timeout);
+			if(result>=0) chirp_dircache_follow_links(name->hostport,name->rest);
 		} else {
 			result = -1;
 			errno = EINVAL;
@@ -329,10 +387,18 @@ public:
 
 	virtual int stat( pfs_name *name, struct pfs_stat *buf ) {
 		struct chirp_stat cbuf;
+		struct chirp_dircache_entry e;
 		int result;
-		if(chirp_dircache_lookup(name->path,&cbuf)) {
-			if(!S_ISLNK(cbuf.cst_mode)) {
-				COPY_CSTAT(cbuf,*buf);
+		if(chirp_dircache_lookup(name->path,&e)) {
+			if(!S_ISLNK(e.info.cst_mode)) {
+				COPY_CSTAT(e.info,*buf);
+				return 0;
+			} else if(e.target_valid) {
+				if(e.target_errno) {
+					errno = e.target_errno;
+					return -1;
+				}
+				COPY_CSTAT(e.target,*buf);
 				return 0;
 			}
 		}
@@ -345,9 +411,10 @@ public:
 
 	virtual int lstat( pfs_name *name, struct pfs_stat *buf ) {
 		struct chirp_stat cbuf;
+		struct chirp_dircache_entry e;
 		int result;
-		if(chirp_dircache_lookup(name->path,&cbuf)) {
-			COPY_CSTAT(cbuf,*buf);
+		if(chirp_dircache_lookup(name->path,&e)) {
+			COPY_CSTAT(e.info,*buf);
 			return 0;
 		}
 		result = chirp_global_lstat(name->hostport,name->rest,&cbuf,time(0)+pfs_master_timeout);
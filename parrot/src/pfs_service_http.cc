@@ -6,19 +6,29 @@ See the file COPYING for details.
 */
 
 #include "pfs_service.h"
+#include "pfs_file_cache.h"
 
 extern "C" {
 #include "debug.h"
 #include "stringtools.h"
 #include "domain_name.h"
+#include "domain_name_cache.h"
 #include "link.h"
 #include "file_cache.h"
 #include "full_io.h"
 #include "http_query.h"
+#include "buffer.h"
+#include "hash_table.h"
+#include "list.h"
+#include "macros.h"
+#include "stats.h"
+#include "url_encode.h"
+#include "xxmalloc.h"
 }
 
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -30,7 +40,44 @@ extern "C" {
 #define HTTP_PORT 80
 #define HTTP_FILE_MODE (S_IFREG | 0555)
 
+/*
+Seekable reads are served from a sparse block cache kept in the Parrot
+file cache, which is shared by every Parrot of the same user on the
+node and counts the blocks against --cache-size. Missing blocks are
+fetched with Range requests on pooled keep-alive connections.
+Sequential readers double the readahead window up to HTTP_READAHEAD_MAX
+blocks; a seek resets it.
+*/
+
+#define HTTP_BLOCK_SIZE (256*1024)
+#define HTTP_READAHEAD_MAX 16
+#define HTTP_POOL_MAX 4
+#define HTTP_POOL_IDLE 30
+
 extern int pfs_master_timeout;
+extern int pfs_force_stream;
+extern char pfs_temp_per_instance_dir[PATH_MAX];
+extern struct file_cache *pfs_file_cache;
+
+struct http_response {
+	int code;
+	int keepalive;
+	INT64_T length;
+	INT64_T first;
+	INT64_T total;
+	char validator[HTTP_LINE_MAX];
+};
+
+struct http_idle {
+	struct link *link;
+	time_t when;
+};
+
+/* Idle keep-alive links, a list per host:port. */
+static struct hash_table *http_pool = 0;
+
+/* Servers that answered a Range request with the whole object. */
+static struct hash_table *http_norange = 0;
 
 static struct link * http_fetch( pfs_name *name, const char *action, INT64_T *size )
 {
@@ -45,6 +92,243 @@ static struct link * http_fetch( pfs_name *name, const char *action, INT64_T *si
 	return http_query_size(url,action,size,time(0)+pfs_master_timeout,0);
 }
 
+/* Proxied requests go through http_query, which handles proxy lists. */
+static int http_can_pool()
+{
+	return !getenv("HTTP_PROXY");
+}
+
+static void http_hostport( pfs_name *name, char *hostport )
+{
+	snprintf(hostport,HTTP_LINE_MAX,"%s:%d",name->host,name->port);
+}
+
+static struct link * http_pool_get( const char *hostport )
+{
+	struct list *idle;
+	struct http_idle *i;
+
+	if(!http_pool) return 0;
+	idle = (struct list *) hash_table_lookup(http_pool,hostport);
+	if(!idle) return 0;
+
+	while((i = (struct http_idle *) list_pop_head(idle))) {
+		struct link *link = i->link;
+		time_t when = i->when;
+		free(i);
+		/* An idle link with anything to read has been closed by the server. */
+		if(when+HTTP_POOL_IDLE > time(0) && !link_usleep(link,0,1,0)) {
+			stats_inc("parrot.http.reuse",1);
+			return link;
+		}
+		link_close(link);
+	}
+	return 0;
+}
+
+static void http_pool_put( const char *hostport, struct link *link )
+{
+	struct list *idle;
+	struct http_idle *i;
+
+	if(!http_pool) http_pool = hash_table_create(0,0);
+	idle = (struct list *) hash_table_lookup(http_pool,hostport);
+	if(!idle) {
+		idle = list_create();
+		hash_table_insert(http_pool,hostport,idle);
+	}
+
+	if(list_size(idle) >= HTTP_POOL_MAX) {
+		link_close(link);
+		return;
+	}
+
+	i = (struct http_idle *) xxmalloc(sizeof(*i));
+	i->link = link;
+	i->when = time(0);
+	list_push_head(idle,i);
+}
+
+/* Give a link back once its response body has been read in full. */
+static void http_release( pfs_name *name, struct link *link, struct http_response *r, int consumed )
+{
+	char hostport[HTTP_LINE_MAX];
+
+	if(consumed && r->keepalive) {
+		http_hostport(name,hostport);
+		http_pool_put(hostport,link);
+	} else {
+		link_close(link);
+	}
+}
+
+static int http_header( const char *line, const char *header, const char **value )
+{
+	size_t n = strlen(header);
+	if(strncasecmp(line,header,n) || line[n]!=':') return 0;
+	for(line += n+1; *line==' ' || *line=='\t'; line++) {}
+	*value = line;
+	return 1;
+}
+
+static int http_code_to_errno( int code )
+{
+	switch(code) {
+		case 401:
+		case 403:
+		case 407:
+			return EACCES;
+		case 404:
+		case 410:
+			return ENOENT;
+		case 408:
+			return ETIMEDOUT;
+		default:
+			return EIO;
+	}
+}
+
+static int http_send( struct link *link, pfs_name *name, const char *action, INT64_T first, INT64_T last, time_t stoptime )
+{
+	char path[HTTP_LINE_MAX];
+	buffer_t B;
+	int result;
+
+	url_encode(name->rest,path,sizeof(path));
+
+	buffer_init(&B);
+	buffer_abortonfailure(&B, 1);
+	buffer_printf(&B, "%s %s HTTP/1.1\r\n", action, path);
+	buffer_printf(&B, "Host: %s\r\n", name->host);
+	if(first >= 0)
+		buffer_printf(&B, "Range: bytes=%" PRId64 "-%" PRId64 "\r\n", first, last);
+	if(getenv("HTTP_USER_AGENT"))
+		buffer_printf(&B, "User-Agent: Mozilla/5.0 (compatible; CCTools %s Parrot; http://ccl.cse.nd.edu/ %s)\r\n", CCTOOLS_VERSION, getenv("HTTP_USER_AGENT"));
+	else
+		buffer_printf(&B, "User-Agent: Mozilla/5.0 (compatible; CCTools %s Parrot; http://ccl.cse.nd.edu/)\r\n", CCTOOLS_VERSION);
+	buffer_putliteral(&B, "\r\n");
+
+	debug(D_HTTP, "%s", buffer_tostring(&B));
+	result = link_putlstring(link, buffer_tostring(&B), buffer_pos(&B), stoptime) == (ssize_t)buffer_pos(&B);
+	buffer_free(&B);
+	return result;
+}
+
+static int http_recv( struct link *link, const char *action, struct http_response *r, time_t stoptime )
+{
+	char line[HTTP_LINE_MAX];
+	const char *value;
+	int major, minor;
+
+	r->code = 0;
+	r->keepalive = 0;
+	r->length = -1;
+	r->first = 0;
+	r->total = -1;
+	r->validator[0] = 0;
+
+	if(!link_readline(link,line,sizeof(line),stoptime)) return 0;
+	string_chomp(line);
+	debug(D_HTTP, "%s", line);
+	if(sscanf(line,"HTTP/%d.%d %d",&major,&minor,&r->code)!=3) return 0;
+	r->keepalive = major>1 || (major==1 && minor>=1);
+
+	while(link_readline(link,line,sizeof(line),stoptime)) {
+		string_chomp(line);
+		debug(D_HTTP, "%s", line);
+		if(!line[0]) {
+			/* A HEAD response never has a body, so the link can always be kept. */
+			if(r->length<0 && strcmp(action,"HEAD")) r->keepalive = 0;
+			return 1;
+		} else if(http_header(line,"Content-Length",&value)) {
+			sscanf(value,"%" SCNd64,&r->length);
+		} else if(http_header(line,"Content-Range",&value)) {
+			INT64_T last;
+			if(sscanf(value,"bytes %" SCNd64 "-%" SCNd64 "/%" SCNd64,&r->first,&last,&r->total)!=3)
+				sscanf(value,"bytes */%" SCNd64,&r->total);
+		} else if(http_header(line,"Connection",&value)) {
+			if(!strcasecmp(value,"close")) r->keepalive = 0;
+			else if(!strcasecmp(value,"keep-alive")) r->keepalive = 1;
+		} else if(http_header(line,"Transfer-Encoding",&value)) {
+			/* Chunked bodies are not understood here; treat them as unsized. */
+			r->length = -1;
+			r->keepalive = 0;
+		} else if(http_header(line,"ETag",&value) || http_header(line,"Last-Modified",&value)) {
+			size_t n = strlen(r->validator);
+			snprintf(r->validator+n,sizeof(r->validator)-n,"%s;",value);
+		}
+	}
+
+	return 0;
+}
+
+/*
+Issue one request on a pooled connection, or a new one if none is idle.
+A link that turns out to be stale is retried once on a fresh connection.
+Returns the link positioned at the body for a 2xx or 416 response.
+Otherwise returns null with r->code set (zero if there was no answer).
+*/
+
+static struct link * http_request( pfs_name *name, const char *action, INT64_T first, INT64_T last, struct http_response *r )
+{
+	char hostport[HTTP_LINE_MAX];
+	char addr[LINK_ADDRESS_MAX];
+	time_t stoptime = time(0)+pfs_master_timeout;
+	struct link *link;
+	int attempt;
+
+	r->code = 0;
+
+	if(!name->host[0]) {
+		errno = ENOENT;
+		return 0;
+	}
+
+	http_hostport(name,hostport);
+
+	for(attempt = 0; attempt < 2; attempt++) {
+		link = attempt==0 ? http_pool_get(hostport) : 0;
+		if(!link) {
+			attempt = 1;
+			debug(D_HTTP, "connect %s port %d", name->host, name->port);
+			if(!domain_name_cache_lookup(name->host,addr)) {
+				errno = ENOENT;
+				return 0;
+			}
+			link = link_connect(addr,name->port,stoptime);
+			if(!link) {
+				errno = ECONNRESET;
+				return 0;
+			}
+			stats_inc("parrot.http.connect",1);
+		}
+
+		if(http_send(link,name,action,first,last,stoptime) && http_recv(link,action,r,stoptime))
+			break;
+
+		link_close(link);
+		link = 0;
+	}
+
+	if(!link) {
+		debug(D_HTTP, "malformed response");
+		errno = ECONNRESET;
+		return 0;
+	}
+
+	if((r->code>=200 && r->code<=299) || r->code==416) {
+		return link;
+	} else {
+		if(r->length==0 && r->keepalive) {
+			http_pool_put(hostport,link);
+		} else {
+			link_close(link);
+		}
+		errno = r->code>=300 && r->code<=399 ? EBUSY : http_code_to_errno(r->code);
+		return 0;
+	}
+}
+
 class pfs_file_http : public pfs_file
 {
 private:
@@ -77,6 +361,220 @@ public:
 		return size;
 	}
 
+	virtual int is_seekable() {
+		return 0;
+	}
+};
+
+class pfs_file_http_range : public pfs_file
+{
+private:
+	INT64_T size;
+	INT64_T nblocks;
+	int fd;
+	int mapfd;
+	unsigned char *present;
+	INT64_T next_block;
+	int window;
+	char key[HTTP_LINE_MAX*2];
+	char validator[HTTP_LINE_MAX];
+
+	int is_present( INT64_T block ) {
+		unsigned char c;
+		if(present[block]) return 1;
+		/* Another Parrot may have fetched it since we last looked. */
+		if(mapfd>=0 && full_pread64(mapfd,&c,1,block)==1 && c) {
+			present[block] = 1;
+			return 1;
+		}
+		return 0;
+	}
+
+public:
+	pfs_file_http_range( pfs_name *n, INT64_T s, const char *v ) : pfs_file(n) {
+		size = s;
+		nblocks = (size+HTTP_BLOCK_SIZE-1)/HTTP_BLOCK_SIZE;
+		present = (unsigned char *) calloc(nblocks ? nblocks : 1, 1);
+		next_block = 0;
+		window = 1;
+		fd = mapfd = -1;
+		key[0] = 0;
+		snprintf(validator,sizeof(validator),"%s",v);
+
+		/* The sparse file cache keeps the blocks itself. */
+		if(pfs_cache_is_loading()==PFS_CACHE_LOADING_BLOCKS) return;
+
+		if(validator[0]) {
+			/* Name the shared copy after the object's version, so a changed object is never mixed with stale blocks. */
+			char path[PATH_MAX];
+
+			snprintf(key,sizeof(key),"http://%s:%d%s\n%s\n%" PRId64,name.host,name.port,name.rest,validator,size);
+			file_cache_name(pfs_file_cache,key,path);
+			fd = ::open(path,O_RDWR|O_CREAT|O_CLOEXEC,S_IRUSR|S_IWUSR);
+			strcat(path,".map");
+			mapfd = ::open(path,O_RDWR|O_CREAT|O_CLOEXEC,S_IRUSR|S_IWUSR);
+			charge();
+		} else {
+			/* Without a validator the blocks are only good for this open. */
+			char path[PATH_MAX];
+			string_nformat(path,sizeof(path),"%s/http.XXXXXX",pfs_temp_per_instance_dir);
+			fd = mkstemp(path);
+			if(fd>=0) ::unlink(path);
+		}
+
+		if(fd<0 || (validator[0] && mapfd<0)) {
+			debug(D_HTTP,"couldn't create block cache for %s: %s",name.path,strerror(errno));
+			if(fd>=0) ::close(fd);
+			if(mapfd>=0) ::close(mapfd);
+			fd = mapfd = -1;
+		}
+	}
+
+	/* Count the blocks held against the cache budget, unless they were evicted while open. */
+	void charge() {
+		struct stat buf;
+		if(key[0] && fd>=0 && ::fstat(fd,&buf)==0 && buf.st_nlink>0)
+			file_cache_charge(pfs_file_cache,key,(INT64_T)buf.st_blocks*512+nblocks);
+	}
+
+	/* Store the body of a range response starting at block first. */
+	int store( struct link *link, struct http_response *r, void *d, pfs_size_t length, pfs_off_t offset ) {
+		time_t stoptime = time(0)+pfs_master_timeout;
+		INT64_T block = r->first/HTTP_BLOCK_SIZE;
+		INT64_T remaining = r->length;
+		char *buffer;
+
+		if(r->first%HTTP_BLOCK_SIZE) {
+			http_release(&name,link,r,0);
+			errno = EIO;
+			return -1;
+		}
+
+		buffer = (char *) malloc(HTTP_BLOCK_SIZE);
+		if(!buffer) {
+			http_release(&name,link,r,0);
+			return -1;
+		}
+
+		while(remaining>0) {
+			pfs_ssize_t chunk = MIN(remaining,HTTP_BLOCK_SIZE);
+			pfs_off_t start = block*HTTP_BLOCK_SIZE;
+			if(link_read(link,buffer,chunk,stoptime)!=chunk) break;
+			remaining -= chunk;
+			stats_inc("parrot.http.bytes",chunk);
+
+			/* A partial block is only complete at the end of the object. */
+			if(chunk<HTTP_BLOCK_SIZE && start+chunk<size) break;
+
+			if(fd>=0) {
+				if(full_pwrite64(fd,buffer,chunk,start)!=chunk) break;
+				if(mapfd>=0) {
+					unsigned char c = 1;
+					full_pwrite64(mapfd,&c,1,block);
+				}
+				present[block] = 1;
+			} else {
+				/* No cache: copy whatever overlaps the caller's buffer. */
+				pfs_off_t lo = MAX(start,offset);
+				pfs_off_t hi = MIN(start+chunk,offset+length);
+				if(lo<hi) memcpy((char*)d+(lo-offset),buffer+(lo-start),hi-lo);
+			}
+			block++;
+		}
+
+		free(buffer);
+		http_release(&name,link,r,remaining==0);
+		charge();
+		if(remaining) {
+			errno = EIO;
+			return -1;
+		}
+		return 0;
+	}
+
+	int fetch( INT64_T block, INT64_T count, void *d, pfs_size_t length, pfs_off_t offset ) {
+		struct http_response r;
+		INT64_T first = block*HTTP_BLOCK_SIZE;
+		INT64_T last = MIN(size,(block+count)*HTTP_BLOCK_SIZE)-1;
+		struct link *link;
+
+		debug(D_HTTP,"fetching %" PRId64 " blocks at %" PRId64 " of %s",count,block,name.path);
+		stats_inc("parrot.http.block.miss",count);
+
+		link = http_request(&name,"GET",first,last,&r);
+		if(!link) {
+			if(!r.code) errno = EIO;
+			return -1;
+		}
+		if(r.code!=206 || r.first!=first || r.length!=last-first+1) {
+			debug(D_HTTP,"server ignored range request for %s",name.path);
+			http_release(&name,link,&r,0);
+			errno = EIO;
+			return -1;
+		}
+		return store(link,&r,d,length,offset);
+	}
+
+	virtual int close() {
+		if(fd>=0) ::close(fd);
+		if(mapfd>=0) ::close(mapfd);
+		free(present);
+		return 0;
+	}
+
+	virtual pfs_ssize_t read( void *d, pfs_size_t length, pfs_off_t offset ) {
+		INT64_T first, last, block;
+
+		if(offset>=size) return 0;
+		if(length>size-offset) length = size-offset;
+		if(length<=0) return 0;
+
+		first = offset/HTTP_BLOCK_SIZE;
+		last = (offset+length-1)/HTTP_BLOCK_SIZE;
+
+		if(fd<0) {
+			if(fetch(first,last-first+1,d,length,offset)<0) return -1;
+			return length;
+		}
+
+		if(first==next_block || first+1==next_block) {
+			window = MIN(window*2,HTTP_READAHEAD_MAX);
+		} else {
+			window = 1;
+		}
+		next_block = last+1;
+
+		for(block=first; block<=last; block++) {
+			INT64_T count, want;
+			if(is_present(block)) {
+				stats_inc("parrot.http.block.hit",1);
+				continue;
+			}
+			want = MAX(last-block+1,window);
+			for(count=1; count<want && block+count<nblocks && !present[block+count]; count++) {}
+			if(fetch(block,count,d,length,offset)<0) return -1;
+			block += count-1;
+		}
+
+		return full_pread64(fd,d,length,offset);
+	}
+
+	virtual int fstat( struct pfs_stat *buf ) {
+		pfs_service_emulate_stat(&name,buf);
+		buf->st_mode = HTTP_FILE_MODE;
+		buf->st_size = size;
+		return 0;
+	}
+
+	virtual pfs_ssize_t get_size() {
+		return size;
+	}
+
+	virtual int get_validator( char *v, size_t len ) {
+		if(!validator[0]) return -1;
+		snprintf(v,len,"%s",validator);
+		return 0;
+	}
 };
 
 class pfs_service_http : public pfs_service {
@@ -86,6 +584,8 @@ public:
 	}
 
 	virtual pfs_file * open( pfs_name *name, int flags, mode_t mode ) {
+		char hostport[HTTP_LINE_MAX];
+		struct http_response r;
 		struct link *link;
 		INT64_T size;
 
@@ -94,28 +594,79 @@ public:
 			return 0;
 		}
 
-		link = http_fetch(name,"GET",&size);
-		if(link) {
-			return new pfs_file_http(name,link,size);
-		} else {
+		/* The file cache is loading the whole object, or -s asked for no cache at all: only a stream is needed. */
+		if(pfs_cache_is_loading()==PFS_CACHE_LOADING_WHOLE || (pfs_force_stream && !pfs_cache_is_loading())) {
+			link = http_fetch(name,"GET",&size);
+			if(link) {
+				return new pfs_file_http(name,link,size);
+			} else {
+				return 0;
+			}
+		}
+
+		http_hostport(name,hostport);
+		if(!http_can_pool() || (http_norange && hash_table_lookup(http_norange,hostport))) {
+			return pfs_cache_open(name,flags,mode);
+		}
+
+		/* Probe for range support with the first block, which most readers want anyway. */
+		link = http_request(name,"GET",0,HTTP_BLOCK_SIZE-1,&r);
+		if(!link) {
+			if(r.code>=300 && r.code<=399) return pfs_cache_open(name,flags,mode);
 			return 0;
 		}
+
+		if(r.code==416) {
+			/* Nothing to satisfy: the object is empty. */
+			pfs_file_http_range *file = new pfs_file_http_range(name,0,r.validator);
+			http_release(name,link,&r,r.length==0);
+			return file;
+		} else if(r.code==206 && r.total>=0 && r.length>=0) {
+			pfs_file_http_range *file = new pfs_file_http_range(name,r.total,r.validator);
+			if(file->store(link,&r,0,0,0)<0) {
+				int save_errno = errno;
+				file->close();
+				delete file;
+				errno = save_errno;
+				return 0;
+			}
+			return file;
+		} else {
+			debug(D_HTTP,"%s does not support range requests",hostport);
+			if(!http_norange) http_norange = hash_table_create(0,0);
+			hash_table_insert(http_norange,hostport,(void*)1);
+			http_release(name,link,&r,0);
+			return pfs_cache_open(name,flags,mode);
+		}
 	}
 
 	virtual int stat( pfs_name *name, struct pfs_stat *buf ) {
+		struct http_response r;
 		struct link *link;
 		INT64_T size;
 
-		link = http_fetch(name,"HEAD",&size);
-		if(link) {
-			link_close(link);
-			pfs_service_emulate_stat(name,buf);
-			buf->st_mode = HTTP_FILE_MODE;
-			buf->st_size = size;
-			return 0;
+		if(http_can_pool()) {
+			link = http_request(name,"HEAD",-1,-1,&r);
+			if(link) {
+				http_release(name,link,&r,1);
+				size = r.length>=0 ? r.length : 0;
+			} else if(r.code>=300 && r.code<=399) {
+				link = http_fetch(name,"HEAD",&size);
+				if(!link) return -1;
+				link_close(link);
+			} else {
+				return -1;
+			}
 		} else {
-			return -1;
+			link = http_fetch(name,"HEAD",&size);
+			if(!link) return -1;
+			link_close(link);
 		}
+
+		pfs_service_emulate_stat(name,buf);
+		buf->st_mode = HTTP_FILE_MODE;
+		buf->st_size = size;
+		return 0;
 	}
 
 	virtual int lstat( pfs_name *name, struct pfs_stat *buf ) {
@@ -123,7 +674,7 @@ public:
 	}
 
 	virtual int is_seekable (void) {
-		return 0;
+		return 1;
 	}
 };
 
@@ -52,6 +52,7 @@ extern "C" ssize_t pread(int fd, void *buf, size_t count, off_t  offset);
 extern "C" ssize_t pwrite(int  fd,  const  void  *buf, size_t count, off_t offset);
 
 extern const char * pfs_username;
+extern int pfs_native_local;
 
 static int check_implicit_acl( const char *path, int checkflags )
 {
@@ -108,6 +109,13 @@ public:
 			snprintf(path, len, "%s", name.rest);
 			return 1;
 		}
+		/* Plain files are only handed over when no ACLs are enforced, as the
+		 * kernel then decides on every later use of the fd. */
+		if (pfs_native_local && !pfs_username && S_ISREG(buf.st_mode)) {
+			stats_inc("parrot.local.native", 1);
+			snprintf(path, len, "%s", name.rest);
+			return 1;
+		}
 		return 0;
 	}
 
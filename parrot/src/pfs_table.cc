@@ -70,6 +70,8 @@ extern "C" {
 #define E_OK 10000
 
 extern int pfs_force_stream;
+extern int pfs_sparse_cache;
+extern int pfs_prefetch;
 extern int pfs_force_sync;
 extern int pfs_follow_symlinks;
 extern int pfs_enable_small_file_optimizations;
@@ -747,6 +749,11 @@ pfs_file * pfs_table::open_object( const char *lname, int flags, mode_t mode, in
 				if(!file && (errno == EISDIR)) {
 					file = open_directory(&pname, flags);
 				}
+			} else if(pfs_sparse_cache && (flags&O_ACCMODE)==O_RDONLY && !(flags&(O_CREAT|O_TRUNC))) {
+				file = pfs_cache_open_sparse(&pname,flags,mode,pfs_prefetch);
+				if(!file && (errno == EISDIR)) {
+					file = open_directory(&pname, flags);
+				}
 			} else {
 				file = pname.service->open(&pname,flags,mode);
 				if(!file && (errno == EISDIR)) {
@@ -797,7 +804,8 @@ int pfs_table::open( const char *lname, int flags, mode_t mode, int force_cache,
 	if(result>=0) {
 		file = open_object(lname,flags,mode,force_cache);
 		if(file) {
-			if(path && file->canbenative(path, len)) {
+			/* The application opens it again, which would fail after O_EXCL created it. */
+			if(path && !(flags&O_EXCL) && file->canbenative(path, len)) {
 				file->close();
 				result = -2;
 			} else {
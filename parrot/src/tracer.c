@@ -86,9 +86,13 @@ struct tracer {
 		struct x86_64_registers regs64;
 	} regs;
 	int has_args5_bug;
+	int insyscall;
 };
 
-int tracer_attach (pid_t pid)
+/* Set once for the whole tree: the options, like the filter, are inherited. */
+static int tracer_seccomp = 0;
+
+int tracer_attach (pid_t pid, int seccomp)
 {
 	intptr_t options = PTRACE_O_TRACESYSGOOD|PTRACE_O_TRACEEXEC|PTRACE_O_TRACEEXIT|PTRACE_O_TRACECLONE|PTRACE_O_TRACEFORK|PTRACE_O_TRACEVFORK;
 
@@ -96,6 +100,13 @@ int tracer_attach (pid_t pid)
 		options |= PTRACE_O_EXITKILL;
 	assert(linux_available(2,5,60));
 
+	if (seccomp) {
+		/* Before 4.8, the seccomp stop does not stand in for syscall-enter-stop. */
+		assert(linux_available(4,8,0));
+		options |= PTRACE_O_TRACESECCOMP;
+		tracer_seccomp = 1;
+	}
+
 	if (linux_available(3,4,0)) {
 		/* So this is a really annoying situation, in order to correctly deal
 		 * with group-stops with ptrace, we must use PTRACE_SEIZE.  For a full
@@ -154,6 +165,7 @@ struct tracer *tracer_init (pid_t pid)
 	t->gotregs = 0;
 	t->setregs = 0;
 	t->has_args5_bug = 0;
+	t->insyscall = 0;
 
 	memset(&t->regs,0,sizeof(t->regs));
 
@@ -200,11 +212,16 @@ int tracer_continue( struct tracer *t, int signum )
 			return -1;
 		t->setregs = 0;
 	}
-	if (ptrace(PTRACE_SYSCALL,t->pid,0,signum) == -1)
+	if (ptrace(tracer_seccomp && !t->insyscall ? PTRACE_CONT : PTRACE_SYSCALL,t->pid,0,signum) == -1)
 		ERROR;
 	return 0;
 }
 
+void tracer_insyscall( struct tracer *t, int insyscall )
+{
+	t->insyscall = insyscall;
+}
+
 int tracer_args_get( struct tracer *t, INT64_T *syscall, INT64_T args[TRACER_ARGS_MAX] )
 {
 	if(!t->gotregs) {
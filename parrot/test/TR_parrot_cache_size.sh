@@ -0,0 +1,105 @@
+#!/bin/sh
+
+# Fetch three 1 MiB files through a shared cache bounded to 2.5 MiB and
+# check that a second session hits the cache and that the oldest is evicted.
+
+. ../../dttools/test/test_runner_common.sh
+. ./parrot-test.sh
+
+exe="$0.test"
+server="$0.server.py"
+docs="$0.docs"
+cache="$0.cache"
+port_file="$0.port"
+pid_file="$0.pid"
+stats="$0.stats"
+
+prepare()
+{
+	gcc -I../src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none <<EOF
+#include <fcntl.h>
+#include <unistd.h>
+
+int main (int argc, char *argv[])
+{
+	char buf[65536];
+	ssize_t n;
+	int i, fd;
+
+	for (i = 1; i < argc; i++) {
+		fd = open(argv[i], O_RDONLY);
+		if (fd == -1)
+			return 1;
+		while ((n = read(fd, buf, sizeof(buf))) > 0)
+			if (write(1, buf, n) != n)
+				return 1;
+		close(fd);
+	}
+	return 0;
+}
+EOF
+
+	mkdir -p "$docs"
+	for f in a b c; do
+		dd if=/dev/urandom of="$docs/$f" bs=1024 count=1024 2> /dev/null
+	done
+
+	cat > "$server" <<EOF
+import functools, sys
+from http.server import HTTPServer, SimpleHTTPRequestHandler
+
+class Handler(SimpleHTTPRequestHandler):
+	def log_message(self, *args):
+		pass
+
+server = HTTPServer(('127.0.0.1', 0), functools.partial(Handler, directory=sys.argv[1]))
+with open(sys.argv[2], 'w') as f:
+	f.write(str(server.server_address[1]))
+server.serve_forever()
+EOF
+
+	python3 "$server" "$docs" "$port_file" &
+	echo $! > "$pid_file"
+	wait_for_file_creation "$port_file" 15
+}
+
+stat_value()
+{
+	tr -d ' \n' < "$stats" | sed -n "s/.*\"$1\":\([0-9]*\).*/\1/p"
+}
+
+cached()
+{
+	parrot -F --tempdir="$cache" --cache-size=2621440 --stats-file="$stats" -- "$exe" "$@"
+}
+
+run()
+{
+	url="/http/127.0.0.1:$(cat "$port_file")"
+
+	cached "$url/a" "$url/b" > output.actual || return 1
+	cat "$docs/a" "$docs/b" > output.expected
+	require_identical_files output.actual output.expected
+	[ "$(stat_value parrot.cache.store)" -eq 2 ] || return 1
+
+	# A second session finds b, and storing c pushes out a.
+	cached "$url/b" "$url/c" > output.actual || return 1
+	cat "$docs/b" "$docs/c" > output.expected
+	require_identical_files output.actual output.expected
+	[ "$(stat_value parrot.cache.hit)" -eq 1 ] || return 1
+
+	[ "$(find "$cache" -path "$cache/??/*" -type f | wc -l)" -eq 2 ] || return 1
+	[ "$(du -sbc "$cache"/??/ | tail -1 | cut -f1)" -le $((2621440 + 256*4096)) ]
+}
+
+clean()
+{
+	if [ -f "$pid_file" ]; then
+		kill $(cat "$pid_file")
+	fi
+	rm -rf "$exe" "$server" "$docs" "$cache" "$port_file" "$pid_file" "$stats" output.actual output.expected
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,125 @@
+#!/bin/sh
+
+# Read a few pieces of a large object over /http and check that only the
+# blocks around them are transferred, over a single pooled connection.
+
+. ../../dttools/test/test_runner_common.sh
+. ./parrot-test.sh
+
+exe="$0.test"
+server="$0.server.py"
+data="$0.data"
+port_file="$0.port"
+pid_file="$0.pid"
+stats="$0.stats"
+
+prepare()
+{
+	gcc -I../src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none <<EOF
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdio.h>
+
+int main (int argc, char *argv[])
+{
+	static const off_t offsets[] = {0, 40<<20, 12345678, 63<<20, 40<<20};
+	char buf[8];
+	unsigned i;
+	int fd;
+
+	fd = open(argv[1], O_RDONLY);
+	if (fd == -1)
+		return 1;
+	for (i = 0; i < sizeof(offsets)/sizeof(offsets[0]); i++) {
+		if (pread(fd, buf, sizeof(buf), offsets[i]) != sizeof(buf))
+			return 1;
+		printf("%.8s\n", buf);
+	}
+	printf("%d\n", (int)pread(fd, buf, sizeof(buf), 64<<20));
+	return 0;
+}
+EOF
+
+	# A 64 MiB object with markers at the offsets read above.
+	python3 - "$data" <<EOF
+import sys
+with open(sys.argv[1], 'wb') as f:
+	f.truncate(64 << 20)
+	for off, mark in ((0, b'begin---'), (40 << 20, b'middle--'), (12345678, b'odd-----'), (63 << 20, b'end-----')):
+		f.seek(off)
+		f.write(mark)
+EOF
+
+	# A minimal keep-alive server that only answers Range requests.
+	cat > "$server" <<EOF
+import re, sys
+from http.server import HTTPServer, BaseHTTPRequestHandler
+
+data = open(sys.argv[1], 'rb').read()
+
+class Handler(BaseHTTPRequestHandler):
+	protocol_version = 'HTTP/1.1'
+	def do_HEAD(self):
+		self.send_response(200)
+		self.send_header('Content-Length', str(len(data)))
+		self.send_header('ETag', '"$$"')
+		self.end_headers()
+	def do_GET(self):
+		m = re.match(r'bytes=(\d+)-(\d+)', self.headers.get('Range', ''))
+		first, last = int(m.group(1)), min(int(m.group(2)), len(data) - 1)
+		self.send_response(206)
+		self.send_header('Content-Length', str(last - first + 1))
+		self.send_header('Content-Range', 'bytes %d-%d/%d' % (first, last, len(data)))
+		self.send_header('ETag', '"$$"')
+		self.end_headers()
+		self.wfile.write(data[first:last + 1])
+	def log_message(self, *args):
+		pass
+
+server = HTTPServer(('127.0.0.1', 0), Handler)
+with open(sys.argv[2], 'w') as f:
+	f.write(str(server.server_address[1]))
+server.serve_forever()
+EOF
+
+	python3 "$server" "$data" "$port_file" &
+	echo $! > "$pid_file"
+	wait_for_file_creation "$port_file" 15
+
+	cat > output.expected <<EOF
+begin---
+middle--
+odd-----
+end-----
+middle--
+0
+EOF
+}
+
+run()
+{
+	port=$(cat "$port_file")
+	if parrot --stats-file="$stats" -- "$exe" "/http/127.0.0.1:$port/object" > output.actual
+	then
+		require_identical_files output.actual output.expected
+		# Four 256 KiB blocks at most, rather than the whole 64 MiB.
+		bytes=$(tr -d ' \n' < "$stats" | sed -n 's/.*"parrot.http.bytes":\([0-9]*\).*/\1/p')
+		connect=$(tr -d ' \n' < "$stats" | sed -n 's/.*"parrot.http.connect":\([0-9]*\).*/\1/p')
+		[ -n "$bytes" ] && [ "$bytes" -le $((4*256*1024)) ] && [ "$connect" -eq 1 ]
+	else
+		return 1
+	fi
+}
+
+clean()
+{
+	if [ -f "$pid_file" ]; then
+		kill $(cat "$pid_file")
+	fi
+	rm -f "$exe" "$server" "$data" "$port_file" "$pid_file" "$stats" output.actual output.expected
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,74 @@
+#!/bin/sh
+
+. ../../dttools/test/test_runner_common.sh
+. ./parrot-test.sh
+
+exe="$0.test"
+data="$0.data"
+
+prepare()
+{
+	gcc -I../src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none <<EOF
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include <stdio.h>
+#include <string.h>
+
+int main (int argc, char *argv[])
+{
+	char buf[16] = "";
+	char *m;
+	int fd;
+
+	fd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR);
+	if (fd == -1 || write(fd, "hello world\n", 12) != 12)
+		return 1;
+	if (pread(fd, buf, 5, 6) != 5 || lseek(fd, 0, SEEK_CUR) != 12)
+		return 1;
+	m = mmap(NULL, 12, PROT_READ, MAP_SHARED, fd, 0);
+	if (m == MAP_FAILED)
+		return 1;
+	printf("%s %.5s\n", buf, m);
+	close(fd);
+
+	/* O_EXCL must still create the file exactly once. */
+	unlink(argv[1]);
+	fd = open(argv[1], O_RDWR|O_CREAT|O_EXCL, S_IRUSR|S_IWUSR);
+	printf("%d\n", fd >= 0);
+	return 0;
+}
+EOF
+	cat > output.expected <<EOF
+world hello
+1
+EOF
+}
+
+run()
+{
+	if ! parrot --stats-file=native.stats -- "$exe" "$data" > output.actual
+	then
+		return 1
+	fi
+	require_identical_files output.actual output.expected || return 1
+	grep -q '"parrot.local.native"' native.stats && return 1
+
+	if ! parrot --native-local --stats-file=native.stats -- "$exe" "$data" > output.actual
+	then
+		return 1
+	fi
+	require_identical_files output.actual output.expected || return 1
+	grep -Eq '"parrot.local.native": *[1-9]' native.stats
+}
+
+clean()
+{
+	rm -f "$exe" "$data" native.stats output.actual output.expected
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
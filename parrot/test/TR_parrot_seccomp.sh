@@ -0,0 +1,92 @@
+#!/bin/sh
+
+# Compare a few syscall-heavy microbenchmarks with and without --seccomp.
+# The timings are only reported; the test checks that both modes agree.
+
+. ../../dttools/test/test_runner_common.sh
+. ./parrot-test.sh
+
+exe="$0.test"
+
+prepare()
+{
+	gcc -I../src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none -lm <<EOF
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define N 20000
+
+static double now (void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+#define BENCH(name, body) \\
+	do {\\
+		int i;\\
+		double start = now();\\
+		for (i = 0; i < N; i++) {\\
+			body;\\
+		}\\
+		fprintf(stderr, "%-16s %8.3f us/call\n", name, (now()-start)*1e6/N);\\
+	} while (0)
+
+int main (int argc, char *argv[])
+{
+	int futex = 0;
+	struct timespec ts;
+	struct stat buf;
+	char data[16];
+	int fd;
+
+	BENCH("sched_yield", sched_yield());
+	BENCH("futex", syscall(SYS_futex, &futex, FUTEX_WAKE, 1, NULL, NULL, 0));
+	BENCH("clock_gettime", syscall(SYS_clock_gettime, CLOCK_REALTIME, &ts));
+	BENCH("mmap anonymous", mprotect(mmap(NULL, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0), 4096, PROT_READ));
+	BENCH("stat", stat(argv[0], &buf));
+
+	/* Calls Parrot rewrites must still be trapped. */
+	fd = open(argv[0], O_RDONLY);
+	if (fd == -1 || read(fd, data, 4) != 4)
+		return 1;
+	printf("%d %.3s\n", fstat(fd, &buf) == 0 && S_ISREG(buf.st_mode), data+1);
+	return 0;
+}
+EOF
+}
+
+run()
+{
+	if ! parrot -- "$exe" > output.expected
+	then
+		return 1
+	fi
+	if parrot --seccomp -- "$exe" > output.actual
+	then
+		require_identical_files output.actual output.expected
+		return 0
+	else
+		return 1
+	fi
+}
+
+clean()
+{
+	rm -f "$exe" output.actual output.expected
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,96 @@
+#!/bin/sh
+
+# Read a few pieces of a large Chirp file with --sparse-cache and check that
+# only their blocks are fetched, then that --prefetch fills in the rest.
+
+. ../../dttools/test/test_runner_common.sh
+. ./parrot-test.sh
+. ../../chirp/test/chirp-common.sh
+
+c="./hostport.$PPID"
+exe="$0.test"
+cache="$0.cache"
+stats="$0.stats"
+
+prepare()
+{
+	chirp_start local
+	echo "$hostport" > "$c"
+
+	# A 16 MiB file with markers at the offsets read below.
+	python3 - "$root/data" <<EOF
+import sys
+with open(sys.argv[1], 'wb') as f:
+	f.truncate(16 << 20)
+	for off, mark in ((0, b'begin---'), (9 << 20, b'middle--'), ((16 << 20) - 8, b'end-----')):
+		f.seek(off)
+		f.write(mark)
+EOF
+	chmod 644 "$root/data"
+
+	gcc -I../src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none <<EOF
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int main (int argc, char *argv[])
+{
+	static const off_t offsets[] = {0, 9<<20, (16<<20)-8, 9<<20};
+	char buf[8];
+	unsigned i;
+	int fd;
+
+	fd = open(argv[1], O_RDONLY);
+	if (fd == -1)
+		return 1;
+	for (i = 0; i < sizeof(offsets)/sizeof(offsets[0]); i++) {
+		if (pread(fd, buf, sizeof(buf), offsets[i]) != sizeof(buf))
+			return 1;
+		printf("%.8s\n", buf);
+	}
+	/* Leave Parrot idle for a while with the file open. */
+	if (argc > 2)
+		sleep(atoi(argv[2]));
+	return 0;
+}
+EOF
+
+	cat > output.expected <<EOF
+begin---
+middle--
+end-----
+middle--
+EOF
+}
+
+block_bytes()
+{
+	tr -d ' \n' < "$stats" | sed -n 's/.*"parrot.cache.block.bytes":\([0-9]*\).*/\1/p'
+}
+
+run()
+{
+	hostport=$(cat "$c")
+
+	parrot --no-chirp-catalog --timeout=15 --sparse-cache --tempdir="$cache" --stats-file="$stats" -- "$exe" "/chirp/$hostport/data" > output.actual || return 1
+	require_identical_files output.actual output.expected
+	# Three 256 KiB blocks, not the whole 16 MiB.
+	[ "$(block_bytes)" -le $((3*256*1024)) ] || return 1
+
+	rm -rf "$cache"
+	parrot --no-chirp-catalog --timeout=15 --sparse-cache --prefetch --tempdir="$cache" --stats-file="$stats" -- "$exe" "/chirp/$hostport/data" 5 > output.actual || return 1
+	require_identical_files output.actual output.expected
+	[ "$(block_bytes)" -eq $((16<<20)) ]
+}
+
+clean()
+{
+	chirp_clean
+	rm -rf "$c" "$exe" "$cache" "$stats" output.actual output.expected
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
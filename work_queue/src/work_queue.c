@@ -22,6 +22,8 @@ See the file COPYING for details.
 #include "interfaces_address.h"
 #include "itable.h"
 #include "list.h"
+#include "set.h"
+#include "priority_queue.h"
 #include "macros.h"
 #include "username.h"
 #include "create_dir.h"
@@ -33,6 +35,7 @@ See the file COPYING for details.
 #include "rmonitor_poll.h"
 #include "category_internal.h"
 #include "copy_stream.h"
+#include "full_io.h"
 #include "random.h"
 #include "process.h"
 #include "path.h"
@@ -47,12 +50,14 @@ See the file COPYING for details.
 #include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -139,17 +144,30 @@ struct work_queue {
 	char workingdir[PATH_MAX];
 
 	struct link      *master_link;   // incoming tcp connection for workers.
-	struct link_info *poll_table;
+	struct link_poll_set *poll_set;  // master link, foreman uplink, and the link of every worker.
+	struct link_info *poll_table;    // links with activity in the last poll.
 	int poll_table_size;
+	int master_link_active;          // whether the master link had activity in the last poll.
 
 	struct itable *tasks;           // taskid -> task
 	struct itable *task_state_map;  // taskid -> state
-	struct list   *ready_list;      // ready to be sent to a worker
+	struct priority_queue *ready_queue;  // ready to be sent to a worker, by priority
+	struct itable *ready_nodes;     // taskid -> node of ready_queue
+	struct hash_table *tasks_by_tag; // tag -> itable of taskid -> task, for tasks in q->tasks
+
+	struct list       *task_state_lists[WORK_QUEUE_TASK_CANCELED + 1];  // tasks in q->tasks, by state, in order of arrival to the state.
+	struct itable     *task_state_index;                                // taskid -> struct task_state_entry
+	struct hash_table *task_state_counts;                               // category -> int[WORK_QUEUE_TASK_CANCELED + 1]
 
 	struct hash_table *worker_table;
 	struct hash_table *worker_blacklist;
 	struct itable  *worker_task_map;
 
+	struct set **worker_buckets;         // free cores -> set of workers that may receive tasks.
+	int         *worker_bucket_counts;   // segment tree with the number of workers in each range of buckets.
+	int          worker_buckets_size;    // number of buckets, always a power of two.
+	int          workers_without_cores;  // indexed workers that report no cores.
+
 	struct hash_table *categories;
 
 	struct hash_table *workers_with_available_results;
@@ -176,6 +194,26 @@ struct work_queue {
 	int transfer_outlier_factor;
 	int default_transfer_rate;
 
+	int dispatch_batch_size;          /* Send at most this many tasks per dispatch pass of work_queue_wait */
+	timestamp_t dispatch_batch_time;  /* ... and spend at most this many usecs doing so. */
+
+	int max_concurrent_transfers;     /* Send inputs to at most this many workers at once from transfer threads. */
+	int transfers_active;             /* transfer threads running, or done but not yet joined. */
+	uint64_t next_transfer_id;
+	struct itable *transfers;         /* transfer id -> threaded transfer not yet finished. */
+	int transfer_notify_fds[2];       /* transfer threads write here the id of the transfer when done. */
+	struct link *transfer_notify_link;
+
+	int peer_transfers_enabled;       /* Let workers fetch cached files from other workers. */
+	int peer_transfer_limit;          /* Serve a file from a worker to at most this many others at once. */
+	char peer_token[33];              /* Secret that workers of this master present to each other to fetch files. */
+	struct hash_table *files_seeding; /* cachename -> number of workers the master is sending the file to, with peer transfers. */
+	struct hash_table *file_holders;  /* cachename -> set of workers with the file in current_files. */
+	struct hash_table *workers_with_peer_fallbacks; /* workers with files to be sent by the master after a failed peer transfer. */
+
+	int content_addressed_cache;      /* Name cached input files by the checksum of their contents. */
+	struct hash_table *content_checksums; /* local path -> struct content_checksum */
+
 	char *catalog_hosts;
 
 	time_t catalog_last_update_time;
@@ -232,6 +270,15 @@ struct work_queue_worker {
 	struct link *link;
 	struct itable *current_tasks;
 	struct itable *current_tasks_boxes;
+	struct work_queue_transfer *transfer;     // threaded transfer of inputs in progress, if any.
+	char *transfer_host;                      // address and port where the worker serves its cache to peers.
+	int   transfer_port;
+	int   peer_transfers_out;                 // peers currently fetching files from this worker.
+	int   peer_source_failed;                 // a peer could not fetch from this worker, do not use it as a source.
+	struct hash_table *peer_pending;          // cachename -> struct peer_fetch, files being fetched from peers.
+	struct list *peer_fallbacks;              // struct peer_fetch that failed, to be sent by the master.
+	int64_t index_bucket;                     // bucket in q->worker_buckets, or -1 if not indexed.
+	int     index_without_cores;              // 1 if counted in q->workers_without_cores.
 	int finished_tasks;
 	int64_t total_tasks_complete;
 	int64_t total_bytes_transferred;
@@ -242,6 +289,17 @@ struct work_queue_worker {
 	timestamp_t last_update_msg_time;
 };
 
+/* A cached file that a worker fetches from a peer, and how the master sends it instead if that fails. */
+struct peer_fetch {
+	char *source_key;             /* hashkey of the worker it is fetched from. */
+	char *cached_name;
+	char *localname;
+	int64_t offset;
+	int64_t length;
+	struct stat info;             /* local file, recorded in current_files once fetched. */
+	int taskid;                   /* task that needs the file. */
+};
+
 struct work_queue_task_report {
 	timestamp_t transfer_time;
 	timestamp_t exec_time;
@@ -252,12 +310,23 @@ struct work_queue_task_report {
 
 static void handle_failure(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, work_queue_result_code_t fail_type);
 
+static void transfer_complete(struct work_queue *q, struct work_queue_transfer *tr);
+static void transfer_discard(struct work_queue *q, struct work_queue_transfer *tr);
+static int transfer_in_progress(struct work_queue_transfer *tr);
+
 struct blacklist_host_info {
 	int    blacklisted;
 	int    times_blacklisted;
 	time_t release_at;
 };
 
+/* Position of a task in the per-state indexes. Lets change_task_state keep
+ * task_state_any and task_state_count at O(1) without scanning q->tasks. */
+struct task_state_entry {
+	struct list_cursor *cursor;       // on the task, in q->task_state_lists[state]
+	int                *category_counts; // counters of the category the task had when indexed
+};
+
 static void handle_worker_failure(struct work_queue *q, struct work_queue_worker *w);
 static void handle_app_failure(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t);
 static void remove_worker(struct work_queue *q, struct work_queue_worker *w, worker_disconnect_reason reason);
@@ -272,16 +341,25 @@ static void count_worker_resources(struct work_queue *q, struct work_queue_worke
 static void find_max_worker(struct work_queue *q);
 static void update_max_worker(struct work_queue *q, struct work_queue_worker *w);
 
+/* keep w in the bucket of q->worker_buckets that corresponds to its free cores. */
+static void worker_index_update(struct work_queue *q, struct work_queue_worker *w);
+static void worker_index_remove(struct work_queue *q, struct work_queue_worker *w);
+
 static void push_task_to_ready_list( struct work_queue *q, struct work_queue_task *t );
 
+/* keep q->tasks_by_tag current, so that tasks can be cancelled by tag without a scan of q->tasks. */
+static void task_tag_index_insert(struct work_queue *q, struct work_queue_task *t);
+static void task_tag_index_remove(struct work_queue *q, struct work_queue_task *t);
+
 /* returns old state */
 static work_queue_task_state_t change_task_state( struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t new_state);
 
 const char *task_state_str(work_queue_task_state_t state);
 const char *task_result_str(work_queue_result_t result);
 
-/* 1, 0 whether t is in state */
-static int task_state_is( struct work_queue *q, uint64_t taskid, work_queue_task_state_t state);
+/* keep the per-state indexes of q->tasks current. Called from change_task_state. */
+static void task_state_index_insert(struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t state);
+static void task_state_index_remove(struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t state);
 /* pointer to first task found with state. NULL if no such task */
 static struct work_queue_task *task_state_any(struct work_queue *q, work_queue_task_state_t state);
 /* number of tasks with state */
@@ -528,6 +606,10 @@ static int send_worker_msg( struct work_queue *q, struct work_queue_worker *w, c
 	buffer_putvfstring(B, fmt, va);
 	va_end(va);
 
+	// A transfer thread owns the link until it is done.
+	if(w->transfer)
+		transfer_complete(q, w->transfer);
+
 	debug(D_WQ, "tx to %s (%s): %s", w->hostname, w->addrport, buffer_tostring(B));
 
 	//If foreman, then we wait until foreman gives the master some attention.
@@ -629,6 +711,14 @@ work_queue_msg_code_t process_info(struct work_queue *q, struct work_queue_worke
 		free(w->workerid);
 		w->workerid = xxstrdup(value);
 		write_transaction_worker(q, w, 0, 0);
+	} else if(string_prefix_is(field, "transfer-port")) {
+		char addr[LINK_ADDRESS_MAX];
+		int port;
+		if(link_address_remote(w->link, addr, &port)) {
+			free(w->transfer_host);
+			w->transfer_host = xxstrdup(addr);
+			w->transfer_port = atoi(value);
+		}
 	}
 
 	//Note we always mark info messages as processed, as they are optional.
@@ -636,6 +726,169 @@ work_queue_msg_code_t process_info(struct work_queue *q, struct work_queue_worke
 }
 
 
+/*
+Record that w has the cached file name, as described by info, which is then
+owned by w. q->file_holders indexes the workers by the files they have, so that
+the sources of a file for peer transfers are found without looking at every
+worker.
+*/
+
+static void worker_file_insert(struct work_queue *q, struct work_queue_worker *w, const char *name, struct stat *info)
+{
+	free(hash_table_remove(w->current_files, name));
+	hash_table_insert(w->current_files, name, info);
+
+	struct set *holders = hash_table_lookup(q->file_holders, name);
+	if(!holders) {
+		holders = set_create(0);
+		hash_table_insert(q->file_holders, name, holders);
+	}
+	set_insert(holders, w);
+}
+
+static void worker_file_remove(struct work_queue *q, struct work_queue_worker *w, const char *name)
+{
+	if(!hash_table_lookup(w->current_files, name))
+		return;
+
+	struct set *holders = hash_table_lookup(q->file_holders, name);
+	if(holders) {
+		set_remove(holders, w);
+		if(set_size(holders) == 0) {
+			hash_table_remove(q->file_holders, name);
+			set_delete(holders);
+		}
+	}
+
+	free(hash_table_remove(w->current_files, name));
+}
+
+static void peer_fetch_delete(struct peer_fetch *pf)
+{
+	free(pf->source_key);
+	free(pf->cached_name);
+	free(pf->localname);
+	free(pf);
+}
+
+/* Release the slot that pf holds at its source. If failed, the source is not used again. */
+
+static void peer_fetch_release(struct work_queue *q, struct peer_fetch *pf, int failed)
+{
+	struct work_queue_worker *source = hash_table_lookup(q->worker_table, pf->source_key);
+	if(!source) return;
+
+	source->peer_transfers_out--;
+	if(failed && !source->peer_source_failed) {
+		debug(D_WQ, "not using %s (%s) as a source of files for other workers", source->hostname, source->addrport);
+		source->peer_source_failed = 1;
+	}
+}
+
+/*
+A worker finished fetching a cached file from a peer. Release the slot taken
+at the peer it was fetched from, and only now record that the worker has it.
+*/
+
+static work_queue_msg_code_t process_peer_done(struct work_queue *q, struct work_queue_worker *w, char *line)
+{
+	char name_encoded[WORK_QUEUE_LINE_MAX];
+	char name[WORK_QUEUE_LINE_MAX];
+
+	if(sscanf(line, "peer-done %s", name_encoded) != 1)
+		return MSG_FAILURE;
+
+	url_decode(name_encoded, name, sizeof(name));
+
+	struct peer_fetch *pf = hash_table_remove(w->peer_pending, name);
+	if(pf) {
+		peer_fetch_release(q, pf, 0);
+
+		struct stat *remote_info = xxmalloc(sizeof(*remote_info));
+		memcpy(remote_info, &pf->info, sizeof(pf->info));
+		worker_file_insert(q, w, name, remote_info);
+
+		peer_fetch_delete(pf);
+		q->stats->transfers_peer++;
+	}
+
+	return MSG_PROCESSED;
+}
+
+/*
+A worker could not fetch a cached file from a peer. The task that needs it
+waits at the worker, and the master sends the file itself from
+send_peer_fallbacks, outside of the message handling.
+*/
+
+static work_queue_msg_code_t process_peer_failed(struct work_queue *q, struct work_queue_worker *w, char *line)
+{
+	char name_encoded[WORK_QUEUE_LINE_MAX];
+	char name[WORK_QUEUE_LINE_MAX];
+
+	if(sscanf(line, "peer-failed %s", name_encoded) != 1)
+		return MSG_FAILURE;
+
+	url_decode(name_encoded, name, sizeof(name));
+
+	struct peer_fetch *pf = hash_table_remove(w->peer_pending, name);
+	if(pf) {
+		peer_fetch_release(q, pf, 1);
+
+		debug(D_WQ, "%s (%s) could not get '%s' from a peer, sending it from the master", w->hostname, w->addrport, name);
+		list_push_tail(w->peer_fallbacks, pf);
+		hash_table_insert(q->workers_with_peer_fallbacks, w->hashkey, w);
+	}
+
+	return MSG_PROCESSED;
+}
+
+/*
+A worker restored a file from a cache that outlives it, before it connected.
+Only content addressed files are kept in such caches, so there is no local
+modification time to compare against, and zero is recorded.
+*/
+
+static work_queue_msg_code_t process_cache_update(struct work_queue *q, struct work_queue_worker *w, char *line)
+{
+	char name[WORK_QUEUE_LINE_MAX];
+	int64_t size;
+
+	if(sscanf(line, "cache-update %s %" SCNd64, name, &size) != 2)
+		return MSG_FAILURE;
+
+	if(!hash_table_lookup(w->current_files, name)) {
+		struct stat *remote_info = xxmalloc(sizeof(*remote_info));
+		memset(remote_info, 0, sizeof(*remote_info));
+		remote_info->st_size = size;
+		worker_file_insert(q, w, name, remote_info);
+	}
+
+	return MSG_PROCESSED;
+}
+
+/*
+Release the slots that transfers to w hold at their sources. If w failed, the
+transfers may be the cause, and the sources are not used again.
+*/
+
+static void release_peer_transfers(struct work_queue *q, struct work_queue_worker *w, int failed)
+{
+	struct peer_fetch *pf;
+	char *name;
+
+	hash_table_firstkey(w->peer_pending);
+	while(hash_table_nextkey(w->peer_pending, &name, (void **) &pf)) {
+		peer_fetch_release(q, pf, failed);
+		peer_fetch_delete(pf);
+	}
+	hash_table_clear(w->peer_pending);
+
+	while((pf = list_pop_head(w->peer_fallbacks))) {
+		peer_fetch_delete(pf);
+	}
+}
+
 /**
  * This function receives a message from worker and records the time a message is successfully
  * received. This timestamp is used in keepalive timeout computations.
@@ -649,6 +902,9 @@ static work_queue_msg_code_t recv_worker_msg(struct work_queue *q, struct work_q
 	else
 		stoptime = time(0) + q->short_timeout;
 
+	if(w->transfer)
+		transfer_complete(q, w->transfer);
+
 	int result = link_readline(w->link, line, length, stoptime);
 
 	if (result <= 0) {
@@ -685,6 +941,12 @@ static work_queue_msg_code_t recv_worker_msg(struct work_queue *q, struct work_q
 		result = process_info(q, w, line);
 	} else if (string_prefix_is(line, "tlq")) {
 		result = advertise_tlq_url(q, w, line);
+	} else if (string_prefix_is(line, "peer-done")) {
+		result = process_peer_done(q, w, line);
+	} else if (string_prefix_is(line, "peer-failed")) {
+		result = process_peer_failed(q, w, line);
+	} else if (string_prefix_is(line, "cache-update")) {
+		result = process_cache_update(q, w, line);
 	} else {
 		// Message is not a status update: return it to the user.
 		result = MSG_NOT_PROCESSED;
@@ -748,18 +1010,23 @@ Two exceptions are made:
   between the master and the workers that it serves.
 */
 
-static int get_transfer_wait_time(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, int64_t length)
+static double get_worker_transfer_rate(struct work_queue *q, struct work_queue_worker *w, char **data_source)
 {
-	double avg_transfer_rate; // bytes per second
-	char *data_source;
-
 	if(w->total_transfer_time>1000000) {
 		// Note w->total_transfer_time is timestamp_t with units of microseconds.
-		avg_transfer_rate = 1000000 * w->total_bytes_transferred / w->total_transfer_time;
-		data_source = xxstrdup("worker's observed");
+		if(data_source) {
+			*data_source = xxstrdup("worker's observed");
+		}
+		return 1000000 * w->total_bytes_transferred / w->total_transfer_time;
 	} else {
-		avg_transfer_rate = get_queue_transfer_rate(q, &data_source);
+		return get_queue_transfer_rate(q, data_source);
 	}
+}
+
+static int get_transfer_wait_time(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, int64_t length)
+{
+	char *data_source;
+	double avg_transfer_rate = get_worker_transfer_rate(q, w, &data_source); // bytes per second
 
 	double tolerable_transfer_rate = avg_transfer_rate / q->transfer_outlier_factor; // bytes per second
 
@@ -860,8 +1127,7 @@ static void cleanup_worker(struct work_queue *q, struct work_queue_worker *w)
 
 	hash_table_firstkey(w->current_files);
 	while(hash_table_nextkey(w->current_files, &key, (void **) &value)) {
-		hash_table_remove(w->current_files, key);
-		free(value);
+		worker_file_remove(q, w, key);
 		hash_table_firstkey(w->current_files);
 	}
 
@@ -926,6 +1192,12 @@ static void remove_worker(struct work_queue *q, struct work_queue_worker *w, wor
 
 	debug(D_WQ, "worker %s (%s) removed", w->hostname, w->addrport);
 
+	if(w->transfer) {
+		transfer_discard(q, w->transfer);
+	}
+
+	release_peer_transfers(q, w, reason == WORKER_DISCONNECT_FAILURE);
+
 	if(w->type == WORKER_TYPE_WORKER || w->type == WORKER_TYPE_FOREMAN) {
 		q->stats->workers_removed++;
 	}
@@ -934,20 +1206,27 @@ static void remove_worker(struct work_queue *q, struct work_queue_worker *w, wor
 
 	cleanup_worker(q, w);
 
+	worker_index_remove(q, w);
 	hash_table_remove(q->worker_table, w->hashkey);
 	hash_table_remove(q->workers_with_available_results, w->hashkey);
+	hash_table_remove(q->workers_with_peer_fallbacks, w->hashkey);
 
 	record_removed_worker_stats(q, w);
 
-	if(w->link)
+	if(w->link) {
+		link_poll_set_remove(q->poll_set, w->link);
 		link_close(w->link);
+	}
 
 	itable_delete(w->current_tasks);
 	itable_delete(w->current_tasks_boxes);
 	hash_table_delete(w->current_files);
+	hash_table_delete(w->peer_pending);
+	list_delete(w->peer_fallbacks);
 	work_queue_resources_delete(w->resources);
 
 	free(w->workerid);
+	free(w->transfer_host);
 
 	if(w->features)
 		hash_table_delete(w->features);
@@ -969,8 +1248,9 @@ static int release_worker(struct work_queue *q, struct work_queue_worker *w)
 {
 	if(!w) return 0;
 
-
-	send_worker_msg(q,w,"release\n");
+	/* as in shut_down_worker, do not wait for a transfer to send the message. */
+	if(!transfer_in_progress(w->transfer))
+		send_worker_msg(q,w,"release\n");
 
 	remove_worker(q, w, WORKER_DISCONNECT_EXPLICIT);
 
@@ -1024,8 +1304,11 @@ static void add_worker(struct work_queue *q)
 	w->draining = 0;
 	w->link = link;
 	w->current_files = hash_table_create(0, 0);
+	w->peer_pending = hash_table_create(0, 0);
+	w->peer_fallbacks = list_create();
 	w->current_tasks = itable_create(0);
 	w->current_tasks_boxes = itable_create(0);
+	w->index_bucket = -1;
 	w->finished_tasks = 0;
 	w->start_time = timestamp_get();
 
@@ -1040,6 +1323,8 @@ static void add_worker(struct work_queue *q)
 	sprintf(w->addrport, "%s:%d", addr, port);
 	hash_table_insert(q->worker_table, w->hashkey, w);
 
+	link_poll_set_add(q->poll_set, link, LINK_READ);
+
 	return;
 }
 
@@ -1259,6 +1544,99 @@ char *make_cached_name( const struct work_queue_file *f )
 	}
 }
 
+/*
+With the content addressed cache, cached input files are named by the md5
+checksum of their contents, rather than by their path. The checksum of a file
+is computed once per (path, mtime, size), and remembered in
+q->content_checksums.
+*/
+
+struct content_checksum {
+	time_t mtime;
+	off_t size;
+	char *cached_name;
+};
+
+static int is_content_cached_name(const char *cached_name)
+{
+	return !strncmp(cached_name, WORK_QUEUE_CONTENT_CACHED_NAME_PREFIX, strlen(WORK_QUEUE_CONTENT_CACHED_NAME_PREFIX));
+}
+
+static const char *content_cached_name(struct work_queue *q, const char *path)
+{
+	struct stat info;
+	if(lstat(path, &info) < 0 || !S_ISREG(info.st_mode))
+		return NULL;
+
+	struct content_checksum *cs = hash_table_lookup(q->content_checksums, path);
+	if(cs && cs->mtime == info.st_mtime && cs->size == info.st_size)
+		return cs->cached_name;
+
+	unsigned char digest[MD5_DIGEST_LENGTH];
+	timestamp_t start = timestamp_get();
+	if(!md5_file(path, digest)) {
+		debug(D_WQ, "could not checksum %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	if(!cs) {
+		cs = xxmalloc(sizeof(*cs));
+		hash_table_insert(q->content_checksums, path, cs);
+	} else {
+		free(cs->cached_name);
+	}
+
+	cs->mtime = info.st_mtime;
+	cs->size = info.st_size;
+	cs->cached_name = string_format(WORK_QUEUE_CONTENT_CACHED_NAME_PREFIX "%s", md5_string(digest));
+
+	debug(D_WQ, "%s is cached as %s (%.3fs to checksum)", path, cs->cached_name, (timestamp_get() - start) / 1000000.0);
+
+	return cs->cached_name;
+}
+
+static char *expand_envnames(struct work_queue_worker *w, const char *payload);
+
+/*
+Rename the cached input files of t by their contents. w is the worker the task
+is going to, or NULL at submission, when file names with environment
+variables cannot yet be expanded.
+*/
+
+static void update_content_cached_names(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t)
+{
+	struct work_queue_file *f;
+
+	if(!q->content_addressed_cache || !t->input_files)
+		return;
+
+	list_first_item(t->input_files);
+	while((f = list_next_item(t->input_files))) {
+		if(f->type != WORK_QUEUE_FILE || !(f->flags & WORK_QUEUE_CACHE) || (f->flags & WORK_QUEUE_THIRDGET))
+			continue;
+
+		char *path;
+		if(w) {
+			path = expand_envnames(w, f->payload);
+		} else if(strchr(f->payload, '$')) {
+			continue;
+		} else {
+			path = xxstrdup(f->payload);
+		}
+
+		if(!path)
+			continue;
+
+		const char *name = content_cached_name(q, path);
+		if(name && strcmp(name, f->cached_name)) {
+			free(f->cached_name);
+			f->cached_name = xxstrdup(name);
+		}
+
+		free(path);
+	}
+}
+
 /*
 This function stores an output file from the remote cache directory
 to a third-party location, which can be either a remote filesystem
@@ -1331,7 +1709,7 @@ static work_queue_result_code_t get_output_file( struct work_queue *q, struct wo
 				return WQ_APP_FAILURE;
 			}
 			memcpy(remote_info, &local_info, sizeof(local_info));
-			hash_table_insert(w->current_files, f->cached_name, remote_info);
+			worker_file_insert(q, w, f->cached_name, remote_info);
 		} else {
 			debug(D_NOTICE, "Cannot stat file %s: %s", f->payload, strerror(errno));
 		}
@@ -1389,7 +1767,7 @@ static work_queue_result_code_t get_monitor_output_file( struct work_queue *q, s
 static void delete_worker_file( struct work_queue *q, struct work_queue_worker *w, const char *filename, int flags, int except_flags ) {
 	if(!(flags & except_flags)) {
 		send_worker_msg(q,w, "unlink %s\n", filename);
-		hash_table_remove(w->current_files, filename);
+		worker_file_remove(q, w, filename);
 	}
 }
 
@@ -1662,28 +2040,26 @@ static int expire_waiting_tasks(struct work_queue *q)
 {
 	struct work_queue_task *t;
 	int expired = 0;
-	int count;
 
 	timestamp_t current_time = timestamp_get();
-	count = task_state_count(q, NULL, WORK_QUEUE_TASK_READY);
-
-	while(count > 0)
-	{
-		count--;
 
-		t = list_pop_head(q->ready_list);
+	// collect the tasks first, as expiring a task modifies the ready queue.
+	struct list *to_expire = list_create();
 
-		if(t->resources_requested->end > 0 && (uint64_t) t->resources_requested->end <= current_time)
-		{
-			expire_waiting_task(q, t);
-			expired++;
-		}
-		else
-		{
-			list_push_tail(q->ready_list, t);
+	priority_queue_first_item(q->ready_queue);
+	while((t = priority_queue_next_item(q->ready_queue))) {
+		if(t->resources_requested->end > 0 && (uint64_t) t->resources_requested->end <= current_time) {
+			list_push_tail(to_expire, t);
 		}
 	}
 
+	while((t = list_pop_head(to_expire))) {
+		expire_waiting_task(q, t);
+		expired++;
+	}
+
+	list_delete(to_expire);
+
 	return expired;
 }
 
@@ -1770,6 +2146,10 @@ static work_queue_msg_code_t process_workqueue(struct work_queue *q, struct work
 		debug(D_DEBUG, "Warning: potential worker version mismatch: worker %s (%s) is version %s, and master is version %s", w->hostname, w->addrport, w->version, CCTOOLS_VERSION);
 	}
 
+	if(q->peer_transfers_enabled && w->type == WORKER_TYPE_WORKER) {
+		send_worker_msg(q, w, "peer-serve %s\n", q->peer_token);
+	}
+
 
 	return MSG_PROCESSED;
 }
@@ -2075,8 +2455,8 @@ static struct rmsummary *largest_waiting_declared_resources(struct work_queue *q
 	struct rmsummary *max_resources_waiting = rmsummary_create(-1);
 	struct work_queue_task *t;
 
-	list_first_item(q->ready_list);
-	while((t = list_next_item(q->ready_list))) {
+	priority_queue_first_item(q->ready_queue);
+	while((t = priority_queue_next_item(q->ready_queue))) {
 
 		if(!category || (t->category && !strcmp(t->category, category))) {
 			rmsummary_merge_max(max_resources_waiting, t->resources_requested);
@@ -2098,8 +2478,8 @@ static struct rmsummary  *total_resources_needed(struct work_queue *q) {
 	struct rmsummary *total = rmsummary_create(0);
 
 	/* for waiting tasks, we use what they would request if dispatched right now. */
-	list_first_item(q->ready_list);
-	while((t = list_next_item(q->ready_list))) {
+	priority_queue_first_item(q->ready_queue);
+	while((t = priority_queue_next_item(q->ready_queue))) {
 		const struct rmsummary *s = task_min_resources(q, t);
 		rmsummary_add(total, s);
 	}
@@ -2127,8 +2507,8 @@ static struct rmsummary *largest_waiting_measured_resources(struct work_queue *q
 	struct rmsummary *max_resources_waiting = rmsummary_create(-1);
 	struct work_queue_task *t;
 
-	list_first_item(q->ready_list);
-	while((t = list_next_item(q->ready_list))) {
+	priority_queue_first_item(q->ready_queue);
+	while((t = priority_queue_next_item(q->ready_queue))) {
 
 		if(!category || (t->category && !strcmp(t->category, category))) {
 			const struct rmsummary *r = task_min_resources(q, t);
@@ -2345,6 +2725,9 @@ static struct jx * queue_to_jx( struct work_queue *q, struct link *foreman_uplin
 	jx_insert_integer(j,"tasks_failed",info.tasks_failed);
 	jx_insert_integer(j,"tasks_cancelled",info.tasks_cancelled);
 	jx_insert_integer(j,"tasks_exhausted_attempts",info.tasks_exhausted_attempts);
+	jx_insert_integer(j,"tasks_dispatch_batches",info.tasks_dispatch_batches);
+	jx_insert_integer(j,"tasks_dispatched_last_batch",info.tasks_dispatched_last_batch);
+	jx_insert_integer(j,"tasks_dispatched_max_batch",info.tasks_dispatched_max_batch);
 
 	// tasks_complete is deprecated, but the old work_queue_status expects it.
 	jx_insert_integer(j,"tasks_complete",info.tasks_done);
@@ -2366,6 +2749,11 @@ static struct jx * queue_to_jx( struct work_queue *q, struct link *foreman_uplin
 
 	jx_insert_integer(j,"bytes_sent",info.bytes_sent);
 	jx_insert_integer(j,"bytes_received",info.bytes_received);
+	jx_insert_integer(j,"transfers_active",info.transfers_active);
+	jx_insert_integer(j,"transfers_done",info.transfers_done);
+	jx_insert_double(j,"bandwidth_transfer_last",info.bandwidth_transfer_last);
+	jx_insert_double(j,"bandwidth_transfer_max",info.bandwidth_transfer_max);
+	jx_insert_integer(j,"transfers_peer",info.transfers_peer);
 
 	jx_insert_integer(j,"capacity_tasks",info.capacity_tasks);
 	jx_insert_integer(j,"capacity_cores",info.capacity_cores);
@@ -2709,6 +3097,8 @@ static work_queue_msg_code_t process_resource( struct work_queue *q, struct work
 		return MSG_FAILURE;
 	}
 
+	worker_index_update(q, w);
+
 	return MSG_PROCESSED;
 }
 
@@ -2744,6 +3134,12 @@ static work_queue_result_code_t handle_worker(struct work_queue *q, struct link
 	link_to_hash_key(l, key);
 	w = hash_table_lookup(q->worker_table, key);
 
+	if(!w) {
+		// not the link of a worker (e.g., a stale foreman uplink), thus we stop polling it.
+		link_poll_set_remove(q->poll_set, l);
+		return WQ_SUCCESS;
+	}
+
 	int worker_failure = 0;
 	work_queue_msg_code_t result = recv_worker_msg(q, w, line, sizeof(line));
 
@@ -2765,136 +3161,314 @@ static work_queue_result_code_t handle_worker(struct work_queue *q, struct link
 	return WQ_SUCCESS;
 }
 
-static int build_poll_table(struct work_queue *q, struct link *master)
-{
-	int n = 0;
-	char *key;
+/*
+The input files and the description of a task are sent to a worker by a
+transfer. The master prepares a transfer as a list of items from the task and
+from what the worker already has in its cache, and then executes it either
+directly, or, when the transfer carries file data and fewer than
+q->max_concurrent_transfers are in progress, from a thread of its own. While
+the thread runs it owns the link of the worker: the link is out of the poll
+set, the worker does not receive new tasks, and any message to the worker
+first waits for the transfer to complete. Thus a worker receiving inputs runs
+at most the one task they are for until they arrive. When done, the thread
+writes the id of the transfer to q->transfer_notify_fds, and the master
+accounts for the transfer in transfer_finish.
+
+If the worker is removed first, the master does not wait for the thread: it
+shuts down the link under the thread, and reaps the thread and the link when
+notified in transfer_reap.
+
+The functions executing a transfer may run in its thread, and so they only
+look at the transfer and its link, and never at the queue or the worker. They
+do not call debug, which is not thread safe. Errors are kept in the transfer
+with transfer_error, and logged by the master.
+*/
+
+typedef enum {
+	TRANSFER_ITEM_FILE,     /* a file, directory, or symlink in the local filesystem */
+	TRANSFER_ITEM_MESSAGE   /* literal bytes, such as a protocol message followed by its payload */
+} transfer_item_t;
+
+struct transfer_item {
+	transfer_item_t type;
+	char *localname;
+	char *remotename;
+	int64_t offset;
+	int64_t length;
+	char *data;
+	int64_t file_bytes;           /* bytes of data counted as file data sent. */
+	struct stat *cache_info;      /* if not null, the worker caches the item as remotename once sent. */
+	int seeding;                  /* counted in q->files_seeding while the transfer is in progress. */
+	int sent;
+};
+
+struct work_queue_transfer {
+	uint64_t id;
 	struct work_queue_worker *w;
+	int taskid;
+	struct link *link;
+	struct list *items;
+
+	int bulk;                     /* whether the transfer carries file data. */
+	int threaded;
+	int completed;
+	int orphaned;                 /* the worker was removed while the thread ran. */
+	pthread_t thread;
+	int notify_fd;
+
+	/* copied from the queue and the worker, so that the thread does not
+	 * look at them. */
+	double tolerable_transfer_rate;
+	int minimum_transfer_timeout;
+	int message_timeout;
+	double bandwidth;
 
-	// Allocate a small table, if it hasn't been done yet.
-	if(!q->poll_table) {
-		q->poll_table = malloc(sizeof(*q->poll_table) * q->poll_table_size);
-		if(!q->poll_table) {
-			//if we can't allocate a poll table, we can't do anything else.
-			fatal("allocating memory for poll table failed.");
-		}
-	}
+	work_queue_result_code_t result;
+	int64_t total_bytes;
+	timestamp_t time_start;
+	timestamp_t time_end;
+	char *error;
+};
 
-	// The first item in the poll table is the master link, which accepts new connections.
-	q->poll_table[0].link = q->master_link;
-	q->poll_table[0].events = LINK_READ;
-	q->poll_table[0].revents = 0;
-	n = 1;
+static struct work_queue_transfer *transfer_create(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t)
+{
+	struct work_queue_transfer *tr = calloc(1, sizeof(*tr));
 
-	if(master) {
-		/* foreman uplink */
-		q->poll_table[1].link = master;
-		q->poll_table[1].events = LINK_READ;
-		q->poll_table[1].revents = 0;
-		n++;
+	tr->id     = ++q->next_transfer_id;
+	tr->w      = w;
+	tr->taskid = t->taskid;
+	tr->link   = w->link;
+	tr->items  = list_create();
+	tr->result = WQ_SUCCESS;
+	tr->notify_fd = q->transfer_notify_fds[1];
+
+	tr->tolerable_transfer_rate = get_worker_transfer_rate(q, w, NULL) / q->transfer_outlier_factor;
+	if(w->type == WORKER_TYPE_FOREMAN) {
+		tr->minimum_transfer_timeout = q->foreman_transfer_timeout;
+		tr->message_timeout = q->long_timeout;
+	} else {
+		tr->minimum_transfer_timeout = q->minimum_transfer_timeout;
+		tr->message_timeout = q->short_timeout;
 	}
+	tr->bandwidth = q->bandwidth;
 
-	// For every worker in the hash table, add an item to the poll table
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		// If poll table is not large enough, reallocate it
-		if(n >= q->poll_table_size) {
-			q->poll_table_size *= 2;
-			q->poll_table = realloc(q->poll_table, sizeof(*q->poll_table) * q->poll_table_size);
-			if(q->poll_table == NULL) {
-				//if we can't allocate a poll table, we can't do anything else.
-				fatal("reallocating memory for poll table failed.");
-			}
-		}
+	return tr;
+}
 
-		q->poll_table[n].link = w->link;
-		q->poll_table[n].events = LINK_READ;
-		q->poll_table[n].revents = 0;
-		n++;
+static void transfer_delete(struct work_queue_transfer *tr)
+{
+	struct transfer_item *item;
+
+	if(!tr) return;
+
+	while((item = list_pop_head(tr->items))) {
+		free(item->localname);
+		free(item->remotename);
+		free(item->data);
+		free(item->cache_info);
+		free(item);
 	}
+	list_delete(tr->items);
 
-	return n;
+	free(tr->error);
+	free(tr);
 }
 
-/*
-Send a symbolic link to the remote worker.
-Note that the target of the link is sent
-as sthe "body" of the link, following the
-message header.
-*/
-
-static int send_symlink( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *localname, const char *remotename, int64_t *total_bytes )
+static struct transfer_item *transfer_add_file(struct work_queue_transfer *tr, const char *localname, const char *remotename, int64_t offset, int64_t length, struct stat *cache_info)
 {
-	char target[WORK_QUEUE_LINE_MAX];
+	struct transfer_item *item = calloc(1, sizeof(*item));
 
-	int length = readlink(localname,target,sizeof(target));
-	if(length<0) return WQ_APP_FAILURE;
+	item->type       = TRANSFER_ITEM_FILE;
+	item->localname  = xxstrdup(localname);
+	item->remotename = xxstrdup(remotename);
+	item->offset     = offset;
+	item->length     = length;
 
-	char remotename_encoded[WORK_QUEUE_LINE_MAX];
-	url_encode(remotename,remotename_encoded,sizeof(remotename_encoded));
+	if(cache_info) {
+		item->cache_info = xxmalloc(sizeof(*cache_info));
+		memcpy(item->cache_info, cache_info, sizeof(*cache_info));
+	}
+
+	tr->bulk = 1;
+	list_push_tail(tr->items, item);
 
-	send_worker_msg(q,w,"symlink %s %d\n",remotename_encoded,length);
+	return item;
+}
 
-	link_write(w->link,target,length,time(0)+q->long_timeout);
+/* Count the files of the transfer that other workers may fetch from its worker once sent. */
+static void transfer_seeding_update(struct work_queue *q, struct work_queue_transfer *tr, int delta)
+{
+	struct transfer_item *item;
 
-	*total_bytes += length;
+	list_first_item(tr->items);
+	while((item = list_next_item(tr->items))) {
+		if(!item->seeding) continue;
 
-	return WQ_SUCCESS;
+		intptr_t count = (intptr_t) hash_table_remove(q->files_seeding, item->remotename) + delta;
+		if(count > 0) {
+			hash_table_insert(q->files_seeding, item->remotename, (void *) count);
+		}
+	}
 }
 
-/*
-Send a single file (or a piece of a file) to the remote worker.
-The transfer time is controlled by the size of the file.
-If the transfer takes too long, then abort.
-*/
-
-static int send_file( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *localname, const char *remotename, off_t offset, int64_t length, struct stat info, int64_t *total_bytes )
+/* Add a message, followed by payload_length bytes of payload. */
+__attribute__ (( format(printf,4,5) ))
+static struct transfer_item *transfer_add_message(struct work_queue_transfer *tr, const char *payload, int64_t payload_length, const char *fmt, ...)
 {
-	time_t stoptime;
-	timestamp_t effective_stoptime = 0;
-	int64_t actual = 0;
+	struct transfer_item *item = calloc(1, sizeof(*item));
+	va_list va;
+	buffer_t B[1];
 
-	/* normalize the mode so as not to set up invalid permissions */
-	int mode = ( info.st_mode | 0x600 ) & 0777;
+	buffer_init(B);
+	buffer_abortonfailure(B, 1);
 
-	if(!length) {
-		length = info.st_size;
-	}
+	va_start(va, fmt);
+	buffer_putvfstring(B, fmt, va);
+	va_end(va);
 
-	int fd = open(localname, O_RDONLY, 0);
-	if(fd < 0) {
-		debug(D_NOTICE, "Cannot open file %s: %s", localname, strerror(errno));
-		return WQ_APP_FAILURE;
+	debug(D_WQ, "tx to %s (%s): %s", tr->w->hostname, tr->w->addrport, buffer_tostring(B));
+
+	if(payload_length > 0) {
+		buffer_putlstring(B, payload, payload_length);
 	}
 
-	/* If we are sending only a piece of the file, seek there first. */
+	item->type = TRANSFER_ITEM_MESSAGE;
+	buffer_dupl(B, &item->data, NULL);
+	item->length = buffer_pos(B);
+
+	buffer_free(B);
+
+	list_push_tail(tr->items, item);
+
+	return item;
+}
+
+/* Keep the first error of a transfer, to be reported by the master. */
+__attribute__ (( format(printf,2,3) ))
+static void transfer_error(struct work_queue_transfer *tr, const char *fmt, ...)
+{
+	va_list va;
+	buffer_t B[1];
+
+	if(tr->error) return;
+
+	buffer_init(B);
+	buffer_abortonfailure(B, 1);
+
+	va_start(va, fmt);
+	buffer_putvfstring(B, fmt, va);
+	va_end(va);
+
+	buffer_dup(B, &tr->error);
+	buffer_free(B);
+}
+
+/* As get_transfer_wait_time, but from the rate copied into the transfer. */
+static int transfer_wait_time(struct work_queue_transfer *tr, int64_t length)
+{
+	int timeout = length / tr->tolerable_transfer_rate;
+	return MAX(tr->minimum_transfer_timeout, timeout);
+}
+
+__attribute__ (( format(printf,2,3) ))
+static int transfer_msg(struct work_queue_transfer *tr, const char *fmt, ...)
+{
+	va_list va;
+	buffer_t B[1];
+	buffer_init(B);
+	buffer_abortonfailure(B, 1);
+	buffer_max(B, WORK_QUEUE_LINE_MAX);
+
+	va_start(va, fmt);
+	buffer_putvfstring(B, fmt, va);
+	va_end(va);
+
+	int result = link_putlstring(tr->link, buffer_tostring(B), buffer_pos(B), time(0) + tr->message_timeout);
+
+	buffer_free(B);
+
+	return result;
+}
+
+/*
+Send a symbolic link to the remote worker.
+Note that the target of the link is sent
+as sthe "body" of the link, following the
+message header.
+*/
+
+static int send_symlink( struct work_queue_transfer *tr, const char *localname, const char *remotename )
+{
+	char target[WORK_QUEUE_LINE_MAX];
+
+	int length = readlink(localname,target,sizeof(target));
+	if(length<0) return WQ_APP_FAILURE;
+
+	char remotename_encoded[WORK_QUEUE_LINE_MAX];
+	url_encode(remotename,remotename_encoded,sizeof(remotename_encoded));
+
+	transfer_msg(tr,"symlink %s %d\n",remotename_encoded,length);
+
+	link_write(tr->link,target,length,time(0)+tr->message_timeout);
+
+	tr->total_bytes += length;
+
+	return WQ_SUCCESS;
+}
+
+/*
+Send a single file (or a piece of a file) to the remote worker.
+The transfer time is controlled by the size of the file.
+If the transfer takes too long, then abort.
+*/
+
+static int send_file( struct work_queue_transfer *tr, const char *localname, const char *remotename, off_t offset, int64_t length, struct stat info )
+{
+	time_t stoptime;
+	timestamp_t effective_stoptime = 0;
+	int64_t actual = 0;
+
+	/* normalize the mode so as not to set up invalid permissions */
+	int mode = ( info.st_mode | 0x600 ) & 0777;
+
+	if(!length) {
+		length = info.st_size;
+	}
+
+	int fd = open(localname, O_RDONLY, 0);
+	if(fd < 0) {
+		transfer_error(tr, "Cannot open file %s: %s", localname, strerror(errno));
+		return WQ_APP_FAILURE;
+	}
+
+	/* If we are sending only a piece of the file, seek there first. */
 
 	if (offset >= 0 && (offset+length) <= info.st_size) {
 		if(lseek(fd, offset, SEEK_SET) == -1) {
-			debug(D_NOTICE, "Cannot seek file %s to offset %lld: %s", localname, (long long) offset, strerror(errno));
+			transfer_error(tr, "Cannot seek file %s to offset %lld: %s", localname, (long long) offset, strerror(errno));
 			close(fd);
 			return WQ_APP_FAILURE;
 		}
 	} else {
-		debug(D_NOTICE, "File specification %s (%lld:%lld) is invalid", localname, (long long) offset, (long long) offset+length);
+		transfer_error(tr, "File specification %s (%lld:%lld) is invalid", localname, (long long) offset, (long long) offset+length);
 		close(fd);
 		return WQ_APP_FAILURE;
 	}
 
-	if(q->bandwidth) {
-		effective_stoptime = (length/q->bandwidth)*1000000 + timestamp_get();
+	if(tr->bandwidth) {
+		effective_stoptime = (length/tr->bandwidth)*1000000 + timestamp_get();
 	}
 
 	/* filenames are url-encoded to avoid problems with spaces, etc */
 	char remotename_encoded[WORK_QUEUE_LINE_MAX];
 	url_encode(remotename,remotename_encoded,sizeof(remotename_encoded));
 
-	stoptime = time(0) + get_transfer_wait_time(q, w, t, length);
-	send_worker_msg(q,w, "put %s %"PRId64" 0%o\n",remotename_encoded, length, mode );
-	actual = link_stream_from_fd(w->link, fd, length, stoptime);
+	stoptime = time(0) + transfer_wait_time(tr, length);
+	transfer_msg(tr, "put %s %"PRId64" 0%o\n",remotename_encoded, length, mode );
+	actual = link_stream_from_fd(tr->link, fd, length, stoptime);
 	close(fd);
 
-	*total_bytes += actual;
+	tr->total_bytes += actual;
 
 	if(actual != length) return WQ_WORKER_FAILURE;
 
@@ -2908,7 +3482,7 @@ static int send_file( struct work_queue *q, struct work_queue_worker *w, struct
 
 /* Need prototype here to address mutually recursive code. */
 
-static work_queue_result_code_t send_item( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *name, const char *remotename, int64_t offset, int64_t length, int64_t * total_bytes, int follow_links );
+static work_queue_result_code_t send_item( struct work_queue_transfer *tr, const char *name, const char *remotename, int64_t offset, int64_t length, int follow_links );
 
 /*
 Send a directory and all of its contents using the new streaming protocol.
@@ -2916,11 +3490,11 @@ Do this by sending a "dir" prefix, then all of the directory contents,
 and then an "end" marker.
 */
 
-static work_queue_result_code_t send_directory( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *localname, const char *remotename, int64_t * total_bytes )
+static work_queue_result_code_t send_directory( struct work_queue_transfer *tr, const char *localname, const char *remotename )
 {
 	DIR *dir = opendir(localname);
 	if(!dir) {
-		debug(D_NOTICE, "Cannot open dir %s: %s", localname, strerror(errno));
+		transfer_error(tr, "Cannot open dir %s: %s", localname, strerror(errno));
 		return WQ_APP_FAILURE;
 	}
 
@@ -2929,7 +3503,7 @@ static work_queue_result_code_t send_directory( struct work_queue *q, struct wor
 	char remotename_encoded[WORK_QUEUE_LINE_MAX];
 	url_encode(remotename,remotename_encoded,sizeof(remotename_encoded));
 
-	send_worker_msg(q,w,"dir %s\n",remotename_encoded);
+	transfer_msg(tr,"dir %s\n",remotename_encoded);
 
 	struct dirent *d;
 	while((d = readdir(dir))) {
@@ -2937,14 +3511,14 @@ static work_queue_result_code_t send_directory( struct work_queue *q, struct wor
 
 		char *localpath = string_format("%s/%s",localname,d->d_name);
 
-		result = send_item( q, w, t, localpath, d->d_name, 0, 0, total_bytes, 0 );
+		result = send_item( tr, localpath, d->d_name, 0, 0, 0 );
 
 		free(localpath);
 
 		if(result != WQ_SUCCESS) break;
 	}
 
-	send_worker_msg(q,w,"end\n");
+	transfer_msg(tr,"end\n");
 
 	closedir(dir);
 	return result;
@@ -2964,7 +3538,7 @@ and internal links are not followed, they are sent natively.
 */
 
 
-static work_queue_result_code_t send_item( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, const char *localpath, const char *remotepath, int64_t offset, int64_t length, int64_t * total_bytes, int follow_links )
+static work_queue_result_code_t send_item( struct work_queue_transfer *tr, const char *localpath, const char *remotepath, int64_t offset, int64_t length, int follow_links )
 {
 	struct stat info;
 	int result = WQ_SUCCESS;
@@ -2977,31 +3551,444 @@ static work_queue_result_code_t send_item( struct work_queue *q, struct work_que
 
 	if(result>=0) {
 		if(S_ISDIR(info.st_mode))  {
-			result = send_directory( q, w, t, localpath, remotepath, total_bytes );
+			result = send_directory( tr, localpath, remotepath );
 		} else if(S_ISLNK(info.st_mode)) {
-			result = send_symlink( q, w, t, localpath, remotepath, total_bytes );
+			result = send_symlink( tr, localpath, remotepath );
 		} else if(S_ISREG(info.st_mode)) {
-			result = send_file( q, w, t, localpath, remotepath, offset, length, info, total_bytes );
+			result = send_file( tr, localpath, remotepath, offset, length, info );
 		} else {
-			debug(D_NOTICE,"skipping unusual file: %s",strerror(errno));
+			transfer_error(tr, "skipping unusual file: %s", localpath);
 		}
 	} else {
-		debug(D_NOTICE, "cannot stat file %s: %s", localpath, strerror(errno));
+		transfer_error(tr, "cannot stat file %s: %s", localpath, strerror(errno));
 		result = WQ_APP_FAILURE;
 	}
 
 	return result;
 }
 
+/* Send the items of a transfer in order, stopping at the first failure. */
+
+static void transfer_execute(struct work_queue_transfer *tr)
+{
+	struct transfer_item *item;
+
+	tr->time_start = timestamp_get();
+
+	list_first_item(tr->items);
+	while((item = list_next_item(tr->items))) {
+		if(item->type == TRANSFER_ITEM_MESSAGE) {
+			int timeout = MAX(tr->message_timeout, transfer_wait_time(tr, item->length));
+			int64_t actual = link_putlstring(tr->link, item->data, item->length, time(0) + timeout);
+			if(actual != item->length) {
+				transfer_error(tr, "could not send message to worker");
+				tr->result = WQ_WORKER_FAILURE;
+			} else {
+				tr->total_bytes += item->file_bytes;
+			}
+		} else {
+			tr->result = send_item(tr, item->localname, item->remotename, item->offset, item->length, 1);
+		}
+
+		if(tr->result != WQ_SUCCESS)
+			break;
+
+		item->sent = 1;
+	}
+
+	tr->time_end = timestamp_get();
+}
+
+static void *transfer_thread(void *arg)
+{
+	struct work_queue_transfer *tr = arg;
+
+	transfer_execute(tr);
+
+	uint64_t id = tr->id;
+	full_write(tr->notify_fd, &id, sizeof(id));
+
+	return NULL;
+}
+
+/*
+Account for an executed transfer: update the byte and time counters of the
+task, the worker, and the queue, and record in the worker the items it now
+caches. t is null if the task is no longer at the worker.
+*/
+
+static void transfer_account(struct work_queue *q, struct work_queue_transfer *tr, struct work_queue_task *t)
+{
+	struct work_queue_worker *w = tr->w;
+	struct transfer_item *item;
+
+	transfer_seeding_update(q, tr, -1);
+
+	list_first_item(tr->items);
+	while((item = list_next_item(tr->items))) {
+		if(item->sent && item->cache_info && !hash_table_lookup(w->current_files, item->remotename)) {
+			worker_file_insert(q, w, item->remotename, item->cache_info);
+			item->cache_info = NULL;
+		}
+	}
+
+	if(tr->error) {
+		debug(D_NOTICE, "%s", tr->error);
+	}
+
+	timestamp_t elapsed_time = tr->time_end - tr->time_start;
+
+	if(tr->result == WQ_SUCCESS) {
+		if(t) {
+			t->bytes_sent        += tr->total_bytes;
+			t->bytes_transferred += tr->total_bytes;
+		}
+
+		w->total_bytes_transferred += tr->total_bytes;
+		w->total_transfer_time     += elapsed_time;
+
+		q->stats->bytes_sent += tr->total_bytes;
+
+		/* threaded transfers happen outside of send_tasks, where the time
+		 * sending is usually measured. */
+		if(tr->threaded) {
+			q->stats->time_send += elapsed_time;
+		}
+
+		// Avoid division by zero below.
+		if(elapsed_time==0) elapsed_time = 1;
+
+		if(tr->total_bytes > 0) {
+			q->stats->transfers_done++;
+			q->stats->bandwidth_transfer_last = ((double) tr->total_bytes / elapsed_time) * 1000000 / MEGABYTE;
+			q->stats->bandwidth_transfer_max  = MAX(q->stats->bandwidth_transfer_max, q->stats->bandwidth_transfer_last);
+
+			debug(D_WQ, "%s (%s) received %.2lf MB in %.02lfs (%.02lfs MB/s) average %.02lfs MB/s",
+				w->hostname,
+				w->addrport,
+				tr->total_bytes / 1000000.0,
+				elapsed_time / 1000000.0,
+				(double) tr->total_bytes / elapsed_time,
+				(double) w->total_bytes_transferred / w->total_transfer_time
+			);
+		}
+	} else {
+		debug(D_WQ, "%s (%s) failed to receive inputs of task %d (%" PRId64 " bytes sent).",
+			w->hostname,
+			w->addrport,
+			tr->taskid,
+			tr->total_bytes);
+
+		if(t && tr->result == WQ_APP_FAILURE) {
+			update_task_result(t, WORK_QUEUE_RESULT_INPUT_MISSING);
+		}
+	}
+}
+
+/*
+Wait for the thread of a transfer, and return the link of the worker to the
+master. The transfer stays with the worker until transfer_finish is called.
+From transfer_finish the thread has already notified, and the join returns at
+once. From a message to the worker, the wait is bounded by the timeouts of the
+items the thread is sending.
+*/
+
+static void transfer_complete(struct work_queue *q, struct work_queue_transfer *tr)
+{
+	if(tr->completed) return;
+
+	pthread_join(tr->thread, NULL);
+	tr->completed = 1;
+	q->transfers_active--;
+
+	struct work_queue_worker *w = tr->w;
+	link_poll_set_add(q->poll_set, w->link, LINK_READ);
+
+	transfer_account(q, tr, itable_lookup(w->current_tasks, tr->taskid));
+}
+
+/* Release a threaded transfer, and handle the failure of its task, if any. */
+
+static void transfer_finish(struct work_queue *q, struct work_queue_transfer *tr)
+{
+	struct work_queue_worker *w = tr->w;
+
+	transfer_complete(q, tr);
+
+	itable_remove(q->transfers, tr->id);
+	w->transfer = NULL;
+
+	work_queue_result_code_t result = tr->result;
+	timestamp_t time_end = tr->time_end;
+	int taskid = tr->taskid;
+	transfer_delete(tr);
+
+	struct work_queue_task *t = itable_lookup(w->current_tasks, taskid);
+	if(!t) return;
+
+	t->time_when_commit_end = time_end;
+
+	if(result != WQ_SUCCESS) {
+		debug(D_WQ, "Failed to send task %d to worker %s (%s).", t->taskid, w->hostname, w->addrport);
+		handle_failure(q, w, t, result);
+	}
+}
+
+/* Whether the thread of a transfer may still be sending, so that a message to its worker would wait for it. */
+
+static int transfer_in_progress(struct work_queue_transfer *tr)
+{
+	return tr && !tr->completed;
+}
+
+/*
+Release the transfer of a worker being removed, without handling its failure.
+A worker that went away may leave its thread blocked on the link until a
+timeout, so the thread is not waited for here. Instead, the link is shut down
+so that the thread fails at once, and the transfer takes the link from the
+worker. The thread and the link are released in transfer_reap.
+*/
+
+static void transfer_discard(struct work_queue *q, struct work_queue_transfer *tr)
+{
+	struct work_queue_worker *w = tr->w;
+
+	w->transfer = NULL;
+
+	if(tr->completed) {
+		itable_remove(q->transfers, tr->id);
+		transfer_delete(tr);
+		return;
+	}
+
+	debug(D_WQ, "%s (%s) removed while receiving inputs of task %d", w->hostname, w->addrport, tr->taskid);
+
+	transfer_seeding_update(q, tr, -1);
+
+	shutdown(link_fd(tr->link), SHUT_RDWR);
+	w->link = NULL;
+
+	tr->w = NULL;
+	tr->orphaned = 1;
+}
+
+/* Join the thread of an orphaned transfer, and close the link it took from its worker. */
+
+static void transfer_reap(struct work_queue *q, struct work_queue_transfer *tr)
+{
+	pthread_join(tr->thread, NULL);
+	q->transfers_active--;
+
+	if(tr->error) {
+		debug(D_WQ, "transfer of inputs of task %d ended with: %s", tr->taskid, tr->error);
+	}
+
+	link_close(tr->link);
+
+	itable_remove(q->transfers, tr->id);
+	transfer_delete(tr);
+}
+
+/* Finish the transfers whose threads have notified the master. */
+
+static void transfers_notified(struct work_queue *q)
+{
+	uint64_t id;
+
+	while(read(q->transfer_notify_fds[0], &id, sizeof(id)) == sizeof(id)) {
+		struct work_queue_transfer *tr = itable_lookup(q->transfers, id);
+		if(!tr) continue;
+
+		if(tr->orphaned) {
+			transfer_reap(q, tr);
+		} else {
+			transfer_finish(q, tr);
+		}
+	}
+}
+
+/*
+Execute a prepared transfer. Without a thread, the transfer is accounted for
+and deleted here, and its result returned. With a thread, WQ_SUCCESS is
+returned, and the result is known later in transfer_finish.
+*/
+
+static work_queue_result_code_t transfer_start(struct work_queue *q, struct work_queue_transfer *tr)
+{
+	struct work_queue_worker *w = tr->w;
+
+	transfer_seeding_update(q, tr, 1);
+
+	if(tr->bulk && q->transfers_active < q->max_concurrent_transfers) {
+		link_poll_set_remove(q->poll_set, w->link);
+		tr->threaded = 1;
+
+		if(pthread_create(&tr->thread, NULL, transfer_thread, tr) == 0) {
+			w->transfer = tr;
+			itable_insert(q->transfers, tr->id, tr);
+			q->transfers_active++;
+			debug(D_WQ, "%s (%s) receiving inputs of task %d in the background", w->hostname, w->addrport, tr->taskid);
+			return WQ_SUCCESS;
+		}
+
+		debug(D_WQ, "could not start transfer thread: %s", strerror(errno));
+		link_poll_set_add(q->poll_set, w->link, LINK_READ);
+		tr->threaded = 0;
+	}
+
+	transfer_execute(tr);
+	transfer_account(q, tr, itable_lookup(w->current_tasks, tr->taskid));
+
+	work_queue_result_code_t result = tr->result;
+	transfer_delete(tr);
+
+	return result;
+}
+
+/*
+Send from the master the cached files that w could not fetch from its peers.
+The tasks that need them are already at w, waiting for the files, so each
+file is sent directly rather than from a thread, after any transfer that owns
+the link.
+*/
+
+static void send_peer_fallbacks(struct work_queue *q, struct work_queue_worker *w)
+{
+	struct peer_fetch *pf;
+
+	while((pf = list_pop_head(w->peer_fallbacks))) {
+		struct work_queue_task *t = itable_lookup(w->current_tasks, pf->taskid);
+		if(!t) {
+			peer_fetch_delete(pf);
+			continue;
+		}
+
+		if(w->transfer)
+			transfer_complete(q, w->transfer);
+
+		struct work_queue_transfer *tr = transfer_create(q, w, t);
+		struct transfer_item *item = transfer_add_file(tr, pf->localname, pf->cached_name, pf->offset, pf->length, &pf->info);
+		item->seeding = 1;
+		peer_fetch_delete(pf);
+
+		transfer_seeding_update(q, tr, 1);
+		transfer_execute(tr);
+		transfer_account(q, tr, t);
+
+		work_queue_result_code_t result = tr->result;
+		transfer_delete(tr);
+
+		if(result != WQ_SUCCESS) {
+			debug(D_WQ, "Failed to send task %d to worker %s (%s).", t->taskid, w->hostname, w->addrport);
+			handle_failure(q, w, t, result);
+			if(result == WQ_WORKER_FAILURE)
+				return;
+		}
+	}
+}
+
+/*
+Find a worker from which w can fetch the cached file f, instead of the master
+sending it. Among the workers that have f (of the same size and mtime as info,
+if given) and are serving fewer than q->peer_transfer_limit peers, choose the
+least busy. Since workers become sources as soon as they have the file, a file
+needed by many workers spreads as a tree of bounded fan-out. Only the holders
+of f in q->file_holders are considered.
+*/
+
+static struct work_queue_worker *find_peer_source(struct work_queue *q, struct work_queue_worker *w, struct work_queue_file *f, struct stat *info)
+{
+	struct work_queue_worker *source;
+	struct work_queue_worker *best = NULL;
+
+	if(!q->peer_transfers_enabled || w->type != WORKER_TYPE_WORKER)
+		return NULL;
+
+	if(!(f->flags & WORK_QUEUE_CACHE))
+		return NULL;
+
+	struct set *holders = hash_table_lookup(q->file_holders, f->cached_name);
+	if(!holders)
+		return NULL;
+
+	set_first_element(holders);
+	while((source = set_next_element(holders))) {
+		if(source == w || !source->transfer_port || source->peer_source_failed)
+			continue;
+		if(source->peer_transfers_out >= q->peer_transfer_limit)
+			continue;
+		if(best && best->peer_transfers_out <= source->peer_transfers_out)
+			continue;
+
+		struct stat *remote_info = hash_table_lookup(source->current_files, f->cached_name);
+		if(info && (remote_info->st_mtime != info->st_mtime || remote_info->st_size != info->st_size))
+			continue;
+
+		best = source;
+	}
+
+	return best;
+}
+
+/* Whether sending task t to worker w would transfer file data from the master. */
+
+static int task_needs_transfer(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t)
+{
+	struct work_queue_file *f;
+
+	if(!t->input_files) return 0;
+
+	list_first_item(t->input_files);
+	while((f = list_next_item(t->input_files))) {
+		if(f->type != WORK_QUEUE_FILE && f->type != WORK_QUEUE_FILE_PIECE)
+			continue;
+		if(f->flags & WORK_QUEUE_THIRDGET)
+			continue;
+		if(!hash_table_lookup(w->current_files, f->cached_name) && !find_peer_source(q, w, f, NULL))
+			return 1;
+	}
+
+	return 0;
+}
+
 /*
-Send an item to a remote worker, if it is not already cached.
+Whether task t should wait before going to worker w, because a cached file it
+needs is not at any worker yet, and the master is already sending it to as many
+workers as a worker may serve. Once those have it, w gets it from them. The
+task also waits while w is fetching one of its files for another task, so that
+only that task depends on the fetch if it fails.
+*/
+
+static int task_waits_for_peers(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t)
+{
+	struct work_queue_file *f;
+
+	if(!q->peer_transfers_enabled || !t->input_files || w->type != WORKER_TYPE_WORKER)
+		return 0;
+
+	list_first_item(t->input_files);
+	while((f = list_next_item(t->input_files))) {
+		if(hash_table_lookup(w->peer_pending, f->cached_name))
+			return 1;
+		if(f->type != WORK_QUEUE_FILE || !(f->flags & WORK_QUEUE_CACHE) || (f->flags & WORK_QUEUE_THIRDGET))
+			continue;
+		if(hash_table_lookup(w->current_files, f->cached_name) || find_peer_source(q, w, f, NULL))
+			continue;
+		if((intptr_t) hash_table_lookup(q->files_seeding, f->cached_name) >= q->peer_transfer_limit)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+Add an item to a transfer, if it is not already cached at the worker.
 The local file name should already have been expanded by the caller.
 If it is in the worker, but a new version is available, warn and return.
 We do not want to rewrite the file while some other task may be using it.
-Otherwise, send it to the worker.
 */
 
-static work_queue_result_code_t send_item_if_not_cached( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, struct work_queue_file *tf, const char *expanded_local_name, int64_t * total_bytes)
+static work_queue_result_code_t add_item_if_not_cached( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, struct work_queue_transfer *tr, struct work_queue_file *tf, const char *expanded_local_name)
 {
 	struct stat local_info;
 	if(lstat(expanded_local_name, &local_info) < 0) {
@@ -3011,7 +3998,7 @@ static work_queue_result_code_t send_item_if_not_cached( struct work_queue *q, s
 
 	struct stat *remote_info = hash_table_lookup(w->current_files, tf->cached_name);
 
-	if(remote_info && (remote_info->st_mtime != local_info.st_mtime || remote_info->st_size != local_info.st_size)) {
+	if(remote_info && !is_content_cached_name(tf->cached_name) && (remote_info->st_mtime != local_info.st_mtime || remote_info->st_size != local_info.st_size)) {
 		debug(D_NOTICE|D_WQ, "File %s changed locally. Task %d will be executed with an older version.", expanded_local_name, t->taskid);
 		return WQ_SUCCESS;
 	} else if(!remote_info) {
@@ -3022,18 +4009,35 @@ static work_queue_result_code_t send_item_if_not_cached( struct work_queue *q, s
 		  debug(D_WQ, "%s (%s) needs file %s (offset %lld length %lld) as '%s'", w->hostname, w->addrport, expanded_local_name, (long long) tf->offset, (long long) tf->length, tf->cached_name );
 		}
 
-		work_queue_result_code_t result;
-		result = send_item(q, w, t, expanded_local_name, tf->cached_name, tf->offset, tf->piece_length, total_bytes, 1 );
+		/* a content addressed file is the same file at any holder, whatever its mtime. */
+		struct work_queue_worker *source = find_peer_source(q, w, tf, is_content_cached_name(tf->cached_name) ? NULL : &local_info);
+		if(source) {
+			char cached_name_encoded[WORK_QUEUE_LINE_MAX];
+			url_encode(tf->cached_name, cached_name_encoded, sizeof(cached_name_encoded));
 
-		if(result == WQ_SUCCESS && tf->flags & WORK_QUEUE_CACHE) {
-			remote_info = xxmalloc(sizeof(*remote_info));
-			if(remote_info) {
-				memcpy(remote_info, &local_info, sizeof(local_info));
-				hash_table_insert(w->current_files, tf->cached_name, remote_info);
-			}
+			debug(D_WQ, "%s (%s) will get '%s' from %s (%s)", w->hostname, w->addrport, tf->cached_name, source->hostname, source->addrport);
+			transfer_add_message(tr, NULL, 0, "peerget %s %s %d\n", cached_name_encoded, source->transfer_host, source->transfer_port);
+
+			source->peer_transfers_out++;
+
+			/* w has the file only once the worker reports peer-done. */
+			struct peer_fetch *pf = calloc(1, sizeof(*pf));
+			pf->source_key  = xxstrdup(source->hashkey);
+			pf->cached_name = xxstrdup(tf->cached_name);
+			pf->localname   = xxstrdup(expanded_local_name);
+			pf->offset      = tf->offset;
+			pf->length      = tf->piece_length;
+			pf->info        = local_info;
+			pf->taskid      = t->taskid;
+			hash_table_insert(w->peer_pending, tf->cached_name, pf);
+
+			return WQ_SUCCESS;
 		}
 
-		return result;
+		struct transfer_item *item = transfer_add_file(tr, expanded_local_name, tf->cached_name, tf->offset, tf->piece_length, (tf->flags & WORK_QUEUE_CACHE) ? &local_info : NULL);
+		item->seeding = q->peer_transfers_enabled && (tf->flags & WORK_QUEUE_CACHE) && w->type == WORKER_TYPE_WORKER;
+
+		return WQ_SUCCESS;
 	} else {
 		/* Up-to-date file on the worker, we do nothing. */
 		return WQ_SUCCESS;
@@ -3111,37 +4115,25 @@ static char *expand_envnames(struct work_queue_worker *w, const char *payload)
 	return expanded_name;
 }
 
-static work_queue_result_code_t send_input_file(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, struct work_queue_file *f)
+static work_queue_result_code_t add_input_file(struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, struct work_queue_transfer *tr, struct work_queue_file *f)
 {
-
-	int64_t total_bytes = 0;
-	int64_t actual = 0;
 	work_queue_result_code_t result = WQ_SUCCESS; //return success unless something fails below
 
-	timestamp_t open_time = timestamp_get();
-
 	switch (f->type) {
 
 	case WORK_QUEUE_BUFFER:
 		debug(D_WQ, "%s (%s) needs literal as %s", w->hostname, w->addrport, f->remote_name);
-		time_t stoptime = time(0) + get_transfer_wait_time(q, w, t, f->length);
-		send_worker_msg(q,w, "put %s %d %o\n",f->cached_name, f->length, 0777 );
-		actual = link_putlstring(w->link, f->payload, f->length, stoptime);
-		if(actual!=f->length) {
-			result = WQ_WORKER_FAILURE;
-		}
-		total_bytes = actual;
+		transfer_add_message(tr, f->payload, f->length, "put %s %d %o\n",f->cached_name, f->length, 0777 )->file_bytes = f->length;
 		break;
 
 	case WORK_QUEUE_REMOTECMD:
 		debug(D_WQ, "%s (%s) needs %s from remote filesystem using %s", w->hostname, w->addrport, f->remote_name, f->payload);
-		send_worker_msg(q,w, "thirdget %d %s %s\n",WORK_QUEUE_FS_CMD, f->cached_name, f->payload);
+		transfer_add_message(tr, NULL, 0, "thirdget %d %s %s\n",WORK_QUEUE_FS_CMD, f->cached_name, f->payload);
 		break;
 
 	case WORK_QUEUE_URL:
 		debug(D_WQ, "%s (%s) needs %s from the url, %s %d", w->hostname, w->addrport, f->cached_name, f->payload, f->length);
-		send_worker_msg(q,w, "url %s %d 0%o %d\n",f->cached_name, f->length, 0777, f->flags);
-		link_putlstring(w->link, f->payload, f->length, time(0) + q->short_timeout);
+		transfer_add_message(tr, f->payload, f->length, "url %s %d 0%o %d\n",f->cached_name, f->length, 0777, f->flags);
 		break;
 
 	case WORK_QUEUE_DIRECTORY:
@@ -3157,15 +4149,15 @@ static work_queue_result_code_t send_input_file(struct work_queue *q, struct wor
 				f->flags |= WORK_QUEUE_PREEXIST;
 			} else {
 				if(f->flags & WORK_QUEUE_SYMLINK) {
-					send_worker_msg(q,w, "thirdget %d %s %s\n", WORK_QUEUE_FS_SYMLINK, f->cached_name, f->payload);
+					transfer_add_message(tr, NULL, 0, "thirdget %d %s %s\n", WORK_QUEUE_FS_SYMLINK, f->cached_name, f->payload);
 				} else {
-					send_worker_msg(q,w, "thirdget %d %s %s\n", WORK_QUEUE_FS_PATH, f->cached_name, f->payload);
+					transfer_add_message(tr, NULL, 0, "thirdget %d %s %s\n", WORK_QUEUE_FS_PATH, f->cached_name, f->payload);
 				}
 			}
 		} else {
 			char *expanded_payload = expand_envnames(w, f->payload);
 			if(expanded_payload) {
-				result = send_item_if_not_cached(q,w,t,f,expanded_payload,&total_bytes);
+				result = add_item_if_not_cached(q,w,t,tr,f,expanded_payload);
 				free(expanded_payload);
 			} else {
 				result = WQ_APP_FAILURE; //signal app-level failure.
@@ -3174,37 +4166,11 @@ static work_queue_result_code_t send_input_file(struct work_queue *q, struct wor
 		break;
 	}
 
-	if(result == WQ_SUCCESS) {
-		timestamp_t close_time = timestamp_get();
-		timestamp_t elapsed_time = close_time-open_time;
-
-		t->bytes_sent        += total_bytes;
-		t->bytes_transferred += total_bytes;
-
-		w->total_bytes_transferred += total_bytes;
-		w->total_transfer_time     += elapsed_time;
-
-		q->stats->bytes_sent += total_bytes;
-
-		// Avoid division by zero below.
-		if(elapsed_time==0) elapsed_time = 1;
-
-		if(total_bytes > 0) {
-			debug(D_WQ, "%s (%s) received %.2lf MB in %.02lfs (%.02lfs MB/s) average %.02lfs MB/s",
-				w->hostname,
-				w->addrport,
-				total_bytes / 1000000.0,
-				elapsed_time / 1000000.0,
-				(double) total_bytes / elapsed_time,
-				(double) w->total_bytes_transferred / w->total_transfer_time
-			);
-		}
-	} else {
-		debug(D_WQ, "%s (%s) failed to send %s (%" PRId64 " bytes sent).",
+	if(result != WQ_SUCCESS) {
+		debug(D_WQ, "%s (%s) failed to send %s.",
 			w->hostname,
 			w->addrport,
-			f->type == WORK_QUEUE_BUFFER ? "literal data" : f->payload,
-			total_bytes);
+			f->type == WORK_QUEUE_BUFFER ? "literal data" : f->payload);
 
 		if(result == WQ_APP_FAILURE) {
 			update_task_result(t, WORK_QUEUE_RESULT_INPUT_MISSING);
@@ -3214,7 +4180,7 @@ static work_queue_result_code_t send_input_file(struct work_queue *q, struct wor
 	return result;
 }
 
-static work_queue_result_code_t send_input_files( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t )
+static work_queue_result_code_t add_input_files( struct work_queue *q, struct work_queue_worker *w, struct work_queue_task *t, struct work_queue_transfer *tr )
 {
 	struct work_queue_file *f;
 	struct stat s;
@@ -3241,12 +4207,14 @@ static work_queue_result_code_t send_input_files( struct work_queue *q, struct w
 		}
 	}
 
-	// Send each of the input files.
-	// If any one fails to be sent, return failure.
+	update_content_cached_names(q, w, t);
+
+	// Add each of the input files to the transfer.
+	// If any one fails, return failure.
 	if(t->input_files) {
 		list_first_item(t->input_files);
 		while((f = list_next_item(t->input_files))) {
-			work_queue_result_code_t result = send_input_file(q,w,t,f);
+			work_queue_result_code_t result = add_input_file(q,w,t,tr,f);
 			if(result != WQ_SUCCESS) {
 				return result;
 			}
@@ -3292,32 +4260,35 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 		command_line = xxstrdup(t->command_line);
 	}
 
-	work_queue_result_code_t result = send_input_files(q, w, t);
+	struct work_queue_transfer *tr = transfer_create(q, w, t);
+
+	work_queue_result_code_t result = add_input_files(q, w, t, tr);
 
 	if (result != WQ_SUCCESS) {
 		free(command_line);
+		rmsummary_delete(limits);
+		transfer_delete(tr);
 		return result;
 	}
 
-	send_worker_msg(q,w, "task %lld\n",  (long long) t->taskid);
+	transfer_add_message(tr, NULL, 0, "task %lld\n",  (long long) t->taskid);
 
 	long long cmd_len = strlen(command_line);
-	send_worker_msg(q,w, "cmd %lld\n", (long long) cmd_len);
-	link_putlstring(w->link, command_line, cmd_len, /* stoptime */ time(0) + (w->type == WORKER_TYPE_FOREMAN ? q->long_timeout : q->short_timeout));
+	transfer_add_message(tr, command_line, cmd_len, "cmd %lld\n", (long long) cmd_len);
 	debug(D_WQ, "%s\n", command_line);
 	free(command_line);
 
-	send_worker_msg(q,w, "category %s\n", t->category);
+	transfer_add_message(tr, NULL, 0, "category %s\n", t->category);
 
-	send_worker_msg(q,w, "cores %"PRId64"\n",  limits->cores);
-	send_worker_msg(q,w, "memory %"PRId64"\n", limits->memory);
-	send_worker_msg(q,w, "disk %"PRId64"\n",   limits->disk);
-	send_worker_msg(q,w, "gpus %"PRId64"\n",   limits->gpus);
+	transfer_add_message(tr, NULL, 0, "cores %"PRId64"\n",  limits->cores);
+	transfer_add_message(tr, NULL, 0, "memory %"PRId64"\n", limits->memory);
+	transfer_add_message(tr, NULL, 0, "disk %"PRId64"\n",   limits->disk);
+	transfer_add_message(tr, NULL, 0, "gpus %"PRId64"\n",   limits->gpus);
 
 	/* Do not specify end, wall_time if running the resource monitor. We let the monitor police these resources. */
 	if(q->monitor_mode == MON_DISABLED) {
-		send_worker_msg(q,w, "end_time %"PRIu64"\n",  limits->end);
-		send_worker_msg(q,w, "wall_time %"PRIu64"\n", limits->wall_time);
+		transfer_add_message(tr, NULL, 0, "end_time %"PRIu64"\n",  limits->end);
+		transfer_add_message(tr, NULL, 0, "wall_time %"PRIu64"\n", limits->wall_time);
 	}
 
 	itable_insert(w->current_tasks_boxes, t->taskid, limits);
@@ -3329,7 +4300,7 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 	char *var;
 	list_first_item(t->env_list);
 	while((var=list_next_item(t->env_list))) {
-		send_worker_msg(q, w,"env %zu\n%s\n", strlen(var), var);
+		transfer_add_message(tr, NULL, 0, "env %zu\n%s\n", strlen(var), var);
 	}
 
 	if(t->input_files) {
@@ -3337,11 +4308,11 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 		list_first_item(t->input_files);
 		while((tf = list_next_item(t->input_files))) {
 			if(tf->type == WORK_QUEUE_DIRECTORY) {
-				send_worker_msg(q,w, "dir %s\n", tf->remote_name);
+				transfer_add_message(tr, NULL, 0, "dir %s\n", tf->remote_name);
 			} else {
 				char remote_name_encoded[PATH_MAX];
 				url_encode(tf->remote_name, remote_name_encoded, PATH_MAX);
-				send_worker_msg(q,w, "infile %s %s %d\n", tf->cached_name, remote_name_encoded, tf->flags);
+				transfer_add_message(tr, NULL, 0, "infile %s %s %d\n", tf->cached_name, remote_name_encoded, tf->flags);
 			}
 		}
 	}
@@ -3352,24 +4323,19 @@ static work_queue_result_code_t start_one_task(struct work_queue *q, struct work
 		while((tf = list_next_item(t->output_files))) {
 			char remote_name_encoded[PATH_MAX];
 			url_encode(tf->remote_name, remote_name_encoded, PATH_MAX);
-			send_worker_msg(q,w, "outfile %s %s %d\n", tf->cached_name, remote_name_encoded, tf->flags);
+			transfer_add_message(tr, NULL, 0, "outfile %s %s %d\n", tf->cached_name, remote_name_encoded, tf->flags);
 		}
 	}
 
-	// send_worker_msg returns the number of bytes sent, or a number less than
-	// zero to indicate errors. We are lazy here, we only check the last
-	// message we sent to the worker (other messages may have failed above).
-	int result_msg = send_worker_msg(q,w,"end\n");
+	transfer_add_message(tr, NULL, 0, "end\n");
 
-	if(result_msg > -1)
-	{
+	result = transfer_start(q, tr);
+
+	if(result == WQ_SUCCESS) {
 		debug(D_WQ, "%s (%s) busy on '%s'", w->hostname, w->addrport, t->command_line);
-		return WQ_SUCCESS;
-	}
-	else
-	{
-		return WQ_WORKER_FAILURE;
 	}
+
+	return result;
 }
 
 /*
@@ -3517,6 +4483,12 @@ static int check_hand_against_task(struct work_queue *q, struct work_queue_worke
 		return 0;
 	}
 
+	/* worker is still receiving the inputs of another task. The thread
+	 * sending them owns the link, so no other task can be sent until then. */
+	if(w->transfer) {
+		return 0;
+	}
+
 	if(w->type != WORKER_TYPE_FOREMAN) {
 		struct blacklist_host_info *info = hash_table_lookup(q->worker_blacklist, w->hostname);
 		if (info && info->blacklisted) {
@@ -3540,53 +4512,224 @@ static int check_hand_against_task(struct work_queue *q, struct work_queue_worke
 		ok = 0;
 	}
 
-	if(w->resources->gpus.inuse + limits->gpus > overcommitted_resource_total(q, w->resources->gpus.total, 0)) {
-		ok = 0;
-	}
+	if(w->resources->gpus.inuse + limits->gpus > overcommitted_resource_total(q, w->resources->gpus.total, 0)) {
+		ok = 0;
+	}
+
+	rmsummary_delete(limits);
+
+	if(t->features) {
+		if(!w->features)
+			return 0;
+
+		char *feature;
+		list_first_item(t->features);
+		while((feature = list_next_item(t->features))) {
+			if(!hash_table_lookup(w->features, feature))
+				return 0;
+		}
+	}
+
+	return ok;
+}
+
+/*
+Workers that may receive tasks are kept in buckets by their number of free
+cores (total - inuse). A segment tree over the buckets counts the workers in
+each range of buckets, so that the next non-empty bucket above or below a given
+one is found in O(log buckets). The find_worker_by_* functions below only visit
+the buckets that could hold a worker for the task, instead of every connected
+worker. Memory, disk, gpus, and features are still checked with
+check_hand_against_task on the visited workers.
+*/
+
+static void worker_index_count(struct work_queue *q, int64_t bucket, int delta)
+{
+	int64_t i = bucket + q->worker_buckets_size;
+	while(i > 0) {
+		q->worker_bucket_counts[i] += delta;
+		i /= 2;
+	}
+}
+
+static void worker_index_grow(struct work_queue *q, int64_t bucket)
+{
+	int old_size = q->worker_buckets_size;
+	int size = old_size > 0 ? old_size : 16;
+
+	while(size <= bucket) {
+		size *= 2;
+	}
+
+	if(size == old_size)
+		return;
+
+	q->worker_buckets = realloc(q->worker_buckets, size * sizeof(*q->worker_buckets));
+	memset(q->worker_buckets + old_size, 0, (size - old_size) * sizeof(*q->worker_buckets));
+
+	free(q->worker_bucket_counts);
+	q->worker_bucket_counts = calloc(2 * size, sizeof(*q->worker_bucket_counts));
+	q->worker_buckets_size  = size;
+
+	int64_t i;
+	for(i = 0; i < old_size; i++) {
+		if(q->worker_buckets[i]) {
+			worker_index_count(q, i, set_size(q->worker_buckets[i]));
+		}
+	}
+}
+
+static void worker_index_remove(struct work_queue *q, struct work_queue_worker *w)
+{
+	if(w->index_bucket < 0)
+		return;
+
+	set_remove(q->worker_buckets[w->index_bucket], w);
+	worker_index_count(q, w->index_bucket, -1);
+	w->index_bucket = -1;
+
+	if(w->index_without_cores) {
+		q->workers_without_cores--;
+		w->index_without_cores = 0;
+	}
+}
+
+static void worker_index_update(struct work_queue *q, struct work_queue_worker *w)
+{
+	/* workers that have not reported resources cannot receive tasks. */
+	if(w->resources->tag < 0 || w->resources->workers.total < 1) {
+		worker_index_remove(q, w);
+		return;
+	}
+
+	int64_t bucket = MAX(0, w->resources->cores.total - w->resources->cores.inuse);
+	int without_cores = w->resources->cores.largest < 1;
+
+	if(bucket == w->index_bucket && without_cores == w->index_without_cores)
+		return;
+
+	worker_index_remove(q, w);
+
+	if(bucket >= q->worker_buckets_size) {
+		worker_index_grow(q, bucket);
+	}
+
+	if(!q->worker_buckets[bucket]) {
+		q->worker_buckets[bucket] = set_create(0);
+	}
+
+	set_insert(q->worker_buckets[bucket], w);
+	worker_index_count(q, bucket, 1);
+	w->index_bucket = bucket;
+
+	if(without_cores) {
+		q->workers_without_cores++;
+		w->index_without_cores = 1;
+	}
+}
+
+/* returns the first non-empty bucket in [from, to] of the subtree at node, or -1. */
+static int64_t worker_index_first_in(struct work_queue *q, int64_t node, int64_t node_from, int64_t node_to, int64_t from)
+{
+	if(node_to < from || q->worker_bucket_counts[node] < 1)
+		return -1;
+
+	if(node_from == node_to)
+		return node_from;
+
+	int64_t middle = (node_from + node_to) / 2;
+	int64_t b = worker_index_first_in(q, 2 * node, node_from, middle, from);
+	if(b < 0) {
+		b = worker_index_first_in(q, 2 * node + 1, middle + 1, node_to, from);
+	}
+
+	return b;
+}
+
+/* returns the last non-empty bucket in [0, to] of the subtree at node, or -1. */
+static int64_t worker_index_last_in(struct work_queue *q, int64_t node, int64_t node_from, int64_t node_to, int64_t to)
+{
+	if(node_from > to || q->worker_bucket_counts[node] < 1)
+		return -1;
+
+	if(node_from == node_to)
+		return node_from;
+
+	int64_t middle = (node_from + node_to) / 2;
+	int64_t b = worker_index_last_in(q, 2 * node + 1, middle + 1, node_to, to);
+	if(b < 0) {
+		b = worker_index_last_in(q, 2 * node, node_from, middle, to);
+	}
+
+	return b;
+}
+
+/* smallest non-empty bucket >= from, or -1 */
+static int64_t worker_index_first(struct work_queue *q, int64_t from)
+{
+	if(q->worker_buckets_size < 1 || from >= q->worker_buckets_size)
+		return -1;
+
+	return worker_index_first_in(q, 1, 0, q->worker_buckets_size - 1, MAX(0, from));
+}
+
+/* largest non-empty bucket <= to, or -1 */
+static int64_t worker_index_last(struct work_queue *q, int64_t to)
+{
+	if(q->worker_buckets_size < 1 || to < 0)
+		return -1;
+
+	return worker_index_last_in(q, 1, 0, q->worker_buckets_size - 1, MIN(to, q->worker_buckets_size - 1));
+}
 
-	rmsummary_delete(limits);
+/* Lower bound of the free cores a worker needs to fit t. This is only used to
+ * skip buckets; candidates are still checked with check_hand_against_task. */
+static int64_t task_free_cores_needed(struct work_queue *q, struct work_queue_task *t)
+{
+	/* with overcommit, workers may fit tasks with fewer free cores. */
+	if(q->asynchrony_multiplier > 1 || q->asynchrony_modifier > 0)
+		return 0;
 
-	if(t->features) {
-		if(!w->features)
-			return 0;
+	const struct rmsummary *max = task_max_resources(q, t);
+	if(max->cores > -1)
+		return max->cores;
 
-		char *feature;
-		list_first_item(t->features);
-		while((feature = list_next_item(t->features))) {
-			if(!hash_table_lookup(w->features, feature))
-				return 0;
-		}
-	}
+	/* otherwise the task uses the largest cores slot of the worker, which it can only do if at least a core is free. */
+	if(q->workers_without_cores > 0)
+		return 0;
 
-	return ok;
+	const struct rmsummary *min = task_min_resources(q, t);
+	return MAX(1, min->cores);
 }
 
 static struct work_queue_worker *find_worker_by_files(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w;
 	struct work_queue_worker *best_worker = 0;
 	int64_t most_task_cached_bytes = 0;
 	int64_t task_cached_bytes;
 	struct stat *remote_info;
 	struct work_queue_file *tf;
-
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		if( check_hand_against_task(q, w, t) ) {
-			task_cached_bytes = 0;
-			list_first_item(t->input_files);
-			while((tf = list_next_item(t->input_files))) {
-				if((tf->type == WORK_QUEUE_FILE || tf->type == WORK_QUEUE_FILE_PIECE) && (tf->flags & WORK_QUEUE_CACHE)) {
-					remote_info = hash_table_lookup(w->current_files, tf->cached_name);
-					if(remote_info)
-						task_cached_bytes += remote_info->st_size;
+	int64_t b;
+
+	for(b = worker_index_first(q, task_free_cores_needed(q, t)); b >= 0; b = worker_index_first(q, b + 1)) {
+		set_first_element(q->worker_buckets[b]);
+		while((w = set_next_element(q->worker_buckets[b]))) {
+			if( check_hand_against_task(q, w, t) ) {
+				task_cached_bytes = 0;
+				list_first_item(t->input_files);
+				while((tf = list_next_item(t->input_files))) {
+					if((tf->type == WORK_QUEUE_FILE || tf->type == WORK_QUEUE_FILE_PIECE) && (tf->flags & WORK_QUEUE_CACHE)) {
+						remote_info = hash_table_lookup(w->current_files, tf->cached_name);
+						if(remote_info)
+							task_cached_bytes += remote_info->st_size;
+					}
 				}
-			}
 
-			if(!best_worker || task_cached_bytes > most_task_cached_bytes) {
-				best_worker = w;
-				most_task_cached_bytes = task_cached_bytes;
+				if(!best_worker || task_cached_bytes > most_task_cached_bytes) {
+					best_worker = w;
+					most_task_cached_bytes = task_cached_bytes;
+				}
 			}
 		}
 	}
@@ -3596,28 +4739,34 @@ static struct work_queue_worker *find_worker_by_files(struct work_queue *q, stru
 
 static struct work_queue_worker *find_worker_by_fcfs(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w;
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void**)&w)) {
-		if( check_hand_against_task(q, w, t) ) {
-			return w;
+	int64_t b;
+
+	for(b = worker_index_first(q, task_free_cores_needed(q, t)); b >= 0; b = worker_index_first(q, b + 1)) {
+		set_first_element(q->worker_buckets[b]);
+		while((w = set_next_element(q->worker_buckets[b]))) {
+			if( check_hand_against_task(q, w, t) ) {
+				return w;
+			}
 		}
 	}
+
 	return NULL;
 }
 
 static struct work_queue_worker *find_worker_by_random(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w = NULL;
 	int random_worker;
 	struct list *valid_workers = list_create();
+	int64_t b;
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void**)&w)) {
-		if(check_hand_against_task(q, w, t)) {
-			list_push_tail(valid_workers, w);
+	for(b = worker_index_first(q, task_free_cores_needed(q, t)); b >= 0; b = worker_index_first(q, b + 1)) {
+		set_first_element(q->worker_buckets[b]);
+		while((w = set_next_element(q->worker_buckets[b]))) {
+			if(check_hand_against_task(q, w, t)) {
+				list_push_tail(valid_workers, w);
+			}
 		}
 	}
 
@@ -3672,7 +4821,6 @@ static int compare_worst_fit(struct work_queue_resources *a, struct work_queue_r
 
 static struct work_queue_worker *find_worker_by_worst_fit(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w;
 	struct work_queue_worker *best_worker = NULL;
 
@@ -3682,22 +4830,32 @@ static struct work_queue_worker *find_worker_by_worst_fit(struct work_queue *q,
 	memset(&bres, 0, sizeof(struct work_queue_resources));
 	memset(&wres, 0, sizeof(struct work_queue_resources));
 
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		if( check_hand_against_task(q, w, t) ) {
+	int64_t needed = task_free_cores_needed(q, t);
+	int64_t b;
 
-			//Use total field on bres, wres to indicate free resources.
-			wres.cores.total   = w->resources->cores.total   - w->resources->cores.inuse;
-			wres.memory.total  = w->resources->memory.total  - w->resources->memory.inuse;
-			wres.disk.total    = w->resources->disk.total    - w->resources->disk.inuse;
-			wres.gpus.total    = w->resources->gpus.total    - w->resources->gpus.inuse;
+	/* free cores are the first criterion, so the answer is in the largest
+	 * bucket that has some worker that fits the task. */
+	for(b = worker_index_last(q, q->worker_buckets_size - 1); b >= needed; b = worker_index_last(q, b - 1)) {
+		set_first_element(q->worker_buckets[b]);
+		while((w = set_next_element(q->worker_buckets[b]))) {
+			if( check_hand_against_task(q, w, t) ) {
 
-			if(!best_worker || compare_worst_fit(&bres, &wres))
-			{
-				best_worker = w;
-				memcpy(&bres, &wres, sizeof(struct work_queue_resources));
+				//Use total field on bres, wres to indicate free resources.
+				wres.cores.total   = w->resources->cores.total   - w->resources->cores.inuse;
+				wres.memory.total  = w->resources->memory.total  - w->resources->memory.inuse;
+				wres.disk.total    = w->resources->disk.total    - w->resources->disk.inuse;
+				wres.gpus.total    = w->resources->gpus.total    - w->resources->gpus.inuse;
+
+				if(!best_worker || compare_worst_fit(&bres, &wres))
+				{
+					best_worker = w;
+					memcpy(&bres, &wres, sizeof(struct work_queue_resources));
+				}
 			}
 		}
+
+		if(best_worker)
+			break;
 	}
 
 	return best_worker;
@@ -3705,19 +4863,21 @@ static struct work_queue_worker *find_worker_by_worst_fit(struct work_queue *q,
 
 static struct work_queue_worker *find_worker_by_time(struct work_queue *q, struct work_queue_task *t)
 {
-	char *key;
 	struct work_queue_worker *w;
 	struct work_queue_worker *best_worker = 0;
 	double best_time = HUGE_VAL;
-
-	hash_table_firstkey(q->worker_table);
-	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
-		if(check_hand_against_task(q, w, t)) {
-			if(w->total_tasks_complete > 0) {
-				double t = (w->total_task_time + w->total_transfer_time) / w->total_tasks_complete;
-				if(!best_worker || t < best_time) {
-					best_worker = w;
-					best_time = t;
+	int64_t b;
+
+	for(b = worker_index_first(q, task_free_cores_needed(q, t)); b >= 0; b = worker_index_first(q, b + 1)) {
+		set_first_element(q->worker_buckets[b]);
+		while((w = set_next_element(q->worker_buckets[b]))) {
+			if(check_hand_against_task(q, w, t)) {
+				if(w->total_tasks_complete > 0) {
+					double t = (w->total_task_time + w->total_transfer_time) / w->total_tasks_complete;
+					if(!best_worker || t < best_time) {
+						best_worker = w;
+						best_time = t;
+					}
 				}
 			}
 		}
@@ -3766,18 +4926,18 @@ static void count_worker_resources(struct work_queue *q, struct work_queue_worke
 
 	update_max_worker(q, w);
 
-	if(w->resources->workers.total < 1)
+	if(w->resources->workers.total > 0)
 	{
-		return;
+		itable_firstkey(w->current_tasks_boxes);
+		while(itable_nextkey(w->current_tasks_boxes, &taskid, (void **)& box)) {
+			w->resources->cores.inuse     += box->cores;
+			w->resources->memory.inuse    += box->memory;
+			w->resources->disk.inuse      += box->disk;
+			w->resources->gpus.inuse      += box->gpus;
+		}
 	}
 
-	itable_firstkey(w->current_tasks_boxes);
-	while(itable_nextkey(w->current_tasks_boxes, &taskid, (void **)& box)) {
-		w->resources->cores.inuse     += box->cores;
-		w->resources->memory.inuse    += box->memory;
-		w->resources->disk.inuse      += box->disk;
-		w->resources->gpus.inuse      += box->gpus;
-	}
+	worker_index_update(q, w);
 }
 
 static void update_max_worker(struct work_queue *q, struct work_queue_worker *w) {
@@ -3829,13 +4989,13 @@ static void commit_task_to_worker(struct work_queue *q, struct work_queue_worker
 	t->hostname = xxstrdup(w->hostname);
 	t->host = xxstrdup(w->addrport);
 
+	itable_insert(w->current_tasks, t->taskid, t);
+	itable_insert(q->worker_task_map, t->taskid, w); //add worker as execution site for t.
+
 	t->time_when_commit_start = timestamp_get();
 	work_queue_result_code_t result = start_one_task(q, w, t);
 	t->time_when_commit_end = timestamp_get();
 
-	itable_insert(w->current_tasks, t->taskid, t);
-	itable_insert(q->worker_task_map, t->taskid, w); //add worker as execution site for t.
-
 	change_task_state(q, t, WORK_QUEUE_TASK_RUNNING);
 
 	t->try_count += 1;
@@ -3873,47 +5033,93 @@ static void reap_task_from_worker(struct work_queue *q, struct work_queue_worker
 	count_worker_resources(q, w);
 }
 
-static int send_one_task( struct work_queue *q )
+/*
+Match ready tasks to workers in priority order, sending up to
+q->dispatch_batch_size tasks in a single pass over the ready queue.  The pass
+also ends when q->dispatch_batch_time usecs have elapsed or stoptime is
+reached, so that results waiting at the workers are not starved while a large
+number of workers is being filled.  Returns the number of tasks sent.
+*/
+
+static int send_tasks( struct work_queue *q, time_t stoptime )
 {
+	struct priority_queue_node *n;
 	struct work_queue_task *t;
 	struct work_queue_worker *w;
+	int sent = 0;
+
+	timestamp_t batch_stoptime = timestamp_get() + q->dispatch_batch_time;
+
+	// Tasks that did not fit any worker. They are put back in the ready
+	// queue at the end of the pass, keeping their original order.
+	struct list *skipped = list_create();
 
 	// Consider each task in the order of priority:
-	list_first_item(q->ready_list);
-	while( (t = list_next_item(q->ready_list))) {
+	while((n = priority_queue_detach(q->ready_queue))) {
+		t = priority_queue_node_data(n);
 
-		// Find the best worker for the task at the head of the list
+		// Find the best worker for the task
 		w = find_best_worker(q,t);
 
 		// If there is no suitable worker, consider the next task.
-		if(!w) continue;
+		if(!w) {
+			list_push_tail(skipped, n);
+			continue;
+		}
+
+		// If the task needs files sent, and all transfer threads are busy,
+		// leave it for later rather than blocking on the transfer here.
+		if(q->max_concurrent_transfers > 0 && q->transfers_active >= q->max_concurrent_transfers && task_needs_transfer(q, w, t)) {
+			list_push_tail(skipped, n);
+			continue;
+		}
+
+		// With peer transfers, a new cached file fans out from the master
+		// to a few workers, and the rest wait to get it from them.
+		if(task_waits_for_peers(q, w, t)) {
+			list_push_tail(skipped, n);
+			continue;
+		}
 
-		// Otherwise, remove it from the ready list and start it:
+		// Otherwise, remove it from the ready queue and start it:
 		commit_task_to_worker(q,w,t);
+		sent++;
 
-		return 1;
+		if(sent >= q->dispatch_batch_size)
+			break;
+
+		if(timestamp_get() > batch_stoptime || (stoptime && time(0) >= stoptime))
+			break;
 	}
 
-	return 0;
+	while((n = list_pop_head(skipped))) {
+		priority_queue_attach(q->ready_queue, n);
+	}
+	list_delete(skipped);
+
+	if(sent > 0) {
+		q->stats->tasks_dispatch_batches++;
+		q->stats->tasks_dispatched_last_batch = sent;
+		q->stats->tasks_dispatched_max_batch = MAX(q->stats->tasks_dispatched_max_batch, sent);
+		debug(D_WQ, "dispatched %d tasks in batch %d", sent, q->stats->tasks_dispatch_batches);
+	}
+
+	return sent;
 }
 
 static int receive_one_task( struct work_queue *q )
 {
 	struct work_queue_task *t;
-
 	struct work_queue_worker *w;
-	uint64_t taskid;
 
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		if( task_state_is(q, taskid, WORK_QUEUE_TASK_WAITING_RETRIEVAL) ) {
-			w = itable_lookup(q->worker_task_map, taskid);
-			fetch_output_from_worker(q, w, taskid);
-			return 1;
-		}
-	}
+	t = task_state_any(q, WORK_QUEUE_TASK_WAITING_RETRIEVAL);
+	if(!t)
+		return 0;
 
-	return 0;
+	w = itable_lookup(q->worker_task_map, t->taskid);
+	fetch_output_from_worker(q, w, t->taskid);
+
+	return 1;
 }
 
 //Sends keepalives to check if connected workers are responsive, and ask for updates If not, removes those workers.
@@ -3924,6 +5130,11 @@ static void ask_for_workers_updates(struct work_queue *q) {
 
 	hash_table_firstkey(q->worker_table);
 	while(hash_table_nextkey(q->worker_table, &key, (void **) &w)) {
+		// a worker receiving inputs is busy with the master, not unresponsive.
+		if(w->transfer) {
+			continue;
+		}
+
 		if(q->keepalive_interval > 0) {
 
 			/* we have not received workqueue message from worker yet, so we
@@ -4053,7 +5264,10 @@ static int shut_down_worker(struct work_queue *q, struct work_queue_worker *w)
 {
 	if(!w) return 0;
 
-	send_worker_msg(q,w,"exit\n");
+	/* a worker still receiving inputs may not be reading them, and
+	 * finds out from the closed link instead. */
+	if(!transfer_in_progress(w->transfer))
+		send_worker_msg(q,w,"exit\n");
 	remove_worker(q, w, WORKER_DISCONNECT_EXPLICIT);
 	q->stats->workers_released++;
 
@@ -4116,12 +5330,45 @@ static int cancel_task_on_worker(struct work_queue *q, struct work_queue_task *t
 	}
 }
 
+static void task_tag_index_insert(struct work_queue *q, struct work_queue_task *t) {
+	if(!t->tag)
+		return;
+
+	struct itable *tagged = hash_table_lookup(q->tasks_by_tag, t->tag);
+	if(!tagged) {
+		tagged = itable_create(0);
+		hash_table_insert(q->tasks_by_tag, t->tag, tagged);
+	}
+
+	itable_insert(tagged, t->taskid, t);
+}
+
+static void task_tag_index_remove(struct work_queue *q, struct work_queue_task *t) {
+	if(!t->tag)
+		return;
+
+	struct itable *tagged = hash_table_lookup(q->tasks_by_tag, t->tag);
+	if(!tagged)
+		return;
+
+	itable_remove(tagged, t->taskid);
+
+	if(itable_size(tagged) < 1) {
+		hash_table_remove(q->tasks_by_tag, t->tag);
+		itable_delete(tagged);
+	}
+}
+
 static struct work_queue_task *find_task_by_tag(struct work_queue *q, const char *tasktag) {
 	struct work_queue_task *t;
 	uint64_t taskid;
 
-	itable_firstkey(q->tasks);
-	while(itable_nextkey(q->tasks, &taskid, (void**)&t)) {
+	struct itable *tagged = hash_table_lookup(q->tasks_by_tag, tasktag);
+	if(!tagged)
+		return NULL;
+
+	itable_firstkey(tagged);
+	while(itable_nextkey(tagged, &taskid, (void**)&t)) {
 		if( tasktag_comparator(t, tasktag) ) {
 			return t;
 		}
@@ -4850,6 +6097,13 @@ void work_queue_invalidate_cached_file(struct work_queue *q, const char *local_n
 
 	work_queue_invalidate_cached_file_internal(q, f->cached_name);
 	work_queue_file_delete(f);
+
+	struct content_checksum *cs = hash_table_remove(q->content_checksums, local_name);
+	if(cs) {
+		work_queue_invalidate_cached_file_internal(q, cs->cached_name);
+		free(cs->cached_name);
+		free(cs);
+	}
 }
 
 void work_queue_invalidate_cached_file_internal(struct work_queue *q, const char *filename) {
@@ -5016,12 +6270,21 @@ struct work_queue *work_queue_create(int port)
 
 	q->next_taskid = 1;
 
-	q->ready_list = list_create();
+	q->ready_queue = priority_queue_create(0);
+	q->ready_nodes = itable_create(0);
+	q->tasks_by_tag = hash_table_create(0, 0);
 
 	q->tasks          = itable_create(0);
 
 	q->task_state_map = itable_create(0);
 
+	int state;
+	for(state = 0; state <= WORK_QUEUE_TASK_CANCELED; state++) {
+		q->task_state_lists[state] = list_create();
+	}
+	q->task_state_index  = itable_create(0);
+	q->task_state_counts = hash_table_create(0, 0);
+
 	q->worker_table = hash_table_create(0, 0);
 	q->worker_blacklist = hash_table_create(0, 0);
 	q->worker_task_map = itable_create(0);
@@ -5035,8 +6298,24 @@ struct work_queue *work_queue_create(int port)
 
 	q->workers_with_available_results = hash_table_create(0, 0);
 
+	q->poll_set = link_poll_set_create();
+	if(!q->poll_set) {
+		fatal("could not create poll set: %s", strerror(errno));
+	}
+	link_poll_set_add(q->poll_set, q->master_link, LINK_READ);
+
+	// Transfer threads wake up the master through this pipe.
+	if(pipe(q->transfer_notify_fds) < 0) {
+		fatal("could not create transfer pipe: %s", strerror(errno));
+	}
+	fcntl(q->transfer_notify_fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(q->transfer_notify_fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(q->transfer_notify_fds[1], F_SETFD, FD_CLOEXEC);
+	q->transfer_notify_link = link_attach_to_fd(q->transfer_notify_fds[0]);
+	link_poll_set_add(q->poll_set, q->transfer_notify_link, LINK_READ);
+
 	// The poll table is initially null, and will be created
-	// (and resized) as needed by build_poll_table.
+	// (and resized) as needed by poll_active_workers.
 	q->poll_table_size = 8;
 
 	q->worker_selection_algorithm = wq_option_scheduler;
@@ -5074,6 +6353,22 @@ struct work_queue *work_queue_create(int port)
 	q->transfer_outlier_factor = 10;
 	q->default_transfer_rate = 1*MEGABYTE;
 
+	q->dispatch_batch_size = 100;
+	q->dispatch_batch_time = 500000;
+
+	q->max_concurrent_transfers = 8;
+	q->transfers = itable_create(0);
+
+	q->peer_transfers_enabled = 0;
+	q->peer_transfer_limit = 3;
+	random_hex(q->peer_token, sizeof(q->peer_token));
+	q->files_seeding = hash_table_create(0, 0);
+	q->file_holders = hash_table_create(0, 0);
+	q->workers_with_peer_fallbacks = hash_table_create(0, 0);
+
+	q->content_addressed_cache = 0;
+	q->content_checksums = hash_table_create(0, 0);
+
 	q->master_preferred_connection = xxstrdup("by_ip");
 
 	if( (envstring  = getenv("WORK_QUEUE_BANDWIDTH")) ) {
@@ -5329,6 +6624,14 @@ void work_queue_delete(struct work_queue *q)
 		hash_table_delete(q->worker_blacklist);
 		itable_delete(q->worker_task_map);
 
+		int b;
+		for(b = 0; b < q->worker_buckets_size; b++) {
+			if(q->worker_buckets[b])
+				set_delete(q->worker_buckets[b]);
+		}
+		free(q->worker_buckets);
+		free(q->worker_bucket_counts);
+
 		struct category *c;
 		hash_table_firstkey(q->categories);
 		while(hash_table_nextkey(q->categories, &key, (void **) &c)) {
@@ -5336,12 +6639,66 @@ void work_queue_delete(struct work_queue *q)
 		}
 		hash_table_delete(q->categories);
 
-		list_delete(q->ready_list);
+		priority_queue_delete(q->ready_queue);
+		itable_delete(q->ready_nodes);
+
+		/* Only transfers of removed workers remain, with their links shut down. */
+		struct work_queue_transfer *orphan;
+		uint64_t trid;
+		itable_firstkey(q->transfers);
+		while(itable_nextkey(q->transfers, &trid, (void **) &orphan)) {
+			transfer_reap(q, orphan);
+			itable_firstkey(q->transfers);
+		}
+		itable_delete(q->transfers);
+		hash_table_delete(q->files_seeding);
+		hash_table_delete(q->file_holders);
+		hash_table_delete(q->workers_with_peer_fallbacks);
+
+		struct content_checksum *cs;
+		hash_table_firstkey(q->content_checksums);
+		while(hash_table_nextkey(q->content_checksums, &key, (void **) &cs)) {
+			free(cs->cached_name);
+			free(cs);
+		}
+		hash_table_delete(q->content_checksums);
+
+		link_detach(q->transfer_notify_link);
+		close(q->transfer_notify_fds[0]);
+		close(q->transfer_notify_fds[1]);
+
+		struct itable *tagged;
+		hash_table_firstkey(q->tasks_by_tag);
+		while(hash_table_nextkey(q->tasks_by_tag, &key, (void **) &tagged)) {
+			itable_delete(tagged);
+		}
+		hash_table_delete(q->tasks_by_tag);
 
 		itable_delete(q->tasks);
 
 		itable_delete(q->task_state_map);
 
+		struct task_state_entry *e;
+		uint64_t taskid;
+		itable_firstkey(q->task_state_index);
+		while(itable_nextkey(q->task_state_index, &taskid, (void **) &e)) {
+			list_cursor_destroy(e->cursor);
+			free(e);
+		}
+		itable_delete(q->task_state_index);
+
+		int state;
+		for(state = 0; state <= WORK_QUEUE_TASK_CANCELED; state++) {
+			list_delete(q->task_state_lists[state]);
+		}
+
+		int *counts;
+		hash_table_firstkey(q->task_state_counts);
+		while(hash_table_nextkey(q->task_state_counts, &key, (void **) &counts)) {
+			free(counts);
+		}
+		hash_table_delete(q->task_state_counts);
+
 		hash_table_delete(q->workers_with_available_results);
 
 		struct work_queue_task_report *tr;
@@ -5362,6 +6719,7 @@ void work_queue_delete(struct work_queue *q)
 			free(q->master_preferred_connection);
 
 		free(q->poll_table);
+		link_poll_set_delete(q->poll_set);
 		link_close(q->master_link);
 		if(q->logfile) {
 			fclose(q->logfile);
@@ -5504,13 +6862,7 @@ char *work_queue_monitor_wrap(struct work_queue *q, struct work_queue_worker *w,
 	return wrap_cmd;
 }
 
-static double work_queue_task_priority(void *item) {
-	assert(item);
-	struct work_queue_task *t = item;
-	return t->priority;
-}
-
-/* Put a given task on the ready list, taking into account the task priority and the queue schedule. */
+/* Put a given task on the ready queue, taking into account the task priority and the queue schedule. */
 
 void push_task_to_ready_list( struct work_queue *q, struct work_queue_task *t )
 {
@@ -5518,18 +6870,21 @@ void push_task_to_ready_list( struct work_queue *q, struct work_queue_task *t )
 
 	if(t->result == WORK_QUEUE_RESULT_RESOURCE_EXHAUSTION) {
 		/* when a task is resubmitted given resource exhaustion, we
-		 * push it at the head of the list, so it gets to run as soon
+		 * push it at the head of the queue, so it gets to run as soon
 		 * as possible. This avoids the issue in which all 'big' tasks
 		 * fail because the first allocation is too small. */
 		by_priority = 0;
 	}
 
+	struct priority_queue_node *n;
 	if(by_priority) {
-		list_push_priority(q->ready_list, work_queue_task_priority, t);
+		n = priority_queue_push(q->ready_queue, t, t->priority);
 	} else {
-		list_push_head(q->ready_list,t);
+		n = priority_queue_push_head(q->ready_queue, t);
 	}
 
+	itable_insert(q->ready_nodes, t->taskid, n);
+
 	/* If the task has been used before, clear out accumulated state. */
 	clean_task_state(t);
 }
@@ -5575,9 +6930,14 @@ static work_queue_task_state_t change_task_state( struct work_queue *q, struct w
 	itable_insert(q->task_state_map, t->taskid, (void *) new_state);
 	// remove from current tables:
 
+	task_state_index_remove(q, t, old_state);
+
 	if( old_state == WORK_QUEUE_TASK_READY ) {
 		// Treat WORK_QUEUE_TASK_READY specially, as it has the order of the tasks
-		list_remove(q->ready_list, t);
+		struct priority_queue_node *n = itable_remove(q->ready_nodes, t->taskid);
+		if(n) {
+			priority_queue_remove(q->ready_queue, n);
+		}
 	}
 
 	// insert to corresponding table
@@ -5593,11 +6953,14 @@ static work_queue_task_state_t change_task_state( struct work_queue *q, struct w
 			/* tasks are freed when returned to user, thus we remove them from our local record */
 			fill_deprecated_tasks_stats(t);
 			itable_remove(q->tasks, t->taskid);
+			task_tag_index_remove(q, t);
 			break;
 		default:
 			/* do nothing */
 			break;
 	}
+
+	task_state_index_insert(q, t, new_state);
 	
 	log_queue_stats(q);
 	write_transaction_task(q, t);
@@ -5700,40 +7063,85 @@ const char *task_result_str(work_queue_result_t result) {
 	return str;
 }
 
-static int task_state_is( struct work_queue *q, uint64_t taskid, work_queue_task_state_t state) {
-	return itable_lookup(q->task_state_map, taskid) == (void *) state;
+static int task_state_is_indexed(work_queue_task_state_t state) {
+	/* tasks in terminal states are removed from q->tasks, and thus from the indexes. */
+	switch(state) {
+		case WORK_QUEUE_TASK_READY:
+		case WORK_QUEUE_TASK_RUNNING:
+		case WORK_QUEUE_TASK_WAITING_RETRIEVAL:
+		case WORK_QUEUE_TASK_RETRIEVED:
+			return 1;
+		default:
+			return 0;
+	}
 }
 
-static struct work_queue_task *task_state_any(struct work_queue *q, work_queue_task_state_t state) {
-	struct work_queue_task *t;
-	uint64_t taskid;
+static int *task_state_category_counts(struct work_queue *q, const char *category) {
+	int *counts = hash_table_lookup(q->task_state_counts, category);
 
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		if( task_state_is(q, taskid, state) ) {
-			return t;
-		}
+	if(!counts) {
+		counts = calloc(WORK_QUEUE_TASK_CANCELED + 1, sizeof(*counts));
+		hash_table_insert(q->task_state_counts, category, counts);
 	}
 
-	return NULL;
+	return counts;
 }
 
-static int task_state_count(struct work_queue *q, const char *category, work_queue_task_state_t state) {
-	struct work_queue_task *t;
-	uint64_t taskid;
+static void task_state_index_insert(struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t state) {
+	if(!task_state_is_indexed(state))
+		return;
 
-	int count = 0;
+	struct task_state_entry *e = malloc(sizeof(*e));
 
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		if( task_state_is(q, taskid, state) ) {
-			if(!category || strcmp(category, t->category) == 0) {
-				count++;
-			}
-		}
+	/* with an undefined position, list_insert appends at the tail. Then we
+	 * move the cursor onto the item just inserted. */
+	e->cursor = list_cursor_create(q->task_state_lists[state]);
+	list_insert(e->cursor, t);
+	list_seek(e->cursor, -1);
+
+	e->category_counts = task_state_category_counts(q, t->category);
+	e->category_counts[state]++;
+
+	itable_insert(q->task_state_index, t->taskid, e);
+}
+
+static void task_state_index_remove(struct work_queue *q, struct work_queue_task *t, work_queue_task_state_t state) {
+	if(!task_state_is_indexed(state))
+		return;
+
+	struct task_state_entry *e = itable_remove(q->task_state_index, t->taskid);
+	if(!e)
+		return;
+
+	list_drop(e->cursor);
+	list_cursor_destroy(e->cursor);
+
+	e->category_counts[state]--;
+
+	free(e);
+}
+
+static struct work_queue_task *task_state_any(struct work_queue *q, work_queue_task_state_t state) {
+	if(!task_state_is_indexed(state))
+		return NULL;
+
+	/* oldest task that arrived to state. */
+	return list_peek_head(q->task_state_lists[state]);
+}
+
+static int task_state_count(struct work_queue *q, const char *category, work_queue_task_state_t state) {
+	if(!task_state_is_indexed(state))
+		return 0;
+
+	if(!category) {
+		return list_size(q->task_state_lists[state]);
 	}
 
-	return count;
+	int *counts = hash_table_lookup(q->task_state_counts, category);
+	if(!counts)
+		return 0;
+
+	return counts[state];
 }
 
 static int task_request_count( struct work_queue *q, const char *category, category_allocation_t request) {
@@ -5757,6 +7165,7 @@ static int task_request_count( struct work_queue *q, const char *category, categ
 int work_queue_submit_internal(struct work_queue *q, struct work_queue_task *t)
 {
 	itable_insert(q->tasks, t->taskid, t);
+	task_tag_index_insert(q, t);
 
 	/* Ensure category structure is created. */
 	work_queue_category_lookup_or_create(q, t->category);
@@ -5769,6 +7178,8 @@ int work_queue_submit_internal(struct work_queue *q, struct work_queue_task *t)
 	if(q->monitor_mode != MON_DISABLED)
 		work_queue_monitor_add_files(q, t);
 
+	update_content_cached_names(q, NULL, t);
+
 	return (t->taskid);
 }
 
@@ -5909,7 +7320,25 @@ static int poll_active_workers(struct work_queue *q, int stoptime, struct link *
 {
 	BEGIN_ACCUM_TIME(q, time_polling);
 
-	int n = build_poll_table(q, foreman_uplink);
+	q->master_link_active = 0;
+	if(foreman_uplink) {
+		*foreman_uplink_active = 0;
+		link_poll_set_add(q->poll_set, foreman_uplink, LINK_READ);
+	}
+
+	// The poll table only needs to hold the links with activity, but make
+	// room for all of them so that every link can be serviced in one pass.
+	int size = link_poll_set_size(q->poll_set);
+	if(!q->poll_table || q->poll_table_size < size) {
+		while(q->poll_table_size < size) {
+			q->poll_table_size *= 2;
+		}
+		q->poll_table = realloc(q->poll_table, sizeof(*q->poll_table) * q->poll_table_size);
+		if(!q->poll_table) {
+			//if we can't allocate a poll table, we can't do anything else.
+			fatal("allocating memory for poll table failed.");
+		}
+	}
 
 	// We poll in at most small time segments (of a second). This lets
 	// promptly dispatch tasks, while avoiding busy waiting.
@@ -5926,32 +7355,27 @@ static int poll_active_workers(struct work_queue *q, int stoptime, struct link *
 
 	BEGIN_ACCUM_TIME(q, time_polling);
 
-	// Poll all links for activity.
-	link_poll(q->poll_table, n, msec);
+	// Wait for activity, and get only the links that are ready.
+	int n = link_poll_set_wait(q->poll_set, q->poll_table, q->poll_table_size, msec);
 	q->link_poll_end = timestamp_get();
 
-	int i, j = 1;
-	// Consider the foreman_uplink passed into the function and disregard if inactive.
-	if(foreman_uplink) {
-		if(q->poll_table[1].revents) {
-			*foreman_uplink_active = 1; //signal that the master link saw activity
-		} else {
-			*foreman_uplink_active = 0;
-		}
-		j++;
-	}
-
 	END_ACCUM_TIME(q, time_polling);
 
 	BEGIN_ACCUM_TIME(q, time_status_msgs);
 
+	int i;
 	int workers_failed = 0;
-	// Then consider all existing active workers
-	for(i = j; i < n; i++) {
-		if(q->poll_table[i].revents) {
-			if(handle_worker(q, q->poll_table[i].link) == WQ_WORKER_FAILURE) {
-				workers_failed++;
-			}
+	for(i = 0; i < n; i++) {
+		struct link *l = q->poll_table[i].link;
+
+		if(l == q->master_link) {
+			q->master_link_active = 1;
+		} else if(l == q->transfer_notify_link) {
+			transfers_notified(q);
+		} else if(foreman_uplink && l == foreman_uplink) {
+			*foreman_uplink_active = 1; //signal that the master link saw activity
+		} else if(handle_worker(q, l) == WQ_WORKER_FAILURE) {
+			workers_failed++;
 		}
 	}
 
@@ -5966,6 +7390,17 @@ static int poll_active_workers(struct work_queue *q, int stoptime, struct link *
 		}
 	}
 
+	if(hash_table_size(q->workers_with_peer_fallbacks) > 0) {
+		char *key;
+		struct work_queue_worker *w;
+		hash_table_firstkey(q->workers_with_peer_fallbacks);
+		while(hash_table_nextkey(q->workers_with_peer_fallbacks,&key,(void**)&w)) {
+			hash_table_remove(q->workers_with_peer_fallbacks, key);
+			send_peer_fallbacks(q, w);
+			hash_table_firstkey(q->workers_with_peer_fallbacks);
+		}
+	}
+
 	END_ACCUM_TIME(q, time_status_msgs);
 
 	return workers_failed;
@@ -5979,7 +7414,7 @@ static int connect_new_workers(struct work_queue *q, int stoptime, int max_new_w
 	// If the master link was awake, then accept at most max_new_workers.
 	// Note we are using the information gathered in poll_active_workers, which
 	// is a little ugly.
-	if(q->poll_table[0].revents) {
+	if(q->master_link_active) {
 		do {
 			add_worker(q);
 			new_workers++;
@@ -5998,7 +7433,7 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
    - update catalog if appropiate
    - retrieve workers status messages
    - tasks waiting to be retrieved?          Yes: retrieve one task and go to S.
-   - tasks waiting to be dispatched?         Yes: dispatch one task and go to S.
+   - tasks waiting to be dispatched?         Yes: dispatch a batch of tasks and go to S.
    - send keepalives to appropiate workers
    - fast-abort workers
    - if new workers, connect n of them
@@ -6096,11 +7531,11 @@ struct work_queue_task *work_queue_wait_internal(struct work_queue *q, int timeo
 
 		// tasks waiting to be dispatched?
 		BEGIN_ACCUM_TIME(q, time_send);
-		result = send_one_task(q);
+		result = send_tasks(q, stoptime);
 		END_ACCUM_TIME(q, time_send);
 		if(result) {
 			// sent at least one task
-			events++;
+			events += result;
 			continue;
 		}
 
@@ -6335,18 +7770,10 @@ void release_all_workers(struct work_queue *q) {
 
 int work_queue_empty(struct work_queue *q)
 {
-	struct work_queue_task *t;
-	uint64_t taskid;
-
-	itable_firstkey(q->tasks);
-	while( itable_nextkey(q->tasks, &taskid, (void **) &t) ) {
-		int state = work_queue_task_state(q, taskid);
-
-		if( state == WORK_QUEUE_TASK_READY   )           return 0;
-		if( state == WORK_QUEUE_TASK_RUNNING )           return 0;
-		if( state == WORK_QUEUE_TASK_WAITING_RETRIEVAL ) return 0;
-		if( state == WORK_QUEUE_TASK_RETRIEVED )         return 0;
-	}
+	if( task_state_any(q, WORK_QUEUE_TASK_READY) )             return 0;
+	if( task_state_any(q, WORK_QUEUE_TASK_RUNNING) )           return 0;
+	if( task_state_any(q, WORK_QUEUE_TASK_WAITING_RETRIEVAL) ) return 0;
+	if( task_state_any(q, WORK_QUEUE_TASK_RETRIEVED) )         return 0;
 
 	return 1;
 }
@@ -6403,6 +7830,18 @@ int work_queue_tune(struct work_queue *q, const char *name, double value)
 	} else if(!strcmp(name, "long-timeout")) {
 		q->long_timeout = MAX(1, (int)value);
 
+	} else if(!strcmp(name, "dispatch-batch-size")) {
+		q->dispatch_batch_size = MAX(1, (int)value);
+
+	} else if(!strcmp(name, "dispatch-batch-time")) {
+		q->dispatch_batch_time = MAX(0, value) * 1000000;
+
+	} else if(!strcmp(name, "max-concurrent-transfers")) {
+		q->max_concurrent_transfers = MAX(0, (int)value);
+
+	} else if(!strcmp(name, "peer-transfer-limit")) {
+		q->peer_transfer_limit = MAX(1, (int)value);
+
 	} else if(!strcmp(name, "category-steady-n-tasks")) {
 		category_tune_bucket_size("category-steady-n-tasks", (int) value);
 
@@ -6429,6 +7868,26 @@ void work_queue_set_bandwidth_limit(struct work_queue *q, const char *bandwidth)
 	q->bandwidth = string_metric_parse(bandwidth);
 }
 
+void work_queue_enable_peer_transfers(struct work_queue *q)
+{
+	q->peer_transfers_enabled = 1;
+}
+
+void work_queue_disable_peer_transfers(struct work_queue *q)
+{
+	q->peer_transfers_enabled = 0;
+}
+
+void work_queue_enable_content_addressed_cache(struct work_queue *q)
+{
+	q->content_addressed_cache = 1;
+}
+
+void work_queue_disable_content_addressed_cache(struct work_queue *q)
+{
+	q->content_addressed_cache = 0;
+}
+
 double work_queue_get_effective_bandwidth(struct work_queue *q)
 {
 	double queue_bandwidth = get_queue_transfer_rate(q, NULL)/MEGABYTE; //return in MB per second
@@ -6519,6 +7978,7 @@ void work_queue_get_stats(struct work_queue *q, struct work_queue_stats *s)
 
 	//info about resources
 	s->bandwidth = work_queue_get_effective_bandwidth(q);
+	s->transfers_active = q->transfers_active;
 	struct work_queue_resources r;
 	aggregate_workers_resources(q,&r,NULL);
 
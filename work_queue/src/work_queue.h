@@ -315,6 +315,20 @@ struct work_queue_stats {
 	int workers_full;               /**< @deprecated Use workers_busy insead. */
 	int total_worker_slots;         /**< @deprecated Use tasks_running instead. */
 	int avg_capacity;               /**< @deprecated Use capacity_cores instead. */
+
+	/* Dispatch batch statistics: */
+	int tasks_dispatch_batches;      /**< Total number of dispatch passes that sent at least one task to workers. */
+	int tasks_dispatched_last_batch; /**< Number of tasks sent to workers in the most recent dispatch pass. */
+	int tasks_dispatched_max_batch;  /**< Largest number of tasks sent to workers in a single dispatch pass. */
+
+	/* Transfer thread statistics: */
+	int     transfers_active;        /**< Number of workers currently receiving task inputs from transfer threads. */
+	int64_t transfers_done;          /**< Total number of transfers of task inputs that sent file data to workers. */
+	double  bandwidth_transfer_last; /**< Network bandwidth in MB/S of the most recent transfer of task inputs to a worker. */
+	double  bandwidth_transfer_max;  /**< Largest network bandwidth in MB/S observed in a single transfer of task inputs to a worker. */
+
+	/* Peer transfer statistics: */
+	int64_t transfers_peer;          /**< Total number of cached files that workers fetched from other workers instead of from the master. */
 };
 
 /* Forward declare the queue's structure. This structure is opaque and defined in work_queue.c */
@@ -770,6 +784,37 @@ work_queue_task_state_t work_queue_task_state(struct work_queue *q, int taskid);
 */
 void work_queue_set_bandwidth_limit(struct work_queue *q, const char *bandwidth);
 
+/** Let workers fetch cached input files from other workers.
+When enabled, workers serve the files in their caches to other workers, and
+a cached input file that some worker already has is fetched by the worker
+that needs it from that worker, rather than sent by the master. Each worker
+serves at most "peer-transfer-limit" others at once (see @ref work_queue_tune).
+Workers only serve files to peers that present a random token issued by the
+master, and the password, if one is set with @ref work_queue_specify_password.
+@param q A work queue object.
+*/
+void work_queue_enable_peer_transfers(struct work_queue *q);
+
+/** Do not let workers fetch cached input files from other workers. (default)
+@param q A work queue object.
+*/
+void work_queue_disable_peer_transfers(struct work_queue *q);
+
+/** Name cached input files by the checksum of their contents.
+When enabled, the master computes the md5 checksum of each cached input file
+once per path, modification time and size, and the workers cache the file
+under that checksum. Files with the same contents are sent to a worker only
+once, even under different paths, and a file rewritten in place is sent again
+without calling @ref work_queue_invalidate_cached_file.
+@param q A work queue object.
+*/
+void work_queue_enable_content_addressed_cache(struct work_queue *q);
+
+/** Name cached input files by their paths. (default)
+@param q A work queue object.
+*/
+void work_queue_disable_content_addressed_cache(struct work_queue *q);
+
 /** Get current queue bandwidth.
 @param q A work queue object.
 @return The average bandwidth in MB/s measured by the master.
@@ -988,6 +1033,10 @@ void work_queue_master_preferred_connection(struct work_queue *q, const char *pr
  - "keepalive-timeout" Set the minimum number of seconds to wait for a keepalive response from worker before marking it as dead. (default=30)
  - "short-timeout" Set the minimum timeout when sending a brief message to a single worker. (default=5s)
  - "long-timeout" Set the minimum timeout when sending a brief message to a foreman. (default=1h)
+ - "dispatch-batch-size" Set the maximum number of tasks sent to workers in one pass of @ref work_queue_wait. (default=100)
+ - "dispatch-batch-time" Set the maximum number of seconds spent sending tasks to workers in one pass of @ref work_queue_wait. (default=0.5s)
+ - "max-concurrent-transfers" Set the maximum number of workers receiving input files at the same time, each from its own thread. If 0, input files are sent from work_queue_wait one task at a time. A worker receiving input files is not sent another task until they arrive. (default=8)
+ - "peer-transfer-limit" Set the maximum number of workers fetching files from a single worker at the same time, when peer transfers are enabled. (default=3)
  - "category-steady-n-tasks" Set the number of tasks considered when computing category buckets.
 @param value The value to set the parameter to.
 @return 0 on succes, -1 on failure.
@@ -0,0 +1,420 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#include "work_queue_cache.h"
+#include "work_queue_internal.h"
+#include "work_queue_protocol.h"
+
+#include "create_dir.h"
+#include "debug.h"
+#include "hash_table.h"
+#include "link.h"
+#include "list.h"
+#include "stringtools.h"
+#include "xxmalloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+The cache directory holds the files themselves in files/, and an index with
+one line per file giving its name, size, modification time, and the last time
+a worker used it. Workers never use the files in place: they hard link them
+into their own cache directories. A file evicted from the index is then only
+unlinked from files/, and workers still using it keep their links. The index
+is read and rewritten whole under an exclusive flock of the lock file.
+
+Since every link shares one inode, a task writing to an input would change the
+file for every later worker. Stored files are made read-only, and a file whose
+size or modification time no longer matches the index is discarded rather
+than handed out again.
+*/
+
+struct work_queue_cache {
+	char *dir;
+	int64_t max_size;
+	struct hash_table *touched;     /* names used by tasks since the last update of the index. */
+};
+
+struct entry {
+	char *name;
+	int64_t size;
+	time_t mtime;
+	time_t last_used;
+};
+
+static int is_persistent_name( const char *name )
+{
+	return string_prefix_is(name, WORK_QUEUE_CONTENT_CACHED_NAME_PREFIX) && !strchr(name, '/');
+}
+
+static char * file_path( struct work_queue_cache *c, const char *name )
+{
+	return string_format("%s/files/%s", c->dir, name);
+}
+
+static int index_lock( struct work_queue_cache *c )
+{
+	char *path = string_format("%s/lock", c->dir);
+	int fd = open(path, O_RDWR | O_CREAT, 0666);
+	free(path);
+
+	if(fd < 0) {
+		debug(D_WQ, "could not open lock of cache %s: %s", c->dir, strerror(errno));
+		return -1;
+	}
+
+	while(flock(fd, LOCK_EX) < 0) {
+		if(errno != EINTR) {
+			debug(D_WQ, "could not lock cache %s: %s", c->dir, strerror(errno));
+			close(fd);
+			return -1;
+		}
+	}
+
+	return fd;
+}
+
+static void index_unlock( int fd )
+{
+	close(fd);
+}
+
+static void index_delete( struct hash_table *index )
+{
+	char *name;
+	struct entry *e;
+
+	hash_table_firstkey(index);
+	while(hash_table_nextkey(index, &name, (void **) &e)) {
+		free(e->name);
+		free(e);
+	}
+	hash_table_delete(index);
+}
+
+/* Entries whose files have gone missing are dropped, and files changed since they were stored are removed. */
+
+static struct hash_table * index_load( struct work_queue_cache *c )
+{
+	struct hash_table *index = hash_table_create(0, 0);
+
+	char *path = string_format("%s/index", c->dir);
+	FILE *file = fopen(path, "r");
+	free(path);
+
+	if(!file)
+		return index;
+
+	char line[WORK_QUEUE_LINE_MAX];
+	char name[WORK_QUEUE_LINE_MAX];
+	int64_t size;
+	long long mtime;
+	long long last_used;
+
+	while(fgets(line, sizeof(line), file)) {
+		if(sscanf(line, "%s %" SCNd64 " %lld %lld", name, &size, &mtime, &last_used) != 4)
+			continue;
+		if(!is_persistent_name(name) || hash_table_lookup(index, name))
+			continue;
+
+		struct stat info;
+		char *fpath = file_path(c, name);
+		int exists = stat(fpath, &info) == 0;
+		int intact = exists && info.st_size == size && info.st_mtime == mtime;
+		if(exists && !intact) {
+			debug(D_WQ, "removing %s from cache %s: it was modified after being stored", name, c->dir);
+			unlink(fpath);
+		}
+		free(fpath);
+
+		if(!intact)
+			continue;
+
+		struct entry *e = xxmalloc(sizeof(*e));
+		e->name = xxstrdup(name);
+		e->size = size;
+		e->mtime = mtime;
+		e->last_used = last_used;
+		hash_table_insert(index, name, e);
+	}
+
+	fclose(file);
+
+	return index;
+}
+
+static int index_store( struct work_queue_cache *c, struct hash_table *index )
+{
+	char *path = string_format("%s/index", c->dir);
+	char *tmp = string_format("%s/index.%d", c->dir, (int) getpid());
+
+	FILE *file = fopen(tmp, "w");
+	if(!file) {
+		debug(D_WQ, "could not write index of cache %s: %s", c->dir, strerror(errno));
+		free(path);
+		free(tmp);
+		return 0;
+	}
+
+	char *name;
+	struct entry *e;
+
+	hash_table_firstkey(index);
+	while(hash_table_nextkey(index, &name, (void **) &e)) {
+		fprintf(file, "%s %" PRId64 " %lld %lld\n", name, e->size, (long long) e->mtime, (long long) e->last_used);
+	}
+
+	int ok = fclose(file) == 0 && rename(tmp, path) == 0;
+	if(!ok) {
+		debug(D_WQ, "could not write index of cache %s: %s", c->dir, strerror(errno));
+		unlink(tmp);
+	}
+
+	free(path);
+	free(tmp);
+
+	return ok;
+}
+
+static void index_apply_touches( struct work_queue_cache *c, struct hash_table *index )
+{
+	char *name;
+	void *dummy;
+	time_t now = time(0);
+
+	hash_table_firstkey(c->touched);
+	while(hash_table_nextkey(c->touched, &name, &dummy)) {
+		struct entry *e = hash_table_lookup(index, name);
+		if(e)
+			e->last_used = now;
+	}
+
+	hash_table_clear(c->touched);
+}
+
+static int entry_compare_last_used( const void *a, const void *b )
+{
+	const struct entry *x = *(const struct entry **) a;
+	const struct entry *y = *(const struct entry **) b;
+
+	if(x->last_used < y->last_used)
+		return -1;
+	if(x->last_used > y->last_used)
+		return 1;
+	return 0;
+}
+
+/* Remove the least recently used files until the cache fits in max_size. */
+
+static void index_evict( struct work_queue_cache *c, struct hash_table *index )
+{
+	char *name;
+	struct entry *e;
+	int64_t total = 0;
+
+	hash_table_firstkey(index);
+	while(hash_table_nextkey(index, &name, (void **) &e)) {
+		total += e->size;
+	}
+
+	if(total <= c->max_size)
+		return;
+
+	int n = 0;
+	struct entry **entries = xxmalloc(hash_table_size(index) * sizeof(*entries));
+
+	hash_table_firstkey(index);
+	while(hash_table_nextkey(index, &name, (void **) &e)) {
+		entries[n++] = e;
+	}
+
+	qsort(entries, n, sizeof(*entries), entry_compare_last_used);
+
+	int i;
+	for(i = 0; i < n && total > c->max_size; i++) {
+		e = entries[i];
+		debug(D_WQ, "evicting %s (%" PRId64 " bytes) from cache %s", e->name, e->size, c->dir);
+
+		char *fpath = file_path(c, e->name);
+		unlink(fpath);
+		free(fpath);
+
+		total -= e->size;
+		hash_table_remove(index, e->name);
+		free(e->name);
+		free(e);
+	}
+
+	free(entries);
+}
+
+struct work_queue_cache * work_queue_cache_create( const char *dir, int64_t max_size )
+{
+	char *files = string_format("%s/files", dir);
+	int ok = create_dir(files, 0777);
+	free(files);
+
+	if(!ok) {
+		debug(D_NOTICE, "could not create cache directory %s: %s", dir, strerror(errno));
+		return NULL;
+	}
+
+	struct work_queue_cache *c = xxmalloc(sizeof(*c));
+	c->dir = xxstrdup(dir);
+	c->max_size = max_size;
+	c->touched = hash_table_create(0, 0);
+
+	return c;
+}
+
+void work_queue_cache_delete( struct work_queue_cache *c )
+{
+	if(!c)
+		return;
+
+	work_queue_cache_sync(c);
+
+	hash_table_delete(c->touched);
+	free(c->dir);
+	free(c);
+}
+
+int work_queue_cache_restore( struct work_queue_cache *c, const char *cachedir, struct link *master, time_t stoptime )
+{
+	int fd = index_lock(c);
+	if(fd < 0)
+		return 0;
+
+	struct hash_table *index = index_load(c);
+
+	/* the cache may have been filled by workers with a larger --cache-size. */
+	index_evict(c, index);
+
+	char *name;
+	struct entry *e;
+	struct list *restored = list_create();
+	time_t now = time(0);
+
+	hash_table_firstkey(index);
+	while(hash_table_nextkey(index, &name, (void **) &e)) {
+		char *source = file_path(c, name);
+		char *target = string_format("%s/%s", cachedir, name);
+
+		if(link(source, target) == 0 || errno == EEXIST) {
+			e->last_used = now;
+			list_push_tail(restored, string_format("%s %" PRId64, name, e->size));
+		} else {
+			debug(D_WQ, "could not link %s to %s: %s", source, target, strerror(errno));
+		}
+
+		free(source);
+		free(target);
+	}
+
+	index_store(c, index);
+	index_delete(index);
+	index_unlock(fd);
+
+	int count = list_size(restored);
+
+	char *line;
+	while((line = list_pop_head(restored))) {
+		debug(D_WQ, "tx to master: cache-update %s", line);
+		link_putfstring(master, "cache-update %s\n", stoptime, line);
+		free(line);
+	}
+	list_delete(restored);
+
+	debug(D_WQ, "restored %d files from cache %s", count, c->dir);
+
+	return count;
+}
+
+int work_queue_cache_save( struct work_queue_cache *c, const char *name, const char *path )
+{
+	if(!is_persistent_name(name))
+		return 0;
+
+	struct stat info;
+	if(lstat(path, &info) < 0 || !S_ISREG(info.st_mode))
+		return 0;
+
+	/* files are only ever added whole, and never rewritten, so another
+	 * worker may have stored the same file already. */
+	char *target = file_path(c, name);
+	int linked = link(path, target) == 0 || errno == EEXIST;
+	if(!linked)
+		debug(D_WQ, "could not link %s to %s: %s", path, target, strerror(errno));
+
+	/* the stored copy is what the index must match, whichever worker stored it. */
+	if(linked) {
+		chmod(target, info.st_mode & 0555);
+		if(stat(target, &info) < 0 || !S_ISREG(info.st_mode))
+			linked = 0;
+	}
+	free(target);
+
+	if(!linked)
+		return 0;
+
+	int fd = index_lock(c);
+	if(fd < 0)
+		return 0;
+
+	struct hash_table *index = index_load(c);
+
+	struct entry *e = hash_table_lookup(index, name);
+	if(!e) {
+		e = xxmalloc(sizeof(*e));
+		e->name = xxstrdup(name);
+		hash_table_insert(index, name, e);
+	}
+	e->size = info.st_size;
+	e->mtime = info.st_mtime;
+	e->last_used = time(0);
+
+	index_apply_touches(c, index);
+	index_evict(c, index);
+	index_store(c, index);
+
+	index_delete(index);
+	index_unlock(fd);
+
+	return 1;
+}
+
+void work_queue_cache_touch( struct work_queue_cache *c, const char *name )
+{
+	if(is_persistent_name(name))
+		hash_table_insert(c->touched, name, (void *) 1);
+}
+
+void work_queue_cache_sync( struct work_queue_cache *c )
+{
+	if(hash_table_size(c->touched) < 1)
+		return;
+
+	int fd = index_lock(c);
+	if(fd < 0)
+		return;
+
+	struct hash_table *index = index_load(c);
+	index_apply_touches(c, index);
+	index_store(c, index);
+
+	index_delete(index);
+	index_unlock(fd);
+}
+
+/* vim: set noexpandtab tabstop=4: */
@@ -0,0 +1,35 @@
+/*
+Copyright (C) 2020- The University of Notre Dame
+This software is distributed under the GNU General Public License.
+See the file COPYING for details.
+*/
+
+#ifndef WORK_QUEUE_CACHE_H
+#define WORK_QUEUE_CACHE_H
+
+#include "link.h"
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+A persistent cache keeps the content addressed files received by a worker in
+a directory that outlives the worker, so that later workers on the same host
+do not fetch them again. The directory may be shared by several workers at
+once, and its total size is bounded by evicting the least recently used files.
+*/
+
+struct work_queue_cache * work_queue_cache_create( const char *dir, int64_t max_size );
+void work_queue_cache_delete( struct work_queue_cache *c );
+
+/* Link every file in the cache into cachedir, and announce them to the master. */
+int work_queue_cache_restore( struct work_queue_cache *c, const char *cachedir, struct link *master, time_t stoptime );
+
+/* Keep a copy of the file at path, received under the cached name. */
+int work_queue_cache_save( struct work_queue_cache *c, const char *name, const char *path );
+
+/* Note that a task used the cached name. Recorded in the index by the next save or sync. */
+void work_queue_cache_touch( struct work_queue_cache *c, const char *name );
+void work_queue_cache_sync( struct work_queue_cache *c );
+
+#endif
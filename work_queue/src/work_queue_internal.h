@@ -10,6 +10,9 @@ See the file COPYING for details.
 #include "list.h"
 #include "hash_table.h"
 
+/* Cached names of files named by the md5 checksum of their contents. */
+#define WORK_QUEUE_CONTENT_CACHED_NAME_PREFIX "md5-"
+
 struct work_queue_file {
 	work_queue_file_t type;
 	int flags;		// WORK_QUEUE_CACHE or others in the future.
@@ -42,6 +42,9 @@ struct work_queue_process {
 	/* 1 if the task sandbox was mounted on a loop device. 0 otherwise. */
 	int loop_mount;
 
+	/* 1 if inputs still being fetched from peers are to be linked into the sandbox once they arrive. */
+	int sandbox_pending;
+
 	/* disk size and number of files found in the process sandbox. */
 	int64_t sandbox_size;
 	int64_t sandbox_file_count;
@@ -20,7 +20,9 @@ This file should not be installed and should only be included by .c files.
 /* 7: added category message */
 /* 8: worker send feature message. */
 /* 9: recursive send/recv and filename encoding. */
-#define WORK_QUEUE_PROTOCOL_VERSION 9
+/* 10: peer-serve and peerget messages, for transfers between workers. */
+/* 11: cache-update message, for files restored from a cache kept across workers. */
+#define WORK_QUEUE_PROTOCOL_VERSION 11
 
 #define WORK_QUEUE_LINE_MAX 4096       /**< Maximum length of a work queue message line. */
 #define WORK_QUEUE_POOL_NAME_MAX 128   /**< Maximum length of a work queue pool name. */
@@ -11,6 +11,7 @@ See the file COPYING for details.
 #include "work_queue_process.h"
 #include "work_queue_catalog.h"
 #include "work_queue_watcher.h"
+#include "work_queue_cache.h"
 
 #include "cctools.h"
 #include "macros.h"
@@ -132,9 +133,23 @@ static int64_t memory_avail_threshold = 100;
 // Password shared between master and worker.
 char *password = 0;
 
+// Process serving the files in the cache to other workers, started on request of the master.
+static pid_t peer_server_pid = 0;
+static int peer_server_port = 0;
+// Secret given by the master, which peers must present to fetch files from this worker.
+static char peer_token[WORK_QUEUE_LINE_MAX] = "";
+
+// Cached files being fetched from peers: name -> pid of the process fetching it, or -1 if it failed.
+static struct hash_table *peer_fetches = NULL;
+
 // Allow worker to use symlinks when link() fails.  Enabled by default.
 static int symlinks_enabled = 1;
 
+// Cache of content addressed files shared with later workers on this host, if --cache-dir is given.
+static char *persistent_cache_dir = NULL;
+static int64_t persistent_cache_size = 10240;
+static struct work_queue_cache *persistent_cache = NULL;
+
 // Worker id. A unique id for this worker instance.
 static char *worker_id;
 
@@ -494,6 +509,11 @@ static void report_worker_ready( struct link *master )
 	send_master_message(master, "info worker-id %s\n", worker_id);
 	send_features(master);
 	send_tlq_config(master);
+
+	/* before the resources, so that the master knows the cached files before sending any task. */
+	if(persistent_cache)
+		work_queue_cache_restore(persistent_cache, "cache", master, time(0) + active_timeout);
+
 	send_keepalive(master, 1);
 }
 
@@ -914,6 +934,47 @@ int setup_sandbox( struct work_queue_process *p )
 	return 1;
 }
 
+/*
+Whether a task needs a cached file that is still being fetched from a peer, or
+that the master has yet to send after a failed fetch.
+*/
+
+static int task_inputs_pending(struct work_queue_task *t)
+{
+	struct work_queue_file *f;
+
+	if(!t->input_files || hash_table_size(peer_fetches) == 0)
+		return 0;
+
+	list_first_item(t->input_files);
+	while((f = list_next_item(t->input_files))) {
+		if(!string_prefix_is(f->payload, "cache/"))
+			continue;
+
+		const char *name = f->payload + strlen("cache/");
+		pid_t pid = (intptr_t) hash_table_lookup(peer_fetches, name);
+		if(pid > 0)
+			return 1;
+		if(pid < 0) {
+			if(access(f->payload, F_OK) != 0)
+				return 1;
+			hash_table_remove(peer_fetches, name);
+		}
+	}
+
+	return 0;
+}
+
+/* Link into the sandbox of p the inputs that were still being fetched from peers when it arrived. */
+
+static int setup_pending_sandbox( struct work_queue_process *p )
+{
+	if(!p->sandbox_pending) return 1;
+
+	p->sandbox_pending = 0;
+	return setup_sandbox(p);
+}
+
 /*
 For a task run locally, if the resources are all set to -1,
 then assume that the task occupies all worker resources.
@@ -974,6 +1035,8 @@ static int do_task( struct link *master, int taskid, time_t stoptime )
 			free(cmd);
 		} else if(sscanf(line,"infile %s %s %d", filename, taskname_encoded, &flags)) {
 			string_nformat(localname, sizeof(localname), "cache/%s", filename);
+			if(persistent_cache)
+				work_queue_cache_touch(persistent_cache, filename);
 			url_decode(taskname_encoded, taskname, WORK_QUEUE_LINE_MAX);
 			work_queue_task_specify_file(task, localname, taskname, WORK_QUEUE_INPUT, flags);
 		} else if(sscanf(line,"outfile %s %s %d", filename, taskname_encoded, &flags)) {
@@ -1027,7 +1090,10 @@ static int do_task( struct link *master, int taskid, time_t stoptime )
 	} else {
 		// XXX sandbox setup should be done in task execution,
 		// so that it can be returned cleanly as a failure to execute.
-		if(!setup_sandbox(p)) {
+		// Inputs still being fetched from peers are linked once they arrive.
+		if(task_inputs_pending(task)) {
+			p->sandbox_pending = 1;
+		} else if(!setup_sandbox(p)) {
 			itable_remove(procs_table,taskid);
 			work_queue_process_delete(p);
 			return 0;
@@ -1063,7 +1129,7 @@ need to be url_decoded because it is sent in the body.
 
 static int do_put_symlink_internal( struct link *master, char *filename, int length )
 {
-	char *target = malloc(length);
+	char *target = malloc(length+1);
 
 	int actual = link_read(master,target,length,time(0)+active_timeout);
 	if(actual!=length) {
@@ -1071,6 +1137,8 @@ static int do_put_symlink_internal( struct link *master, char *filename, int len
 		return 0;
 	}
 
+	target[length] = 0;
+
 	int result = symlink(target,filename);
 	if(result<0) {
 		debug(D_WQ,"could not create symlink %s: %s",filename,strerror(errno));
@@ -1100,6 +1168,9 @@ static int do_put_file_internal( struct link *master, char *filename, int64_t le
 	/* Ensure that worker can access the file! */
 	mode = mode | 0600;
 
+	/* The file may be a hard link into the persistent cache, which must not be rewritten in place. */
+	unlink(filename);
+
 	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, mode);
 	if(fd<0) {
 		debug(D_WQ, "Could not open %s for writing. (%s)\n", filename, strerror(errno));
@@ -1222,6 +1293,9 @@ static int do_put_single_file( struct link *master, char *filename, int64_t leng
 
 	int result = do_put_file_internal(master,cached_filename,length,mode);
 
+	if(result && persistent_cache)
+		work_queue_cache_save(persistent_cache, filename, cached_filename);
+
 	free(cached_filename);
 
 	return result;
@@ -1411,6 +1485,351 @@ static int do_thirdput(struct link *master, int mode, char *filename, const char
 
 }
 
+/*
+Peer transfers. When the master enables them, the worker serves the files
+in its cache to other workers from a separate process, and the master may
+then tell a worker to fetch a cached file from a peer (peerget) instead of
+sending the file itself. A peer asks for a file with "get <token> <name>",
+where the token is a secret that the master gives to all of its workers, so
+that only workers of the same master may fetch files. The
+file is sent back with the same put/dir/symlink messages that the master uses
+for the recursive put protocol, so that do_put_*_internal can receive it.
+*/
+
+static int send_peer_item(struct link *peer, const char *path, const char *name, int follow_links)
+{
+	struct stat info;
+	char name_encoded[WORK_QUEUE_LINE_MAX];
+	time_t stoptime = time(0) + active_timeout;
+	int result;
+
+	if(follow_links) {
+		result = stat(path, &info);
+	} else {
+		result = lstat(path, &info);
+	}
+
+	if(result < 0) {
+		debug(D_WQ, "cannot stat %s for peer: %s", path, strerror(errno));
+		return 0;
+	}
+
+	url_encode(name, name_encoded, sizeof(name_encoded));
+
+	if(S_ISDIR(info.st_mode)) {
+		DIR *dir = opendir(path);
+		if(!dir) return 0;
+
+		link_putfstring(peer, "dir %s\n", stoptime, name_encoded);
+
+		result = 1;
+		struct dirent *d;
+		while((d = readdir(dir))) {
+			if(!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..")) continue;
+
+			char *subpath = string_format("%s/%s", path, d->d_name);
+			result = send_peer_item(peer, subpath, d->d_name, 0);
+			free(subpath);
+
+			if(!result) break;
+		}
+		closedir(dir);
+
+		link_putliteral(peer, "end\n", stoptime);
+
+		return result;
+	} else if(S_ISLNK(info.st_mode)) {
+		char target[WORK_QUEUE_LINE_MAX];
+		int length = readlink(path, target, sizeof(target));
+		if(length < 0) return 0;
+
+		link_putfstring(peer, "symlink %s %d\n", stoptime, name_encoded, length);
+		return link_write(peer, target, length, stoptime) == length;
+	} else if(S_ISREG(info.st_mode)) {
+		int fd = open(path, O_RDONLY, 0);
+		if(fd < 0) return 0;
+
+		int64_t length = info.st_size;
+		link_putfstring(peer, "put %s %"PRId64" 0%o\n", stoptime, name_encoded, length, (int) ((info.st_mode | 0600) & 0777));
+		int64_t actual = link_stream_from_fd(peer, fd, length, stoptime);
+		close(fd);
+
+		return actual == length;
+	}
+
+	debug(D_WQ, "skipping unusual file %s for peer", path);
+	return 1;
+}
+
+static void serve_peer(struct link *peer)
+{
+	char line[WORK_QUEUE_LINE_MAX];
+	char token[WORK_QUEUE_LINE_MAX];
+	char name_encoded[WORK_QUEUE_LINE_MAX];
+	char name[WORK_QUEUE_LINE_MAX];
+	time_t stoptime = time(0) + active_timeout;
+
+	if(password && !link_auth_password(peer, password, stoptime)) {
+		debug(D_WQ, "peer failed to authenticate");
+		return;
+	}
+
+	if(!link_readline(peer, line, sizeof(line), stoptime)) return;
+
+	if(sscanf(line, "get %s %s", token, name_encoded) != 2) {
+		debug(D_WQ, "unrecognized peer message: %s", line);
+		return;
+	}
+
+	if(!peer_token[0] || strcmp(token, peer_token)) {
+		debug(D_WQ, "peer presented the wrong token");
+		return;
+	}
+
+	url_decode(name_encoded, name, sizeof(name));
+	if(!is_valid_filename(name)) return;
+
+	char *path = string_format("cache/%s", name);
+	if(send_peer_item(peer, path, name, 1)) {
+		debug(D_WQ, "sent %s to peer", path);
+	} else {
+		debug(D_WQ, "could not send %s to peer", path);
+	}
+	free(path);
+}
+
+/*
+Accept connections from peers, and serve each from a child process. Exit when
+the worker is gone.
+*/
+
+static void peer_server(struct link *server, pid_t worker_pid)
+{
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGQUIT, SIG_DFL);
+	signal(SIGCHLD, SIG_DFL);
+
+	while(getppid() == worker_pid) {
+		struct link *peer = link_accept(server, time(0) + 5);
+
+		while(waitpid(-1, NULL, WNOHANG) > 0) {}
+
+		if(!peer) continue;
+
+		pid_t pid = fork();
+		if(pid == 0) {
+			link_close(server);
+			serve_peer(peer);
+			link_close(peer);
+			_exit(0);
+		} else if(pid < 0) {
+			debug(D_WQ, "could not fork to serve peer: %s", strerror(errno));
+		}
+
+		link_close(peer);
+	}
+
+	_exit(0);
+}
+
+static void peer_server_stop();
+
+static int do_peer_serve(struct link *master, const char *token)
+{
+	/* the server keeps the token it was started with, so restart it for a new master. */
+	if(peer_server_pid && strcmp(token, peer_token))
+		peer_server_stop();
+
+	if(!peer_server_pid) {
+		snprintf(peer_token, sizeof(peer_token), "%s", token);
+
+		struct link *server = link_serve(0);
+		if(!server) {
+			debug(D_WQ, "could not listen for peers: %s", strerror(errno));
+			return 1;
+		}
+
+		char addr[LINK_ADDRESS_MAX];
+		link_address_local(server, addr, &peer_server_port);
+
+		pid_t worker_pid = getpid();
+		pid_t pid = fork();
+		if(pid == 0) {
+			link_close(master);
+			peer_server(server, worker_pid);
+		} else if(pid < 0) {
+			debug(D_WQ, "could not fork peer server: %s", strerror(errno));
+			link_close(server);
+			return 1;
+		}
+
+		link_close(server);
+		peer_server_pid = pid;
+		debug(D_WQ, "serving cache to peers on port %d", peer_server_port);
+	}
+
+	send_master_message(master, "info transfer-port %d\n", peer_server_port);
+
+	return 1;
+}
+
+static void peer_server_stop()
+{
+	if(!peer_server_pid) return;
+
+	kill(peer_server_pid, SIGTERM);
+	waitpid(peer_server_pid, NULL, 0);
+	peer_server_pid = 0;
+}
+
+/*
+Fetch a cached file from a peer. This runs in a child process of the worker,
+started by do_peerget.
+*/
+
+static int peer_fetch(const char *filename, const char *host, int port)
+{
+	char line[WORK_QUEUE_LINE_MAX];
+	char name_encoded[WORK_QUEUE_LINE_MAX];
+	char filename_encoded[WORK_QUEUE_LINE_MAX];
+	int64_t length;
+	int mode;
+	int result = 0;
+
+	timestamp_t start = timestamp_get();
+
+	struct link *peer = link_connect(host, port, time(0) + active_timeout);
+	if(!peer) {
+		debug(D_WQ, "could not connect to peer %s:%d: %s", host, port, strerror(errno));
+		return 0;
+	}
+
+	time_t stoptime = time(0) + active_timeout;
+	url_encode(filename, filename_encoded, sizeof(filename_encoded));
+
+	if(!password || link_auth_password(peer, password, stoptime)) {
+		link_putfstring(peer, "get %s %s\n", stoptime, peer_token, filename_encoded);
+
+		if(link_readline(peer, line, sizeof(line), stoptime)) {
+			char *cached_filename = string_format("cache/%s", filename);
+
+			if(sscanf(line, "put %s %" SCNd64 " %o", name_encoded, &length, &mode) == 3) {
+				result = do_put_file_internal(peer, cached_filename, length, mode);
+			} else if(sscanf(line, "dir %s", name_encoded) == 1) {
+				result = do_put_dir_internal(peer, cached_filename);
+			} else if(sscanf(line, "symlink %s %" SCNd64, name_encoded, &length) == 2) {
+				result = do_put_symlink_internal(peer, cached_filename, length);
+			}
+
+			free(cached_filename);
+		}
+	}
+
+	link_close(peer);
+
+	if(result) {
+		debug(D_WQ, "got %s from peer %s:%d in %.02lfs", filename, host, port, (timestamp_get() - start) / 1000000.0);
+	}
+
+	return result;
+}
+
+/*
+Fetch a cached file from a peer in a child process, so that the worker keeps
+talking to the master and running tasks meanwhile. Tasks that need the file
+stay in procs_waiting until it arrives. check_peer_fetches reports to the
+master when the fetch ends: with peer-done, or with peer-failed, after which
+the master sends the file itself.
+*/
+
+static int do_peerget(struct link *master, const char *filename, const char *host, int port)
+{
+	char filename_encoded[WORK_QUEUE_LINE_MAX];
+
+	if(!is_valid_filename(filename)) return 0;
+
+	url_encode(filename, filename_encoded, sizeof(filename_encoded));
+	hash_table_remove(peer_fetches, filename);
+
+	pid_t pid = fork();
+	if(pid == 0) {
+		_exit(peer_fetch(filename, host, port) ? 0 : 1);
+	} else if(pid < 0) {
+		debug(D_WQ, "could not fork to get %s from peer: %s", filename, strerror(errno));
+		hash_table_insert(peer_fetches, filename, (void *) (intptr_t) -1);
+		send_master_message(master, "peer-failed %s\n", filename_encoded);
+		return 1;
+	}
+
+	debug(D_WQ, "getting %s from peer %s:%d", filename, host, port);
+	hash_table_insert(peer_fetches, filename, (void *) (intptr_t) pid);
+
+	return 1;
+}
+
+/* Report to the master the fetches from peers that ended. */
+
+static void check_peer_fetches(struct link *master)
+{
+	char filename_encoded[WORK_QUEUE_LINE_MAX];
+	char *filename;
+	void *value;
+	int status;
+
+	hash_table_firstkey(peer_fetches);
+	while(hash_table_nextkey(peer_fetches, &filename, &value)) {
+		pid_t pid = (intptr_t) value;
+		if(pid < 0 || waitpid(pid, &status, WNOHANG) != pid)
+			continue;
+
+		char *name = xxstrdup(filename);
+		char *cached_filename = string_format("cache/%s", name);
+		url_encode(name, filename_encoded, sizeof(filename_encoded));
+		hash_table_remove(peer_fetches, name);
+
+		if(WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+			struct stat info;
+			if(persistent_cache && lstat(cached_filename, &info) == 0 && S_ISREG(info.st_mode))
+				work_queue_cache_save(persistent_cache, name, cached_filename);
+			send_master_message(master, "peer-done %s\n", filename_encoded);
+		} else {
+			debug(D_WQ, "could not get %s from peer, the master will send it", name);
+			delete_dir(cached_filename);
+			hash_table_insert(peer_fetches, name, (void *) (intptr_t) -1);
+			send_master_message(master, "peer-failed %s\n", filename_encoded);
+		}
+
+		free(cached_filename);
+		free(name);
+
+		hash_table_firstkey(peer_fetches);
+	}
+}
+
+/* Stop the fetches from peers in progress, and forget the failed ones. */
+
+static void peer_fetches_stop()
+{
+	char *filename;
+	void *value;
+
+	hash_table_firstkey(peer_fetches);
+	while(hash_table_nextkey(peer_fetches, &filename, &value)) {
+		pid_t pid = (intptr_t) value;
+		if(pid > 0) {
+			kill(pid, SIGKILL);
+			waitpid(pid, NULL, 0);
+
+			char *cached_filename = string_format("cache/%s", filename);
+			delete_dir(cached_filename);
+			free(cached_filename);
+		}
+	}
+
+	hash_table_clear(peer_fetches);
+}
+
 /*
 do_kill removes a process currently known by the worker.
 Note that a kill message from the master is used for every case
@@ -1592,6 +2011,7 @@ static void disconnect_master(struct link *master) {
 
 	debug(D_WQ, "killing all outstanding tasks");
 	kill_all_tasks();
+	peer_fetches_stop();
 
 	//KNOWN HACK: We remove all workers on a master disconnection to avoid
 	//returning old tasks to a new master.
@@ -1653,6 +2073,12 @@ static int handle_master(struct link *master) {
 			url_decode(filename_encoded,filename,sizeof(filename));
 			r = do_thirdput(master, mode, filename, path);
 			reset_idle_timer();
+		} else if(sscanf(line, "peerget %s %s %d", filename_encoded, path, &n) == 3) {
+			url_decode(filename_encoded,filename,sizeof(filename));
+			r = do_peerget(master, filename, path, n);
+			reset_idle_timer();
+		} else if(sscanf(line, "peer-serve %s", path) == 1) {
+			r = do_peer_serve(master, path);
 		} else if(sscanf(line, "kill %" SCNd64, &taskid) == 1) {
 			if(taskid >= 0) {
 				r = do_kill(taskid);
@@ -1857,6 +2283,8 @@ static void work_for_master(struct link *master) {
 
 		ok &= handle_tasks(master);
 
+		check_peer_fetches(master);
+
 		measure_worker_resources();
 
 		if(!enforce_worker_promises(master)) {
@@ -1888,6 +2316,11 @@ static void work_for_master(struct link *master) {
 				p = list_pop_head(procs_waiting);
 				if(!p) {
 					break;
+				} else if(task_inputs_pending(p->task)) {
+					list_push_tail(procs_waiting, p);
+				} else if(!setup_pending_sandbox(p)) {
+					forsake_waiting_process(master, p);
+					task_event++;
 				} else if(task_resources_fit_now(p->task)) {
 					start_process(p);
 					task_event++;
@@ -2107,8 +2540,11 @@ static void workspace_delete()
 	if(procs_table)        itable_delete(procs_table);
 	if(procs_complete)     itable_delete(procs_complete);
 	if(procs_waiting)      list_delete(procs_waiting);
+	if(peer_fetches)       hash_table_delete(peer_fetches);
 
 	if(watcher)            work_queue_watcher_delete(watcher);
+	if(persistent_cache)   work_queue_cache_delete(persistent_cache);
+	if(persistent_cache_dir) free(persistent_cache_dir);
 
 	printf( "work_queue_worker: deleting workspace %s\n", workspace);
 
@@ -2194,6 +2630,9 @@ static int serve_master_by_hostport( const char *host, int port, const char *ver
 	last_task_received     = 0;
 	results_to_be_sent_msg = 0;
 
+	if(persistent_cache)
+		work_queue_cache_sync(persistent_cache);
+
 	workspace_cleanup();
 	disconnect_master(master);
 	printf("disconnected from master %s:%d\n", host, port );
@@ -2431,7 +2870,7 @@ static void show_help(const char *cmd)
 	printf( " %-30s Select port to listen to at random and write to this file.  Implies --foreman.\n", "-Z,--foreman-port-file=<file>");
 	printf( " %-30s Set the fast abort multiplier for foreman (default=disabled).\n", "-F,--fast-abort=<mult>");
 	printf( " %-30s Send statistics about foreman to this file.\n", "--specify-log=<logfile>");
-	printf( " %-30s Password file for authenticating to the master.\n", "-P,--password=<pwfile>");
+	printf( " %-30s Password file for authenticating to the master and to peers.\n", "-P,--password=<pwfile>");
 	printf( " %-30s Set both --idle-timeout and --connect-timeout.\n", "-t,--timeout=<time>");
 	printf( " %-30s Disconnect after this time if master sends no work. (default=%ds)\n", "   --idle-timeout=<time>", idle_timeout);
 	printf( " %-30s Abort after this time if no masters are available. (default=%ds)\n", "   --connect-timeout=<time>", idle_timeout);
@@ -2459,6 +2898,8 @@ static void show_help(const char *cmd)
 	printf( " %-30s Specifies a user-defined feature the worker provides. May be specified several times.\n", "--feature");
 	printf( " %-30s Set the maximum number of seconds the worker may be active. (in s).\n", "--wall-time=<s>");
 	printf( " %-30s Forbid the use of symlinks for cache management.\n", "--disable-symlinks");
+	printf( " %-30s Keep content addressed files in this directory, shared with later workers.\n", "--cache-dir=<path>");
+	printf( " %-30s Maximum size of --cache-dir in MB. (default=%" PRId64 ")\n", "--cache-size=<mb>", persistent_cache_size);
 	printf(" %-30s Single-shot mode -- quit immediately after disconnection.\n", "--single-shot");
 	printf(" %-30s docker mode -- run each task with a container based on this docker image.\n", "--docker=<image>");
 	printf(" %-30s docker-preserve mode -- tasks execute by a worker share a container based on this docker image.\n", "--docker-preserve=<image>");
@@ -2472,7 +2913,7 @@ enum {LONG_OPT_DEBUG_FILESIZE = 256, LONG_OPT_VOLATILITY, LONG_OPT_BANDWIDTH,
 	  LONG_OPT_DISK, LONG_OPT_GPUS, LONG_OPT_FOREMAN, LONG_OPT_FOREMAN_PORT, LONG_OPT_DISABLE_SYMLINKS,
 	  LONG_OPT_IDLE_TIMEOUT, LONG_OPT_CONNECT_TIMEOUT, LONG_OPT_RUN_DOCKER, LONG_OPT_RUN_DOCKER_PRESERVE,
 	  LONG_OPT_BUILD_FROM_TAR, LONG_OPT_SINGLE_SHOT, LONG_OPT_WALL_TIME, LONG_OPT_DISK_ALLOCATION,
-	  LONG_OPT_MEMORY_THRESHOLD, LONG_OPT_FEATURE, LONG_OPT_TLQ};
+	  LONG_OPT_MEMORY_THRESHOLD, LONG_OPT_FEATURE, LONG_OPT_TLQ, LONG_OPT_CACHE_DIR, LONG_OPT_CACHE_SIZE};
 
 static const struct option long_options[] = {
 	{"advertise",           no_argument,        0,  'a'},
@@ -2518,6 +2959,8 @@ static const struct option long_options[] = {
 	{"docker-tar",          required_argument,  0,  LONG_OPT_BUILD_FROM_TAR},
 	{"feature",             required_argument,  0,  LONG_OPT_FEATURE},
 	{"tlq",					required_argument,	0,  LONG_OPT_TLQ},
+	{"cache-dir",           required_argument,  0,  LONG_OPT_CACHE_DIR},
+	{"cache-size",          required_argument,  0,  LONG_OPT_CACHE_SIZE},
 	{0,0,0,0}
 };
 
@@ -2758,6 +3201,16 @@ int main(int argc, char *argv[])
 		case LONG_OPT_TLQ:
 			tlq_port = atoi(optarg);
 			break;
+		case LONG_OPT_CACHE_DIR:
+			{
+				char absolute[PATH_MAX];
+				path_absolute(optarg, absolute, 0);
+				persistent_cache_dir = xxstrdup(absolute);
+			}
+			break;
+		case LONG_OPT_CACHE_SIZE:
+			persistent_cache_size = atoll(optarg);
+			break;
 		default:
 			show_help(argv[0]);
 			return 1;
@@ -2832,6 +3285,23 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if(persistent_cache_dir) {
+		persistent_cache = work_queue_cache_create(persistent_cache_dir, persistent_cache_size * MEGA);
+		if(!persistent_cache) {
+			fprintf(stderr, "work_queue_worker: could not use cache directory %s.\n", persistent_cache_dir);
+			return 1;
+		}
+
+		/* files are moved in and out of the cache with hard links, which cannot cross filesystems. */
+		struct stat cache_info, workspace_info;
+		if(stat(persistent_cache_dir, &cache_info) == 0 && stat(workspace, &workspace_info) == 0 && cache_info.st_dev != workspace_info.st_dev) {
+			warn(D_NOTICE, "cache directory %s is not on the same filesystem as the workspace %s, so it will not be used.", persistent_cache_dir, workspace);
+			warn(D_NOTICE, "Use --workdir to place the workspace on the filesystem of the cache directory.");
+			work_queue_cache_delete(persistent_cache);
+			persistent_cache = NULL;
+		}
+	}
+
 	// set $WORK_QUEUE_SANDBOX to workspace.
 	debug(D_WQ, "WORK_QUEUE_SANDBOX set to %s.\n", workspace);
 	setenv("WORK_QUEUE_SANDBOX", workspace, 0);
@@ -2917,6 +3387,7 @@ int main(int argc, char *argv[])
 	procs_table    = itable_create(0);
 	procs_waiting  = list_create();
 	procs_complete = itable_create(0);
+	peer_fetches   = hash_table_create(0, 0);
 
 	watcher = work_queue_watcher_create();
 
@@ -3009,6 +3480,8 @@ int main(int argc, char *argv[])
 
 	}
 
+	peer_server_stop();
+
 	workspace_delete();
 
 	return 0;
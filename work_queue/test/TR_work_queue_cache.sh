@@ -0,0 +1,130 @@
+#!/bin/sh
+
+# Run two workers, one after the other, on the same --cache-dir. The first
+# task tries to append to one of its inputs, and the second worker must then
+# find the untouched input in the cache. Only root can write to the cached
+# input, and then the second worker must fetch it again.
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="cache.test"
+port_file="cache.port"
+status_file="cache.status"
+cache_dir="cache.dir"
+
+prepare()
+{
+	rm -rf "$port_file" "$status_file" "$cache_dir"
+
+	${CC} -I../src/ -I../../dttools/src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libwork_queue.a ../../dttools/src/libdttools.a -lm -lz -lpthread <<EOF
+#include "work_queue.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIZE_A (1<<20)
+#define SIZE_B (2<<20)
+
+int main (int argc, char *argv[])
+{
+	struct work_queue *q;
+	struct work_queue_task *t;
+	struct work_queue_stats s;
+	FILE *file;
+	int second = atoi(argv[2]);
+	int i;
+
+	q = work_queue_create(0);
+	if(!q)
+		fatal("couldn't create queue: %s", strerror(errno));
+	work_queue_enable_content_addressed_cache(q);
+
+	file = fopen(argv[1], "w");
+	if(!file)
+		fatal("couldn't open %s: %s", argv[1], strerror(errno));
+	fprintf(file, "%d\n", work_queue_port(q));
+	fclose(file);
+
+	if(second) {
+		t = work_queue_task_create("cat a b > output");
+	} else {
+		/* Fails as an ordinary user, since cached inputs are read-only. */
+		t = work_queue_task_create("cat a b > output; echo corrupt 2> /dev/null >> b; true");
+	}
+	work_queue_task_specify_file(t, "cache.a", "a", WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
+	work_queue_task_specify_file(t, "cache.b", "b", WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
+	work_queue_task_specify_file(t, second ? "cache.out.2" : "cache.out.1", "output", WORK_QUEUE_OUTPUT, WORK_QUEUE_NOCACHE);
+	work_queue_submit(q, t);
+
+	t = 0;
+	for(i = 0; i < 60 && !t; i++)
+		t = work_queue_wait(q, 5);
+	if(!t || t->result != WORK_QUEUE_RESULT_SUCCESS || t->return_status != 0)
+		fatal("task did not complete");
+	work_queue_task_delete(t);
+
+	work_queue_get_stats(q, &s);
+	if(second && s.bytes_sent >= SIZE_A + SIZE_B)
+		fatal("second worker was sent every input again");
+
+	file = fopen("cache.sent", "w");
+	if(!file)
+		fatal("couldn't open cache.sent: %s", strerror(errno));
+	fprintf(file, "%lld\n", (long long) s.bytes_sent);
+	fclose(file);
+
+	work_queue_delete(q);
+	return 0;
+}
+EOF
+
+	dd if=/dev/urandom of=cache.a bs=1024 count=1024 2> /dev/null
+	dd if=/dev/urandom of=cache.b bs=1024 count=2048 2> /dev/null
+	cat cache.a cache.b > cache.expected
+}
+
+session()
+{
+	rm -f "$port_file" "$status_file"
+
+	("./$exe" "$port_file" $1; echo $? > "$status_file") &
+
+	wait_for_file_creation "$port_file" 15 || return 1
+	"$WORK_QUEUE_WORKER" --single-shot --timeout=10s --cores 1 --memory 250 --disk 250 --cache-dir="$cache_dir" --debug=all --debug-file=worker.log localhost $(cat "$port_file") || return 1
+
+	wait_for_file_creation "$status_file" 5 || return 1
+	[ "$(cat "$status_file")" -eq 0 ]
+}
+
+run()
+{
+	session 0 || return 1
+	require_identical_files cache.expected cache.out.1
+
+	[ -z "$(find "$cache_dir/files" -type f -perm /222)" ] || return 1
+
+	session 1 || return 1
+	require_identical_files cache.expected cache.out.2
+
+	# Both inputs are kept again, and none of them can be written to.
+	[ "$(find "$cache_dir/files" -type f | wc -l)" -eq 2 ] || return 1
+	[ -z "$(find "$cache_dir/files" -type f -perm /222)" ] || return 1
+
+	if [ "$(id -u)" -eq 0 ]; then
+		[ "$(cat cache.sent)" -ge $((2048*1024)) ]
+	else
+		[ "$(cat cache.sent)" -eq 0 ]
+	fi
+}
+
+clean()
+{
+	rm -rf "$exe" "$port_file" "$status_file" "$cache_dir" cache.a cache.b cache.expected cache.out.* cache.sent worker.log
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
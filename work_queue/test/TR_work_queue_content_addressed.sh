@@ -0,0 +1,130 @@
+#!/bin/sh
+
+# With the content addressed cache enabled, check that identical inputs under
+# different paths are sent to a worker only once, and that a file rewritten in
+# place is sent again under its new name.
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="content_addressed.test"
+port_file="content_addressed.port"
+status_file="content_addressed.status"
+
+prepare()
+{
+	rm -f "$port_file" "$status_file"
+
+	${CC} -I../src/ -I../../dttools/src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libwork_queue.a ../../dttools/src/libdttools.a -lm -lz -lpthread <<EOF
+#include "work_queue.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIZE (1<<20)
+
+static struct work_queue *q;
+
+static void write_file(const char *path, char c, int size)
+{
+	FILE *file = fopen(path, "w");
+	int i;
+
+	if(!file)
+		fatal("couldn't open %s: %s", path, strerror(errno));
+	for(i = 0; i < size; i++)
+		fputc(c, file);
+	fclose(file);
+}
+
+/* Run one task reading path, and return the input bytes sent for it. */
+static int64_t run_task(const char *path, const char *output)
+{
+	struct work_queue_stats s;
+	struct work_queue_task *t;
+	int64_t before;
+	int i;
+
+	work_queue_get_stats(q, &s);
+	before = s.bytes_sent;
+
+	t = work_queue_task_create("cat input > output");
+	work_queue_task_specify_file(t, path, "input", WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
+	work_queue_task_specify_file(t, output, "output", WORK_QUEUE_OUTPUT, WORK_QUEUE_NOCACHE);
+	work_queue_submit(q, t);
+
+	t = 0;
+	for(i = 0; i < 60 && !t; i++)
+		t = work_queue_wait(q, 5);
+	if(!t || t->result != WORK_QUEUE_RESULT_SUCCESS || t->return_status != 0)
+		fatal("task reading %s did not complete", path);
+	work_queue_task_delete(t);
+
+	work_queue_get_stats(q, &s);
+	return s.bytes_sent - before;
+}
+
+int main (int argc, char *argv[])
+{
+	FILE *file;
+	int64_t sent;
+
+	q = work_queue_create(0);
+	if(!q)
+		fatal("couldn't create queue: %s", strerror(errno));
+	work_queue_enable_content_addressed_cache(q);
+
+	file = fopen(argv[1], "w");
+	if(!file)
+		fatal("couldn't open %s: %s", argv[1], strerror(errno));
+	fprintf(file, "%d\n", work_queue_port(q));
+	fclose(file);
+
+	write_file("content_addressed.a", 'a', SIZE);
+	write_file("content_addressed.b", 'a', SIZE);
+
+	sent = run_task("content_addressed.a", "content_addressed.out.1");
+	if(sent < SIZE)
+		fatal("first copy sent only %lld bytes", (long long) sent);
+
+	sent = run_task("content_addressed.b", "content_addressed.out.2");
+	if(sent != 0)
+		fatal("identical copy under another path sent %lld bytes", (long long) sent);
+
+	/* A different size, so the change is seen even within the same mtime second. */
+	write_file("content_addressed.a", 'b', SIZE + 1);
+	sent = run_task("content_addressed.a", "content_addressed.out.3");
+	if(sent < SIZE + 1)
+		fatal("rewritten file sent only %lld bytes", (long long) sent);
+
+	work_queue_delete(q);
+	return 0;
+}
+EOF
+}
+
+run()
+{
+	("./$exe" "$port_file"; echo $? > "$status_file") &
+
+	run_local_worker "$port_file" worker.log
+
+	wait_for_file_creation "$status_file" 5
+	[ "$(cat "$status_file")" -eq 0 ] || return 1
+
+	cp content_addressed.b content_addressed.expected
+	require_identical_files content_addressed.expected content_addressed.out.1
+	require_identical_files content_addressed.expected content_addressed.out.2
+	require_identical_files content_addressed.a content_addressed.out.3
+}
+
+clean()
+{
+	rm -f "$exe" "$port_file" "$status_file" content_addressed.a content_addressed.b content_addressed.expected content_addressed.out.* worker.log
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
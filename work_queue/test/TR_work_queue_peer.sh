@@ -0,0 +1,164 @@
+#!/bin/sh
+
+# Run two workers with peer transfers enabled. A cached input held by the first
+# worker must reach the second from the first, not from the master. Then the
+# peer server of the first worker is killed, and a task on the second worker
+# needing another file held only by the first must still complete, with the
+# master sending the file after the failed peer fetch.
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="peer.test"
+port_file="peer.port"
+status_file="peer.status"
+
+prepare()
+{
+	rm -f "$port_file" "$status_file" peer.killed
+
+	${CC} -I../src/ -I../../dttools/src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libwork_queue.a ../../dttools/src/libdttools.a -lm -lz -lpthread <<EOF
+#include "work_queue.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SIZE (8<<20)
+
+static struct work_queue *q;
+
+static void write_number(const char *path, int64_t n)
+{
+	FILE *file = fopen(path, "w");
+	if(!file)
+		fatal("couldn't open %s: %s", path, strerror(errno));
+	fprintf(file, "%lld\n", (long long) n);
+	fclose(file);
+}
+
+/* Run one task on the worker with the given feature, and return the input bytes sent by the master. */
+static int64_t run_task(const char *feature, const char *input, const char *output)
+{
+	struct work_queue_stats s;
+	struct work_queue_task *t;
+	int64_t before;
+	int i;
+
+	work_queue_get_stats(q, &s);
+	before = s.bytes_sent;
+
+	t = work_queue_task_create("cat input > output");
+	work_queue_task_specify_feature(t, feature);
+	work_queue_task_specify_file(t, input, "input", WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
+	work_queue_task_specify_file(t, output, "output", WORK_QUEUE_OUTPUT, WORK_QUEUE_NOCACHE);
+	work_queue_submit(q, t);
+
+	t = 0;
+	for(i = 0; i < 60 && !t; i++)
+		t = work_queue_wait(q, 5);
+	if(!t || t->result != WORK_QUEUE_RESULT_SUCCESS || t->return_status != 0)
+		fatal("task on worker %s did not complete", feature);
+	work_queue_task_delete(t);
+
+	work_queue_get_stats(q, &s);
+	return s.bytes_sent - before;
+}
+
+int main (int argc, char *argv[])
+{
+	struct work_queue_stats s;
+	int i;
+
+	q = work_queue_create(0);
+	if(!q)
+		fatal("couldn't create queue: %s", strerror(errno));
+	work_queue_enable_peer_transfers(q);
+	write_number(argv[1], work_queue_port(q));
+
+	/* the first worker gets both files from the master. */
+	if(run_task("one", "peer.a", "peer.out.1") < SIZE)
+		fatal("first worker was not sent peer.a");
+	if(run_task("one", "peer.b", "peer.out.2") < SIZE)
+		fatal("first worker was not sent peer.b");
+
+	/* the second worker gets peer.a from the first. */
+	if(run_task("two", "peer.a", "peer.out.3") >= SIZE)
+		fatal("second worker was sent peer.a by the master");
+	work_queue_get_stats(q, &s);
+	if(s.transfers_peer != 1)
+		fatal("%lld peer transfers instead of 1", (long long) s.transfers_peer);
+
+	/* wait for the peer server of the first worker to be killed. */
+	for(i = 0; i < 30 && access("peer.killed", F_OK) != 0; i++)
+		sleep(1);
+	if(i == 30)
+		fatal("peer server was not killed");
+
+	/* peer.b is only at the first worker, which can no longer serve it. */
+	if(run_task("two", "peer.b", "peer.out.4") < SIZE)
+		fatal("master did not send peer.b after the failed peer fetch");
+	work_queue_get_stats(q, &s);
+	if(s.transfers_peer != 1)
+		fatal("%lld peer transfers instead of 1", (long long) s.transfers_peer);
+
+	work_queue_delete(q);
+	return 0;
+}
+EOF
+
+	dd if=/dev/urandom of=peer.a bs=1024 count=8192 2> /dev/null
+	dd if=/dev/urandom of=peer.b bs=1024 count=8192 2> /dev/null
+}
+
+run()
+{
+	local w1 w2 server i
+
+	("./$exe" "$port_file"; echo $? > "$status_file") &
+
+	wait_for_file_creation "$port_file" 15 || return 1
+	"$WORK_QUEUE_WORKER" --single-shot --timeout=20s --cores 1 --memory 250 --disk 250 --feature one --debug=all --debug-file=peer.worker.1.log localhost $(cat "$port_file") &
+	w1=$!
+	"$WORK_QUEUE_WORKER" --single-shot --timeout=20s --cores 1 --memory 250 --disk 250 --feature two --debug=all --debug-file=peer.worker.2.log localhost $(cat "$port_file") &
+	w2=$!
+
+	# the second task on the second worker is the peer transfer.
+	wait_for_file_creation peer.out.3 60 || return 1
+	i=0
+	until [ "$(wc -c < peer.out.3)" -eq $((8192*1024)) ]; do
+		i=$((i+1))
+		[ $i -lt 30 ] || return 1
+		sleep 1
+	done
+
+	# the peer server is the only child of the idle first worker.
+	server=$(ps -o pid= --ppid $w1)
+	[ -n "$server" ] || return 1
+	kill -9 $server
+	touch peer.killed
+
+	wait_for_file_creation "$status_file" 120 || return 1
+	[ "$(cat "$status_file")" -eq 0 ] || return 1
+
+	kill $w1 $w2 2> /dev/null
+	wait $w1 $w2
+
+	require_identical_files peer.a peer.out.1 || return 1
+	require_identical_files peer.b peer.out.2 || return 1
+	require_identical_files peer.a peer.out.3 || return 1
+	require_identical_files peer.b peer.out.4 || return 1
+
+	grep -q "peer-failed" peer.worker.2.log
+}
+
+clean()
+{
+	rm -f "$exe" "$port_file" "$status_file" peer.killed peer.a peer.b peer.out.* peer.worker.*.log
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
@@ -0,0 +1,101 @@
+#!/bin/sh
+
+# Move inputs, outputs and task stdout large enough to go through the
+# sendfile/splice paths of link_stream_from_fd and link_stream_to_fd, and
+# check that every byte arrives intact in both directions.
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="sendfile.test"
+port_file="sendfile.port"
+status_file="sendfile.status"
+
+prepare()
+{
+	rm -f "$port_file" "$status_file"
+
+	${CC} -I../src/ -I../../dttools/src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libwork_queue.a ../../dttools/src/libdttools.a -lm -lz -lpthread <<EOF
+#include "work_queue.h"
+#include "debug.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main (int argc, char *argv[])
+{
+	struct work_queue *q;
+	struct work_queue_task *t;
+	FILE *file;
+	int i;
+
+	q = work_queue_create(0);
+	if(!q)
+		fatal("couldn't create queue: %s", strerror(errno));
+
+	file = fopen(argv[1], "w");
+	if(!file)
+		fatal("couldn't open %s: %s", argv[1], strerror(errno));
+	fprintf(file, "%d\n", work_queue_port(q));
+	fclose(file);
+
+	t = work_queue_task_create("cat input > output; cat dir/* > joined; cat input");
+	work_queue_task_specify_file(t, "sendfile.input", "input", WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
+	work_queue_task_specify_directory(t, "sendfile.dir", "dir", WORK_QUEUE_INPUT, WORK_QUEUE_NOCACHE, 1);
+	work_queue_task_specify_file(t, "sendfile.output", "output", WORK_QUEUE_OUTPUT, WORK_QUEUE_NOCACHE);
+	work_queue_task_specify_file(t, "sendfile.joined", "joined", WORK_QUEUE_OUTPUT, WORK_QUEUE_NOCACHE);
+	work_queue_submit(q, t);
+
+	t = 0;
+	for(i = 0; i < 60 && !t; i++)
+		t = work_queue_wait(q, 5);
+	if(!t || t->result != WORK_QUEUE_RESULT_SUCCESS || t->return_status != 0)
+		fatal("task did not complete");
+
+	file = fopen("sendfile.stdout", "w");
+	if(!file || fwrite(t->output, 1, strlen(t->output), file) != strlen(t->output))
+		fatal("couldn't write task stdout: %s", strerror(errno));
+	fclose(file);
+
+	work_queue_task_delete(t);
+	work_queue_delete(q);
+	return 0;
+}
+EOF
+
+	# Odd sizes, so that transfers end in partial pipe and socket buffers.
+	dd if=/dev/urandom of=sendfile.input bs=1000003 count=24 2> /dev/null
+	mkdir -p sendfile.dir
+	dd if=/dev/urandom of=sendfile.dir/a bs=65537 count=31 2> /dev/null
+	dd if=/dev/urandom of=sendfile.dir/b bs=4093 count=1 2> /dev/null
+	: > sendfile.dir/c
+	cat sendfile.dir/* > sendfile.joined.expected
+
+	# Task stdout is returned as a string, so keep it text.
+	base64 sendfile.input > sendfile.text
+	mv sendfile.text sendfile.input
+}
+
+run()
+{
+	("./$exe" "$port_file"; echo $? > "$status_file") &
+
+	run_local_worker "$port_file" worker.log
+
+	wait_for_file_creation "$status_file" 5
+	[ "$(cat "$status_file")" -eq 0 ] || return 1
+
+	require_identical_files sendfile.input sendfile.output
+	require_identical_files sendfile.input sendfile.stdout
+	require_identical_files sendfile.joined.expected sendfile.joined
+}
+
+clean()
+{
+	rm -rf "$exe" "$port_file" "$status_file" sendfile.input sendfile.dir sendfile.output sendfile.joined sendfile.joined.expected sendfile.stdout worker.log
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4:
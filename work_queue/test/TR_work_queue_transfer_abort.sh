@@ -0,0 +1,172 @@
+#!/bin/sh
+
+# Kill a worker while it is receiving the inputs of a task from a transfer
+# thread, and check that the master keeps running and retries the task on a
+# second worker. Then stop the second worker in the middle of receiving a large
+# input and delete the queue, which must not wait for the blocked transfer.
+# The master must end with the same threads and file descriptors it started
+# with.
+
+. ../../dttools/test/test_runner_common.sh
+
+exe="transfer_abort.test"
+port_file="transfer_abort.port"
+status_file="transfer_abort.status"
+
+prepare()
+{
+	rm -f "$port_file" "$status_file" transfer_abort.phase1 transfer_abort.stopped
+
+	${CC} -I../src/ -I../../dttools/src/ -g $CCTOOLS_TEST_CCFLAGS -o "$exe" -x c - -x none ../src/libwork_queue.a ../../dttools/src/libdttools.a -lm -lz -lpthread <<EOF
+#include "work_queue.h"
+#include "debug.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static int count_entries(const char *path)
+{
+	DIR *dir = opendir(path);
+	struct dirent *d;
+	int n = 0;
+
+	if(!dir)
+		fatal("couldn't open %s: %s", path, strerror(errno));
+	while((d = readdir(dir)))
+		if(d->d_name[0] != '.')
+			n++;
+	closedir(dir);
+
+	return n;
+}
+
+static void wait_for(const char *path)
+{
+	int i;
+	for(i = 0; i < 60 && access(path, F_OK) != 0; i++)
+		sleep(1);
+	if(i == 60)
+		fatal("%s was not created", path);
+}
+
+int main (int argc, char *argv[])
+{
+	struct work_queue *q;
+	struct work_queue_task *t;
+	FILE *file;
+	int fds = count_entries("/proc/self/fd");
+	int threads = count_entries("/proc/self/task");
+	time_t start;
+	int i;
+
+	q = work_queue_create(0);
+	if(!q)
+		fatal("couldn't create queue: %s", strerror(errno));
+
+	file = fopen(argv[1], "w");
+	if(!file)
+		fatal("couldn't open %s: %s", argv[1], strerror(errno));
+	fprintf(file, "%d\n", work_queue_port(q));
+	fclose(file);
+
+	/* the transfer thread waits after each file, leaving time to kill the worker in between. */
+	work_queue_set_bandwidth_limit(q, "1M");
+
+	t = work_queue_task_create("cat a b > output");
+	work_queue_task_specify_file(t, "transfer_abort.a", "a", WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
+	work_queue_task_specify_file(t, "transfer_abort.b", "b", WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
+	work_queue_task_specify_file(t, "transfer_abort.out", "output", WORK_QUEUE_OUTPUT, WORK_QUEUE_NOCACHE);
+	work_queue_submit(q, t);
+
+	t = 0;
+	for(i = 0; i < 60 && !t; i++)
+		t = work_queue_wait(q, 5);
+	if(!t || t->result != WORK_QUEUE_RESULT_SUCCESS || t->return_status != 0)
+		fatal("task did not complete");
+	if(t->try_count < 2)
+		fatal("task was not retried");
+	work_queue_task_delete(t);
+
+	file = fopen("transfer_abort.phase1", "w");
+	fclose(file);
+	wait_for("transfer_abort.stopped");
+
+	work_queue_set_bandwidth_limit(q, "0");
+
+	t = work_queue_task_create("cat c > output");
+	work_queue_task_specify_file(t, "transfer_abort.c", "c", WORK_QUEUE_INPUT, WORK_QUEUE_CACHE);
+	work_queue_submit(q, t);
+
+	/* the stopped worker cannot finish receiving c. */
+	if(work_queue_wait(q, 5))
+		fatal("task completed on a stopped worker");
+
+	start = time(0);
+	work_queue_delete(q);
+	if(time(0) - start > 10)
+		fatal("deleting the queue waited %d seconds for the transfer", (int) (time(0) - start));
+
+	if(count_entries("/proc/self/fd") != fds)
+		fatal("%d file descriptors open instead of %d", count_entries("/proc/self/fd"), fds);
+	if(count_entries("/proc/self/task") != threads)
+		fatal("%d threads instead of %d", count_entries("/proc/self/task"), threads);
+
+	return 0;
+}
+EOF
+
+	dd if=/dev/urandom of=transfer_abort.a bs=1024 count=8192 2> /dev/null
+	dd if=/dev/urandom of=transfer_abort.b bs=1024 count=1024 2> /dev/null
+	dd if=/dev/urandom of=transfer_abort.c bs=1024 count=262144 2> /dev/null
+	cat transfer_abort.a transfer_abort.b > transfer_abort.expected
+}
+
+run()
+{
+	local w1 w2 i
+
+	("./$exe" "$port_file"; echo $? > "$status_file") &
+
+	wait_for_file_creation "$port_file" 15 || return 1
+	"$WORK_QUEUE_WORKER" --single-shot --timeout=20s --cores 1 --memory 250 --disk 1000 --debug=all --debug-file=transfer_abort.worker.1.log localhost $(cat "$port_file") &
+	w1=$!
+
+	# kill the first worker once it has received a, while the master waits to send b.
+	i=0
+	until grep -q "rx from master: put" transfer_abort.worker.1.log 2> /dev/null; do
+		i=$((i+1))
+		[ $i -lt 150 ] || return 1
+		sleep 0.1
+	done
+	kill -9 $w1
+	wait $w1
+
+	"$WORK_QUEUE_WORKER" --single-shot --timeout=20s --cores 1 --memory 250 --disk 1000 --debug=all --debug-file=transfer_abort.worker.2.log localhost $(cat "$port_file") &
+	w2=$!
+
+	wait_for_file_creation transfer_abort.phase1 60 || return 1
+	require_identical_files transfer_abort.expected transfer_abort.out || return 1
+
+	kill -STOP $w2
+	touch transfer_abort.stopped
+
+	wait_for_file_creation "$status_file" 60
+	kill -9 $w2
+	wait $w2
+
+	[ "$(cat "$status_file")" -eq 0 ]
+}
+
+clean()
+{
+	rm -f "$exe" "$port_file" "$status_file" transfer_abort.phase1 transfer_abort.stopped transfer_abort.a transfer_abort.b transfer_abort.c transfer_abort.expected transfer_abort.out transfer_abort.worker.*.log
+}
+
+dispatch "$@"
+
+# vim: set noexpandtab tabstop=4: